@@ -0,0 +1,6 @@
+#define HAVE_SYS_FANOTIFY_H 1
+#define HAVE_SYS_INOTIFY_H 1
+#define HAVE_LINUX_FS_H 1
+#define HAVE_COPY_FILE_RANGE 1
+#define PACKAGE_NAME "libprojfs"
+#define PACKAGE_VERSION "0.1"
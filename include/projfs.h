@@ -46,6 +46,77 @@ struct projfs_event {
 	const char *path;
 	const char *target_path;	/* move destination or link target */
 	int fd;				/* file descriptor for projection */
+	uint64_t cookie;		/* identifies a pending projection */
+	off_t offset;			/* start of range, if PROJFS_ONRANGE */
+	size_t length;			/* length of range, if PROJFS_ONRANGE */
+};
+
+/** Asynchronous notification queue statistics */
+struct projfs_notify_stats {
+	uint64_t queued;		/* events added to the queue */
+	uint64_t dropped;		/* events dropped on overflow */
+	uint64_t coalesced;		/* events merged with prior events */
+	uint64_t batches;		/* deliveries to the provider */
+	unsigned int depth;		/* events currently queued */
+	unsigned int max_depth;		/* maximum events ever queued */
+};
+
+/** Operations whose counts and latencies are recorded */
+enum projfs_stats_op {
+	PROJFS_STATS_GETATTR,		/* FUSE operations */
+	PROJFS_STATS_READLINK,
+	PROJFS_STATS_MKNOD,
+	PROJFS_STATS_MKDIR,
+	PROJFS_STATS_UNLINK,
+	PROJFS_STATS_RMDIR,
+	PROJFS_STATS_SYMLINK,
+	PROJFS_STATS_RENAME,
+	PROJFS_STATS_LINK,
+	PROJFS_STATS_CHMOD,
+	PROJFS_STATS_CHOWN,
+	PROJFS_STATS_TRUNCATE,
+	PROJFS_STATS_OPEN,
+	PROJFS_STATS_STATFS,
+	PROJFS_STATS_FLUSH,
+	PROJFS_STATS_RELEASE,
+	PROJFS_STATS_FSYNC,
+	PROJFS_STATS_SETXATTR,
+	PROJFS_STATS_GETXATTR,
+	PROJFS_STATS_LISTXATTR,
+	PROJFS_STATS_REMOVEXATTR,
+	PROJFS_STATS_OPENDIR,
+	PROJFS_STATS_READDIR,
+	PROJFS_STATS_RELEASEDIR,
+	PROJFS_STATS_ACCESS,
+	PROJFS_STATS_CREATE,
+	PROJFS_STATS_UTIMENS,
+	PROJFS_STATS_WRITE_BUF,
+	PROJFS_STATS_READ_BUF,
+	PROJFS_STATS_FLOCK,
+	PROJFS_STATS_FALLOCATE,
+	PROJFS_STATS_LOCK_WAIT,		/* waits for a projection lock */
+	PROJFS_STATS_PROJ_HANDLER,	/* projection event handler calls */
+	PROJFS_STATS_NOTIFY_HANDLER,	/* notification event handler calls */
+	PROJFS_STATS_PERM_HANDLER,	/* permission event handler calls */
+	PROJFS_STATS_MAX
+};
+
+/** Number of latency buckets in struct projfs_op_stats */
+#define PROJFS_STATS_BUCKETS 32
+
+/** Count and latency histogram of one kind of operation */
+struct projfs_op_stats {
+	uint64_t count;			/* operations completed */
+	uint64_t errors;		/* operations which failed */
+	uint64_t total_nsec;		/* sum of latencies */
+	uint64_t max_nsec;		/* maximum latency */
+	uint64_t buckets[PROJFS_STATS_BUCKETS];	/* counts by latency;
+					   see projfs_get_stats() */
+};
+
+/** Operation statistics, indexed by enum projfs_stats_op */
+struct projfs_stats {
+	struct projfs_op_stats ops[PROJFS_STATS_MAX];
 };
 
 /** File projection attribute */
@@ -55,6 +126,39 @@ struct projfs_attr {
 	ssize_t size;			/* length of the value data, or -1 */
 };
 
+/** Placeholder entry for projfs_create_proj_entries() */
+struct projfs_entry {
+	const char *name;		/* name within the parent directory */
+	mode_t mode;			/* S_IFDIR, S_IFREG, or S_IFLNK type,
+					   and permissions */
+	off_t size;			/* projected size of a file */
+	const char *target;		/* target of a symlink */
+	struct projfs_attr *attrs;	/* attributes of a file or directory,
+					   or NULL */
+	unsigned int nattrs;
+	int result;			/* zero or an errno, on return */
+};
+
+/** Path states recorded when the state-index option is set */
+enum projfs_state {
+	PROJFS_STATE_MODIFIED = 1,	/* created or modified */
+	PROJFS_STATE_DELETED,		/* removed or renamed away */
+	PROJFS_STATE_POPULATED		/* projected, but not modified */
+};
+
+/**
+ * Iterator for paths in a given state.
+ *
+ * @param data Data pointer passed to \p projfs_iterate_state().
+ * @param path Path relative to the projfs mount point.
+ * @param isdir One if the path is a directory; zero otherwise.
+ * @return Zero to continue, or a non-zero value to stop iterating.
+ */
+typedef int (*projfs_state_iter_t)(void *data, const char *path, int isdir);
+
+/** Projection handler response deferring completion of the request */
+#define PROJFS_PENDING		0x100
+
 /**
  * Filesystem event handlers
  *
@@ -65,9 +169,43 @@ struct projfs_handlers {
 	 * Handle projection request for a file or directory.
 	 *
 	 * @param event Filesystem projection event.
-	 * @return Zero on success or a negated errno(3) code on failure.
+	 * @return Zero on success, PROJFS_PENDING if the request will be
+	 *         completed later with \p projfs_complete_event(), or a
+	 *         negated errno(3) code on failure.
 	 * @note When event->mask contains PROJFS_ONDIR, the file
 	 *       descriptor in event->fd will be NULL.
+	 * @note When event->mask contains PROJFS_ONRANGE, only the range
+	 *       of the file given by event->offset and event->length need
+	 *       be written; such events are sent only when the chunk-size
+	 *       option is set.
+	 * @note File contents may be written to event->fd directly, or
+	 *       copied from another descriptor with
+	 *       \p projfs_copy_from_fd().
+	 * @note If PROJFS_PENDING is returned, event->path and event->fd
+	 *       remain valid until the request is completed, but the
+	 *       event structure itself does not.  The filesystem operation
+	 *       which caused the event still holds one of libfuse's worker
+	 *       threads until then, so each pending request in flight ties
+	 *       up one thread; only the handler's own thread is released.
+	 * @note A pending request which is not completed within
+	 *       pending-timeout-msec milliseconds (five minutes by default)
+	 *       fails with ETIMEDOUT; event->path and event->fd are then no
+	 *       longer valid, and \p projfs_complete_event() returns ENOENT
+	 *       for its cookie.
+	 * @note When the max-hydrations option is set, no more than that
+	 *       many projection requests are outstanding at once, including
+	 *       pending requests; others wait, with file requests served
+	 *       ahead of directory requests, and those of niced processes
+	 *       served last.
+	 * @note When the prefetch-threshold option is set and that many
+	 *       files in one directory are projected in quick succession,
+	 *       the directory's remaining files are projected by background
+	 *       threads; event->pid is then that of the process which
+	 *       caused the earlier projections.
+	 * @note When the hydration-trace option is set, the paths projected
+	 *       during the previous mount are projected again, in the same
+	 *       order, by a background thread; event->pid is then that of
+	 *       the calling process.
 	 */
 	int (*handle_proj_event) (struct projfs_event *event);
 
@@ -92,6 +230,23 @@ struct projfs_handlers {
 	 *       rename(2) or link(2) filesystem operation.
 	 */
 	int (*handle_perm_event) (struct projfs_event *event);
+
+	/**
+	 * Handle notification of a batch of file or directory events.
+	 *
+	 * @param events Array of filesystem notification events, in the
+	 *               order in which they occurred.
+	 * @param n Number of events in the array.
+	 * @return Zero on success or a negated errno(3) code on failure.
+	 * @note If provided, this handler is called in place of
+	 *       handle_notify_event, and events are always delivered
+	 *       asynchronously.  Events are collected until notify-batch-size
+	 *       events are queued or notify-batch-msec milliseconds elapse,
+	 *       and an event which repeats the preceding event for the same
+	 *       path is omitted.  The events and their paths are only valid
+	 *       for the duration of the call.
+	 */
+	int (*handle_notify_batch) (struct projfs_event *events, size_t n);
 };
 
 /**
@@ -123,6 +278,118 @@ int projfs_start(struct projfs *fs);
  */
 void *projfs_stop(struct projfs *fs);
 
+/**
+ * Retrieve statistics of the asynchronous notification queue.
+ *
+ * @param[in] fs Projected filesystem handle.
+ * @param[out] stats Statistics of the notification queue; all values will
+ *                   be zero unless a batch notification handler was
+ *                   provided, or the notify-async option was given and a
+ *                   notification event handler was provided.
+ * @return Zero on success or an \p errno(3) code on failure.
+ */
+int projfs_get_notify_stats(struct projfs *fs,
+			    struct projfs_notify_stats *stats);
+
+/**
+ * Retrieve the counts and latencies of the filesystem's operations.
+ *
+ * @param[in] fs Projected filesystem handle.
+ * @param[out] stats Statistics of each kind of operation since the
+ *                   filesystem was created, indexed by enum
+ *                   projfs_stats_op.
+ * @return Zero on success or an \p errno(3) code on failure.
+ * @note Latency bucket zero counts operations which took less than one
+ *       microsecond, and each bucket i after it counts those which took
+ *       at least 2^(i-1) and less than 2^i microseconds, except that the
+ *       last bucket also counts all longer operations.
+ * @note Lock waits fail if they time out; handler calls fail if the
+ *       handler returns an error, or denies permission.
+ * @note Statistics are recorded by each thread without locking, and are
+ *       merged when this function is called, so it may be called from any
+ *       thread at any time, but should not be called too frequently.
+ * @note These statistics, with counts of projected files and bytes and
+ *       other internal counters, may also be read by any user from the
+ *       virtual file .projfs/stats at the root of the mount point.
+ */
+int projfs_get_stats(struct projfs *fs, struct projfs_stats *stats);
+
+/**
+ * Get the name of a kind of operation, for reporting statistics.
+ *
+ * @param[in] op Kind of operation.
+ * @return Name of the operation (e.g., "getattr" or "lock_wait"), or NULL
+ *         if op is not valid.
+ */
+const char *projfs_stats_op_name(enum projfs_stats_op op);
+
+/**
+ * Iterate over the paths which have been created, modified, or removed
+ * within a projfs filesystem, or the files which have been projected,
+ * as recorded in its state index.
+ *
+ * @param[in] fs Projected filesystem handle.
+ * @param[in] state PROJFS_STATE_MODIFIED for paths which were created,
+ *                  or whose files were modified; PROJFS_STATE_DELETED for
+ *                  paths which were removed or renamed;
+ *                  PROJFS_STATE_POPULATED for files whose contents were
+ *                  projected but have not been modified.
+ * @param[in] iter Function called for each path in the given state.
+ * @param[in] data Data pointer passed to the iterator.
+ * @return Zero on success, the non-zero value returned by the iterator if
+ *         it stopped the iteration, or an \p errno(3) code on failure;
+ *         ENOTSUP if the state-index option was not set.
+ * @note The state index is kept in the file named by the state-index
+ *       option, and is updated as each path changes state.  If the file
+ *       does not exist or is corrupt, or the system crashed while the
+ *       filesystem was mounted, it is rebuilt by scanning the lower
+ *       directory when the filesystem is mounted; symlinks created by
+ *       the user are not found by such a scan.
+ * @note Directories are in the PROJFS_STATE_MODIFIED state once their
+ *       contents have been projected.  When a directory is renamed, the
+ *       indexed paths beneath it are renamed as well, and their old paths
+ *       are recorded as removed.
+ * @note Paths are passed in directory order: sorted bytewise, except
+ *       that a slash sorts before any other character, so the paths
+ *       beneath each directory immediately follow it.
+ */
+int projfs_iterate_state(struct projfs *fs, enum projfs_state state,
+			 projfs_state_iter_t iter, void *data);
+
+/**
+ * Complete a projection request whose handler returned PROJFS_PENDING.
+ *
+ * @param[in] fs Projected filesystem handle.
+ * @param[in] cookie Value of the cookie field of the projection event.
+ * @param[in] result Zero on success or a negated errno(3) code on failure,
+ *                   as would otherwise have been returned by the handler.
+ * @return Zero on success or an \p errno(3) code on failure; ENOENT if no
+ *         request with the given cookie is outstanding.
+ * @note This function may be called from any thread, including before
+ *       the handler has returned.
+ */
+int projfs_complete_event(struct projfs *fs, uint64_t cookie, int result);
+
+/**
+ * Fill a range of a file being projected with data from another file
+ * descriptor, without copying the data through user memory if possible.
+ *
+ * @param[in] fd File descriptor for projection, from event->fd.
+ * @param[in] offset Offset in the projected file at which to write.
+ * @param[in] src_fd File descriptor from which to read the data.
+ * @param[in] src_offset Offset in the source at which to read, or -1 to
+ *                       read from the current position, as for a pipe.
+ * @param[in] length Number of bytes to copy.
+ * @return Zero on success or an \p errno(3) code on failure; EIO if the
+ *         source ends before the given length has been copied.
+ * @note The data is cloned with FICLONERANGE if the source is on the same
+ *       filesystem as the projected file and the range is block-aligned;
+ *       otherwise, copy_file_range(2) or splice(2) is used if the source
+ *       permits, and finally read(2) and write(2).
+ */
+int projfs_copy_from_fd(int fd, off_t offset, int src_fd, off_t src_offset,
+			size_t length);
+
 /**
  * Create a directory whose contents will be projected until written.
  *
@@ -164,6 +431,31 @@ int projfs_create_proj_file(struct projfs *fs, const char *path, off_t size,
 int projfs_create_proj_symlink(struct projfs *fs, const char *path,
 			       const char *target);
 
+/**
+ * Create many placeholder directories, files, and symlinks within a single
+ * directory, at a lower cost per entry than the functions above.
+ *
+ * @param[in] fs Projected filesystem handle.
+ * @param[in] parent Relative path of the directory under the projfs mount
+ *                   point in which to create the entries.
+ * @param[in,out] entries Array of entries to create; the result field of
+ *                        each is set to zero or an \p errno(3) code.
+ * @param[in] n Number of items in the entries array.
+ * @return Zero if all entries were created, otherwise the \p errno(3)
+ *         code of the first entry which failed, or of the failure to
+ *         open the parent directory.
+ * @note Entries which fail are not left partially created, and do not
+ *       prevent the creation of subsequent entries.
+ * @note Entries are created in the order given.  However, when the
+ *       io-uring option is set and the library was built with liburing,
+ *       consecutive directories and files whose modes grant user write
+ *       permission are created together with a batch of io_uring
+ *       requests, which may complete in any order; so if two such
+ *       entries share a name, either may be the one which fails.
+ */
+int projfs_create_proj_entries(struct projfs *fs, const char *parent,
+			       struct projfs_entry *entries, unsigned int n);
+
 /**
  * Read projection attributes of a file or directory.
  *
@@ -211,6 +503,28 @@ int projfs_get_attrs(struct projfs *fs, const char *path,
 int projfs_set_attrs(struct projfs *fs, const char *path,
 		     struct projfs_attr *attrs, unsigned int nattrs);
 
+/**
+ * Dehydrate a projected file, discarding its contents from the lower
+ * directory and returning it to the unpopulated state, so that they will
+ * be projected again when the file is next opened.
+ *
+ * @param[in] fs Projected filesystem handle.
+ * @param[in] path Relative path of the file.
+ * @return Zero on success or an \p errno(3) code on failure; EPERM if the
+ *         file has been modified, EBUSY if it is open for reading,
+ *         EISDIR if it is a directory, or EINVAL if it is not a regular
+ *         file.
+ * @note The lower filesystem must support punching holes with
+ *       \p fallocate(2); the file's size, mode, modification time,
+ *       and projection attributes are retained.
+ * @note When the evict-budget-mb option is set, populated files are
+ *       dehydrated in the background, least recently used first, whenever
+ *       the blocks allocated to them exceed the given number of megabytes.
+ *       If the state-index option is also set, files populated during
+ *       earlier mounts are counted as well.
+ */
+int projfs_dehydrate(struct projfs *fs, const char *path);
+
 #ifdef __cplusplus
 }
 #endif
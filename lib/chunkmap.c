@@ -0,0 +1,191 @@
+/* Linux Projected Filesystem
+   Copyright (C) 2019 GitHub, Inc.
+
+   See the NOTICE file distributed with this library for additional
+   information regarding copyright ownership.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library, in the file COPYING; if not,
+   see <http://www.gnu.org/licenses/>.
+*/
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chunkmap.h"
+
+/*
+ * We track which fixed-size chunks of a partially hydrated file have been
+ * populated using a bitmap with one bit per chunk, which is stored in an
+ * extended attribute of the lower file while the file remains otherwise
+ * unpopulated.
+ *
+ * The encoded map consists of a single byte holding the base-2 logarithm
+ * of the chunk size, followed by the bitmap, in which the bit for chunk N
+ * is bit (N % 8) of byte (N / 8).  Recording the chunk size in the map
+ * allows the configured chunk size to change between mounts without
+ * invalidating existing maps.
+ *
+ * To keep the map small enough to be stored in a single filesystem block,
+ * which some filesystems (e.g., ext4) require of extended attributes, the
+ * chunk size of a new map is increased as necessary for large files.
+ */
+
+#define CHUNKMAP_HDR_SIZE 1
+#define CHUNKMAP_MAX_CHUNKS ((CHUNKMAP_MAX_SIZE - CHUNKMAP_HDR_SIZE) * 8)
+
+static inline uint64_t get_nchunks(off_t file_size, unsigned int shift)
+{
+	return ((uint64_t)file_size + ((uint64_t)1 << shift) - 1) >> shift;
+}
+
+static inline size_t get_map_size(uint64_t nchunks)
+{
+	return CHUNKMAP_HDR_SIZE + (nchunks + 7) / 8;
+}
+
+/**
+ * Initializes an empty map for a file.
+ *
+ * @param shift base-2 logarithm of the minimum chunk size
+ * @return 0 or an errno; EFBIG if the file is too large to be mapped
+ */
+int chunkmap_init(struct chunkmap *map, off_t file_size, unsigned int shift)
+{
+	if (file_size < 0 || shift < CHUNKMAP_MIN_SHIFT)
+		return EINVAL;
+
+	while (get_nchunks(file_size, shift) > CHUNKMAP_MAX_CHUNKS) {
+		if (++shift > CHUNKMAP_MAX_SHIFT)
+			return EFBIG;
+	}
+
+	map->shift = shift;
+	map->nchunks = get_nchunks(file_size, shift);
+	map->size = get_map_size(map->nchunks);
+	map->value = calloc(1, map->size);
+	if (map->value == NULL)
+		return ENOMEM;
+	map->value[0] = shift;
+
+	return 0;
+}
+
+/**
+ * Loads an encoded map, which must be consistent with the file's size.
+ *
+ * @return 0 or an errno
+ */
+int chunkmap_load(struct chunkmap *map, off_t file_size,
+		  const void *value, size_t size)
+{
+	const unsigned char *bytes = value;
+	unsigned int shift;
+
+	if (file_size < 0 || size < CHUNKMAP_HDR_SIZE)
+		return EINVAL;
+
+	shift = bytes[0];
+	if (shift < CHUNKMAP_MIN_SHIFT || shift > CHUNKMAP_MAX_SHIFT)
+		return EINVAL;
+
+	map->shift = shift;
+	map->nchunks = get_nchunks(file_size, shift);
+	map->size = get_map_size(map->nchunks);
+	if (size != map->size)
+		return EINVAL;
+
+	map->value = malloc(size);
+	if (map->value == NULL)
+		return ENOMEM;
+	memcpy(map->value, value, size);
+
+	return 0;
+}
+
+void chunkmap_free(struct chunkmap *map)
+{
+	free(map->value);
+	map->value = NULL;
+}
+
+static inline int is_chunk_set(const struct chunkmap *map, uint64_t chunk)
+{
+	const unsigned char *bits = map->value + CHUNKMAP_HDR_SIZE;
+
+	return (bits[chunk / 8] >> (chunk % 8)) & 1;
+}
+
+/**
+ * Finds the first run of unpopulated chunks which overlap a byte range.
+ *
+ * @param first set to the index of the first chunk in the run
+ * @return number of chunks in the run, or 0 if all are populated
+ */
+uint64_t chunkmap_find_missing(const struct chunkmap *map, off_t offset,
+			       size_t length, uint64_t *first)
+{
+	uint64_t chunk, last;
+
+	if (offset < 0 || length == 0 || map->nchunks == 0)
+		return 0;
+
+	chunk = (uint64_t)offset >> map->shift;
+	last = ((uint64_t)offset + length - 1) >> map->shift;
+	if (last >= map->nchunks)
+		last = map->nchunks - 1;
+
+	while (chunk <= last && chunk < map->nchunks &&
+	       is_chunk_set(map, chunk))
+		++chunk;
+	if (chunk > last || chunk >= map->nchunks)
+		return 0;
+
+	*first = chunk;
+	while (chunk <= last && !is_chunk_set(map, chunk))
+		++chunk;
+
+	return chunk - *first;
+}
+
+void chunkmap_set(struct chunkmap *map, uint64_t first, uint64_t count)
+{
+	unsigned char *bits = map->value + CHUNKMAP_HDR_SIZE;
+	uint64_t chunk;
+
+	for (chunk = first; chunk < first + count && chunk < map->nchunks;
+	     ++chunk)
+		bits[chunk / 8] |= 1 << (chunk % 8);
+}
+
+int chunkmap_is_full(const struct chunkmap *map)
+{
+	const unsigned char *bits = map->value + CHUNKMAP_HDR_SIZE;
+	uint64_t full_bytes = map->nchunks / 8;
+	uint64_t i;
+
+	for (i = 0; i < full_bytes; ++i) {
+		if (bits[i] != 0xFF)
+			return 0;
+	}
+	for (i = full_bytes * 8; i < map->nchunks; ++i) {
+		if (!is_chunk_set(map, i))
+			return 0;
+	}
+
+	return 1;
+}
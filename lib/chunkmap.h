@@ -0,0 +1,57 @@
+/* Linux Projected Filesystem
+   Copyright (C) 2019 GitHub, Inc.
+
+   See the NOTICE file distributed with this library for additional
+   information regarding copyright ownership.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library, in the file COPYING; if not,
+   see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _CHUNKMAP_H
+#define _CHUNKMAP_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#define CHUNKMAP_MIN_SHIFT 12		/* 4 KiB */
+#define CHUNKMAP_MAX_SHIFT 30		/* 1 GiB */
+
+// encoded size limit, so maps fit in a single filesystem block as an xattr
+#define CHUNKMAP_MAX_SIZE 2048
+
+struct chunkmap {
+	unsigned char *value;		/* encoded shift and bitmap */
+	size_t size;
+	unsigned int shift;
+	uint64_t nchunks;
+};
+
+int chunkmap_init(struct chunkmap *map, off_t file_size, unsigned int shift);
+int chunkmap_load(struct chunkmap *map, off_t file_size,
+		  const void *value, size_t size);
+void chunkmap_free(struct chunkmap *map);
+
+uint64_t chunkmap_find_missing(const struct chunkmap *map, off_t offset,
+			       size_t length, uint64_t *first);
+void chunkmap_set(struct chunkmap *map, uint64_t first, uint64_t count);
+int chunkmap_is_full(const struct chunkmap *map);
+
+static inline off_t chunkmap_offset(const struct chunkmap *map,
+				    uint64_t chunk)
+{
+	return (off_t)(chunk << map->shift);
+}
+
+#endif /* _CHUNKMAP_H */
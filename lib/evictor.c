@@ -0,0 +1,542 @@
+/* Linux Projected Filesystem
+   Copyright (C) 2019 GitHub, Inc.
+
+   See the NOTICE file distributed with this library for additional
+   information regarding copyright ownership.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library, in the file COPYING; if not,
+   see <http://www.gnu.org/licenses/>.
+*/
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "evictor.h"
+#include "pathhash.h"
+
+/*
+ * We keep the populated files in the lower filesystem within a budget of
+ * allocated bytes by dehydrating those which were least recently used.
+ *
+ * Each file is recorded, with the size of its allocated blocks, when it
+ * is hydrated, and touched again each time it is opened.  The entries
+ * are kept on a doubly linked list in order of use, from least to most
+ * recent, and are also found by path in a chained hash table (FNV-1a)
+ * which grows as needed.  Files which are modified or removed are no
+ * longer candidates for dehydration, and their entries are removed.
+ *
+ * Once the total size exceeds the budget, a background thread passes the
+ * least recently used paths to a callback, which dehydrates each one,
+ * until the total is below a low watermark a tenth under the budget, so
+ * that we do not start evicting again after every hydration.  A file the
+ * callback reports as busy (i.e., open, or locked by a hydration) is
+ * moved to the most recently used end of the list and kept; any other
+ * error simply drops the entry, as the file is presumably gone or no
+ * longer dehydratable.  If an entire pass ends over budget, because
+ * every candidate was busy, the thread waits a short interval before
+ * trying again, rather than busy-looping over the same files.
+ */
+
+struct evict_entry {
+	char *path;
+	uint32_t hash;
+	uint64_t size;
+	struct evict_entry *prev;	/* less recently used */
+	struct evict_entry *next;	/* more recently used */
+	struct evict_entry *chain;	/* next in hash bucket */
+};
+
+struct evictor {
+	uint64_t budget;
+	uint64_t low;			/* low watermark for evictions */
+	evictor_evict_t evict;
+	void *data;
+	struct evict_entry **buckets;
+	unsigned int num_buckets;	/* always a power of two */
+	unsigned int num_entries;
+	uint64_t size;
+	struct evict_entry *lru_head;	/* least recently used */
+	struct evict_entry *lru_tail;	/* most recently used */
+	uint64_t evicted_bytes;
+	uint64_t evicted_files;
+	pthread_t thread_id;
+	int running;
+	int stopping;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	pthread_condattr_t condattr;
+};
+
+#define EVICTOR_MIN_BUCKETS 256
+
+struct evictor *evictor_create(uint64_t budget, evictor_evict_t evict,
+			       void *data)
+{
+	struct evictor *ev;
+
+	if (budget == 0) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	ev = calloc(1, sizeof(*ev));
+	if (ev == NULL)
+		return NULL;
+
+	ev->buckets = calloc(EVICTOR_MIN_BUCKETS, sizeof(*ev->buckets));
+	if (ev->buckets == NULL)
+		goto out_ev;
+
+	if (pthread_mutex_init(&ev->mutex, NULL) != 0)
+		goto out_buckets;
+	if (pthread_condattr_init(&ev->condattr) != 0)
+		goto out_mutex;
+	if (pthread_condattr_setclock(&ev->condattr, CLOCK_MONOTONIC) != 0)
+		goto out_condattr;
+	if (pthread_cond_init(&ev->cond, &ev->condattr) != 0)
+		goto out_condattr;
+
+	ev->budget = budget;
+	ev->low = budget - budget / 10;
+	ev->evict = evict;
+	ev->data = data;
+	ev->num_buckets = EVICTOR_MIN_BUCKETS;
+
+	return ev;
+
+out_condattr:
+	pthread_condattr_destroy(&ev->condattr);
+out_mutex:
+	pthread_mutex_destroy(&ev->mutex);
+out_buckets:
+	free(ev->buckets);
+out_ev:
+	free(ev);
+	return NULL;
+}
+
+static struct evict_entry **find_entry(struct evictor *ev, const char *path,
+				       uint32_t hash)
+{
+	struct evict_entry **entryp;
+
+	entryp = &ev->buckets[hash & (ev->num_buckets - 1)];
+	while (*entryp != NULL) {
+		if ((*entryp)->hash == hash &&
+		    strcmp((*entryp)->path, path) == 0)
+			break;
+		entryp = &(*entryp)->chain;
+	}
+
+	return entryp;
+}
+
+// best effort; longer chains are only slower
+static void grow_buckets(struct evictor *ev)
+{
+	unsigned int num_buckets = ev->num_buckets * 2;
+	struct evict_entry **buckets;
+	struct evict_entry *entry;
+	unsigned int i;
+
+	buckets = calloc(num_buckets, sizeof(*buckets));
+	if (buckets == NULL)
+		return;
+
+	for (i = 0; i < ev->num_buckets; ++i) {
+		while ((entry = ev->buckets[i]) != NULL) {
+			unsigned int j = entry->hash & (num_buckets - 1);
+
+			ev->buckets[i] = entry->chain;
+			entry->chain = buckets[j];
+			buckets[j] = entry;
+		}
+	}
+
+	free(ev->buckets);
+	ev->buckets = buckets;
+	ev->num_buckets = num_buckets;
+}
+
+static void unlink_lru(struct evictor *ev, struct evict_entry *entry)
+{
+	if (entry->prev != NULL)
+		entry->prev->next = entry->next;
+	else
+		ev->lru_head = entry->next;
+	if (entry->next != NULL)
+		entry->next->prev = entry->prev;
+	else
+		ev->lru_tail = entry->prev;
+}
+
+static void append_lru(struct evictor *ev, struct evict_entry *entry)
+{
+	entry->prev = ev->lru_tail;
+	entry->next = NULL;
+	if (ev->lru_tail != NULL)
+		ev->lru_tail->next = entry;
+	else
+		ev->lru_head = entry;
+	ev->lru_tail = entry;
+}
+
+static void link_bucket(struct evictor *ev, struct evict_entry *entry)
+{
+	struct evict_entry **entryp;
+
+	entryp = &ev->buckets[entry->hash & (ev->num_buckets - 1)];
+	entry->chain = *entryp;
+	*entryp = entry;
+}
+
+static void insert_entry(struct evictor *ev, struct evict_entry *entry)
+{
+	if (ev->num_entries >= ev->num_buckets)
+		grow_buckets(ev);
+
+	link_bucket(ev, entry);
+	append_lru(ev, entry);
+
+	++ev->num_entries;
+	ev->size += entry->size;
+}
+
+/**
+ * Removes an entry from its hash bucket and the LRU list.
+ *
+ * @param entryp link to the entry within its hash bucket
+ * @param entry the entry, which must be found at entryp
+ */
+static void detach_entry(struct evictor *ev, struct evict_entry **entryp,
+			 struct evict_entry *entry)
+{
+	*entryp = entry->chain;
+	unlink_lru(ev, entry);
+
+	--ev->num_entries;
+	ev->size -= entry->size;
+}
+
+static void free_entry(struct evict_entry *entry)
+{
+	free(entry->path);
+	free(entry);
+}
+
+static void get_deadline(struct timespec *ts, int wait_ms)
+{
+	clock_gettime(CLOCK_MONOTONIC, ts);
+
+	ts->tv_sec += wait_ms / 1000;
+	ts->tv_nsec += (long)(wait_ms % 1000) * 1000 * 1000;
+	if (ts->tv_nsec >= 1000 * 1000 * 1000) {
+		ts->tv_nsec -= 1000 * 1000 * 1000;
+		++ts->tv_sec;
+	}
+}
+
+/**
+ * Evicts least recently used files until the total size is below the low
+ * watermark, or every file has been tried once; called with the mutex held.
+ *
+ * @return 1 if still over budget; 0 otherwise
+ */
+static int evict_entries(struct evictor *ev)
+{
+	unsigned int tries = ev->num_entries;
+	struct evict_entry **entryp;
+	struct evict_entry *entry;
+	int res;
+
+	while (!ev->stopping && ev->size > ev->low && ev->lru_head != NULL &&
+	       tries-- > 0) {
+		entry = ev->lru_head;
+		detach_entry(ev, find_entry(ev, entry->path, entry->hash),
+			     entry);
+		pthread_mutex_unlock(&ev->mutex);
+
+		res = ev->evict(ev->data, entry->path);
+
+		pthread_mutex_lock(&ev->mutex);
+		if (res == 0) {
+			ev->evicted_bytes += entry->size;
+			++ev->evicted_files;
+		} else if (res == EBUSY || res == EWOULDBLOCK) {
+			// keep unless the file was recorded again meanwhile
+			entryp = find_entry(ev, entry->path, entry->hash);
+			if (*entryp == NULL) {
+				insert_entry(ev, entry);
+				continue;
+			}
+		}
+		free_entry(entry);
+	}
+
+	return (ev->size > ev->budget);
+}
+
+static void *evict_loop(void *data)
+{
+	struct evictor *ev = (struct evictor *)data;
+	struct timespec deadline;
+	int retry = 0;
+
+	pthread_mutex_lock(&ev->mutex);
+	while (!ev->stopping) {
+		if (retry) {
+			get_deadline(&deadline, EVICTOR_RETRY_MSEC);
+			while (!ev->stopping &&
+			       pthread_cond_timedwait(&ev->cond, &ev->mutex,
+						      &deadline) != ETIMEDOUT)
+				;
+			retry = 0;
+		} else if (ev->size <= ev->budget) {
+			pthread_cond_wait(&ev->cond, &ev->mutex);
+		} else {
+			retry = evict_entries(ev);
+		}
+	}
+	pthread_mutex_unlock(&ev->mutex);
+
+	return NULL;
+}
+
+int evictor_start(struct evictor *ev)
+{
+	int res;
+
+	ev->stopping = 0;
+	res = pthread_create(&ev->thread_id, NULL, evict_loop, ev);
+	if (res == 0)
+		ev->running = 1;
+
+	return res;
+}
+
+void evictor_stop(struct evictor *ev)
+{
+	pthread_mutex_lock(&ev->mutex);
+	ev->stopping = 1;
+	pthread_cond_broadcast(&ev->cond);
+	pthread_mutex_unlock(&ev->mutex);
+
+	if (ev->running) {
+		pthread_join(ev->thread_id, NULL);
+		ev->running = 0;
+	}
+}
+
+/**
+ * Records a populated file as the most recently used, replacing any
+ * previous record of it.
+ *
+ * @param path path of the file relative to lowerdir
+ * @param size number of bytes allocated to the file
+ * @return 0 or an errno
+ */
+int evictor_record(struct evictor *ev, const char *path, uint64_t size)
+{
+	uint32_t hash = pathhash_fnv1a(path);
+	struct evict_entry **entryp;
+	struct evict_entry *entry;
+	int res = 0;
+
+	pthread_mutex_lock(&ev->mutex);
+
+	entryp = find_entry(ev, path, hash);
+	if (*entryp != NULL) {
+		entry = *entryp;
+		unlink_lru(ev, entry);
+		append_lru(ev, entry);
+		ev->size = ev->size - entry->size + size;
+		entry->size = size;
+	} else {
+		entry = malloc(sizeof(*entry));
+		if (entry == NULL) {
+			res = ENOMEM;
+			goto out;
+		}
+		entry->path = strdup(path);
+		if (entry->path == NULL) {
+			free(entry);
+			res = ENOMEM;
+			goto out;
+		}
+		entry->hash = hash;
+		entry->size = size;
+		insert_entry(ev, entry);
+	}
+
+	if (ev->size > ev->budget)
+		pthread_cond_signal(&ev->cond);
+
+out:
+	pthread_mutex_unlock(&ev->mutex);
+	return res;
+}
+
+/**
+ * Marks a recorded file as the most recently used; files which have not
+ * been recorded are ignored.
+ *
+ * @param path path of the file relative to lowerdir
+ */
+void evictor_touch(struct evictor *ev, const char *path)
+{
+	struct evict_entry *entry;
+
+	pthread_mutex_lock(&ev->mutex);
+
+	entry = *find_entry(ev, path, pathhash_fnv1a(path));
+	if (entry != NULL) {
+		unlink_lru(ev, entry);
+		append_lru(ev, entry);
+	}
+
+	pthread_mutex_unlock(&ev->mutex);
+}
+
+/**
+ * Removes any record of a file, which is then never evicted.
+ *
+ * @param path path of the file relative to lowerdir
+ */
+void evictor_remove(struct evictor *ev, const char *path)
+{
+	struct evict_entry **entryp;
+	struct evict_entry *entry;
+
+	pthread_mutex_lock(&ev->mutex);
+
+	entryp = find_entry(ev, path, pathhash_fnv1a(path));
+	entry = *entryp;
+	if (entry != NULL) {
+		detach_entry(ev, entryp, entry);
+		free_entry(entry);
+	}
+
+	pthread_mutex_unlock(&ev->mutex);
+}
+
+/**
+ * @return length of dir if path is dir or is found beneath it; 0 otherwise
+ */
+static size_t match_dir(const char *path, const char *dir)
+{
+	size_t len = strlen(dir);
+
+	if (strncmp(path, dir, len) != 0 ||
+	    (path[len] != '\0' && path[len] != '/'))
+		return 0;
+
+	return len;
+}
+
+/**
+ * Records the renaming of a path, moving the records of any files beneath
+ * it if it is a directory, without changing their order of use.  Unless
+ * the paths were exchanged, any files previously recorded at or beneath
+ * the destination path were replaced, and their records are removed.
+ *
+ * @param src path relative to lowerdir before the rename
+ * @param dst path relative to lowerdir after the rename
+ * @param exchange 1 if the paths were exchanged (per RENAME_EXCHANGE)
+ */
+void evictor_rename(struct evictor *ev, const char *src, const char *dst,
+		    int exchange)
+{
+	struct evict_entry *entry, *next;
+	struct evict_entry *moved = NULL;
+	const char *new_dir;
+	size_t len;
+	char *path;
+
+	pthread_mutex_lock(&ev->mutex);
+
+	// unlink all moved entries first, as exchanged paths may be reused
+	for (entry = ev->lru_head; entry != NULL; entry = next) {
+		next = entry->next;
+
+		if ((len = match_dir(entry->path, src)) > 0)
+			new_dir = dst;
+		else if ((len = match_dir(entry->path, dst)) > 0)
+			new_dir = exchange ? src : NULL;
+		else
+			continue;
+
+		path = NULL;
+		if (new_dir != NULL) {
+			path = malloc(strlen(new_dir) +
+				      strlen(entry->path + len) + 1);
+		}
+		if (path == NULL) {
+			// replaced, or not recordable under its new path
+			detach_entry(ev, find_entry(ev, entry->path,
+						    entry->hash), entry);
+			free_entry(entry);
+			continue;
+		}
+		strcpy(path, new_dir);
+		strcat(path, entry->path + len);
+
+		*find_entry(ev, entry->path, entry->hash) = entry->chain;
+		free(entry->path);
+		entry->path = path;
+		entry->hash = pathhash_fnv1a(path);
+		entry->chain = moved;
+		moved = entry;
+	}
+
+	while ((entry = moved) != NULL) {
+		moved = entry->chain;
+		link_bucket(ev, entry);
+	}
+
+	pthread_mutex_unlock(&ev->mutex);
+}
+
+void evictor_get_stats(struct evictor *ev, struct evictor_stats *stats)
+{
+	pthread_mutex_lock(&ev->mutex);
+	stats->tracked_bytes = ev->size;
+	stats->tracked_files = ev->num_entries;
+	stats->evicted_bytes = ev->evicted_bytes;
+	stats->evicted_files = ev->evicted_files;
+	pthread_mutex_unlock(&ev->mutex);
+}
+
+void evictor_destroy(struct evictor *ev)
+{
+	struct evict_entry *entry;
+
+	evictor_stop(ev);
+
+	while ((entry = ev->lru_head) != NULL) {
+		ev->lru_head = entry->next;
+		free_entry(entry);
+	}
+
+	pthread_cond_destroy(&ev->cond);
+	pthread_condattr_destroy(&ev->condattr);
+	pthread_mutex_destroy(&ev->mutex);
+	free(ev->buckets);
+	free(ev);
+}
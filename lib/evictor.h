@@ -0,0 +1,57 @@
+/* Linux Projected Filesystem
+   Copyright (C) 2019 GitHub, Inc.
+
+   See the NOTICE file distributed with this library for additional
+   information regarding copyright ownership.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library, in the file COPYING; if not,
+   see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef _EVICTOR_H
+#define _EVICTOR_H
+
+#include <stdint.h>
+
+// interval between eviction passes while all candidates are busy
+#define EVICTOR_RETRY_MSEC 1000
+
+struct evictor;
+
+struct evictor_stats {
+	uint64_t tracked_bytes;
+	unsigned int tracked_files;
+	uint64_t evicted_bytes;
+	uint64_t evicted_files;
+};
+
+typedef int (*evictor_evict_t)(void *data, const char *path);
+
+struct evictor *evictor_create(uint64_t budget, evictor_evict_t evict,
+			       void *data);
+void evictor_destroy(struct evictor *ev);
+
+int evictor_start(struct evictor *ev);
+void evictor_stop(struct evictor *ev);
+
+int evictor_record(struct evictor *ev, const char *path, uint64_t size);
+void evictor_touch(struct evictor *ev, const char *path);
+void evictor_remove(struct evictor *ev, const char *path);
+void evictor_rename(struct evictor *ev, const char *src, const char *dst,
+		    int exchange);
+
+void evictor_get_stats(struct evictor *ev, struct evictor_stats *stats);
+
+#endif /* _EVICTOR_H */
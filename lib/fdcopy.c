@@ -0,0 +1,255 @@
+/* Linux Projected Filesystem
+   Copyright (C) 2019 GitHub, Inc.
+
+   See the NOTICE file distributed with this library for additional
+   information regarding copyright ownership.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library, in the file COPYING; if not,
+   see <http://www.gnu.org/licenses/>.
+*/
+
+#define _GNU_SOURCE
+
+#include <config.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#ifdef HAVE_LINUX_FS_H
+#include <linux/fs.h>			/* for FICLONERANGE */
+#endif
+
+#include "fdcopy.h"
+
+/*
+ * We copy a range of data from a file descriptor supplied by a provider
+ * into a file being projected, using the cheapest method available, so
+ * that where possible the data never passes through user memory:
+ *
+ * 1. A reflink clone with the FICLONERANGE ioctl(2), which shares the
+ *    source's extents with the destination and copies no data at all.
+ *    This requires both files to be on the same filesystem, and one
+ *    which supports it (e.g., XFS or btrfs), and the offsets and length
+ *    to be aligned to the filesystem's block size, except that the range
+ *    may end at the end of the source file.
+ * 2. copy_file_range(2), which copies within the kernel, and which some
+ *    filesystems (e.g., NFS) may perform on the server.
+ * 3. splice(2), through a pipe, which moves pages within the kernel and
+ *    also accepts sources such as pipes and sockets.
+ * 4. read(2) and write(2), through a buffer, for any other source.
+ *
+ * We fall back from each method to the next only when it is unsupported
+ * for the given descriptors, and before it has consumed any data from a
+ * source without an offset (i.e., a stream), so that no data is lost.
+ * If the source ends before the full length is copied, we return EIO.
+ *
+ * When the source offset is negative, the source is read from its current
+ * position, as is required for pipes and sockets; in this case no clone
+ * is attempted.
+ */
+
+static inline int is_unsupported(int err)
+{
+	return (err == EINVAL || err == EXDEV || err == ENOSYS ||
+		err == EOPNOTSUPP || err == ENOTTY || err == EBADF);
+}
+
+static int clone_range(int fd, off_t offset, int src_fd, off_t src_offset,
+		       size_t length)
+{
+#ifdef FICLONERANGE
+	struct file_clone_range range;
+
+	range.src_fd = src_fd;
+	range.src_offset = src_offset;
+	range.src_length = length;
+	range.dest_offset = offset;
+
+	if (ioctl(fd, FICLONERANGE, &range) == -1)
+		return errno;
+	return 0;
+#else
+	return EOPNOTSUPP;
+#endif
+}
+
+static int copy_range(int fd, off_t *offset, int src_fd, off_t *src_offset,
+		      size_t *length)
+{
+#ifdef HAVE_COPY_FILE_RANGE
+	ssize_t n;
+
+	while (*length > 0) {
+		n = copy_file_range(src_fd, src_offset, fd, offset,
+				    *length, 0);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			return errno;
+		}
+		if (n == 0)
+			return EIO;	// source too short
+		*length -= n;
+	}
+
+	return 0;
+#else
+	return ENOSYS;
+#endif
+}
+
+/**
+ * @param moved set if any data was consumed from the source
+ */
+static int splice_range(int fd, off_t *offset, int src_fd, off_t *src_offset,
+			size_t *length, int *moved)
+{
+	int pipefd[2];
+	ssize_t n, m;
+	int res = 0;
+
+	if (pipe2(pipefd, O_CLOEXEC) == -1)
+		return errno;
+
+	while (*length > 0) {
+		n = splice(src_fd, src_offset, pipefd[1], NULL,
+			   (*length < FDCOPY_CHUNK_SIZE) ? *length
+							 : FDCOPY_CHUNK_SIZE,
+			   SPLICE_F_MOVE);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			res = errno;
+			break;
+		}
+		if (n == 0) {
+			res = EIO;	// source too short
+			break;
+		}
+		*moved = 1;
+
+		while (n > 0) {
+			m = splice(pipefd[0], NULL, fd, offset, n,
+				   SPLICE_F_MOVE);
+			if (m == -1) {
+				if (errno == EINTR)
+					continue;
+				res = errno;
+				// data left in the pipe may be read again
+				if (src_offset != NULL)
+					*src_offset -= n;
+				goto out;
+			}
+			n -= m;
+			*length -= m;
+		}
+	}
+
+out:
+	close(pipefd[0]);
+	close(pipefd[1]);
+	return res;
+}
+
+static int rw_range(int fd, off_t *offset, int src_fd, off_t *src_offset,
+		    size_t *length)
+{
+	char *buf;
+	ssize_t n, m;
+	size_t len;
+	int res = 0;
+
+	buf = malloc(FDCOPY_CHUNK_SIZE);
+	if (buf == NULL)
+		return ENOMEM;
+
+	while (*length > 0) {
+		len = (*length < FDCOPY_CHUNK_SIZE) ? *length
+						    : FDCOPY_CHUNK_SIZE;
+		if (src_offset == NULL)
+			n = read(src_fd, buf, len);
+		else
+			n = pread(src_fd, buf, len, *src_offset);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			res = errno;
+			break;
+		}
+		if (n == 0) {
+			res = EIO;	// source too short
+			break;
+		}
+		if (src_offset != NULL)
+			*src_offset += n;
+
+		len = 0;
+		while (len < (size_t)n) {
+			m = pwrite(fd, buf + len, n - len, *offset);
+			if (m == -1) {
+				if (errno == EINTR)
+					continue;
+				res = errno;
+				goto out;
+			}
+			len += m;
+			*offset += m;
+		}
+		*length -= n;
+	}
+
+out:
+	free(buf);
+	return res;
+}
+
+/**
+ * Copies a range of data from one file descriptor to another.
+ *
+ * @param src_offset offset in the source, or -1 to read from its current
+ *                   position
+ * @return 0 or an errno; EIO if the source ended prematurely
+ */
+int fdcopy_range(int fd, off_t offset, int src_fd, off_t src_offset,
+		 size_t length)
+{
+	off_t *src_offset_ptr = (src_offset < 0) ? NULL : &src_offset;
+	int moved = 0;
+	int res;
+
+	if (offset < 0)
+		return EINVAL;
+	if (length == 0)
+		return 0;
+
+	if (src_offset_ptr != NULL) {
+		res = clone_range(fd, offset, src_fd, src_offset, length);
+		if (!is_unsupported(res))
+			return res;
+	}
+
+	res = copy_range(fd, &offset, src_fd, src_offset_ptr, &length);
+	if (!is_unsupported(res))
+		return res;
+
+	res = splice_range(fd, &offset, src_fd, src_offset_ptr, &length,
+			   &moved);
+	if (!is_unsupported(res) || (moved && src_offset_ptr == NULL))
+		return res;
+
+	return rw_range(fd, &offset, src_fd, src_offset_ptr, &length);
+}
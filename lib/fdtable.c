@@ -22,6 +22,7 @@
 #define _GNU_SOURCE
 
 #include <errno.h>
+#include <limits.h>
 #include <pthread.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -74,6 +75,33 @@
  * especially, sequential and mostly-sequential key values indicates we
  * achieve more single-probe-only lookups and shorter maximum probe lengths
  * when using the lower bits of the hash for the array index.
+ *
+ * To avoid serializing all FUSE worker threads on a single lock, the
+ * table is split into a fixed number of shards, each with its own array
+ * and mutex, and each padded out to a multiple of the L1 cache line size
+ * so that no two shards' locks or counters share a cache line.  A key is
+ * assigned to a shard by its low bits, so that the typically sequential
+ * fds opened at any one time are spread evenly over all shards; the key's
+ * remaining bits are then hashed as described above within its shard,
+ * which preserves their sequential nature.  Resizing is performed per
+ * shard, and so only blocks operations on keys in the same shard.
+ *
+ * Resizing is also incremental, so that no single operation pays the cost
+ * of rehashing a large array.  When a shard's array must grow or shrink,
+ * we allocate the new array and retain the old one, and each subsequent
+ * operation on the shard then migrates a few entries from the old array
+ * to the new one.  New entries are only ever inserted into the new array,
+ * but until the migration is complete, an entry not found in the new array
+ * is sought in the old one.  Migrated entries are marked as removed in the
+ * old array so that its probe sequences remain intact.  Should another
+ * resize be required before a migration completes, the migration is
+ * finished at once; since we migrate several entries per operation and a
+ * resize at least doubles or halves an array, this should be rare.
+ *
+ * To avoid repeatedly growing and shrinking a shard when its load hovers
+ * around the lower threshold, we only shrink once the load has stayed below
+ * that threshold for a number of operations proportional to the array size,
+ * which also amortizes the cost of the migration over those operations.
  */
 
 struct fd_pid_entry {
@@ -81,65 +109,124 @@ struct fd_pid_entry {
 	pid_t pid;
 };
 
-struct fdtable {
+struct fd_array {
+	struct fd_pid_entry *entries;
 	unsigned int size;
-	unsigned int used;
 	uint32_t mask;
-	long l1cache_linesize;
-	struct fd_pid_entry *array;
+};
+
+struct fdtable_shard {
+	struct fd_array cur;
+	struct fd_array old;		/* entries not yet migrated, if any */
+	unsigned int migrate_index;
+	unsigned int used;
+	unsigned int low_load_ops;	/* operations since load fell low */
 	pthread_mutex_t mutex;
 };
 
+struct fdtable {
+	long l1cache_linesize;
+	size_t shard_stride;
+	void *shards;
+};
+
 #define DEFAULT_CACHE_LINESIZE 64
 
 #define DEFAULT_TABLE_SIZE 32
 #define MIN_TABLE_SIZE DEFAULT_TABLE_SIZE
+#define MAX_TABLE_SIZE (1U << 30)
+
+#define MIGRATE_ENTRIES 8
+
+#define SHARD_BITS 4
+#define NUM_SHARDS (1 << SHARD_BITS)
+#define SHARD_MASK (NUM_SHARDS - 1)
+
+static inline struct fdtable_shard *get_shard(struct fdtable *table,
+					      unsigned int index)
+{
+	return (struct fdtable_shard *)((char *)table->shards +
+					index * table->shard_stride);
+}
 
-static int create_array(struct fdtable *table, unsigned int table_size)
+static int create_array(struct fd_array *array, long linesize,
+			unsigned int table_size)
 {
-	void *array;
+	void *entries;
 	size_t array_bytes;
 
-	array_bytes = table_size * sizeof(*table->array);
+	array_bytes = (size_t)table_size * sizeof(*array->entries);
 
-	if (posix_memalign(&array, table->l1cache_linesize,
-			   array_bytes) != 0) {
+	if (posix_memalign(&entries, linesize, array_bytes) != 0) {
 		errno = ENOMEM;
 		return -1;
 	}
 
 	// fill array with int values corresponding to SENTINEL_EMPTY (-1)
-	memset(array, 0xFF, array_bytes);
+	memset(entries, 0xFF, array_bytes);
 
-	table->size = table_size;
-	table->mask = table_size - 1;
-	table->array = array;
+	array->size = table_size;
+	array->mask = table_size - 1;
+	array->entries = entries;
 
 	return 0;
 }
 
+static void destroy_shards(struct fdtable *table, unsigned int num_shards)
+{
+	unsigned int i;
+
+	for (i = 0; i < num_shards; ++i) {
+		struct fdtable_shard *shard = get_shard(table, i);
+
+		pthread_mutex_destroy(&shard->mutex);
+		free(shard->old.entries);
+		free(shard->cur.entries);
+	}
+	free(table->shards);
+}
+
 struct fdtable *fdtable_create(void)
 {
 	struct fdtable *table;
+	long linesize;
+	unsigned int i;
 
 	table = calloc(1, sizeof(*table));
 	if (table == NULL)
 		return NULL;
 
-	table->l1cache_linesize = sysconf(_SC_LEVEL1_DCACHE_LINESIZE);
-	if (table->l1cache_linesize == -1)
-		table->l1cache_linesize = DEFAULT_CACHE_LINESIZE;
+	linesize = sysconf(_SC_LEVEL1_DCACHE_LINESIZE);
+	if (linesize <= 0)
+		linesize = DEFAULT_CACHE_LINESIZE;
+	table->l1cache_linesize = linesize;
+
+	// round shard size up to a whole number of cache lines
+	table->shard_stride = (sizeof(struct fdtable_shard) + linesize - 1) /
+			      linesize * linesize;
 
-	if (create_array(table, DEFAULT_TABLE_SIZE) == -1)
+	if (posix_memalign(&table->shards, linesize,
+			   NUM_SHARDS * table->shard_stride) != 0)
 		goto out_table;
+	memset(table->shards, 0, NUM_SHARDS * table->shard_stride);
 
-	if (pthread_mutex_init(&table->mutex, NULL) != 0)
-		goto out_array;
+	for (i = 0; i < NUM_SHARDS; ++i) {
+		struct fdtable_shard *shard = get_shard(table, i);
+
+		if (create_array(&shard->cur, linesize,
+				 DEFAULT_TABLE_SIZE) == -1)
+			goto out_shards;
+
+		if (pthread_mutex_init(&shard->mutex, NULL) != 0) {
+			free(shard->cur.entries);
+			goto out_shards;
+		}
+	}
 
 	return table;
 
-out_array:
-	free(table->array);
+out_shards:
+	destroy_shards(table, i);
 out_table:
 	free(table);
 	return NULL;
@@ -162,10 +249,10 @@ enum update_result {
 };
 
 static enum update_result
-try_update_entry(struct fdtable *table, unsigned int index,
+try_update_entry(struct fd_array *array, unsigned int index,
 		 int fd, pid_t *pid, enum entry_operation op)
 {
-	struct fd_pid_entry *entry = &table->array[index];
+	struct fd_pid_entry *entry = &array->entries[index];
 	int entry_fd = entry->fd;
 
 	switch (op) {
@@ -175,8 +262,6 @@ try_update_entry(struct fdtable *table, unsigned int index,
 			return UPDATE_CONTINUE;
 		entry->fd = fd;
 		entry->pid = *pid;
-		if (op == OP_INSERT)
-			++table->used;
 		break;
 	case OP_REPLACE:
 	case OP_REMOVE:
@@ -186,11 +271,12 @@ try_update_entry(struct fdtable *table, unsigned int index,
 			} else {
 				entry->fd = SENTINEL_REMOVED;
 				*pid = entry->pid;
-				--table->used;
 			}
 		} else {
 			/* We should never reach the end of a cluster of
-			 * entries; this would imply a FUSE error.
+			 * entries, unless the entry has yet to be migrated
+			 * from an old array; otherwise this would imply a
+			 * FUSE error.
 			 */
 			return (entry_fd == SENTINEL_EMPTY) ? UPDATE_ERROR
 							    : UPDATE_CONTINUE;
@@ -207,23 +293,24 @@ try_update_entry(struct fdtable *table, unsigned int index,
 
 static inline unsigned int hash32_index(uint32_t key, uint32_t mask)
 {
-	return (key * GOLDEN_RATIO_PRIME) & mask;
+	// the low bits of the key select the shard, so exclude them here
+	return ((key >> SHARD_BITS) * GOLDEN_RATIO_PRIME) & mask;
 }
 
-static int update_entry(struct fdtable *table, int fd, pid_t *pid,
+static int update_entry(struct fd_array *array, int fd, pid_t *pid,
 			enum entry_operation op)
 {
-	unsigned int index = hash32_index(fd, table->mask);
+	unsigned int index = hash32_index(fd, array->mask);
 	unsigned int i;
 	enum update_result res;
 
-	for (i = index; i < table->size; ++i) {
-		res = try_update_entry(table, i, fd, pid, op);
+	for (i = index; i < array->size; ++i) {
+		res = try_update_entry(array, i, fd, pid, op);
 		if (res != UPDATE_CONTINUE)
 			return (res == UPDATE_SUCCESS) ? 0 : -1;
 	}
 	for (i = 0; i < index; ++i) {
-		res = try_update_entry(table, i, fd, pid, op);
+		res = try_update_entry(array, i, fd, pid, op);
 		if (res != UPDATE_CONTINUE)
 			return (res == UPDATE_SUCCESS) ? 0 : -1;
 	}
@@ -234,27 +321,56 @@ static int update_entry(struct fdtable *table, int fd, pid_t *pid,
 	return -1;
 }
 
-static int resize_table(struct fdtable *table, unsigned int new_size)
+static void migrate_entries(struct fdtable_shard *shard, unsigned int count)
 {
-	struct fd_pid_entry *array = table->array;
-	unsigned int old_size = table->size;
-	unsigned int i;
+	struct fd_array *old = &shard->old;
+	unsigned int i, end;
+
+	if (old->entries == NULL)
+		return;
+
+	end = shard->migrate_index + count;
+	if (end > old->size || end < count)
+		end = old->size;
+
+	for (i = shard->migrate_index; i < end; ++i) {
+		struct fd_pid_entry *entry = &old->entries[i];
+
+		if (entry->fd < 0)
+			continue;
+		// we know table size is sufficient so ignore return code
+		(void)update_entry(&shard->cur, entry->fd, &entry->pid,
+				   OP_REHASH);
+		entry->fd = SENTINEL_REMOVED;
+	}
+	shard->migrate_index = end;
+
+	if (shard->migrate_index == old->size) {
+		free(old->entries);
+		old->entries = NULL;
+	}
+}
+
+static int resize_shard(struct fdtable *table, struct fdtable_shard *shard,
+			unsigned int new_size)
+{
+	struct fd_array array;
 
 	if (new_size > MAX_TABLE_SIZE) {
 		errno = ENOMEM;
 		return -1;
 	}
 
-	if (create_array(table, new_size) == -1)
+	if (create_array(&array, table->l1cache_linesize, new_size) == -1)
 		return -1;
 
-	for (i = 0; i < old_size; ++i) {
-		if (array[i].fd < 0)
-			continue;
-		// we know table size is sufficient so ignore return code
-		(void)update_entry(table, array[i].fd, &array[i].pid,
-				   OP_REHASH);
-	}
+	// complete any prior migration before starting a new one
+	migrate_entries(shard, UINT_MAX);
+
+	shard->old = shard->cur;
+	shard->cur = array;
+	shard->migrate_index = 0;
+	shard->low_load_ops = 0;
 
 	return 0;
 }
@@ -262,56 +378,129 @@ static int resize_table(struct fdtable *table, unsigned int new_size)
 #define max_load(sz) (2 * (sz) / 3)
 #define min_load(sz) (1 * (sz) / 6)
 
+// number of operations below min_load() before we shrink
+#define shrink_delay(sz) ((sz) / 4)
+
+/* Once a shard's load falls below its lower threshold, count its
+ * operations, and shrink its array only after the load has stayed low
+ * for long enough.
+ */
+static void check_shrink_shard(struct fdtable *table,
+			       struct fdtable_shard *shard)
+{
+	unsigned int size = shard->cur.size;
+
+	if (size <= MIN_TABLE_SIZE || shard->used >= min_load(size)) {
+		shard->low_load_ops = 0;
+		return;
+	}
+
+	if (++shard->low_load_ops < shrink_delay(size))
+		return;
+
+	// failure to shrink is harmless, so ignore it and retry later
+	if (resize_shard(table, shard, size / 2) == -1)
+		shard->low_load_ops = 0;
+}
+
+/* Update an entry which may not yet have been migrated from the old array,
+ * if a migration is in progress.
+ */
+static int update_shard_entry(struct fdtable_shard *shard, int fd,
+			      pid_t *pid, enum entry_operation op)
+{
+	if (update_entry(&shard->cur, fd, pid, op) == 0)
+		return 0;
+	if (shard->old.entries == NULL)
+		return -1;
+	return update_entry(&shard->old, fd, pid, op);
+}
+
 int fdtable_insert(struct fdtable *table, int fd, pid_t pid)
 {
+	struct fdtable_shard *shard = get_shard(table, fd & SHARD_MASK);
 	int ret;
 
-	pthread_mutex_lock(&table->mutex);
+	pthread_mutex_lock(&shard->mutex);
+
+	migrate_entries(shard, MIGRATE_ENTRIES);
 
-	if (table->used + 1 > max_load(table->size)) {
-		ret = resize_table(table, table->size * 2);
+	if (shard->used + 1 > max_load(shard->cur.size)) {
+		ret = resize_shard(table, shard, shard->cur.size * 2);
 		if (ret == -1)
 			goto out;
 	}
-	ret = update_entry(table, fd, &pid, OP_INSERT);
+	ret = update_entry(&shard->cur, fd, &pid, OP_INSERT);
+	if (ret == 0) {
+		++shard->used;
+		check_shrink_shard(table, shard);
+	}
 
 out:
-	pthread_mutex_unlock(&table->mutex);
+	pthread_mutex_unlock(&shard->mutex);
 	return ret;
 }
 
 int fdtable_replace(struct fdtable *table, int fd, pid_t pid)
 {
+	struct fdtable_shard *shard = get_shard(table, fd & SHARD_MASK);
 	int ret;
 
-	pthread_mutex_lock(&table->mutex);
-	ret = update_entry(table, fd, &pid, OP_REPLACE);
-	pthread_mutex_unlock(&table->mutex);
+	pthread_mutex_lock(&shard->mutex);
+
+	migrate_entries(shard, MIGRATE_ENTRIES);
+
+	ret = update_shard_entry(shard, fd, &pid, OP_REPLACE);
+	check_shrink_shard(table, shard);
+
+	pthread_mutex_unlock(&shard->mutex);
 	return ret;
 }
 
 int fdtable_remove(struct fdtable *table, int fd, pid_t *pid)
 {
+	struct fdtable_shard *shard = get_shard(table, fd & SHARD_MASK);
 	int ret;
 
-	pthread_mutex_lock(&table->mutex);
+	pthread_mutex_lock(&shard->mutex);
 
-	if (table->size > MIN_TABLE_SIZE &&
-	    table->used - 1 < min_load(table->size)) {
-		ret = resize_table(table, table->size / 2);
-		if (ret == -1)
-			goto out;
-	}
-	ret = update_entry(table, fd, pid, OP_REMOVE);
+	migrate_entries(shard, MIGRATE_ENTRIES);
 
-out:
-	pthread_mutex_unlock(&table->mutex);
+	ret = update_shard_entry(shard, fd, pid, OP_REMOVE);
+	if (ret == 0)
+		--shard->used;
+	check_shrink_shard(table, shard);
+
+	pthread_mutex_unlock(&shard->mutex);
 	return ret;
 }
 
+/**
+ * Reports the occupancy of the table, which may change as soon as the
+ * shards are unlocked.
+ *
+ * @param used number of entries stored
+ * @param size number of entries for which space is allocated
+ */
+void fdtable_get_usage(struct fdtable *table, unsigned int *used,
+		       unsigned int *size)
+{
+	unsigned int i;
+
+	*used = 0;
+	*size = 0;
+	for (i = 0; i < NUM_SHARDS; ++i) {
+		struct fdtable_shard *shard = get_shard(table, i);
+
+		pthread_mutex_lock(&shard->mutex);
+		*used += shard->used;
+		*size += shard->cur.size;
+		pthread_mutex_unlock(&shard->mutex);
+	}
+}
+
 void fdtable_destroy(struct fdtable *table)
 {
-	pthread_mutex_destroy(&table->mutex);
-	free(table->array);
+	destroy_shards(table, NUM_SHARDS);
 	free(table);
 }
@@ -22,8 +22,6 @@
 #ifndef _FDTABLE_H
 #define _FDTABLE_H
 
-#define MAX_TABLE_SIZE 65536
-
 struct fdtable;
 
 struct fdtable *fdtable_create(void);
@@ -33,4 +31,7 @@ int fdtable_insert(struct fdtable *table, int fd, pid_t pid);
 int fdtable_replace(struct fdtable *table, int fd, pid_t pid);
 int fdtable_remove(struct fdtable *table, int fd, pid_t *pid);
 
+void fdtable_get_usage(struct fdtable *table, unsigned int *used,
+		       unsigned int *size);
+
 #endif /* _FDTABLE_H */
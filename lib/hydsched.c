@@ -0,0 +1,253 @@
+/* Linux Projected Filesystem
+   Copyright (C) 2019 GitHub, Inc.
+
+   See the NOTICE file distributed with this library for additional
+   information regarding copyright ownership.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library, in the file COPYING; if not,
+   see <http://www.gnu.org/licenses/>.
+*/
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "hydsched.h"
+
+/*
+ * We limit the number of projection requests which may be sent to the
+ * provider at once, and schedule those which must wait, so that a single
+ * process performing bulk work (e.g., a recursive grep(1)) can not delay
+ * the projection requests of others (e.g., an editor opening a file).
+ *
+ * Each waiting request is assigned to one of several priority classes,
+ * and within each class, to a flow of requests from the same process.
+ * When a running request completes, its slot is passed directly to the
+ * first waiting request from the highest non-empty class, and within that
+ * class, the flows are served in round-robin order, one request at a time.
+ * So that lower classes are never starved entirely, once a waiting class
+ * has been passed over HYDSCHED_MAX_SKIP times, its next request is served
+ * ahead of those of higher classes.
+ *
+ * When there are free slots and no requests are waiting, a new request
+ * proceeds immediately without being queued; otherwise it joins the end
+ * of its flow, so requests are never served out of order within a flow.
+ *
+ * Each waiter, allocated on the stack of the thread which is waiting, has
+ * its own condition variable so that only the thread granted a slot is
+ * woken.  Flows are allocated as needed and freed when empty; if one can
+ * not be allocated, the request proceeds without waiting, since exceeding
+ * the limit is preferable to failing the request.
+ */
+
+struct hydsched_wait {
+	int granted;
+	pthread_cond_t cond;
+	struct hydsched_wait *next;
+};
+
+struct hydsched_flow {
+	pid_t pid;
+	struct hydsched_wait *head;
+	struct hydsched_wait **tail;
+	struct hydsched_flow *next;
+};
+
+struct hydsched_queue {
+	struct hydsched_flow *head;
+	struct hydsched_flow **tail;
+	unsigned int skipped;
+};
+
+struct hydsched {
+	unsigned int max_running;
+	unsigned int running;
+	unsigned int waiting;
+	struct hydsched_queue queues[HYDSCHED_NUM_CLASSES];
+	pthread_mutex_t mutex;
+};
+
+struct hydsched *hydsched_create(unsigned int max_running)
+{
+	struct hydsched *sched;
+	int i;
+
+	if (max_running == 0) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	sched = calloc(1, sizeof(*sched));
+	if (sched == NULL)
+		return NULL;
+
+	if (pthread_mutex_init(&sched->mutex, NULL) != 0) {
+		free(sched);
+		return NULL;
+	}
+
+	sched->max_running = max_running;
+	for (i = 0; i < HYDSCHED_NUM_CLASSES; ++i)
+		sched->queues[i].tail = &sched->queues[i].head;
+
+	return sched;
+}
+
+static void append_flow(struct hydsched_queue *queue,
+			struct hydsched_flow *flow)
+{
+	flow->next = NULL;
+	*queue->tail = flow;
+	queue->tail = &flow->next;
+}
+
+static struct hydsched_flow *get_flow(struct hydsched_queue *queue,
+				      pid_t pid)
+{
+	struct hydsched_flow *flow;
+
+	for (flow = queue->head; flow != NULL; flow = flow->next) {
+		if (flow->pid == pid)
+			return flow;
+	}
+
+	flow = malloc(sizeof(*flow));
+	if (flow == NULL)
+		return NULL;
+	flow->pid = pid;
+	flow->head = NULL;
+	flow->tail = &flow->head;
+	append_flow(queue, flow);
+
+	return flow;
+}
+
+void hydsched_enter(struct hydsched *sched, pid_t pid,
+		    enum hydsched_class class)
+{
+	struct hydsched_wait wait;
+	struct hydsched_flow *flow;
+
+	pthread_mutex_lock(&sched->mutex);
+	if (sched->running < sched->max_running && sched->waiting == 0) {
+		++sched->running;
+		pthread_mutex_unlock(&sched->mutex);
+		return;
+	}
+
+	flow = get_flow(&sched->queues[class], pid);
+	if (flow == NULL || pthread_cond_init(&wait.cond, NULL) != 0) {
+		++sched->running;
+		pthread_mutex_unlock(&sched->mutex);
+		return;
+	}
+
+	wait.granted = 0;
+	wait.next = NULL;
+	*flow->tail = &wait;
+	flow->tail = &wait.next;
+	++sched->waiting;
+
+	while (!wait.granted)
+		pthread_cond_wait(&wait.cond, &sched->mutex);
+	pthread_mutex_unlock(&sched->mutex);
+
+	pthread_cond_destroy(&wait.cond);
+}
+
+static struct hydsched_queue *select_queue(struct hydsched *sched)
+{
+	struct hydsched_queue *selected = NULL;
+	int i;
+
+	for (i = 0; i < HYDSCHED_NUM_CLASSES; ++i) {
+		struct hydsched_queue *queue = &sched->queues[i];
+
+		if (queue->head == NULL)
+			continue;
+		if (selected == NULL) {
+			selected = queue;
+		} else if (++queue->skipped >= HYDSCHED_MAX_SKIP) {
+			// serve the lowest starved class
+			selected = queue;
+		}
+	}
+
+	if (selected != NULL)
+		selected->skipped = 0;
+
+	return selected;
+}
+
+static struct hydsched_wait *dequeue_wait(struct hydsched *sched)
+{
+	struct hydsched_queue *queue;
+	struct hydsched_flow *flow;
+	struct hydsched_wait *wait;
+
+	queue = select_queue(sched);
+	if (queue == NULL)
+		return NULL;
+
+	flow = queue->head;
+	wait = flow->head;
+	flow->head = wait->next;
+	if (flow->head == NULL)
+		flow->tail = &flow->head;
+
+	// rotate the flow to the end of its queue, or free it if empty
+	queue->head = flow->next;
+	if (queue->head == NULL)
+		queue->tail = &queue->head;
+	if (flow->head != NULL)
+		append_flow(queue, flow);
+	else
+		free(flow);
+
+	--sched->waiting;
+	return wait;
+}
+
+void hydsched_exit(struct hydsched *sched)
+{
+	struct hydsched_wait *wait;
+
+	pthread_mutex_lock(&sched->mutex);
+	wait = dequeue_wait(sched);
+	if (wait != NULL) {
+		// pass our slot directly to the waiter
+		wait->granted = 1;
+		pthread_cond_signal(&wait->cond);
+	} else {
+		--sched->running;
+	}
+	pthread_mutex_unlock(&sched->mutex);
+}
+
+void hydsched_get_counts(struct hydsched *sched, unsigned int *running,
+			 unsigned int *waiting)
+{
+	pthread_mutex_lock(&sched->mutex);
+	*running = sched->running;
+	*waiting = sched->waiting;
+	pthread_mutex_unlock(&sched->mutex);
+}
+
+void hydsched_destroy(struct hydsched *sched)
+{
+	pthread_mutex_destroy(&sched->mutex);
+	free(sched);
+}
@@ -0,0 +1,49 @@
+/* Linux Projected Filesystem
+   Copyright (C) 2019 GitHub, Inc.
+
+   See the NOTICE file distributed with this library for additional
+   information regarding copyright ownership.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library, in the file COPYING; if not,
+   see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _HYDSCHED_H
+#define _HYDSCHED_H
+
+#include <sys/types.h>
+
+// grants to higher classes before a waiting lower class is served
+#define HYDSCHED_MAX_SKIP 16
+
+enum hydsched_class {
+	HYDSCHED_INTERACTIVE,
+	HYDSCHED_NORMAL,
+	HYDSCHED_BACKGROUND,
+	HYDSCHED_NUM_CLASSES
+};
+
+struct hydsched;
+
+struct hydsched *hydsched_create(unsigned int max_running);
+void hydsched_destroy(struct hydsched *sched);
+
+void hydsched_enter(struct hydsched *sched, pid_t pid,
+		    enum hydsched_class class);
+void hydsched_exit(struct hydsched *sched);
+
+void hydsched_get_counts(struct hydsched *sched, unsigned int *running,
+			 unsigned int *waiting);
+
+#endif /* _HYDSCHED_H */
@@ -0,0 +1,397 @@
+/* Linux Projected Filesystem
+   Copyright (C) 2019 GitHub, Inc.
+
+   See the NOTICE file distributed with this library for additional
+   information regarding copyright ownership.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library, in the file COPYING; if not,
+   see <http://www.gnu.org/licenses/>.
+*/
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "hydtrace.h"
+#include "pathhash.h"
+#include "readfile.h"
+
+/*
+ * We record the order in which files and directories are hydrated during
+ * each mount in a trace file, and when the filesystem is next mounted, we
+ * replay the trace from a background thread, hydrating each path in turn
+ * before, ideally, it is first accessed.  Workloads such as CI jobs, which
+ * touch much the same files in much the same order on every run, should
+ * then rarely have to wait for a hydration.
+ *
+ * The trace file consists of a magic string followed by one record per
+ * path, each of which is a type character ('d' or 'f') and the path
+ * relative to lowerdir, terminated by a NUL character; paths may contain
+ * any other character.  Reading stops at the first invalid or truncated
+ * record, so a trace left incomplete by a crash is still usable.  A file
+ * too short to hold the magic string, or which does not begin with it, is
+ * ignored as if there were no old trace, and the caller may log this.
+ *
+ * The new trace is written to a temporary file alongside the old one as
+ * hydrations occur, and is renamed over the old one only when the trace is
+ * destroyed, so that the old trace remains available for replay until
+ * then.  If nothing was hydrated, the old trace is kept.  All hydrations
+ * are recorded, including those performed by the replay itself, so the
+ * new trace preserves those paths of the old trace which were reached
+ * before the replay stopped.
+ *
+ * The replay must not get in the way of the workload it is meant to help.
+ * We therefore index the old trace by path in an open-addressed hash
+ * table, and whenever a hydration not performed by the replay (i.e., one
+ * the replay failed to anticipate) is of a path which lies ahead of the
+ * replay's position in the trace, we count the replay as overtaken.  Once
+ * it has been overtaken HYDTRACE_MAX_OVERTAKEN times, the workload has
+ * evidently diverged from the trace or is outpacing it, and the replay is
+ * stopped.
+ */
+
+#define HYDTRACE_MAGIC "projfs-trace-1"
+#define HYDTRACE_MAGIC_LEN sizeof(HYDTRACE_MAGIC)	/* including NUL */
+
+#define HYDTRACE_TMP_SUFFIX ".new"
+
+struct hydtrace {
+	char *path;
+	char *tmp_path;
+	FILE *file;			/* new trace, or NULL on error */
+	unsigned int num_recorded;
+	char *buf;			/* contents of old trace */
+	int invalid;			/* old trace was ignored */
+	const char **entries;		/* records in old trace */
+	unsigned int num_entries;
+	unsigned int *index;		/* entry number + 1, or zero */
+	uint32_t index_mask;
+	hydtrace_replay_t replay;
+	void *data;
+	pthread_t thread_id;
+	int running;
+	int stopping;
+	unsigned int cursor;		/* entry being replayed */
+	unsigned int overtaken;
+	pthread_mutex_t mutex;
+};
+
+static int load_trace(struct hydtrace *trace)
+{
+	size_t len, off;
+	unsigned int i, n = 0, size;
+	int err;
+
+	err = readfile_load(trace->path, &trace->buf, &len);
+	if (err == ENOENT)
+		return 0;
+	else if (err != 0)
+		return err;
+
+	if (len < HYDTRACE_MAGIC_LEN ||
+	    memcmp(trace->buf, HYDTRACE_MAGIC, HYDTRACE_MAGIC_LEN) != 0) {
+		free(trace->buf);
+		trace->buf = NULL;
+		trace->invalid = 1;
+		return 0;
+	}
+
+	// count complete, valid records
+	for (off = HYDTRACE_MAGIC_LEN; off < len; ++n) {
+		size_t rec_len = strlen(trace->buf + off);
+
+		if (off + rec_len == len || rec_len < 2 ||
+		    (trace->buf[off] != 'd' && trace->buf[off] != 'f'))
+			break;
+		off += rec_len + 1;
+	}
+	if (n == 0)
+		return 0;
+
+	trace->entries = calloc(n, sizeof(*trace->entries));
+	if (trace->entries == NULL)
+		return ENOMEM;
+
+	for (size = 1; size < 2 * n; size <<= 1)
+		;
+	trace->index = calloc(size, sizeof(*trace->index));
+	if (trace->index == NULL)
+		return ENOMEM;
+	trace->index_mask = size - 1;
+
+	off = HYDTRACE_MAGIC_LEN;
+	for (i = 0; i < n; ++i) {
+		const char *entry = trace->buf + off;
+		uint32_t j = pathhash_fnv1a(entry + 1) & trace->index_mask;
+
+		trace->entries[i] = entry;
+		off += strlen(entry) + 1;
+
+		// keep the first occurrence of any path
+		while (trace->index[j] != 0) {
+			if (strcmp(trace->entries[trace->index[j] - 1] + 1,
+				   entry + 1) == 0)
+				break;
+			j = (j + 1) & trace->index_mask;
+		}
+		if (trace->index[j] == 0)
+			trace->index[j] = i + 1;
+	}
+	trace->num_entries = n;
+
+	return 0;
+}
+
+static int open_new_trace(struct hydtrace *trace)
+{
+	trace->tmp_path = malloc(strlen(trace->path) +
+				 sizeof(HYDTRACE_TMP_SUFFIX));
+	if (trace->tmp_path == NULL)
+		return ENOMEM;
+	sprintf(trace->tmp_path, "%s%s", trace->path, HYDTRACE_TMP_SUFFIX);
+
+	trace->file = fopen(trace->tmp_path, "we");
+	if (trace->file == NULL)
+		return errno;
+
+	if (fwrite(HYDTRACE_MAGIC, HYDTRACE_MAGIC_LEN, 1, trace->file) != 1) {
+		fclose(trace->file);
+		trace->file = NULL;
+		unlink(trace->tmp_path);
+		return EIO;
+	}
+
+	return 0;
+}
+
+static void free_trace(struct hydtrace *trace)
+{
+	free(trace->index);
+	free(trace->entries);
+	free(trace->buf);
+	free(trace->tmp_path);
+	free(trace->path);
+	free(trace);
+}
+
+/**
+ * Loads the trace file at trace_path, if it exists, and begins recording
+ * a new trace which will replace it.
+ *
+ * @return trace, or NULL with errno set
+ */
+struct hydtrace *hydtrace_create(const char *trace_path)
+{
+	struct hydtrace *trace;
+	int err;
+
+	trace = calloc(1, sizeof(*trace));
+	if (trace == NULL)
+		return NULL;
+
+	trace->path = strdup(trace_path);
+	if (trace->path == NULL) {
+		err = ENOMEM;
+		goto out_trace;
+	}
+
+	err = load_trace(trace);
+	if (err != 0)
+		goto out_trace;
+
+	err = open_new_trace(trace);
+	if (err != 0)
+		goto out_trace;
+
+	if (pthread_mutex_init(&trace->mutex, NULL) != 0) {
+		err = ENOMEM;
+		goto out_file;
+	}
+
+	return trace;
+
+out_file:
+	fclose(trace->file);
+	unlink(trace->tmp_path);
+out_trace:
+	free_trace(trace);
+	errno = err;
+	return NULL;
+}
+
+/**
+ * Appends a hydrated path to the new trace.  After a write error, no
+ * further paths are recorded and the old trace is retained.
+ *
+ * @return 0 or an errno
+ */
+int hydtrace_record(struct hydtrace *trace, int isdir, const char *path)
+{
+	int err = 0;
+
+	pthread_mutex_lock(&trace->mutex);
+	if (trace->file == NULL) {
+		err = EIO;
+		goto out;
+	}
+
+	if (fputc(isdir ? 'd' : 'f', trace->file) == EOF ||
+	    fwrite(path, strlen(path) + 1, 1, trace->file) != 1) {
+		fclose(trace->file);
+		trace->file = NULL;
+		unlink(trace->tmp_path);
+		err = EIO;
+	} else {
+		++trace->num_recorded;
+	}
+
+out:
+	pthread_mutex_unlock(&trace->mutex);
+	return err;
+}
+
+static void *replay_loop(void *data)
+{
+	struct hydtrace *trace = (struct hydtrace *)data;
+	const char *entry;
+	unsigned int i;
+
+	for (i = 0; i < trace->num_entries; ++i) {
+		pthread_mutex_lock(&trace->mutex);
+		if (trace->stopping) {
+			pthread_mutex_unlock(&trace->mutex);
+			break;
+		}
+		trace->cursor = i;
+		pthread_mutex_unlock(&trace->mutex);
+
+		entry = trace->entries[i];
+		trace->replay(trace->data, (entry[0] == 'd'), entry + 1);
+	}
+
+	return NULL;
+}
+
+int hydtrace_start_replay(struct hydtrace *trace, hydtrace_replay_t replay,
+			  void *data)
+{
+	int res;
+
+	if (trace->num_entries == 0)
+		return 0;
+
+	trace->replay = replay;
+	trace->data = data;
+	trace->stopping = 0;
+	res = pthread_create(&trace->thread_id, NULL, replay_loop, trace);
+	if (res == 0)
+		trace->running = 1;
+
+	return res;
+}
+
+/**
+ * @return 1 if the old trace file was not a valid trace and was ignored
+ */
+int hydtrace_was_invalid(struct hydtrace *trace)
+{
+	return trace->invalid;
+}
+
+int hydtrace_is_replay_stopping(struct hydtrace *trace)
+{
+	int stopping;
+
+	pthread_mutex_lock(&trace->mutex);
+	stopping = trace->stopping;
+	pthread_mutex_unlock(&trace->mutex);
+
+	return stopping;
+}
+
+void hydtrace_stop_replay(struct hydtrace *trace)
+{
+	if (!trace->running)
+		return;
+
+	pthread_mutex_lock(&trace->mutex);
+	trace->stopping = 1;
+	pthread_mutex_unlock(&trace->mutex);
+
+	pthread_join(trace->thread_id, NULL);
+	trace->running = 0;
+}
+
+static unsigned int lookup_entry(struct hydtrace *trace, const char *path)
+{
+	uint32_t j = pathhash_fnv1a(path) & trace->index_mask;
+
+	while (trace->index[j] != 0) {
+		if (strcmp(trace->entries[trace->index[j] - 1] + 1,
+			   path) == 0)
+			return trace->index[j];
+		j = (j + 1) & trace->index_mask;
+	}
+
+	return 0;
+}
+
+/**
+ * Notes a hydration which was not performed by the replay, and stops the
+ * replay if such hydrations have overtaken it too often.
+ */
+void hydtrace_note_foreground(struct hydtrace *trace, const char *path)
+{
+	unsigned int entry;
+
+	if (trace->num_entries == 0)
+		return;
+
+	entry = lookup_entry(trace, path);
+	if (entry == 0)
+		return;
+
+	pthread_mutex_lock(&trace->mutex);
+	if (entry - 1 > trace->cursor &&
+	    ++trace->overtaken >= HYDTRACE_MAX_OVERTAKEN)
+		trace->stopping = 1;
+	pthread_mutex_unlock(&trace->mutex);
+}
+
+/**
+ * Stops any replay, and replaces the old trace with the new one, unless
+ * nothing was recorded or an error occurred while recording it.
+ */
+void hydtrace_destroy(struct hydtrace *trace)
+{
+	hydtrace_stop_replay(trace);
+
+	if (trace->file != NULL) {
+		if (fclose(trace->file) == 0 && trace->num_recorded > 0)
+			rename(trace->tmp_path, trace->path);
+		else
+			unlink(trace->tmp_path);
+	}
+
+	pthread_mutex_destroy(&trace->mutex);
+	free_trace(trace);
+}
@@ -0,0 +1,46 @@
+/* Linux Projected Filesystem
+   Copyright (C) 2019 GitHub, Inc.
+
+   See the NOTICE file distributed with this library for additional
+   information regarding copyright ownership.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library, in the file COPYING; if not,
+   see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _HYDTRACE_H
+#define _HYDTRACE_H
+
+// foreground hydrations ahead of the replay before it is abandoned
+#define HYDTRACE_MAX_OVERTAKEN 8
+
+struct hydtrace;
+
+typedef void (*hydtrace_replay_t)(void *data, int isdir, const char *path);
+
+struct hydtrace *hydtrace_create(const char *trace_path);
+void hydtrace_destroy(struct hydtrace *trace);
+
+int hydtrace_was_invalid(struct hydtrace *trace);
+
+int hydtrace_record(struct hydtrace *trace, int isdir, const char *path);
+
+int hydtrace_start_replay(struct hydtrace *trace, hydtrace_replay_t replay,
+			  void *data);
+void hydtrace_stop_replay(struct hydtrace *trace);
+int hydtrace_is_replay_stopping(struct hydtrace *trace);
+
+void hydtrace_note_foreground(struct hydtrace *trace, const char *path);
+
+#endif /* _HYDTRACE_H */
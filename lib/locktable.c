@@ -0,0 +1,290 @@
+/* Linux Projected Filesystem
+   Copyright (C) 2019 GitHub, Inc.
+
+   See the NOTICE file distributed with this library for additional
+   information regarding copyright ownership.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library, in the file COPYING; if not,
+   see <http://www.gnu.org/licenses/>.
+*/
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "locktable.h"
+
+/*
+ * We implement a table of exclusive locks keyed by device and inode
+ * number, used to serialize changes to the projection state of each
+ * inode in the lower filesystem.
+ *
+ * The table is a fixed array of hash buckets, each with its own mutex
+ * and a chained list of lock entries.  An entry exists only while its
+ * lock is held or waited upon; it is allocated by the first locker and
+ * freed by the last unlocker.  Each entry carries its own condition
+ * variable so that a waiter is woken as soon as the lock is released,
+ * rather than polling, and so that releasing one inode's lock never
+ * wakes waiters for other inodes which happen to share a bucket.
+ *
+ * Waits are bounded by a timeout measured against the monotonic clock,
+ * after which EWOULDBLOCK is returned, matching the behaviour of the
+ * non-blocking flock(2) calls these locks replace.
+ *
+ * A lock holder may also publish the result of the work it performed
+ * while holding the lock, i.e., the projection state it reached or the
+ * error it encountered.  Each waiter states the minimum projection state
+ * it wants (or LOCKTABLE_NO_SHARE), and if a result published after the
+ * waiter began waiting is either an error or a sufficient state, the
+ * waiter returns that shared result without acquiring the lock at all.
+ * This gives us "single-flight" projection: when many callers wait on
+ * one in-flight hydration, only the first one sends a projection event,
+ * and the others all complete as soon as it does, with the same outcome.
+ */
+
+struct lock_entry {
+	dev_t dev;
+	ino_t ino;
+	int held;
+	unsigned int waiters;
+	unsigned int seq;		/* count of published results */
+	struct lock_result result;	/* last published result */
+	pthread_cond_t cond;
+	struct lock_entry *next;
+};
+
+struct lock_bucket {
+	pthread_mutex_t mutex;
+	struct lock_entry *head;
+};
+
+struct locktable {
+	struct lock_bucket buckets[LOCKTABLE_BUCKETS];
+	pthread_condattr_t condattr;
+};
+
+#define LOCKTABLE_BITS 8
+
+#if (1 << LOCKTABLE_BITS) != LOCKTABLE_BUCKETS
+#error "LOCKTABLE_BITS does not match LOCKTABLE_BUCKETS"
+#endif
+
+struct locktable *locktable_create(void)
+{
+	struct locktable *table;
+	unsigned int i;
+
+	table = calloc(1, sizeof(*table));
+	if (table == NULL)
+		return NULL;
+
+	if (pthread_condattr_init(&table->condattr) != 0)
+		goto out_table;
+	if (pthread_condattr_setclock(&table->condattr, CLOCK_MONOTONIC) != 0)
+		goto out_condattr;
+
+	for (i = 0; i < LOCKTABLE_BUCKETS; ++i) {
+		if (pthread_mutex_init(&table->buckets[i].mutex, NULL) != 0)
+			goto out_mutexes;
+	}
+
+	return table;
+
+out_mutexes:
+	while (i-- > 0)
+		pthread_mutex_destroy(&table->buckets[i].mutex);
+out_condattr:
+	pthread_condattr_destroy(&table->condattr);
+out_table:
+	free(table);
+	return NULL;
+}
+
+// 2^64 / golden ratio
+#define GOLDEN_RATIO_64 0x9E3779B97F4A7C15ULL
+
+static inline struct lock_bucket *get_bucket(struct locktable *table,
+					     dev_t dev, ino_t ino)
+{
+	uint64_t key = (uint64_t)ino ^ ((uint64_t)dev << 32);
+
+	return &table->buckets[(key * GOLDEN_RATIO_64) >>
+			       (64 - LOCKTABLE_BITS)];
+}
+
+static struct lock_entry *find_entry(struct lock_bucket *bucket,
+				     dev_t dev, ino_t ino)
+{
+	struct lock_entry *entry;
+
+	for (entry = bucket->head; entry != NULL; entry = entry->next) {
+		if (entry->ino == ino && entry->dev == dev)
+			break;
+	}
+
+	return entry;
+}
+
+static void remove_entry(struct lock_bucket *bucket, struct lock_entry *entry)
+{
+	struct lock_entry **entryp = &bucket->head;
+
+	while (*entryp != entry)
+		entryp = &(*entryp)->next;
+	*entryp = entry->next;
+
+	pthread_cond_destroy(&entry->cond);
+	free(entry);
+}
+
+static void get_deadline(struct timespec *ts, int wait_ms)
+{
+	clock_gettime(CLOCK_MONOTONIC, ts);
+
+	ts->tv_sec += wait_ms / 1000;
+	ts->tv_nsec += (long)(wait_ms % 1000) * 1000 * 1000;
+	if (ts->tv_nsec >= 1000 * 1000 * 1000) {
+		ts->tv_nsec -= 1000 * 1000 * 1000;
+		++ts->tv_sec;
+	}
+}
+
+static inline int can_share_result(const struct lock_entry *entry,
+				   unsigned int seq, int want)
+{
+	if (want == LOCKTABLE_NO_SHARE || entry->seq == seq)
+		return 0;
+
+	return (entry->result.err != 0 || entry->result.state >= want);
+}
+
+int locktable_lock(struct locktable *table, dev_t dev, ino_t ino,
+		   int want, int wait_ms, struct lock_result *shared)
+{
+	struct lock_bucket *bucket = get_bucket(table, dev, ino);
+	struct lock_entry *entry;
+	struct timespec deadline;
+	unsigned int seq;
+	int res = 0;
+
+	get_deadline(&deadline, wait_ms);
+
+	pthread_mutex_lock(&bucket->mutex);
+
+	entry = find_entry(bucket, dev, ino);
+	if (entry == NULL) {
+		entry = calloc(1, sizeof(*entry));
+		if (entry == NULL) {
+			res = ENOMEM;
+			goto out;
+		}
+		if (pthread_cond_init(&entry->cond, &table->condattr) != 0) {
+			free(entry);
+			res = ENOMEM;
+			goto out;
+		}
+		entry->dev = dev;
+		entry->ino = ino;
+		entry->held = 1;
+		entry->next = bucket->head;
+		bucket->head = entry;
+		goto out;
+	}
+
+	++entry->waiters;
+	seq = entry->seq;
+	while (1) {
+		if (can_share_result(entry, seq, want)) {
+			*shared = entry->result;
+			res = LOCKTABLE_SHARED;
+			break;
+		}
+
+		// the lock may have been released just as our wait timed out
+		if (!entry->held) {
+			entry->held = 1;
+			res = 0;
+			break;
+		}
+
+		if (res != 0) {
+			res = EWOULDBLOCK;
+			break;
+		}
+
+		res = pthread_cond_timedwait(&entry->cond, &bucket->mutex,
+					     &deadline);
+	}
+	--entry->waiters;
+
+	// we may have been the last waiter on an unheld lock
+	if (res == LOCKTABLE_SHARED && !entry->held && entry->waiters == 0)
+		remove_entry(bucket, entry);
+
+out:
+	pthread_mutex_unlock(&bucket->mutex);
+	return res;
+}
+
+void locktable_unlock(struct locktable *table, dev_t dev, ino_t ino,
+		      const struct lock_result *result)
+{
+	struct lock_bucket *bucket = get_bucket(table, dev, ino);
+	struct lock_entry *entry;
+
+	pthread_mutex_lock(&bucket->mutex);
+
+	entry = find_entry(bucket, dev, ino);
+	if (entry == NULL)
+		goto out;
+
+	entry->held = 0;
+	if (entry->waiters == 0) {
+		remove_entry(bucket, entry);
+	} else if (result != NULL) {
+		// all waiters must check if they can share the new result
+		entry->result = *result;
+		++entry->seq;
+		pthread_cond_broadcast(&entry->cond);
+	} else {
+		pthread_cond_signal(&entry->cond);
+	}
+
+out:
+	pthread_mutex_unlock(&bucket->mutex);
+}
+
+void locktable_destroy(struct locktable *table)
+{
+	unsigned int i;
+
+	for (i = 0; i < LOCKTABLE_BUCKETS; ++i) {
+		struct lock_entry *entry = table->buckets[i].head;
+
+		while (entry != NULL) {
+			struct lock_entry *next = entry->next;
+
+			pthread_cond_destroy(&entry->cond);
+			free(entry);
+			entry = next;
+		}
+		pthread_mutex_destroy(&table->buckets[i].mutex);
+	}
+	pthread_condattr_destroy(&table->condattr);
+	free(table);
+}
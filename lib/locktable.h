@@ -0,0 +1,47 @@
+/* Linux Projected Filesystem
+   Copyright (C) 2019 GitHub, Inc.
+
+   See the NOTICE file distributed with this library for additional
+   information regarding copyright ownership.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library, in the file COPYING; if not,
+   see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _LOCKTABLE_H
+#define _LOCKTABLE_H
+
+#include <sys/types.h>
+
+#define LOCKTABLE_BUCKETS 256
+
+#define LOCKTABLE_SHARED -1
+#define LOCKTABLE_NO_SHARE -1
+
+struct locktable;
+
+struct lock_result {
+	int state;
+	int err;
+};
+
+struct locktable *locktable_create(void);
+void locktable_destroy(struct locktable *table);
+
+int locktable_lock(struct locktable *table, dev_t dev, ino_t ino,
+		   int want, int wait_ms, struct lock_result *shared);
+void locktable_unlock(struct locktable *table, dev_t dev, ino_t ino,
+		      const struct lock_result *result);
+
+#endif /* _LOCKTABLE_H */
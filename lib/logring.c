@@ -0,0 +1,741 @@
+/* Linux Projected Filesystem
+   Copyright (C) 2019 GitHub, Inc.
+
+   See the NOTICE file distributed with this library for additional
+   information regarding copyright ownership.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library, in the file COPYING; if not,
+   see <http://www.gnu.org/licenses/>.
+*/
+
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "logring.h"
+
+/*
+ * Log messages are written by FUSE worker threads in the middle of
+ * their requests, so rather than format each message and write it to
+ * the log file under the stdio lock of the FILE, each thread stores a
+ * binary record of its message in its own ring, and a background thread
+ * formats the records and writes them to the file.
+ *
+ * A record holds the format string pointer and the arguments of the
+ * message; as callers pass string literals as formats, the pointer
+ * remains valid until the record is written, and serves as the format
+ * identifier.  Numeric arguments are stored by value according to their
+ * conversion specifications, and string arguments are copied into the
+ * text area of the record, since they may not outlive the call; strings
+ * which do not fit are truncated.  A message whose format has more than
+ * LOGRING_MAX_ARGS arguments, or conversions we do not store (such as
+ * '*' widths or positional arguments), is instead formatted immediately
+ * into the text area, which costs more but is never wrong.
+ *
+ * Each ring has a single producer, its thread, and a single consumer,
+ * the writer, so records are published by storing the head index with
+ * release semantics and consumed by storing the tail index likewise,
+ * and no lock is taken when logging, except when a thread logs its first
+ * message.  When a ring is full the message is dropped rather than
+ * blocking the thread, and the writer reports the number of dropped
+ * messages in the log.
+ *
+ * The writer wakes every LOGRING_FLUSH_MSEC milliseconds, and writes the
+ * pending records of all the rings in the order of their timestamps,
+ * then flushes the file.  As with our statistics, the ring of a thread
+ * which exits is marked unused and given to the next new thread, so the
+ * rings are only freed when the logger is destroyed, and any records a
+ * thread leaves behind are still written.
+ */
+
+#define MAX_SPEC_LEN 32
+
+enum log_arg_type {
+	LOG_ARG_NONE,			/* "%%" */
+	LOG_ARG_INT,
+	LOG_ARG_UINT,
+	LOG_ARG_CHAR,
+	LOG_ARG_DOUBLE,
+	LOG_ARG_PTR,
+	LOG_ARG_STR			/* offset into record text */
+};
+
+enum log_arg_length {
+	LOG_LEN_NONE,
+	LOG_LEN_HH,
+	LOG_LEN_H,
+	LOG_LEN_L,
+	LOG_LEN_LL,
+	LOG_LEN_Z,
+	LOG_LEN_J,
+	LOG_LEN_T
+};
+
+struct log_spec {
+	size_t len;
+	enum log_arg_type type;
+	enum log_arg_length length;
+};
+
+struct log_arg {
+	union {
+		intmax_t i;
+		uintmax_t u;
+		double d;
+		const void *p;
+		size_t str;
+	} v;
+};
+
+struct log_record {
+	uint64_t time;
+	const char *fmt;		/* NULL if text is preformatted */
+	struct log_arg args[LOGRING_MAX_ARGS];
+	char text[LOGRING_TEXT_SIZE];
+};
+
+struct log_thread {
+	struct log_thread *next;
+	int in_use;
+	unsigned int head;		/* written by thread */
+	unsigned int tail;		/* written by writer */
+	uint64_t dropped;		/* written by thread */
+	struct log_record records[];
+};
+
+struct logring {
+	FILE *file;
+	unsigned int num_records;
+	pthread_key_t key;
+	struct log_thread *threads;
+	uint64_t reported;		/* drops already logged */
+
+	pthread_t thread_id;
+	int running;
+	int stopping;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	pthread_condattr_t condattr;
+};
+
+static void release_thread(void *data)
+{
+	struct log_thread *thread = (struct log_thread *)data;
+
+	__atomic_store_n(&thread->in_use, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * Creates a logger which writes to a file once started.
+ *
+ * @param file log file, which remains owned by the caller
+ * @param num_records size of each thread's ring, rounded up to a
+ *                    power of two
+ */
+struct logring *logring_create(FILE *file, unsigned int num_records)
+{
+	struct logring *ring;
+
+	if (num_records == 0 || num_records > (1U << 20))
+		return NULL;
+
+	ring = calloc(1, sizeof(*ring));
+	if (ring == NULL)
+		return NULL;
+
+	if (pthread_key_create(&ring->key, release_thread) != 0)
+		goto out_ring;
+
+	if (pthread_mutex_init(&ring->mutex, NULL) != 0)
+		goto out_key;
+	if (pthread_condattr_init(&ring->condattr) != 0)
+		goto out_mutex;
+	if (pthread_condattr_setclock(&ring->condattr, CLOCK_MONOTONIC) != 0)
+		goto out_condattr;
+	if (pthread_cond_init(&ring->cond, &ring->condattr) != 0)
+		goto out_condattr;
+
+	ring->file = file;
+	ring->num_records = 1;
+	while (ring->num_records < num_records)
+		ring->num_records <<= 1;
+
+	return ring;
+
+out_condattr:
+	pthread_condattr_destroy(&ring->condattr);
+out_mutex:
+	pthread_mutex_destroy(&ring->mutex);
+out_key:
+	pthread_key_delete(ring->key);
+out_ring:
+	free(ring);
+	return NULL;
+}
+
+static uint64_t get_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000 * 1000 * 1000 + ts.tv_nsec;
+}
+
+static struct log_thread *get_thread(struct logring *ring)
+{
+	struct log_thread *thread;
+
+	thread = (struct log_thread *)pthread_getspecific(ring->key);
+	if (thread != NULL)
+		return thread;
+
+	pthread_mutex_lock(&ring->mutex);
+
+	for (thread = ring->threads; thread != NULL; thread = thread->next) {
+		if (!__atomic_load_n(&thread->in_use, __ATOMIC_ACQUIRE))
+			break;
+	}
+
+	if (thread == NULL) {
+		thread = calloc(1, sizeof(*thread) + ring->num_records *
+						     sizeof(*thread->records));
+		if (thread == NULL)
+			goto out;
+		thread->next = ring->threads;
+		__atomic_store_n(&ring->threads, thread, __ATOMIC_RELEASE);
+	}
+
+	if (pthread_setspecific(ring->key, thread) != 0) {
+		thread = NULL;
+		goto out;
+	}
+	__atomic_store_n(&thread->in_use, 1, __ATOMIC_RELAXED);
+
+out:
+	pthread_mutex_unlock(&ring->mutex);
+	return thread;
+}
+
+/**
+ * Parses a conversion specification, which begins with '%'.
+ *
+ * @return 0 if its argument can be stored in a record; -1 otherwise
+ */
+static int parse_spec(const char *fmt, struct log_spec *spec)
+{
+	const char *p = fmt + 1;
+
+	p += strspn(p, "#0- +'");
+	p += strspn(p, "0123456789");
+	if (*p == '.') {
+		++p;
+		p += strspn(p, "0123456789");
+	}
+
+	spec->length = LOG_LEN_NONE;
+	if (p[0] == 'h' && p[1] == 'h') {
+		spec->length = LOG_LEN_HH;
+		p += 2;
+	} else if (p[0] == 'l' && p[1] == 'l') {
+		spec->length = LOG_LEN_LL;
+		p += 2;
+	} else if (*p == 'h' || *p == 'l' || *p == 'z' || *p == 'j' ||
+		   *p == 't') {
+		spec->length = (*p == 'h') ? LOG_LEN_H :
+			       (*p == 'l') ? LOG_LEN_L :
+			       (*p == 'z') ? LOG_LEN_Z :
+			       (*p == 'j') ? LOG_LEN_J : LOG_LEN_T;
+		++p;
+	}
+
+	switch (*p) {
+	case 'd':
+	case 'i':
+		spec->type = LOG_ARG_INT;
+		break;
+	case 'o':
+	case 'u':
+	case 'x':
+	case 'X':
+		spec->type = LOG_ARG_UINT;
+		break;
+	case 'c':
+		spec->type = LOG_ARG_CHAR;
+		break;
+	case 'e':
+	case 'E':
+	case 'f':
+	case 'F':
+	case 'g':
+	case 'G':
+	case 'a':
+	case 'A':
+		// "%lf" is the same as "%f"
+		if (spec->length == LOG_LEN_L)
+			spec->length = LOG_LEN_NONE;
+		spec->type = LOG_ARG_DOUBLE;
+		break;
+	case 'p':
+		spec->type = LOG_ARG_PTR;
+		break;
+	case 's':
+		spec->type = LOG_ARG_STR;
+		break;
+	case '%':
+		if (p != fmt + 1)
+			return -1;
+		spec->type = LOG_ARG_NONE;
+		break;
+	default:
+		return -1;
+	}
+
+	if (spec->type != LOG_ARG_INT && spec->type != LOG_ARG_UINT &&
+	    spec->length != LOG_LEN_NONE)
+		return -1;
+
+	spec->len = p + 1 - fmt;
+	if (spec->len >= MAX_SPEC_LEN)
+		return -1;
+
+	return 0;
+}
+
+static void store_int(const struct log_spec *spec, struct log_arg *arg,
+		      va_list *ap)
+{
+	switch (spec->length) {
+	case LOG_LEN_L:
+		arg->v.i = va_arg(*ap, long);
+		break;
+	case LOG_LEN_LL:
+		arg->v.i = va_arg(*ap, long long);
+		break;
+	case LOG_LEN_Z:
+		arg->v.i = va_arg(*ap, ssize_t);
+		break;
+	case LOG_LEN_J:
+		arg->v.i = va_arg(*ap, intmax_t);
+		break;
+	case LOG_LEN_T:
+		arg->v.i = va_arg(*ap, ptrdiff_t);
+		break;
+	default:
+	case LOG_LEN_NONE:
+	case LOG_LEN_HH:
+	case LOG_LEN_H:
+		// char and short arguments are promoted to int
+		arg->v.i = va_arg(*ap, int);
+		break;
+	}
+}
+
+static void store_uint(const struct log_spec *spec, struct log_arg *arg,
+		       va_list *ap)
+{
+	switch (spec->length) {
+	case LOG_LEN_L:
+		arg->v.u = va_arg(*ap, unsigned long);
+		break;
+	case LOG_LEN_LL:
+		arg->v.u = va_arg(*ap, unsigned long long);
+		break;
+	case LOG_LEN_Z:
+		arg->v.u = va_arg(*ap, size_t);
+		break;
+	case LOG_LEN_J:
+		arg->v.u = va_arg(*ap, uintmax_t);
+		break;
+	case LOG_LEN_T:
+		arg->v.u = (uintmax_t)va_arg(*ap, ptrdiff_t);
+		break;
+	default:
+	case LOG_LEN_NONE:
+	case LOG_LEN_HH:
+	case LOG_LEN_H:
+		arg->v.u = va_arg(*ap, unsigned int);
+		break;
+	}
+}
+
+// copies a string argument into the record text, truncating if necessary
+static void store_str(struct log_record *rec, size_t *used,
+		      struct log_arg *arg, const char *s)
+{
+	size_t len;
+
+	if (s == NULL)
+		s = "(null)";
+
+	// share the terminator of the previous string once the text is full
+	if (*used == LOGRING_TEXT_SIZE) {
+		arg->v.str = *used - 1;
+		return;
+	}
+
+	len = strnlen(s, LOGRING_TEXT_SIZE - 1 - *used);
+	memcpy(rec->text + *used, s, len);
+	rec->text[*used + len] = '\0';
+	arg->v.str = *used;
+	*used += len + 1;
+}
+
+/**
+ * Stores the arguments of a message in a record.
+ *
+ * @return 0 on success; -1 if the message must be preformatted
+ */
+static int store_args(struct log_record *rec, const char *fmt, va_list *ap)
+{
+	struct log_spec spec;
+	struct log_arg *arg;
+	unsigned int n = 0;
+	size_t used = 0;
+
+	while ((fmt = strchr(fmt, '%')) != NULL) {
+		if (parse_spec(fmt, &spec) != 0)
+			return -1;
+		fmt += spec.len;
+		if (spec.type == LOG_ARG_NONE)
+			continue;
+
+		if (n == LOGRING_MAX_ARGS)
+			return -1;
+		arg = &rec->args[n++];
+
+		switch (spec.type) {
+		case LOG_ARG_INT:
+			store_int(&spec, arg, ap);
+			break;
+		case LOG_ARG_UINT:
+			store_uint(&spec, arg, ap);
+			break;
+		case LOG_ARG_CHAR:
+			arg->v.i = va_arg(*ap, int);
+			break;
+		case LOG_ARG_DOUBLE:
+			arg->v.d = va_arg(*ap, double);
+			break;
+		case LOG_ARG_PTR:
+			arg->v.p = va_arg(*ap, void *);
+			break;
+		case LOG_ARG_STR:
+			store_str(rec, &used, arg, va_arg(*ap, const char *));
+			break;
+		default:
+		case LOG_ARG_NONE:
+			break;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Logs a message without blocking; the message is written to the log
+ * file asynchronously, once the logger has been started.
+ *
+ * @param fmt printf-style format, which must remain valid until the
+ *            logger is stopped (normally a string literal)
+ * @return 0 on success; ENOBUFS if the thread's ring is full and the
+ *         message was dropped, or ENOMEM
+ */
+int logring_vwrite(struct logring *ring, const char *fmt, va_list ap)
+{
+	struct log_thread *thread = get_thread(ring);
+	struct log_record *rec;
+	unsigned int head;
+	va_list args;
+	int res;
+
+	if (thread == NULL)
+		return ENOMEM;
+
+	head = thread->head;
+	if (head - __atomic_load_n(&thread->tail, __ATOMIC_ACQUIRE) ==
+	    ring->num_records) {
+		__atomic_store_n(&thread->dropped, thread->dropped + 1,
+				 __ATOMIC_RELAXED);
+		return ENOBUFS;
+	}
+
+	rec = &thread->records[head & (ring->num_records - 1)];
+	rec->time = get_time();
+	rec->fmt = fmt;
+
+	va_copy(args, ap);
+	res = store_args(rec, fmt, &args);
+	va_end(args);
+	if (res != 0) {
+		rec->fmt = NULL;
+		vsnprintf(rec->text, sizeof(rec->text), fmt, ap);
+	}
+
+	__atomic_store_n(&thread->head, head + 1, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wformat-nonliteral"
+
+static void write_arg(FILE *file, const char *spec_str,
+		      const struct log_spec *spec, const struct log_arg *arg,
+		      const struct log_record *rec)
+{
+	switch (spec->type) {
+	case LOG_ARG_INT:
+		switch (spec->length) {
+		case LOG_LEN_L:
+			fprintf(file, spec_str, (long)arg->v.i);
+			break;
+		case LOG_LEN_LL:
+			fprintf(file, spec_str, (long long)arg->v.i);
+			break;
+		case LOG_LEN_Z:
+			fprintf(file, spec_str, (ssize_t)arg->v.i);
+			break;
+		case LOG_LEN_J:
+			fprintf(file, spec_str, arg->v.i);
+			break;
+		case LOG_LEN_T:
+			fprintf(file, spec_str, (ptrdiff_t)arg->v.i);
+			break;
+		default:
+		case LOG_LEN_NONE:
+		case LOG_LEN_HH:
+		case LOG_LEN_H:
+			fprintf(file, spec_str, (int)arg->v.i);
+			break;
+		}
+		break;
+	case LOG_ARG_UINT:
+		switch (spec->length) {
+		case LOG_LEN_L:
+			fprintf(file, spec_str, (unsigned long)arg->v.u);
+			break;
+		case LOG_LEN_LL:
+			fprintf(file, spec_str, (unsigned long long)arg->v.u);
+			break;
+		case LOG_LEN_Z:
+			fprintf(file, spec_str, (size_t)arg->v.u);
+			break;
+		case LOG_LEN_J:
+			fprintf(file, spec_str, arg->v.u);
+			break;
+		case LOG_LEN_T:
+			fprintf(file, spec_str, (ptrdiff_t)arg->v.u);
+			break;
+		default:
+		case LOG_LEN_NONE:
+		case LOG_LEN_HH:
+		case LOG_LEN_H:
+			fprintf(file, spec_str, (unsigned int)arg->v.u);
+			break;
+		}
+		break;
+	case LOG_ARG_CHAR:
+		fprintf(file, spec_str, (int)arg->v.i);
+		break;
+	case LOG_ARG_DOUBLE:
+		fprintf(file, spec_str, arg->v.d);
+		break;
+	case LOG_ARG_PTR:
+		fprintf(file, spec_str, arg->v.p);
+		break;
+	case LOG_ARG_STR:
+		fprintf(file, spec_str, rec->text + arg->v.str);
+		break;
+	default:
+	case LOG_ARG_NONE:
+		break;
+	}
+}
+
+#pragma GCC diagnostic pop
+
+static void write_record(FILE *file, const struct log_record *rec)
+{
+	const char *fmt = rec->fmt;
+	char spec_str[MAX_SPEC_LEN];
+	struct log_spec spec;
+	const char *next;
+	unsigned int n = 0;
+
+	if (fmt == NULL) {
+		fputs(rec->text, file);
+		goto out;
+	}
+
+	// each specification was parsed successfully when the record was stored
+	while ((next = strchr(fmt, '%')) != NULL) {
+		fwrite(fmt, 1, next - fmt, file);
+		parse_spec(next, &spec);
+		fmt = next + spec.len;
+
+		if (spec.type == LOG_ARG_NONE) {
+			fputc('%', file);
+			continue;
+		}
+		memcpy(spec_str, next, spec.len);
+		spec_str[spec.len] = '\0';
+		write_arg(file, spec_str, &spec, &rec->args[n++], rec);
+	}
+	fputs(fmt, file);
+
+out:
+	fputc('\n', file);
+}
+
+/**
+ * Writes the pending records of all threads in timestamp order, then any
+ * count of dropped messages, and flushes the file.
+ */
+static void write_records(struct logring *ring)
+{
+	struct log_thread *first, *thread, *next_thread;
+	const struct log_record *rec, *next_rec;
+	unsigned int mask = ring->num_records - 1;
+	uint64_t dropped = 0;
+
+	first = __atomic_load_n(&ring->threads, __ATOMIC_ACQUIRE);
+
+	for (;;) {
+		next_thread = NULL;
+		next_rec = NULL;
+		for (thread = first; thread != NULL; thread = thread->next) {
+			if (thread->tail == __atomic_load_n(&thread->head,
+							    __ATOMIC_ACQUIRE))
+				continue;
+			rec = &thread->records[thread->tail & mask];
+			if (next_rec == NULL || rec->time < next_rec->time) {
+				next_thread = thread;
+				next_rec = rec;
+			}
+		}
+		if (next_thread == NULL)
+			break;
+
+		write_record(ring->file, next_rec);
+		__atomic_store_n(&next_thread->tail, next_thread->tail + 1,
+				 __ATOMIC_RELEASE);
+	}
+
+	for (thread = first; thread != NULL; thread = thread->next)
+		dropped += __atomic_load_n(&thread->dropped, __ATOMIC_RELAXED);
+	if (dropped > ring->reported) {
+		fprintf(ring->file, "%" PRIu64 " log messages dropped\n",
+			dropped - ring->reported);
+		ring->reported = dropped;
+	}
+
+	fflush(ring->file);
+}
+
+static void get_deadline(struct timespec *ts, int wait_ms)
+{
+	clock_gettime(CLOCK_MONOTONIC, ts);
+
+	ts->tv_sec += wait_ms / 1000;
+	ts->tv_nsec += (long)(wait_ms % 1000) * 1000 * 1000;
+	if (ts->tv_nsec >= 1000 * 1000 * 1000) {
+		ts->tv_nsec -= 1000 * 1000 * 1000;
+		++ts->tv_sec;
+	}
+}
+
+static void *write_loop(void *data)
+{
+	struct logring *ring = (struct logring *)data;
+	struct timespec deadline;
+
+	pthread_mutex_lock(&ring->mutex);
+	while (!ring->stopping) {
+		pthread_mutex_unlock(&ring->mutex);
+		write_records(ring);
+		pthread_mutex_lock(&ring->mutex);
+
+		get_deadline(&deadline, LOGRING_FLUSH_MSEC);
+		while (!ring->stopping &&
+		       pthread_cond_timedwait(&ring->cond, &ring->mutex,
+					      &deadline) != ETIMEDOUT)
+			;
+	}
+	pthread_mutex_unlock(&ring->mutex);
+
+	// write whatever was logged before we were stopped
+	write_records(ring);
+
+	return NULL;
+}
+
+int logring_start(struct logring *ring)
+{
+	int res;
+
+	ring->stopping = 0;
+	res = pthread_create(&ring->thread_id, NULL, write_loop, ring);
+	if (res == 0)
+		ring->running = 1;
+
+	return res;
+}
+
+/**
+ * Stops the writer thread, once all pending records have been written;
+ * records may still be logged afterwards, and are written when the
+ * logger is next started or destroyed.
+ */
+void logring_stop(struct logring *ring)
+{
+	pthread_mutex_lock(&ring->mutex);
+	ring->stopping = 1;
+	pthread_cond_broadcast(&ring->cond);
+	pthread_mutex_unlock(&ring->mutex);
+
+	if (ring->running) {
+		pthread_join(ring->thread_id, NULL);
+		ring->running = 0;
+	}
+}
+
+void logring_destroy(struct logring *ring)
+{
+	struct log_thread *thread;
+
+	logring_stop(ring);
+	write_records(ring);
+
+	pthread_key_delete(ring->key);
+
+	while ((thread = ring->threads) != NULL) {
+		ring->threads = thread->next;
+		free(thread);
+	}
+
+	pthread_cond_destroy(&ring->cond);
+	pthread_condattr_destroy(&ring->condattr);
+	pthread_mutex_destroy(&ring->mutex);
+	free(ring);
+}
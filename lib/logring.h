@@ -0,0 +1,44 @@
+/* Linux Projected Filesystem
+   Copyright (C) 2019 GitHub, Inc.
+
+   See the NOTICE file distributed with this library for additional
+   information regarding copyright ownership.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library, in the file COPYING; if not,
+   see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _LOGRING_H
+#define _LOGRING_H
+
+#include <stdarg.h>
+#include <stdio.h>
+
+#define LOGRING_DEFAULT_RECORDS 128	/* per thread; a power of two */
+#define LOGRING_FLUSH_MSEC 100
+
+#define LOGRING_MAX_ARGS 12
+#define LOGRING_TEXT_SIZE 896
+
+struct logring;
+
+struct logring *logring_create(FILE *file, unsigned int num_records);
+void logring_destroy(struct logring *ring);
+
+int logring_start(struct logring *ring);
+void logring_stop(struct logring *ring);
+
+int logring_vwrite(struct logring *ring, const char *fmt, va_list ap);
+
+#endif /* _LOGRING_H */
@@ -0,0 +1,437 @@
+/* Linux Projected Filesystem
+   Copyright (C) 2019 GitHub, Inc.
+
+   See the NOTICE file distributed with this library for additional
+   information regarding copyright ownership.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library, in the file COPYING; if not,
+   see <http://www.gnu.org/licenses/>.
+*/
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "notifyqueue.h"
+
+/*
+ * We implement a bounded queue of notification events, to which any
+ * number of FUSE worker threads may add events, and from which a single
+ * dispatcher thread removes them and delivers each one in turn, so that
+ * file operations need not wait while the provider handles their events.
+ *
+ * The queue is a ring buffer protected by a mutex, with condition variables
+ * to wake the dispatcher when events are added and to wake any producers
+ * blocked on a full queue when events are removed.  Each event's paths are
+ * copied when it is queued, since the originals belong to libfuse and are
+ * only valid for the duration of the file operation.
+ *
+ * When the queue is full, the outcome depends on its overflow policy:
+ *
+ * - NOTIFYQUEUE_BLOCK: the producer waits until space is available.
+ * - NOTIFYQUEUE_DROP: the new event is discarded and counted as dropped.
+ * - NOTIFYQUEUE_COALESCE: if the newest queued event for the same path
+ *   or paths is identical (same mask and paths), the new event is merged
+ *   into it and counted as coalesced; otherwise the producer waits as with
+ *   NOTIFYQUEUE_BLOCK, so no event is ever lost or reordered.  The process
+ *   ID of the earlier event is retained.
+ *
+ * The dispatcher may also deliver events in batches, of up to a maximum
+ * number of events.  Once the first event of a batch arrives, it waits for
+ * up to a fixed time window for more to accumulate, but delivers the batch
+ * as soon as the maximum is reached.  Within each batch, an event which
+ * exactly duplicates the preceding event for the same path or paths (e.g.,
+ * a file which is repeatedly written and closed) is coalesced into that
+ * earlier event and counted as coalesced.  Since only consecutive events
+ * for a path are merged, the provider never sees the events for a single
+ * path out of order.  By default, the maximum batch size is one, so each
+ * event is delivered as soon as it is dequeued.
+ *
+ * When the queue is stopped, the dispatcher delivers all remaining events
+ * before it exits, without waiting for batches to fill.
+ */
+
+struct notifyqueue {
+	struct notify_entry *ring;
+	unsigned int size;
+	unsigned int head;		/* index of oldest event */
+	unsigned int count;
+	enum notifyqueue_policy policy;
+	notifyqueue_deliver_t deliver;
+	void *data;
+	struct notify_entry *batch;	/* events being delivered */
+	unsigned int batch_size;
+	unsigned int batch_msec;
+	pthread_mutex_t mutex;
+	pthread_cond_t not_empty;
+	pthread_cond_t not_full;
+	pthread_t thread_id;
+	int running;
+	int stopping;
+	struct notifyqueue_stats stats;
+};
+
+struct notifyqueue *notifyqueue_create(unsigned int size,
+				       enum notifyqueue_policy policy,
+				       notifyqueue_deliver_t deliver,
+				       void *data)
+{
+	struct notifyqueue *queue;
+	pthread_condattr_t attr;
+
+	if (size == 0) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	queue = calloc(1, sizeof(*queue));
+	if (queue == NULL)
+		return NULL;
+
+	queue->ring = calloc(size, sizeof(*queue->ring));
+	if (queue->ring == NULL)
+		goto out_queue;
+
+	if (pthread_mutex_init(&queue->mutex, NULL) != 0)
+		goto out_ring;
+
+	// batch windows are timed against the monotonic clock
+	if (pthread_condattr_init(&attr) != 0)
+		goto out_mutex;
+	if (pthread_condattr_setclock(&attr, CLOCK_MONOTONIC) != 0 ||
+	    pthread_cond_init(&queue->not_empty, &attr) != 0) {
+		pthread_condattr_destroy(&attr);
+		goto out_mutex;
+	}
+	pthread_condattr_destroy(&attr);
+
+	if (pthread_cond_init(&queue->not_full, NULL) != 0)
+		goto out_not_empty;
+
+	queue->size = size;
+	queue->batch_size = 1;
+	queue->policy = policy;
+	queue->deliver = deliver;
+	queue->data = data;
+
+	return queue;
+
+out_not_empty:
+	pthread_cond_destroy(&queue->not_empty);
+out_mutex:
+	pthread_mutex_destroy(&queue->mutex);
+out_ring:
+	free(queue->ring);
+out_queue:
+	free(queue);
+	return NULL;
+}
+
+/**
+ * Sets the maximum number of events delivered together, and the time
+ * window for which the dispatcher waits for a batch to fill; the batch
+ * size is limited to that of the queue.  Must be called before the queue
+ * is started.
+ *
+ * @return 0 or an errno
+ */
+int notifyqueue_set_batch(struct notifyqueue *queue, unsigned int max_size,
+			  unsigned int window_msec)
+{
+	if (max_size == 0)
+		return EINVAL;
+	if (queue->running)
+		return EBUSY;
+
+	queue->batch_size = (max_size < queue->size) ? max_size : queue->size;
+	queue->batch_msec = window_msec;
+
+	return 0;
+}
+
+static void free_entry(struct notify_entry *entry)
+{
+	free(entry->path);
+	free(entry->target_path);
+}
+
+static inline int strings_equal(const char *s1, const char *s2)
+{
+	if (s1 == NULL || s2 == NULL)
+		return (s1 == s2);
+	return (strcmp(s1, s2) == 0);
+}
+
+static inline int entries_equal(const struct notify_entry *entry1,
+				const struct notify_entry *entry2)
+{
+	return (entry1->mask == entry2->mask &&
+		strings_equal(entry1->path, entry2->path) &&
+		strings_equal(entry1->target_path, entry2->target_path));
+}
+
+static inline int path_in_entry(const char *path,
+				const struct notify_entry *entry)
+{
+	return (path != NULL &&
+		(strings_equal(path, entry->path) ||
+		 strings_equal(path, entry->target_path)));
+}
+
+/**
+ * Removes from a batch each event which duplicates the preceding event
+ * for the same paths, preserving the order of the remaining events.
+ *
+ * @return number of events remaining
+ */
+static unsigned int coalesce_batch(struct notify_entry *batch, unsigned int n)
+{
+	unsigned int i, j, k = 0;
+
+	for (i = 0; i < n; ++i) {
+		struct notify_entry *entry = &batch[i];
+		int dup = 0;
+
+		j = k;
+		while (j-- > 0) {
+			if (path_in_entry(entry->path, &batch[j]) ||
+			    path_in_entry(entry->target_path, &batch[j])) {
+				dup = entries_equal(entry, &batch[j]);
+				break;
+			}
+		}
+
+		if (dup)
+			free_entry(entry);
+		else
+			batch[k++] = *entry;
+	}
+
+	return k;
+}
+
+static void get_deadline(struct timespec *ts, unsigned int msec)
+{
+	clock_gettime(CLOCK_MONOTONIC, ts);
+	ts->tv_sec += msec / 1000;
+	ts->tv_nsec += (msec % 1000) * 1000 * 1000;
+	if (ts->tv_nsec >= 1000 * 1000 * 1000) {
+		++ts->tv_sec;
+		ts->tv_nsec -= 1000 * 1000 * 1000;
+	}
+}
+
+static void *dispatch_loop(void *data)
+{
+	struct notifyqueue *queue = (struct notifyqueue *)data;
+	struct timespec deadline;
+	unsigned int i, k, n;
+
+	pthread_mutex_lock(&queue->mutex);
+	while (1) {
+		while (queue->count == 0 && !queue->stopping)
+			pthread_cond_wait(&queue->not_empty, &queue->mutex);
+		if (queue->count == 0)
+			break;
+
+		if (queue->batch_size > 1 && queue->batch_msec > 0) {
+			get_deadline(&deadline, queue->batch_msec);
+			while (queue->count < queue->batch_size &&
+			       !queue->stopping) {
+				if (pthread_cond_timedwait(&queue->not_empty,
+							   &queue->mutex,
+							   &deadline)
+				    == ETIMEDOUT)
+					break;
+			}
+		}
+
+		n = 0;
+		while (queue->count > 0 && n < queue->batch_size) {
+			queue->batch[n++] = queue->ring[queue->head];
+			queue->head = (queue->head + 1) % queue->size;
+			--queue->count;
+		}
+		pthread_cond_broadcast(&queue->not_full);
+		pthread_mutex_unlock(&queue->mutex);
+
+		k = coalesce_batch(queue->batch, n);
+		queue->deliver(queue->data, queue->batch, k);
+		for (i = 0; i < k; ++i)
+			free_entry(&queue->batch[i]);
+
+		pthread_mutex_lock(&queue->mutex);
+		queue->stats.coalesced += n - k;
+		++queue->stats.batches;
+	}
+	pthread_mutex_unlock(&queue->mutex);
+
+	return NULL;
+}
+
+int notifyqueue_start(struct notifyqueue *queue)
+{
+	int res;
+
+	queue->batch = calloc(queue->batch_size, sizeof(*queue->batch));
+	if (queue->batch == NULL)
+		return ENOMEM;
+
+	queue->stopping = 0;
+	res = pthread_create(&queue->thread_id, NULL, dispatch_loop, queue);
+	if (res == 0) {
+		queue->running = 1;
+	} else {
+		free(queue->batch);
+		queue->batch = NULL;
+	}
+
+	return res;
+}
+
+void notifyqueue_stop(struct notifyqueue *queue)
+{
+	if (!queue->running)
+		return;
+
+	pthread_mutex_lock(&queue->mutex);
+	queue->stopping = 1;
+	pthread_cond_signal(&queue->not_empty);
+	pthread_mutex_unlock(&queue->mutex);
+
+	pthread_join(queue->thread_id, NULL);
+	queue->running = 0;
+
+	free(queue->batch);
+	queue->batch = NULL;
+}
+
+/**
+ * Checks whether a new event duplicates the newest queued event for the
+ * same paths, as with coalesce_batch(), so that merging it never changes
+ * the order of events for any path.
+ *
+ * @return 1 if the event may be merged into a queued event; 0 otherwise
+ */
+static int coalesce_entry(struct notifyqueue *queue, uint64_t mask,
+			  const char *path, const char *target_path)
+{
+	struct notify_entry new_entry = {
+		.mask = mask,
+		.path = (char *)path,
+		.target_path = (char *)target_path
+	};
+	unsigned int i = queue->count;
+
+	while (i-- > 0) {
+		struct notify_entry *entry;
+
+		entry = &queue->ring[(queue->head + i) % queue->size];
+		if (path_in_entry(path, entry) ||
+		    path_in_entry(target_path, entry))
+			return entries_equal(&new_entry, entry);
+	}
+
+	return 0;
+}
+
+/**
+ * Adds an event to the queue, copying its paths.
+ *
+ * @return 0 or an errno; ENOBUFS if the event was dropped
+ */
+int notifyqueue_push(struct notifyqueue *queue, uint64_t mask, pid_t pid,
+		     const char *path, const char *target_path)
+{
+	struct notify_entry entry;
+	int res = 0;
+
+	pthread_mutex_lock(&queue->mutex);
+	while (queue->count == queue->size) {
+		if (queue->policy == NOTIFYQUEUE_DROP) {
+			++queue->stats.dropped;
+			res = ENOBUFS;
+			goto out;
+		} else if (queue->policy == NOTIFYQUEUE_COALESCE &&
+			   coalesce_entry(queue, mask, path, target_path)) {
+			++queue->stats.coalesced;
+			goto out;
+		}
+		pthread_cond_wait(&queue->not_full, &queue->mutex);
+	}
+	pthread_mutex_unlock(&queue->mutex);
+
+	// copy paths without holding the lock, then recheck for space
+	entry.mask = mask;
+	entry.pid = pid;
+	entry.path = (path == NULL) ? NULL : strdup(path);
+	entry.target_path = (target_path == NULL) ? NULL : strdup(target_path);
+	if ((path != NULL && entry.path == NULL) ||
+	    (target_path != NULL && entry.target_path == NULL)) {
+		free_entry(&entry);
+		return ENOMEM;
+	}
+
+	pthread_mutex_lock(&queue->mutex);
+	while (queue->count == queue->size) {
+		if (queue->policy == NOTIFYQUEUE_DROP) {
+			++queue->stats.dropped;
+			free_entry(&entry);
+			res = ENOBUFS;
+			goto out;
+		}
+		pthread_cond_wait(&queue->not_full, &queue->mutex);
+	}
+
+	queue->ring[(queue->head + queue->count) % queue->size] = entry;
+	++queue->count;
+	++queue->stats.queued;
+	if (queue->count > queue->stats.max_depth)
+		queue->stats.max_depth = queue->count;
+	pthread_cond_signal(&queue->not_empty);
+
+out:
+	pthread_mutex_unlock(&queue->mutex);
+	return res;
+}
+
+void notifyqueue_get_stats(struct notifyqueue *queue,
+			   struct notifyqueue_stats *stats)
+{
+	pthread_mutex_lock(&queue->mutex);
+	*stats = queue->stats;
+	stats->depth = queue->count;
+	pthread_mutex_unlock(&queue->mutex);
+}
+
+void notifyqueue_destroy(struct notifyqueue *queue)
+{
+	notifyqueue_stop(queue);
+
+	while (queue->count > 0) {
+		free_entry(&queue->ring[queue->head]);
+		queue->head = (queue->head + 1) % queue->size;
+		--queue->count;
+	}
+
+	pthread_cond_destroy(&queue->not_full);
+	pthread_cond_destroy(&queue->not_empty);
+	pthread_mutex_destroy(&queue->mutex);
+	free(queue->ring);
+	free(queue);
+}
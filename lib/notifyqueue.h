@@ -0,0 +1,79 @@
+/* Linux Projected Filesystem
+   Copyright (C) 2019 GitHub, Inc.
+
+   See the NOTICE file distributed with this library for additional
+   information regarding copyright ownership.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library, in the file COPYING; if not,
+   see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _NOTIFYQUEUE_H
+#define _NOTIFYQUEUE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#define NOTIFYQUEUE_DEFAULT_SIZE 1024
+
+#define NOTIFYQUEUE_DEFAULT_BATCH_SIZE 64
+#define NOTIFYQUEUE_DEFAULT_BATCH_MSEC 10
+
+enum notifyqueue_policy {
+	NOTIFYQUEUE_BLOCK,
+	NOTIFYQUEUE_DROP,
+	NOTIFYQUEUE_COALESCE
+};
+
+struct notifyqueue;
+
+struct notify_entry {
+	uint64_t mask;
+	pid_t pid;
+	char *path;
+	char *target_path;
+};
+
+struct notifyqueue_stats {
+	uint64_t queued;
+	uint64_t dropped;
+	uint64_t coalesced;
+	uint64_t batches;
+	unsigned int depth;
+	unsigned int max_depth;
+};
+
+typedef void (*notifyqueue_deliver_t)(void *data,
+				      const struct notify_entry *entries,
+				      unsigned int n);
+
+struct notifyqueue *notifyqueue_create(unsigned int size,
+				       enum notifyqueue_policy policy,
+				       notifyqueue_deliver_t deliver,
+				       void *data);
+void notifyqueue_destroy(struct notifyqueue *queue);
+
+int notifyqueue_set_batch(struct notifyqueue *queue, unsigned int max_size,
+			  unsigned int window_msec);
+
+int notifyqueue_start(struct notifyqueue *queue);
+void notifyqueue_stop(struct notifyqueue *queue);
+
+int notifyqueue_push(struct notifyqueue *queue, uint64_t mask, pid_t pid,
+		     const char *path, const char *target_path);
+
+void notifyqueue_get_stats(struct notifyqueue *queue,
+			   struct notifyqueue_stats *stats);
+
+#endif /* _NOTIFYQUEUE_H */
@@ -0,0 +1,185 @@
+/* Linux Projected Filesystem
+   Copyright (C) 2019 GitHub, Inc.
+
+   See the NOTICE file distributed with this library for additional
+   information regarding copyright ownership.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library, in the file COPYING; if not,
+   see <http://www.gnu.org/licenses/>.
+*/
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "opentable.h"
+
+/*
+ * We count the file handles open for reading on each inode in the lower
+ * filesystem, keyed by device and inode number, so that a file is not
+ * dehydrated while a client may still be reading its contents.
+ *
+ * The table is a fixed array of hash buckets, each with its own mutex
+ * and a chained list of entries, in the same manner as our lock table.
+ * An entry exists only while its count is non-zero.
+ */
+
+struct open_entry {
+	dev_t dev;
+	ino_t ino;
+	unsigned int count;
+	struct open_entry *next;
+};
+
+struct open_bucket {
+	pthread_mutex_t mutex;
+	struct open_entry *head;
+};
+
+struct opentable {
+	struct open_bucket buckets[OPENTABLE_BUCKETS];
+};
+
+#define OPENTABLE_BITS 8
+
+#if (1 << OPENTABLE_BITS) != OPENTABLE_BUCKETS
+#error "OPENTABLE_BITS does not match OPENTABLE_BUCKETS"
+#endif
+
+struct opentable *opentable_create(void)
+{
+	struct opentable *table;
+	unsigned int i;
+
+	table = calloc(1, sizeof(*table));
+	if (table == NULL)
+		return NULL;
+
+	for (i = 0; i < OPENTABLE_BUCKETS; ++i) {
+		if (pthread_mutex_init(&table->buckets[i].mutex, NULL) != 0)
+			goto out_mutexes;
+	}
+
+	return table;
+
+out_mutexes:
+	while (i-- > 0)
+		pthread_mutex_destroy(&table->buckets[i].mutex);
+	free(table);
+	return NULL;
+}
+
+// 2^64 / golden ratio
+#define GOLDEN_RATIO_64 0x9E3779B97F4A7C15ULL
+
+static inline struct open_bucket *get_bucket(struct opentable *table,
+					     dev_t dev, ino_t ino)
+{
+	uint64_t key = (uint64_t)ino ^ ((uint64_t)dev << 32);
+
+	return &table->buckets[(key * GOLDEN_RATIO_64) >>
+			       (64 - OPENTABLE_BITS)];
+}
+
+static struct open_entry **find_entry(struct open_bucket *bucket,
+				      dev_t dev, ino_t ino)
+{
+	struct open_entry **entryp;
+
+	for (entryp = &bucket->head; *entryp != NULL;
+	     entryp = &(*entryp)->next) {
+		if ((*entryp)->ino == ino && (*entryp)->dev == dev)
+			break;
+	}
+
+	return entryp;
+}
+
+int opentable_add(struct opentable *table, dev_t dev, ino_t ino)
+{
+	struct open_bucket *bucket = get_bucket(table, dev, ino);
+	struct open_entry **entryp;
+	int res = 0;
+
+	pthread_mutex_lock(&bucket->mutex);
+
+	entryp = find_entry(bucket, dev, ino);
+	if (*entryp == NULL) {
+		*entryp = calloc(1, sizeof(**entryp));
+		if (*entryp == NULL) {
+			res = ENOMEM;
+			goto out;
+		}
+		(*entryp)->dev = dev;
+		(*entryp)->ino = ino;
+	}
+	++(*entryp)->count;
+
+out:
+	pthread_mutex_unlock(&bucket->mutex);
+	return res;
+}
+
+void opentable_remove(struct opentable *table, dev_t dev, ino_t ino)
+{
+	struct open_bucket *bucket = get_bucket(table, dev, ino);
+	struct open_entry **entryp;
+	struct open_entry *entry;
+
+	pthread_mutex_lock(&bucket->mutex);
+
+	entryp = find_entry(bucket, dev, ino);
+	entry = *entryp;
+	if (entry != NULL && --entry->count == 0) {
+		*entryp = entry->next;
+		free(entry);
+	}
+
+	pthread_mutex_unlock(&bucket->mutex);
+}
+
+unsigned int opentable_count(struct opentable *table, dev_t dev, ino_t ino)
+{
+	struct open_bucket *bucket = get_bucket(table, dev, ino);
+	struct open_entry *entry;
+	unsigned int count = 0;
+
+	pthread_mutex_lock(&bucket->mutex);
+
+	entry = *find_entry(bucket, dev, ino);
+	if (entry != NULL)
+		count = entry->count;
+
+	pthread_mutex_unlock(&bucket->mutex);
+	return count;
+}
+
+void opentable_destroy(struct opentable *table)
+{
+	struct open_entry *entry;
+	unsigned int i;
+
+	for (i = 0; i < OPENTABLE_BUCKETS; ++i) {
+		while ((entry = table->buckets[i].head) != NULL) {
+			table->buckets[i].head = entry->next;
+			free(entry);
+		}
+		pthread_mutex_destroy(&table->buckets[i].mutex);
+	}
+
+	free(table);
+}
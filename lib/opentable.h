@@ -0,0 +1,39 @@
+/* Linux Projected Filesystem
+   Copyright (C) 2019 GitHub, Inc.
+
+   See the NOTICE file distributed with this library for additional
+   information regarding copyright ownership.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library, in the file COPYING; if not,
+   see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef _OPENTABLE_H
+#define _OPENTABLE_H
+
+#include <sys/types.h>
+
+#define OPENTABLE_BUCKETS 256
+
+struct opentable;
+
+struct opentable *opentable_create(void);
+void opentable_destroy(struct opentable *table);
+
+int opentable_add(struct opentable *table, dev_t dev, ino_t ino);
+void opentable_remove(struct opentable *table, dev_t dev, ino_t ino);
+unsigned int opentable_count(struct opentable *table, dev_t dev, ino_t ino);
+
+#endif /* _OPENTABLE_H */
@@ -0,0 +1,245 @@
+/* Linux Projected Filesystem
+   Copyright (C) 2019 GitHub, Inc.
+
+   See the NOTICE file distributed with this library for additional
+   information regarding copyright ownership.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library, in the file COPYING; if not,
+   see <http://www.gnu.org/licenses/>.
+*/
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "opstats.h"
+
+/*
+ * We count the operations of each kind (FUSE operations, lock waits,
+ * handler calls, etc.) which complete, and how many fail, and record
+ * their latencies in histograms whose buckets are powers of two of
+ * microseconds, so that the caller can find percentiles to within a
+ * factor of two without our storing each sample.
+ *
+ * To keep the cost low enough to leave enabled, each thread records into
+ * its own slot of counters, found through a thread-specific key, and
+ * no lock or atomic read-modify-write instruction is needed on the
+ * recording path, as each counter has a single writer.  Counters are
+ * only read and written with relaxed atomic loads and stores, so that a
+ * reader never sees a torn value.  The slots are merged on demand,
+ * which is the only time they are all visited.
+ *
+ * FUSE creates and destroys worker threads as its load varies, so when
+ * a thread exits, its slot is marked unused rather than freed, and it is
+ * reused by the next new thread; since the counters are cumulative, the
+ * new thread simply adds to them.  Slots are therefore only freed when
+ * the statistics are destroyed, and the list of them only grows, under
+ * a mutex which is taken only when a thread first records a sample.
+ */
+
+struct opstats_slot {
+	struct opstats_slot *next;
+	int in_use;
+	struct opstats_counter counters[];
+};
+
+struct opstats {
+	unsigned int num_ids;
+	pthread_key_t key;
+	pthread_mutex_t mutex;
+	struct opstats_slot *head;
+};
+
+static void release_slot(void *data)
+{
+	struct opstats_slot *slot = (struct opstats_slot *)data;
+
+	__atomic_store_n(&slot->in_use, 0, __ATOMIC_RELEASE);
+}
+
+struct opstats *opstats_create(unsigned int num_ids)
+{
+	struct opstats *stats;
+
+	stats = calloc(1, sizeof(*stats));
+	if (stats == NULL)
+		return NULL;
+
+	if (pthread_key_create(&stats->key, release_slot) != 0)
+		goto out_stats;
+
+	if (pthread_mutex_init(&stats->mutex, NULL) != 0)
+		goto out_key;
+
+	stats->num_ids = num_ids;
+
+	return stats;
+
+out_key:
+	pthread_key_delete(stats->key);
+out_stats:
+	free(stats);
+	return NULL;
+}
+
+uint64_t opstats_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000 * 1000 * 1000 + ts.tv_nsec;
+}
+
+static struct opstats_slot *get_slot(struct opstats *stats)
+{
+	struct opstats_slot *slot;
+
+	slot = (struct opstats_slot *)pthread_getspecific(stats->key);
+	if (slot != NULL)
+		return slot;
+
+	pthread_mutex_lock(&stats->mutex);
+
+	for (slot = stats->head; slot != NULL; slot = slot->next) {
+		if (!__atomic_load_n(&slot->in_use, __ATOMIC_ACQUIRE))
+			break;
+	}
+
+	if (slot == NULL) {
+		slot = calloc(1, sizeof(*slot) +
+				 stats->num_ids * sizeof(slot->counters[0]));
+		if (slot == NULL)
+			goto out;
+		slot->next = stats->head;
+		stats->head = slot;
+	}
+
+	if (pthread_setspecific(stats->key, slot) != 0) {
+		slot = NULL;
+		goto out;
+	}
+	__atomic_store_n(&slot->in_use, 1, __ATOMIC_RELAXED);
+
+out:
+	pthread_mutex_unlock(&stats->mutex);
+	return slot;
+}
+
+static inline void add_counter(uint64_t *counter, uint64_t n)
+{
+	uint64_t value = __atomic_load_n(counter, __ATOMIC_RELAXED);
+
+	__atomic_store_n(counter, value + n, __ATOMIC_RELAXED);
+}
+
+static inline unsigned int get_bucket(uint64_t nsec)
+{
+	uint64_t usec = nsec / 1000;
+	unsigned int i;
+
+	if (usec == 0)
+		return 0;
+
+	i = 64 - __builtin_clzll(usec);
+	return (i < OPSTATS_BUCKETS) ? i : OPSTATS_BUCKETS - 1;
+}
+
+/**
+ * Records the completion of an operation in the calling thread's slot;
+ * the sample is discarded if no slot can be allocated.
+ *
+ * @param id operation identifier, less than num_ids
+ * @param nsec latency of the operation, measured with opstats_now()
+ * @param failed 1 if the operation failed; 0 otherwise
+ */
+void opstats_record(struct opstats *stats, unsigned int id, uint64_t nsec,
+		    int failed)
+{
+	struct opstats_slot *slot = get_slot(stats);
+	struct opstats_counter *counter;
+
+	if (slot == NULL)
+		return;
+	counter = &slot->counters[id];
+
+	add_counter(&counter->count, 1);
+	if (failed)
+		add_counter(&counter->errors, 1);
+	add_counter(&counter->total_nsec, nsec);
+	if (nsec > counter->max_nsec)
+		__atomic_store_n(&counter->max_nsec, nsec, __ATOMIC_RELAXED);
+	add_counter(&counter->buckets[get_bucket(nsec)], 1);
+}
+
+/**
+ * Sums the counters of all threads, past and present.
+ *
+ * @param counters array of num_ids counters to fill in
+ */
+void opstats_merge(struct opstats *stats, struct opstats_counter *counters)
+{
+	const struct opstats_counter *counter;
+	struct opstats_slot *slot;
+	unsigned int i, j;
+	uint64_t max;
+
+	memset(counters, 0, stats->num_ids * sizeof(*counters));
+
+	pthread_mutex_lock(&stats->mutex);
+
+	for (slot = stats->head; slot != NULL; slot = slot->next) {
+		for (i = 0; i < stats->num_ids; ++i) {
+			counter = &slot->counters[i];
+
+			counters[i].count += __atomic_load_n(&counter->count,
+							     __ATOMIC_RELAXED);
+			counters[i].errors += __atomic_load_n(&counter->errors,
+							      __ATOMIC_RELAXED);
+			counters[i].total_nsec +=
+				__atomic_load_n(&counter->total_nsec,
+						__ATOMIC_RELAXED);
+			max = __atomic_load_n(&counter->max_nsec,
+					      __ATOMIC_RELAXED);
+			if (max > counters[i].max_nsec)
+				counters[i].max_nsec = max;
+			for (j = 0; j < OPSTATS_BUCKETS; ++j) {
+				counters[i].buckets[j] +=
+					__atomic_load_n(&counter->buckets[j],
+							__ATOMIC_RELAXED);
+			}
+		}
+	}
+
+	pthread_mutex_unlock(&stats->mutex);
+}
+
+void opstats_destroy(struct opstats *stats)
+{
+	struct opstats_slot *slot;
+
+	pthread_key_delete(stats->key);
+
+	while ((slot = stats->head) != NULL) {
+		stats->head = slot->next;
+		free(slot);
+	}
+
+	pthread_mutex_destroy(&stats->mutex);
+	free(stats);
+}
@@ -0,0 +1,50 @@
+/* Linux Projected Filesystem
+   Copyright (C) 2019 GitHub, Inc.
+
+   See the NOTICE file distributed with this library for additional
+   information regarding copyright ownership.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library, in the file COPYING; if not,
+   see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef _OPSTATS_H
+#define _OPSTATS_H
+
+#include <stdint.h>
+
+// latency buckets, each twice as wide as the last, from one microsecond
+#define OPSTATS_BUCKETS 32
+
+struct opstats;
+
+struct opstats_counter {
+	uint64_t count;
+	uint64_t errors;
+	uint64_t total_nsec;
+	uint64_t max_nsec;
+	uint64_t buckets[OPSTATS_BUCKETS];
+};
+
+struct opstats *opstats_create(unsigned int num_ids);
+void opstats_destroy(struct opstats *stats);
+
+uint64_t opstats_now(void);
+void opstats_record(struct opstats *stats, unsigned int id, uint64_t nsec,
+		    int failed);
+
+void opstats_merge(struct opstats *stats, struct opstats_counter *counters);
+
+#endif /* _OPSTATS_H */
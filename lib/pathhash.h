@@ -0,0 +1,43 @@
+/* Linux Projected Filesystem
+   Copyright (C) 2019 GitHub, Inc.
+
+   See the NOTICE file distributed with this library for additional
+   information regarding copyright ownership.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library, in the file COPYING; if not,
+   see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _PATHHASH_H
+#define _PATHHASH_H
+
+#include <stdint.h>
+
+// FNV-1a
+#define PATHHASH_OFFSET_BASIS 2166136261U
+#define PATHHASH_PRIME 16777619U
+
+static inline uint32_t pathhash_fnv1a(const char *path)
+{
+	uint32_t hash = PATHHASH_OFFSET_BASIS;
+
+	while (*path != '\0') {
+		hash ^= (unsigned char)*path++;
+		hash *= PATHHASH_PRIME;
+	}
+
+	return hash;
+}
+
+#endif /* _PATHHASH_H */
@@ -0,0 +1,264 @@
+/* Linux Projected Filesystem
+   Copyright (C) 2019 GitHub, Inc.
+
+   See the NOTICE file distributed with this library for additional
+   information regarding copyright ownership.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library, in the file COPYING; if not,
+   see <http://www.gnu.org/licenses/>.
+*/
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "pendtable.h"
+
+/*
+ * We implement a table of projection requests whose completion has been
+ * deferred by the provider, keyed by a unique cookie which is passed to
+ * the provider with each projection event.
+ *
+ * Before a projection event is sent, the FUSE worker thread handling the
+ * request adds a waiter to the table, allocated on its own stack, with a
+ * newly assigned cookie.  If the provider's handler returns PROJFS_PENDING,
+ * the thread then waits on the waiter's condition variable until another
+ * thread calls projfs_complete_event() with the same cookie; otherwise it
+ * simply removes the waiter from the table.  Because the waiter is added
+ * before the handler is called, the provider may complete the event from
+ * another thread even before its handler returns.
+ *
+ * Since libfuse's high-level API requires that a request be answered
+ * before its operation function returns, the worker thread must remain
+ * parked while the event is pending; however, the provider's own threads
+ * are released, so a small pool of them may keep many projections in
+ * flight, while libfuse starts additional worker threads as required.
+ *
+ * Waiters are kept in a hash table of singly-linked lists, all protected
+ * by a single mutex, since each is accessed only briefly on addition and
+ * removal.  Each waiter has its own condition variable so that completion
+ * of one event wakes only the thread waiting for it.
+ *
+ * A waiter which is not completed within a given time, measured against
+ * the monotonic clock, is removed from the table and fails with ETIMEDOUT,
+ * so that a provider which loses track of an event cannot hold a worker
+ * thread forever; any later completion of its cookie returns ENOENT.
+ *
+ * When the table is cancelled, as the filesystem is being stopped, all
+ * current and future waiters are completed immediately with the given
+ * result, so that no worker thread remains blocked indefinitely.
+ */
+
+struct pendtable {
+	struct pending_wait **array;
+	uint64_t next_cookie;
+	int cancelled;
+	int cancel_result;
+	pthread_mutex_t mutex;
+	pthread_condattr_t condattr;
+};
+
+#define PENDTABLE_MASK (PENDTABLE_SIZE - 1)
+
+#if (PENDTABLE_SIZE & PENDTABLE_MASK) != 0
+#error "PENDTABLE_SIZE is not a power of two"
+#endif
+
+struct pendtable *pendtable_create(void)
+{
+	struct pendtable *table;
+
+	table = calloc(1, sizeof(*table));
+	if (table == NULL)
+		return NULL;
+
+	table->array = calloc(PENDTABLE_SIZE, sizeof(*table->array));
+	if (table->array == NULL)
+		goto out_table;
+
+	if (pthread_mutex_init(&table->mutex, NULL) != 0)
+		goto out_array;
+	if (pthread_condattr_init(&table->condattr) != 0)
+		goto out_mutex;
+	if (pthread_condattr_setclock(&table->condattr, CLOCK_MONOTONIC) != 0)
+		goto out_condattr;
+
+	table->next_cookie = 1;
+
+	return table;
+
+out_condattr:
+	pthread_condattr_destroy(&table->condattr);
+out_mutex:
+	pthread_mutex_destroy(&table->mutex);
+out_array:
+	free(table->array);
+out_table:
+	free(table);
+	return NULL;
+}
+
+static inline struct pending_wait **get_bucket(struct pendtable *table,
+					       uint64_t cookie)
+{
+	// cookies are sequential, so the low bits are evenly distributed
+	return &table->array[cookie & PENDTABLE_MASK];
+}
+
+static void remove_wait(struct pendtable *table, struct pending_wait *wait)
+{
+	struct pending_wait **link = get_bucket(table, wait->cookie);
+
+	while (*link != NULL) {
+		if (*link == wait) {
+			*link = wait->next;
+			break;
+		}
+		link = &(*link)->next;
+	}
+	wait->next = NULL;
+}
+
+/**
+ * Adds a waiter to the table, assigning it a new cookie.
+ *
+ * @return cookie of the waiter, or zero if it could not be added
+ */
+uint64_t pendtable_add(struct pendtable *table, struct pending_wait *wait)
+{
+	struct pending_wait **bucket;
+
+	if (pthread_cond_init(&wait->cond, &table->condattr) != 0)
+		return 0;
+	wait->result = 0;
+	wait->done = 0;
+
+	pthread_mutex_lock(&table->mutex);
+	wait->cookie = table->next_cookie++;
+	bucket = get_bucket(table, wait->cookie);
+	wait->next = *bucket;
+	*bucket = wait;
+	pthread_mutex_unlock(&table->mutex);
+
+	return wait->cookie;
+}
+
+static void get_deadline(struct timespec *ts, unsigned int wait_ms)
+{
+	clock_gettime(CLOCK_MONOTONIC, ts);
+
+	ts->tv_sec += wait_ms / 1000;
+	ts->tv_nsec += (long)(wait_ms % 1000) * 1000 * 1000;
+	if (ts->tv_nsec >= 1000 * 1000 * 1000) {
+		ts->tv_nsec -= 1000 * 1000 * 1000;
+		++ts->tv_sec;
+	}
+}
+
+/**
+ * Removes a waiter from the table, first waiting for its completion
+ * if pending is set.
+ *
+ * @param wait_ms maximum time to wait for completion, in milliseconds
+ * @return the result passed on completion if pending, otherwise result;
+ *         -ETIMEDOUT if not completed in time
+ */
+int pendtable_finish(struct pendtable *table, struct pending_wait *wait,
+		     int pending, int result, unsigned int wait_ms)
+{
+	struct timespec deadline;
+	int res = 0;
+
+	get_deadline(&deadline, wait_ms);
+
+	pthread_mutex_lock(&table->mutex);
+	if (pending) {
+		while (!wait->done && !table->cancelled && res == 0) {
+			res = pthread_cond_timedwait(&wait->cond,
+						     &table->mutex, &deadline);
+		}
+		if (wait->done)
+			result = wait->result;
+		else if (table->cancelled)
+			result = table->cancel_result;
+		else
+			result = -ETIMEDOUT;
+	}
+	if (!wait->done)
+		remove_wait(table, wait);
+	pthread_mutex_unlock(&table->mutex);
+
+	pthread_cond_destroy(&wait->cond);
+
+	return result;
+}
+
+/**
+ * Completes the waiter with the given cookie, if it is still in the table.
+ *
+ * @return 0 or ENOENT
+ */
+int pendtable_complete(struct pendtable *table, uint64_t cookie, int result)
+{
+	struct pending_wait *wait;
+	int res = ENOENT;
+
+	pthread_mutex_lock(&table->mutex);
+	for (wait = *get_bucket(table, cookie); wait != NULL;
+	     wait = wait->next) {
+		if (wait->cookie == cookie) {
+			remove_wait(table, wait);
+			wait->result = result;
+			wait->done = 1;
+			pthread_cond_signal(&wait->cond);
+			res = 0;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&table->mutex);
+
+	return res;
+}
+
+void pendtable_cancel(struct pendtable *table, int result)
+{
+	struct pending_wait *wait;
+	unsigned int i;
+
+	pthread_mutex_lock(&table->mutex);
+	table->cancelled = 1;
+	table->cancel_result = result;
+	for (i = 0; i < PENDTABLE_SIZE; ++i) {
+		while ((wait = table->array[i]) != NULL) {
+			table->array[i] = wait->next;
+			wait->next = NULL;
+			wait->result = result;
+			wait->done = 1;
+			pthread_cond_signal(&wait->cond);
+		}
+	}
+	pthread_mutex_unlock(&table->mutex);
+}
+
+void pendtable_destroy(struct pendtable *table)
+{
+	pthread_condattr_destroy(&table->condattr);
+	pthread_mutex_destroy(&table->mutex);
+	free(table->array);
+	free(table);
+}
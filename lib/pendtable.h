@@ -0,0 +1,52 @@
+/* Linux Projected Filesystem
+   Copyright (C) 2019 GitHub, Inc.
+
+   See the NOTICE file distributed with this library for additional
+   information regarding copyright ownership.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library, in the file COPYING; if not,
+   see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _PENDTABLE_H
+#define _PENDTABLE_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+#define PENDTABLE_SIZE 256
+
+// time allowed for a pending event to be completed
+#define PENDTABLE_DEFAULT_TIMEOUT_MSEC (5 * 60 * 1000)
+
+struct pendtable;
+
+struct pending_wait {
+	uint64_t cookie;
+	int result;
+	int done;
+	pthread_cond_t cond;
+	struct pending_wait *next;
+};
+
+struct pendtable *pendtable_create(void);
+void pendtable_destroy(struct pendtable *table);
+
+uint64_t pendtable_add(struct pendtable *table, struct pending_wait *wait);
+int pendtable_finish(struct pendtable *table, struct pending_wait *wait,
+		     int pending, int result, unsigned int wait_ms);
+int pendtable_complete(struct pendtable *table, uint64_t cookie, int result);
+void pendtable_cancel(struct pendtable *table, int result);
+
+#endif /* _PENDTABLE_H */
@@ -0,0 +1,330 @@
+/* Linux Projected Filesystem
+   Copyright (C) 2019 GitHub, Inc.
+
+   See the NOTICE file distributed with this library for additional
+   information regarding copyright ownership.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library, in the file COPYING; if not,
+   see <http://www.gnu.org/licenses/>.
+*/
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "pathhash.h"
+#include "prefetch.h"
+
+/*
+ * We watch for directories in which several files are hydrated in quick
+ * succession, as when a build tool reads every source file in a directory,
+ * and when we see one, we hydrate the directory's remaining files in the
+ * background so that later opens of them need not wait for the provider.
+ *
+ * Each hydration is recorded against its parent directory in a fixed-size,
+ * direct-mapped table keyed by a hash of the directory's path, in the same
+ * manner as our state cache; a new directory simply evicts the previous
+ * occupant of its slot.  Each entry counts the hydrations which occur
+ * within a time window starting from the first, and once the count reaches
+ * a threshold, the directory is queued for prefetching.  A directory is
+ * queued at most once per window.
+ *
+ * A small pool of worker threads takes directories from the queue and
+ * passes each to a callback, along with the ID of the process whose
+ * hydration triggered the prefetch.  The queue is bounded, and should it
+ * be full, further directories are discarded, since prefetching is only
+ * an optimization.  A directory which is already queued is not queued
+ * again.
+ *
+ * When stopped, the workers finish any callbacks in progress, which should
+ * check prefetch_is_stopping() periodically and return early if it is set,
+ * and any directories still queued are discarded.
+ */
+
+struct prefetch_track {
+	char *dir;
+	uint64_t start_ms;
+	unsigned int count;
+	int queued;
+};
+
+struct prefetch_job {
+	char *dir;
+	pid_t pid;
+	struct prefetch_job *next;
+};
+
+struct prefetch {
+	unsigned int threshold;
+	unsigned int window_msec;
+	unsigned int num_threads;
+	prefetch_func_t func;
+	void *data;
+	struct prefetch_track *track;
+	struct prefetch_job *head;
+	struct prefetch_job **tail;
+	unsigned int num_jobs;
+	pthread_t *thread_ids;
+	unsigned int num_running;
+	int stopping;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+};
+
+struct prefetch *prefetch_create(unsigned int threshold,
+				 unsigned int window_msec,
+				 unsigned int num_threads,
+				 prefetch_func_t func, void *data)
+{
+	struct prefetch *pf;
+
+	if (threshold == 0 || num_threads == 0) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	pf = calloc(1, sizeof(*pf));
+	if (pf == NULL)
+		return NULL;
+
+	pf->track = calloc(PREFETCH_TRACK_SIZE, sizeof(*pf->track));
+	if (pf->track == NULL)
+		goto out_pf;
+
+	pf->thread_ids = calloc(num_threads, sizeof(*pf->thread_ids));
+	if (pf->thread_ids == NULL)
+		goto out_track;
+
+	if (pthread_mutex_init(&pf->mutex, NULL) != 0)
+		goto out_threads;
+
+	if (pthread_cond_init(&pf->cond, NULL) != 0)
+		goto out_mutex;
+
+	pf->threshold = threshold;
+	pf->window_msec = window_msec;
+	pf->num_threads = num_threads;
+	pf->func = func;
+	pf->data = data;
+	pf->tail = &pf->head;
+
+	return pf;
+
+out_mutex:
+	pthread_mutex_destroy(&pf->mutex);
+out_threads:
+	free(pf->thread_ids);
+out_track:
+	free(pf->track);
+out_pf:
+	free(pf);
+	return NULL;
+}
+
+static struct prefetch_job *dequeue_job(struct prefetch *pf)
+{
+	struct prefetch_job *job = pf->head;
+
+	pf->head = job->next;
+	if (pf->head == NULL)
+		pf->tail = &pf->head;
+	--pf->num_jobs;
+
+	return job;
+}
+
+static void *prefetch_loop(void *data)
+{
+	struct prefetch *pf = (struct prefetch *)data;
+	struct prefetch_job *job;
+
+	pthread_mutex_lock(&pf->mutex);
+	while (1) {
+		while (pf->head == NULL && !pf->stopping)
+			pthread_cond_wait(&pf->cond, &pf->mutex);
+		if (pf->stopping)
+			break;
+
+		job = dequeue_job(pf);
+		pthread_mutex_unlock(&pf->mutex);
+
+		pf->func(pf->data, job->dir, job->pid);
+		free(job->dir);
+		free(job);
+
+		pthread_mutex_lock(&pf->mutex);
+	}
+	pthread_mutex_unlock(&pf->mutex);
+
+	return NULL;
+}
+
+int prefetch_start(struct prefetch *pf)
+{
+	int res = 0;
+
+	pf->stopping = 0;
+	while (pf->num_running < pf->num_threads) {
+		res = pthread_create(&pf->thread_ids[pf->num_running], NULL,
+				     prefetch_loop, pf);
+		if (res != 0)
+			break;
+		++pf->num_running;
+	}
+
+	// run with fewer workers if at least one could be started
+	return (pf->num_running > 0) ? 0 : res;
+}
+
+int prefetch_is_stopping(struct prefetch *pf)
+{
+	int stopping;
+
+	pthread_mutex_lock(&pf->mutex);
+	stopping = pf->stopping;
+	pthread_mutex_unlock(&pf->mutex);
+
+	return stopping;
+}
+
+void prefetch_stop(struct prefetch *pf)
+{
+	struct prefetch_job *job;
+
+	pthread_mutex_lock(&pf->mutex);
+	pf->stopping = 1;
+	pthread_cond_broadcast(&pf->cond);
+	pthread_mutex_unlock(&pf->mutex);
+
+	while (pf->num_running > 0)
+		pthread_join(pf->thread_ids[--pf->num_running], NULL);
+
+	while (pf->head != NULL) {
+		job = dequeue_job(pf);
+		free(job->dir);
+		free(job);
+	}
+}
+
+static unsigned int hash_index(const char *dir)
+{
+	return pathhash_fnv1a(dir) % PREFETCH_TRACK_SIZE;
+}
+
+static uint64_t get_time_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / (1000 * 1000);
+}
+
+static int is_job_queued(struct prefetch *pf, const char *dir)
+{
+	struct prefetch_job *job;
+
+	for (job = pf->head; job != NULL; job = job->next) {
+		if (strcmp(job->dir, dir) == 0)
+			return 1;
+	}
+
+	return 0;
+}
+
+static void queue_job(struct prefetch *pf, const char *dir, pid_t pid)
+{
+	struct prefetch_job *job;
+
+	if (pf->num_jobs >= PREFETCH_MAX_JOBS || is_job_queued(pf, dir))
+		return;
+
+	job = malloc(sizeof(*job));
+	if (job == NULL)
+		return;
+	job->dir = strdup(dir);
+	if (job->dir == NULL) {
+		free(job);
+		return;
+	}
+	job->pid = pid;
+	job->next = NULL;
+
+	*pf->tail = job;
+	pf->tail = &job->next;
+	++pf->num_jobs;
+	pthread_cond_signal(&pf->cond);
+}
+
+/**
+ * Records the hydration of a file in a directory, and queues the directory
+ * for prefetching if enough files in it have been hydrated recently.
+ *
+ * @param dir path of the directory containing the hydrated file
+ * @param pid process ID responsible for the hydration
+ */
+void prefetch_record(struct prefetch *pf, const char *dir, pid_t pid)
+{
+	struct prefetch_track *track = &pf->track[hash_index(dir)];
+	uint64_t now = get_time_ms();
+
+	pthread_mutex_lock(&pf->mutex);
+	if (pf->stopping)
+		goto out;
+
+	if (track->dir == NULL || strcmp(track->dir, dir) != 0) {
+		char *copy = strdup(dir);
+
+		if (copy == NULL)
+			goto out;
+		free(track->dir);
+		track->dir = copy;
+		track->count = 0;
+	}
+
+	if (track->count == 0 || now - track->start_ms > pf->window_msec) {
+		track->start_ms = now;
+		track->count = 0;
+		track->queued = 0;
+	}
+
+	if (++track->count >= pf->threshold && !track->queued) {
+		track->queued = 1;
+		queue_job(pf, dir, pid);
+	}
+
+out:
+	pthread_mutex_unlock(&pf->mutex);
+}
+
+void prefetch_destroy(struct prefetch *pf)
+{
+	unsigned int i;
+
+	prefetch_stop(pf);
+
+	for (i = 0; i < PREFETCH_TRACK_SIZE; ++i)
+		free(pf->track[i].dir);
+
+	pthread_cond_destroy(&pf->cond);
+	pthread_mutex_destroy(&pf->mutex);
+	free(pf->thread_ids);
+	free(pf->track);
+	free(pf);
+}
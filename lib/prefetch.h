@@ -0,0 +1,49 @@
+/* Linux Projected Filesystem
+   Copyright (C) 2019 GitHub, Inc.
+
+   See the NOTICE file distributed with this library for additional
+   information regarding copyright ownership.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library, in the file COPYING; if not,
+   see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _PREFETCH_H
+#define _PREFETCH_H
+
+#include <sys/types.h>
+
+#define PREFETCH_TRACK_SIZE 256
+#define PREFETCH_MAX_JOBS 64
+
+#define PREFETCH_DEFAULT_THREADS 2
+#define PREFETCH_DEFAULT_WINDOW_MSEC 1000
+
+struct prefetch;
+
+typedef void (*prefetch_func_t)(void *data, const char *dir, pid_t pid);
+
+struct prefetch *prefetch_create(unsigned int threshold,
+				 unsigned int window_msec,
+				 unsigned int num_threads,
+				 prefetch_func_t func, void *data);
+void prefetch_destroy(struct prefetch *pf);
+
+int prefetch_start(struct prefetch *pf);
+void prefetch_stop(struct prefetch *pf);
+int prefetch_is_stopping(struct prefetch *pf);
+
+void prefetch_record(struct prefetch *pf, const char *dir, pid_t pid);
+
+#endif /* _PREFETCH_H */
@@ -0,0 +1,88 @@
+/* Linux Projected Filesystem
+   Copyright (C) 2019 GitHub, Inc.
+
+   See the NOTICE file distributed with this library for additional
+   information regarding copyright ownership.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library, in the file COPYING; if not,
+   see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef _PROBES_H
+#define _PROBES_H
+
+/*
+ * Static tracepoints (USDT probes) in the "projfs" provider, which may be
+ * attached by bpftrace, perf, or systemtap without rebuilding the library,
+ * e.g., "bpftrace -l 'usdt:/usr/lib/libprojfs.so:projfs:*'".  Each probe
+ * is a single nop instruction until attached.  When sys/sdt.h is not
+ * available, or configure was given --disable-sdt, they are compiled out.
+ *
+ * In the arguments below, pid is the ID of the client thread or process
+ * on whose behalf the operation was performed, nsec is a duration in
+ * nanoseconds, and res is zero or a negated errno.
+ *
+ * op__entry(const char *op, const char *path, pid)
+ * op__exit(const char *op, const char *path, pid, int res, nsec)
+ *	FUSE operation, e.g., "getattr", on a path within the mount
+ *
+ * lock__wait(const char *path, pid, uint64_t ino)
+ * lock__acquire(const char *path, pid, int err, nsec)
+ *	projection state lock, and time spent waiting for it; err is zero,
+ *	-1 if a result was shared by another lock holder, or an errno
+ * lock__release(const char *path, pid, nsec)
+ *	projection state lock, and time for which it was held
+ *
+ * state__change(const char *path, pid, uint64_t mask, int from, int to,
+ *		 nsec)
+ *	projection state of a path, from and to 0 (empty), 1 (populated),
+ *	or 2 (modified); mask is that of the event sent to the provider,
+ *	if any, and nsec the time taken by the transition
+ *
+ * handler__entry(const char *path, pid, uint64_t mask)
+ * handler__exit(const char *path, pid, uint64_t mask, int res, nsec)
+ *	call to a provider's event handler
+ */
+
+#ifdef HAVE_SYS_SDT_H
+
+#include <sys/sdt.h>
+
+#define PROJFS_PROBE3(name, a1, a2, a3) \
+	STAP_PROBE3(projfs, name, a1, a2, a3)
+#define PROJFS_PROBE4(name, a1, a2, a3, a4) \
+	STAP_PROBE4(projfs, name, a1, a2, a3, a4)
+#define PROJFS_PROBE5(name, a1, a2, a3, a4, a5) \
+	STAP_PROBE5(projfs, name, a1, a2, a3, a4, a5)
+#define PROJFS_PROBE6(name, a1, a2, a3, a4, a5, a6) \
+	STAP_PROBE6(projfs, name, a1, a2, a3, a4, a5, a6)
+
+#else
+
+// arguments are never evaluated, but count as used to the compiler
+#define PROJFS_PROBE3(name, a1, a2, a3) \
+	do { if (0) { (void)(a1); (void)(a2); (void)(a3); } } while (0)
+#define PROJFS_PROBE4(name, a1, a2, a3, a4) \
+	do { if (0) { PROJFS_PROBE3(name, a1, a2, a3); (void)(a4); } } while (0)
+#define PROJFS_PROBE5(name, a1, a2, a3, a4, a5) \
+	do { if (0) { PROJFS_PROBE4(name, a1, a2, a3, a4); (void)(a5); } } \
+	while (0)
+#define PROJFS_PROBE6(name, a1, a2, a3, a4, a5, a6) \
+	do { if (0) { PROJFS_PROBE5(name, a1, a2, a3, a4, a5); (void)(a6); } } \
+	while (0)
+
+#endif /* HAVE_SYS_SDT_H */
+
+#endif /* _PROBES_H */
@@ -23,7 +23,6 @@
 
 #include <config.h>
 
-#include <ctype.h>
 #include <dirent.h>
 #include <errno.h>
 #include <inttypes.h>
@@ -36,12 +35,31 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
 #include <sys/syscall.h>
 #include <attr/xattr.h>
 #include <unistd.h>
 
+#include "chunkmap.h"
+#include "evictor.h"
+#include "fdcopy.h"
 #include "fdtable.h"
+#include "hydsched.h"
+#include "hydtrace.h"
+#include "locktable.h"
+#include "logring.h"
+#include "notifyqueue.h"
+#include "opentable.h"
+#include "opstats.h"
+#include "pendtable.h"
+#include "prefetch.h"
+#include "probes.h"
 #include "projfs.h"
+#include "statecache.h"
+#include "stateindex.h"
+#include "tgidcache.h"
+#include "uringexec.h"
 
 #define FUSE_USE_VERSION 32
 #include <fuse3/fuse.h>
@@ -53,6 +71,25 @@
 struct projfs_config {
 	int initial;
 	char *log;
+	char *log_level;
+	double entry_timeout;
+	double attr_timeout;
+	double negative_timeout;
+	int notify_async;
+	unsigned int notify_queue_size;
+	char *notify_overflow;
+	unsigned int notify_batch_size;
+	unsigned int notify_batch_msec;
+	unsigned int chunk_size;
+	unsigned int max_hydrations;
+	unsigned int prefetch_threshold;
+	unsigned int prefetch_threads;
+	unsigned int prefetch_window_msec;
+	char *hydration_trace;
+	char *state_index;
+	int io_uring;
+	unsigned int evict_budget_mb;
+	unsigned int pending_timeout_msec;
 };
 
 #define PROJFS_OPT(t, p, v) { t, offsetof(struct projfs_config, p), v }
@@ -64,9 +101,65 @@ static struct fuse_opt projfs_opts[] = {
 	PROJFS_OPT("log=%s",	log, 0),
 	PROJFS_OPT("--log=%s",	log, 0),
 
+	PROJFS_OPT("log-level=%s",	log_level, 0),
+	PROJFS_OPT("--log-level=%s",	log_level, 0),
+
+	PROJFS_OPT("entry-timeout=%lf",		entry_timeout, 0),
+	PROJFS_OPT("--entry-timeout=%lf",	entry_timeout, 0),
+	PROJFS_OPT("attr-timeout=%lf",		attr_timeout, 0),
+	PROJFS_OPT("--attr-timeout=%lf",	attr_timeout, 0),
+	PROJFS_OPT("negative-timeout=%lf",	negative_timeout, 0),
+	PROJFS_OPT("--negative-timeout=%lf",	negative_timeout, 0),
+
+	PROJFS_OPT("notify-async",		notify_async, 1),
+	PROJFS_OPT("--notify-async",		notify_async, 1),
+	PROJFS_OPT("notify-queue-size=%u",	notify_queue_size, 0),
+	PROJFS_OPT("--notify-queue-size=%u",	notify_queue_size, 0),
+	PROJFS_OPT("notify-overflow=%s",	notify_overflow, 0),
+	PROJFS_OPT("--notify-overflow=%s",	notify_overflow, 0),
+	PROJFS_OPT("notify-batch-size=%u",	notify_batch_size, 0),
+	PROJFS_OPT("--notify-batch-size=%u",	notify_batch_size, 0),
+	PROJFS_OPT("notify-batch-msec=%u",	notify_batch_msec, 0),
+	PROJFS_OPT("--notify-batch-msec=%u",	notify_batch_msec, 0),
+
+	PROJFS_OPT("chunk-size=%u",	chunk_size, 0),
+	PROJFS_OPT("--chunk-size=%u",	chunk_size, 0),
+
+	PROJFS_OPT("max-hydrations=%u",		max_hydrations, 0),
+	PROJFS_OPT("--max-hydrations=%u",	max_hydrations, 0),
+
+	PROJFS_OPT("prefetch-threshold=%u",	prefetch_threshold, 0),
+	PROJFS_OPT("--prefetch-threshold=%u",	prefetch_threshold, 0),
+	PROJFS_OPT("prefetch-threads=%u",	prefetch_threads, 0),
+	PROJFS_OPT("--prefetch-threads=%u",	prefetch_threads, 0),
+	PROJFS_OPT("prefetch-window-msec=%u",	prefetch_window_msec, 0),
+	PROJFS_OPT("--prefetch-window-msec=%u",	prefetch_window_msec, 0),
+
+	PROJFS_OPT("hydration-trace=%s",	hydration_trace, 0),
+	PROJFS_OPT("--hydration-trace=%s",	hydration_trace, 0),
+
+	PROJFS_OPT("state-index=%s",	state_index, 0),
+	PROJFS_OPT("--state-index=%s",	state_index, 0),
+
+	PROJFS_OPT("io-uring",		io_uring, 1),
+	PROJFS_OPT("--io-uring",	io_uring, 1),
+
+	PROJFS_OPT("evict-budget-mb=%u",	evict_budget_mb, 0),
+	PROJFS_OPT("--evict-budget-mb=%u",	evict_budget_mb, 0),
+
+	PROJFS_OPT("pending-timeout-msec=%u",	pending_timeout_msec, 0),
+	PROJFS_OPT("--pending-timeout-msec=%u",	pending_timeout_msec, 0),
+
 	FUSE_OPT_END
 };
 
+enum log_level {
+	LOG_LEVEL_ERROR,
+	LOG_LEVEL_WARNING,
+	LOG_LEVEL_INFO,
+	LOG_LEVEL_DEBUG
+};
+
 struct projfs {
 	char *lowerdir;
 	char *mountdir;
@@ -76,24 +169,58 @@ struct projfs {
 	struct projfs_config config;
 	pthread_mutex_t mutex;
 	struct fuse_session *session;
+	struct fuse *fuse;
+	struct inval_path *inval_head;	/* kernel cache invalidation queue */
+	struct inval_path **inval_tail;
+	pthread_cond_t inval_cond;
+	pthread_t inval_thread_id;
+	int inval_running;
 	FILE *log_file;
+	struct logring *logring;	/* NULL unless log file open */
+	enum log_level log_level;
 	int lowerdir_fd;
 	pthread_t thread_id;
 	struct fdtable *fdtable;
+	struct statecache *statecache;
+	struct locktable *locktable;
+	struct tgidcache *tgidcache;
+	struct opentable *opentable;
+	struct opstats *opstats;
+	struct notifyqueue *notifyqueue;
+	struct pendtable *pendtable;
+	unsigned int chunk_shift;	/* zero unless hydrating by range */
+	struct hydsched *hydsched;	/* NULL if hydration is unlimited */
+	struct prefetch *prefetch;	/* NULL unless prefetching */
+	struct hydtrace *hydtrace;	/* NULL unless tracing */
+	struct stateindex *stateindex;	/* NULL unless indexing */
+	struct uringexec *uringexec;	/* NULL unless using io_uring */
+	struct evictor *evictor;	/* NULL unless evicting */
+	uint64_t projected_files;	/* totals for the stats file */
+	uint64_t projected_bytes;
 	int error;
 };
 
 typedef int (*projfs_handler_t)(struct projfs_event *);
 
 struct projfs_dir {
-	DIR *dir;
+	DIR *dir;			/* NULL for our reserved directory */
 	long loc;
 	struct dirent *ent;
+	int root;			/* 1 if the root of the mount */
 };
 
-// NOTE: only functional within a FUSE file operation!
+/* Our background hydration threads (prefetch workers and trace replay)
+ * have no FUSE context, so each records here the filesystem it serves and
+ * the process on whose behalf it is hydrating.
+ */
+static __thread struct projfs *worker_fs;
+static __thread pid_t worker_pid;
+
+// NOTE: only functional within a FUSE file operation or worker thread!
 static inline struct projfs *get_fuse_context_projfs(void)
 {
+	if (worker_fs != NULL)
+		return worker_fs;
 	return (struct projfs *)fuse_get_context()->private_data;
 }
 
@@ -103,60 +230,21 @@ static inline int get_fuse_context_lowerdir_fd(void)
 	return get_fuse_context_projfs()->lowerdir_fd;
 }
 
-// ceil(log10(INT_MAX)) = ceil(log10(2) * sizeof(int) * CHAR_BIT)
-//			<     (   1/3   * sizeof(int) * CHAR_BIT) + 1
-#define INT_FMT_LEN ((sizeof(int) * CHAR_BIT) / 3 + 1)
-
-#define PROC_STATUS_PATH_FMT "/proc/%d/status"
-#define MAX_PROC_STATUS_PATH_LEN \
-	(sizeof(PROC_STATUS_PATH_FMT) + INT_FMT_LEN - 3)
-
-#define PROC_STATUS_BUF_SIZE 32
-
-#define PROC_STATUS_TGID_KEY "Tgid:"
-#define PROC_STATUS_TGID_KEY_LEN (sizeof(PROC_STATUS_TGID_KEY) - 1)
-
-// NOTE: only functional within a FUSE file operation!
-static pid_t get_fuse_context_tgid(void)
-{
-	pid_t pid = fuse_get_context()->pid;
-	char path[MAX_PROC_STATUS_PATH_LEN + 1];
-	char buf[PROC_STATUS_BUF_SIZE];
-	FILE *file;
-	int found = 0;
-
-	// do not report IO or parsing errors
-	sprintf(path, PROC_STATUS_PATH_FMT, pid);
-	file = fopen(path, "r");
-	if (file == NULL)
-		return pid;		// best effort
-	while (fgets(buf, sizeof(buf), file) != NULL) {
-		if (strncmp(buf, PROC_STATUS_TGID_KEY,
-			    PROC_STATUS_TGID_KEY_LEN) == 0)
-		{
-			found = 1;
-			break;
-		}
-		while (strchr(buf, '\n') == NULL &&
-		       fgets(buf, sizeof(buf), file) != NULL);
-	}
-	fclose(file);
-
-	if (found) {
-		char *s = buf + PROC_STATUS_TGID_KEY_LEN;
-		unsigned long val = 0;
-
-		while (isblank(*s))
-			++s;
-		while (isdigit(*s) && val < INT_MAX)
-			val = val * 10 + (*s++ - '0');
-		while (isblank(*s))
-			++s;
-		if (*s == '\n' && val < INT_MAX)
-			pid = val;
-	}
+// NOTE: only functional within a FUSE file operation or worker thread!
+static inline pid_t get_fuse_context_pid(void)
+{
+	if (worker_fs != NULL)
+		return worker_pid;
+	return fuse_get_context()->pid;
+}
 
-	return pid;
+// NOTE: only functional within a FUSE file operation or worker thread!
+static inline pid_t get_fuse_context_tgid(void)
+{
+	if (worker_fs != NULL)
+		return worker_pid;
+	return tgidcache_lookup(get_fuse_context_projfs()->tgidcache,
+				fuse_get_context()->pid);
 }
 
 enum log_stderr_opt {
@@ -174,25 +262,29 @@ static void log_file_printf(FILE *file, const char *fmt, va_list ap)
 	fprintf(file, "\n");
 }
 
+/* Messages to the log file are queued in a per-thread ring and written
+ * by a background thread, so their formats must be string literals (or
+ * otherwise outlive the log file); messages to stderr are written at once.
+ */
 static void log_printf(struct projfs *fs, enum log_stderr_opt stderr_opt,
 		       const char *fmt, ...)
 {
-	FILE *log_file = NULL;
+	int use_file = 0;
 	int use_stderr = (stderr_opt != LOG_STDERR_NONE);
 	va_list ap;
 
-	if (fs == NULL || fs->log_file == NULL) {
+	if (fs == NULL || fs->logring == NULL) {
 		if (!use_stderr)
 			return;
 	} else if (stderr_opt != LOG_STDERR_ONLY) {
-		log_file = fs->log_file;
+		use_file = 1;
 		if (stderr_opt == LOG_STDERR_FALLBACK)
 			use_stderr = 0;
 	}
 
-	if (log_file != NULL) {
+	if (use_file) {
 		va_start(ap, fmt);
-		log_file_printf(log_file, fmt, ap);
+		logring_vwrite(fs->logring, fmt, ap);
 		va_end(ap);
 	}
 
@@ -203,23 +295,59 @@ static void log_printf(struct projfs *fs, enum log_stderr_opt stderr_opt,
 	}
 }
 
-// NOTE: only functional within a FUSE file operation!
-static void log_printf_fuse_context(const char *fmt, ...)
+static inline int log_level_enabled(struct projfs *fs, enum log_level level)
+{
+	return (fs->logring != NULL && level <= fs->log_level);
+}
+
+// log to the log file only, if the level is enabled
+static void log_printf_level(struct projfs *fs, enum log_level level,
+			     const char *fmt, ...)
 {
-	FILE *log_file;
 	va_list ap;
 
-	log_file = get_fuse_context_projfs()->log_file;
-	if (log_file == NULL)
+	if (!log_level_enabled(fs, level))
 		return;
 
 	va_start(ap, fmt);
-	log_file_printf(log_file, fmt, ap);
+	logring_vwrite(fs->logring, fmt, ap);
 	va_end(ap);
 }
 
+// NOTE: only functional within a FUSE file operation or worker thread!
+static void log_printf_fuse_context(enum log_level level, const char *fmt, ...)
+{
+	struct projfs *fs = get_fuse_context_projfs();
+	va_list ap;
+
+	if (!log_level_enabled(fs, level))
+		return;
+
+	va_start(ap, fmt);
+	logring_vwrite(fs->logring, fmt, ap);
+	va_end(ap);
+}
+
+static int get_log_level(const char *name, enum log_level *level)
+{
+	if (name == NULL || strcmp(name, "info") == 0)
+		*level = LOG_LEVEL_INFO;
+	else if (strcmp(name, "error") == 0)
+		*level = LOG_LEVEL_ERROR;
+	else if (strcmp(name, "warning") == 0)
+		*level = LOG_LEVEL_WARNING;
+	else if (strcmp(name, "debug") == 0)
+		*level = LOG_LEVEL_DEBUG;
+	else
+		return -1;
+
+	return 0;
+}
+
 static int log_open(struct projfs *fs)
 {
+	int res;
+
 	if (fs->config.log == NULL)
 		return 0;
 
@@ -231,79 +359,413 @@ static int log_open(struct projfs *fs)
 		return -1;
 	}
 
+	fs->logring = logring_create(fs->log_file, LOGRING_DEFAULT_RECORDS);
+	if (fs->logring == NULL) {
+		log_printf(fs, LOG_STDERR_ONLY, "failed to allocate log ring");
+		goto out_close;
+	}
+
+	res = logring_start(fs->logring);
+	if (res != 0) {
+		log_printf(fs, LOG_STDERR_ONLY,
+			   "error creating log writer thread: %s",
+			   strerror(res));
+		goto out_logring;
+	}
+
 	return 0;
+
+out_logring:
+	logring_destroy(fs->logring);
+	fs->logring = NULL;
+out_close:
+	fclose(fs->log_file);
+	fs->log_file = NULL;
+	return -1;
 }
 
+// writes out any queued messages before closing the log file
 static void log_close(struct projfs *fs)
 {
-	if (fs->log_file != NULL)
+	if (fs->logring != NULL) {
+		logring_destroy(fs->logring);
+		fs->logring = NULL;
+	}
+	if (fs->log_file != NULL) {
 		fclose(fs->log_file);
+		fs->log_file = NULL;
+	}
+}
+
+/* When the kernel is permitted to cache entries and attributes (i.e., when
+ * any of the entry, attribute, or negative lookup timeouts are non-zero),
+ * we must invalidate its caches whenever we change a projection state or
+ * the provider creates a placeholder, since these change the attributes of
+ * the affected inode or its parent directory without the kernel's knowledge.
+ *
+ * Kernel invalidation requests may block on locks held by the kernel while
+ * it waits for us to complete the very file operation which changed a
+ * projection state, so we queue the paths to invalidate and send the
+ * requests from a dedicated thread.
+ */
+
+struct inval_path {
+	struct inval_path *next;
+	char path[];
+};
+
+static int has_kernel_cache(const struct projfs_config *config)
+{
+	return (config->entry_timeout > 0 || config->attr_timeout > 0 ||
+		config->negative_timeout > 0);
 }
 
 /**
- * @return 0 or a negative errno
+ * Queues a path for invalidation in the kernel's caches, if enabled.
+ * Errors are not reported since the cache timeouts bound any staleness.
+ *
+ * @param fs projfs handle
+ * @param path path relative to lowerdir
+ * @param parent 1 if we should invalidate the parent directory containing
+ *               path, 0 if we invalidate path itself
  */
-static int send_event(projfs_handler_t handler, uint64_t mask, pid_t pid,
-		      const char *path, const char *target_path,
-		      int fd, int perm)
+static void queue_inval_path(struct projfs *fs, const char *path, int parent)
 {
-	struct projfs_event event;
-	int err;
+	struct inval_path *inval;
+	size_t len = strlen(path);
 
-	if (handler == NULL)
+	if (parent) {
+		const char *last = strrchr(path, '/');
+
+		len = (last == NULL) ? 0 : (size_t)(last - path);
+	} else if (strcmp(path, ".") == 0) {
+		len = 0;
+	}
+
+	// paths known to libfuse are absolute, relative to the mount point
+	inval = malloc(sizeof(*inval) + len + 2);
+	if (inval == NULL)
+		return;
+	inval->next = NULL;
+	inval->path[0] = '/';
+	memcpy(inval->path + 1, path, len);
+	inval->path[len + 1] = '\0';
+
+	pthread_mutex_lock(&fs->mutex);
+	if (fs->inval_running) {
+		*fs->inval_tail = inval;
+		fs->inval_tail = &inval->next;
+		pthread_cond_signal(&fs->inval_cond);
+		inval = NULL;
+	}
+	pthread_mutex_unlock(&fs->mutex);
+
+	free(inval);
+}
+
+static void *inval_loop(void *data)
+{
+	struct projfs *fs = (struct projfs *)data;
+	struct inval_path *inval;
+
+	pthread_mutex_lock(&fs->mutex);
+	while (1) {
+		while (fs->inval_head == NULL && fs->inval_running)
+			pthread_cond_wait(&fs->inval_cond, &fs->mutex);
+		if (!fs->inval_running)
+			break;
+
+		inval = fs->inval_head;
+		fs->inval_head = inval->next;
+		if (fs->inval_head == NULL)
+			fs->inval_tail = &fs->inval_head;
+		pthread_mutex_unlock(&fs->mutex);
+
+		// ENOENT just means libfuse has no node cached for the path
+		(void)fuse_invalidate_path(fs->fuse, inval->path);
+		free(inval);
+
+		pthread_mutex_lock(&fs->mutex);
+	}
+	pthread_mutex_unlock(&fs->mutex);
+
+	return NULL;
+}
+
+static int start_inval_thread(struct projfs *fs, struct fuse *fuse)
+{
+	int res;
+
+	if (!has_kernel_cache(&fs->config))
 		return 0;
 
-	if (pid == 0)
-		pid = get_fuse_context_tgid();
+	fs->fuse = fuse;
+	fs->inval_running = 1;
+	res = pthread_create(&fs->inval_thread_id, NULL, inval_loop, fs);
+	if (res != 0)
+		fs->inval_running = 0;
+
+	return res;
+}
 
-	event.fs = get_fuse_context_projfs();
-	event.mask = mask;
-	event.pid = pid;
-	event.path = path;
-	event.target_path = target_path;
-	event.fd = fd;
+static void stop_inval_thread(struct projfs *fs)
+{
+	struct inval_path *inval;
 
-	err = handler(&event);
+	pthread_mutex_lock(&fs->mutex);
+	if (!fs->inval_running) {
+		pthread_mutex_unlock(&fs->mutex);
+		return;
+	}
+	fs->inval_running = 0;
+	pthread_cond_signal(&fs->inval_cond);
+	pthread_mutex_unlock(&fs->mutex);
+
+	pthread_join(fs->inval_thread_id, NULL);
+
+	while ((inval = fs->inval_head) != NULL) {
+		fs->inval_head = inval->next;
+		free(inval);
+	}
+	fs->inval_tail = &fs->inval_head;
+	fs->fuse = NULL;
+}
+
+/**
+ * @return 0 or a negative errno
+ */
+static int call_handler(struct projfs *fs, projfs_handler_t handler,
+			struct projfs_event *event, int perm,
+			struct pending_wait *wait, enum projfs_stats_op stat)
+{
+	uint64_t start = opstats_now();
+	uint64_t nsec;
+	int err;
+
+	PROJFS_PROBE3(handler__entry, event->path, event->pid, event->mask);
+	err = handler(event);
+	if (wait != NULL) {
+		unsigned int wait_ms = fs->config.pending_timeout_msec;
+
+		if (wait_ms == 0)
+			wait_ms = PENDTABLE_DEFAULT_TIMEOUT_MSEC;
+		err = pendtable_finish(fs->pendtable, wait,
+				       (err == PROJFS_PENDING), err, wait_ms);
+	}
 	if (err < 0) {
-		log_printf_fuse_context("event handler failed: %s; "
-					"mask 0x%04" PRIx64 "-%08" PRIx64 ", "
-					"pid %d, path %s%s%s",
-					strerror(-err),
-					mask >> 32, mask & 0xFFFFFFFF,
-					pid, path,
-					(target_path == NULL)
-						? "" : ", target path ",
-					(target_path == NULL)
-						? "" : target_path);
+		log_printf_level(fs, LOG_LEVEL_WARNING,
+				 "event handler failed: %s; "
+				 "mask 0x%04" PRIx64 "-%08" PRIx64 ", "
+				 "pid %d, path %s%s%s",
+				 strerror(-err),
+				 event->mask >> 32, event->mask & 0xFFFFFFFF,
+				 event->pid, event->path,
+				 (event->target_path == NULL)
+					? "" : ", target path ",
+				 (event->target_path == NULL)
+					? "" : event->target_path);
 	}
 	else if (perm) {
 		err = (err == PROJFS_ALLOW) ? 0 : -EPERM;
 	}
 
+	nsec = opstats_now() - start;
+	PROJFS_PROBE5(handler__exit, event->path, event->pid, event->mask,
+		      err, nsec);
+	opstats_record(fs->opstats, stat, nsec, err < 0);
 	return err;
 }
 
+static void init_event(struct projfs_event *event, uint64_t mask, pid_t pid,
+		       const char *path, const char *target_path, int fd)
+{
+	event->fs = NULL;
+	event->mask = mask;
+	event->pid = pid;
+	event->path = path;
+	event->target_path = target_path;
+	event->fd = fd;
+	event->cookie = 0;
+	event->offset = 0;
+	event->length = 0;
+}
+
+static int send_event(projfs_handler_t handler, struct projfs_event *event,
+		      int perm, int pending)
+{
+	struct pending_wait wait;
+
+	if (handler == NULL)
+		return 0;
+
+	if (event->pid == 0)
+		event->pid = get_fuse_context_tgid();
+
+	event->fs = get_fuse_context_projfs();
+
+	// register before calling the handler, which may complete at once
+	if (pending) {
+		event->cookie = pendtable_add(event->fs->pendtable, &wait);
+		if (event->cookie == 0)
+			return -ENOMEM;
+	}
+
+	return call_handler(event->fs, handler, event, perm,
+			    pending ? &wait : NULL,
+			    perm ? PROJFS_STATS_PERM_HANDLER
+				 : pending ? PROJFS_STATS_PROJ_HANDLER
+					   : PROJFS_STATS_NOTIFY_HANDLER);
+}
+
+/**
+ * Classifies a projection request for scheduling: a file is most likely
+ * being opened by a user who is waiting for it, while a directory is more
+ * likely being listed as part of a larger traversal.  Prefetch and trace
+ * replay requests, and requests from any process which has lowered its
+ * own priority (e.g., with nice(1)), are treated as background work.
+ */
+static enum hydsched_class
+get_hydration_class(const struct projfs_event *event)
+{
+	int prio;
+
+	if (worker_fs != NULL)
+		return HYDSCHED_BACKGROUND;
+	errno = 0;
+	prio = getpriority(PRIO_PROCESS, event->pid);
+	if (errno == 0 && prio > 0)
+		return HYDSCHED_BACKGROUND;
+	if (event->mask & PROJFS_ONDIR)
+		return HYDSCHED_NORMAL;
+	return HYDSCHED_INTERACTIVE;
+}
+
+/**
+ * Sends a projection event, first waiting for the scheduler to allow it
+ * if the number of concurrent projections is limited.
+ *
+ * @return 0 or a negative errno
+ */
+static int send_scheduled_event(struct projfs_event *event)
+{
+	struct projfs *fs = get_fuse_context_projfs();
+	projfs_handler_t handler = fs->handlers.handle_proj_event;
+	int res;
+
+	if (handler == NULL || fs->hydsched == NULL)
+		return send_event(handler, event, 0, 1);
+
+	event->pid = get_fuse_context_tgid();
+	hydsched_enter(fs->hydsched, event->pid,
+		       get_hydration_class(event));
+	res = send_event(handler, event, 0, 1);
+	hydsched_exit(fs->hydsched);
+
+	return res;
+}
+
 /**
  * @return 0 or a negative errno
  */
 static int send_proj_event(uint64_t mask, const char *path, int fd)
 {
-	projfs_handler_t handler =
-		get_fuse_context_projfs()->handlers.handle_proj_event;
+	struct projfs_event event;
 
-	return send_event(handler, mask, 0, path, NULL, fd, 0);
+	init_event(&event, mask, 0, path, NULL, fd);
+	return send_scheduled_event(&event);
 }
 
 /**
+ * Sends a projection event for a byte range of a file.
+ *
+ * @return 0 or a negative errno
+ */
+static int send_proj_range_event(const char *path, int fd, off_t offset,
+				 size_t length)
+{
+	struct projfs_event event;
+
+	init_event(&event, PROJFS_CREATE | PROJFS_ONRANGE, 0, path, NULL,
+		   fd);
+	event.offset = offset;
+	event.length = length;
+	return send_scheduled_event(&event);
+}
+
+static void init_notify_event(struct projfs *fs, struct projfs_event *event,
+			      const struct notify_entry *entry)
+{
+	init_event(event, entry->mask, entry->pid, entry->path,
+		   entry->target_path, 0);
+	event->fs = fs;
+}
+
+// called by the notification dispatcher thread, outside of FUSE context
+static void deliver_notify_events(void *data,
+				  const struct notify_entry *entries,
+				  unsigned int n)
+{
+	struct projfs *fs = (struct projfs *)data;
+	struct projfs_event event;
+	struct projfs_event *events;
+	unsigned int i;
+	int err;
+
+	if (fs->handlers.handle_notify_batch == NULL) {
+		for (i = 0; i < n; ++i) {
+			init_notify_event(fs, &event, &entries[i]);
+			(void)call_handler(fs, fs->handlers.handle_notify_event,
+					   &event, 0, NULL,
+					   PROJFS_STATS_NOTIFY_HANDLER);
+		}
+		return;
+	}
+
+	events = calloc(n, sizeof(*events));
+	if (events == NULL) {
+		log_printf_level(fs, LOG_LEVEL_ERROR,
+				 "failed to allocate %u notification events",
+				 n);
+		return;
+	}
+
+	for (i = 0; i < n; ++i)
+		init_notify_event(fs, &events[i], &entries[i]);
+
+	err = fs->handlers.handle_notify_batch(events, n);
+	if (err < 0) {
+		log_printf_level(fs, LOG_LEVEL_WARNING,
+				 "batch event handler failed: %s; "
+				 "%u events, first path %s",
+				 strerror(-err), n, events[0].path);
+	}
+
+	free(events);
+}
+
+/**
+ * Sends a notification event, or queues it for asynchronous delivery if
+ * the notify-async option was set or a batch handler was provided; in this
+ * case, the result of the handler is not available.
+ *
  * @return 0 or a negative errno
  */
 static int send_notify_event(uint64_t mask, pid_t pid, const char *path,
 			     const char *target_path)
 {
-	projfs_handler_t handler =
-		get_fuse_context_projfs()->handlers.handle_notify_event;
+	struct projfs *fs = get_fuse_context_projfs();
+	projfs_handler_t handler = fs->handlers.handle_notify_event;
+	struct projfs_event event;
 
-	return send_event(handler, mask, pid, path, target_path, 0, 0);
+	if (fs->notifyqueue != NULL) {
+		if (pid == 0)
+			pid = get_fuse_context_tgid();
+		return -notifyqueue_push(fs->notifyqueue, mask, pid, path,
+					 target_path);
+	}
+
+	init_event(&event, mask, pid, path, target_path, 0);
+	return send_event(handler, &event, 0, 0);
 }
 
 /**
@@ -314,14 +776,17 @@ static int send_perm_event(uint64_t mask, const char *path,
 {
 	projfs_handler_t handler =
 		get_fuse_context_projfs()->handlers.handle_perm_event;
+	struct projfs_event event;
 
-	return send_event(handler, mask, 0, path, target_path, 0, 1);
+	init_event(&event, mask, 0, path, target_path, 0);
+	return send_event(handler, &event, 1, 0);
 }
 
 #define PROJ_XATTR_PRE_NAME "user.projection."
 #define PROJ_XATTR_PRE_LEN (sizeof(PROJ_XATTR_PRE_NAME) - 1)
 
 #define PROJ_STATE_XATTR_NAME PROJ_XATTR_PRE_NAME"empty"
+#define PROJ_CHUNKS_XATTR_NAME PROJ_XATTR_PRE_NAME"chunks"
 
 static int xattr_name_has_prefix(const char *name)
 {
@@ -333,7 +798,8 @@ static int xattr_name_has_prefix(const char *name)
 
 static int xattr_name_is_reserved(const char *name)
 {
-	if (strcmp(name, PROJ_STATE_XATTR_NAME) == 0)
+	if (strcmp(name, PROJ_STATE_XATTR_NAME) == 0 ||
+	    strcmp(name, PROJ_CHUNKS_XATTR_NAME) == 0)
 		return 1;
 	// add other reserved names as they are defined
 
@@ -376,33 +842,56 @@ enum proj_state {
 #define PROJ_STATE_XATTR_VALUE_POPULATED 'n'
 /* The PROJ_STATE_XATTR_NAME xattr is removed for the MODIFIED state. */
 
-static enum proj_state get_proj_state_xattr(int fd)
+/* The projection state of each inode we read or write is also recorded in
+ * an in-memory cache, so that paths which have already reached a sufficient
+ * state can be handled without opening, locking, and reading the xattr of
+ * the lower file or directory.  The cache is keyed by the lower device and
+ * inode numbers in the supplied stat(2) buffer; if this is NULL, the cache
+ * is bypassed, which is only permitted before the filesystem is mounted.
+ */
+
+static enum proj_state get_proj_state_xattr(struct projfs *fs, int fd,
+					    const struct stat *st)
 {
+	enum proj_state state;
 	char value;
 	ssize_t size = sizeof(value);
 
 	if (get_xattr(fd, PROJ_STATE_XATTR_NAME, &value, &size) == -1)
 		return PROJ_STATE_ERROR;
 
-	if (size == -1)
-		return PROJ_STATE_MODIFIED;
+	if (size == -1) {
+		state = PROJ_STATE_MODIFIED;
+	} else {
+		switch (value) {
+		case PROJ_STATE_XATTR_VALUE_POPULATED:
+			state = PROJ_STATE_POPULATED;
+			break;
+		case PROJ_STATE_XATTR_VALUE_EMPTY:
+			state = PROJ_STATE_EMPTY;
+			break;
+		default:
+			errno = EINVAL;
+			return PROJ_STATE_ERROR;
+		}
+	}
 
-	switch (value) {
-	case PROJ_STATE_XATTR_VALUE_POPULATED:
-		return PROJ_STATE_POPULATED;
-	case PROJ_STATE_XATTR_VALUE_EMPTY:
-		return PROJ_STATE_EMPTY;
-	default:
-		errno = EINVAL;
-		return PROJ_STATE_ERROR;
+	if (st != NULL) {
+		statecache_update(fs->statecache, st->st_dev, st->st_ino,
+				  state);
 	}
+
+	return state;
 }
 
-static int set_proj_state_xattr(int fd, enum proj_state state, int flags)
+static int set_proj_state_xattr(struct projfs *fs, int fd,
+				const struct stat *st, enum proj_state state,
+				int flags)
 {
 	char value;
 	void *valuep = &value;
 	ssize_t size = sizeof(value);
+	int res;
 
 	switch (state) {
 	case PROJ_STATE_POPULATED:
@@ -421,66 +910,187 @@ static int set_proj_state_xattr(int fd, enum proj_state state, int flags)
 		return -1;
 	}
 
-	return set_xattr(fd, PROJ_STATE_XATTR_NAME, valuep, &size, flags);
+	res = set_xattr(fd, PROJ_STATE_XATTR_NAME, valuep, &size, flags);
+	if (res == 0 && st != NULL) {
+		statecache_update(fs->statecache, st->st_dev, st->st_ino,
+				  state);
+	}
+
+	return res;
+}
+
+/* While a file larger than one chunk remains in the EMPTY state, and
+ * range hydration is enabled, the chunks of it which have been populated
+ * are recorded in the PROJ_CHUNKS_XATTR_NAME xattr; see chunkmap.c.  The
+ * xattr is removed once the file is fully populated.
+ */
+
+static int get_proj_chunks_xattr(struct projfs *fs, int fd,
+				 const struct stat *st, struct chunkmap *map)
+{
+	unsigned char value[CHUNKMAP_MAX_SIZE];
+	ssize_t size = sizeof(value);
+
+	if (get_xattr(fd, PROJ_CHUNKS_XATTR_NAME, value, &size) == -1)
+		return errno;
+
+	if (size == -1)
+		return chunkmap_init(map, st->st_size, fs->chunk_shift);
+
+	return chunkmap_load(map, st->st_size, value, size);
+}
+
+static int set_proj_chunks_xattr(int fd, const struct chunkmap *map)
+{
+	ssize_t size = map->size;
+
+	if (set_xattr(fd, PROJ_CHUNKS_XATTR_NAME, map->value, &size, 0) == -1)
+		return errno;
+	return 0;
+}
+
+/* When the state-index option is set, paths which are created, modified,
+ * or removed, and files which are populated, are also recorded in an
+ * index, so that providers can find them without reading the xattrs of
+ * every inode; see stateindex.c.
+ * Errors are ignored, as the index will then be rebuilt at the next mount.
+ */
+
+static void index_path_state(struct projfs *fs, const char *path, int isdir,
+			     enum stateindex_state state)
+{
+	if (fs->stateindex != NULL)
+		(void)stateindex_set(fs->stateindex, path, isdir, state);
+}
+
+/**
+ * Looks up the cached projection state of a path without opening it.
+ *
+ * @param path path relative to lowerdir
+ * @param st stat(2) buffer to fill in for the path (not following symlinks);
+ *           if the path's attributes can not be read, st_mode will be zero
+ * @return cached projection state, or PROJ_STATE_ERROR if the path's
+ *         state is not cached or its attributes could not be read
+ */
+static enum proj_state get_cached_proj_state(const char *path, struct stat *st)
+{
+	struct projfs *fs = get_fuse_context_projfs();
+	int state;
+
+	if (fstatat(fs->lowerdir_fd, path, st, AT_SYMLINK_NOFOLLOW) == -1) {
+		st->st_mode = 0;
+		return PROJ_STATE_ERROR;
+	}
+
+	state = statecache_lookup(fs->statecache, st->st_dev, st->st_ino);
+	if (state == STATECACHE_MISS)
+		return PROJ_STATE_ERROR;
+
+	return state;
+}
+
+/* The inode number of a removed path may later be reused by a file with
+ * no state xattr, which would then match a stale cache entry, so callers
+ * stat a path before removing it and drop its cached state afterwards.
+ */
+
+static void stat_removed_path(const char *path, struct stat *st)
+{
+	if (fstatat(get_fuse_context_lowerdir_fd(), path, st,
+		    AT_SYMLINK_NOFOLLOW) == -1)
+		st->st_mode = 0;
+}
+
+static void uncache_proj_state(const struct stat *st)
+{
+	if (st->st_mode != 0) {
+		statecache_invalidate(get_fuse_context_projfs()->statecache,
+				      st->st_dev, st->st_ino);
+	}
 }
 
 struct proj_state_lock {
 	int lock_fd;
 	enum proj_state state;
+	struct stat st;
+	int publish;			/* share result with lock waiters */
+	struct lock_result result;
+	const char *path;		/* for tracing only */
+	uint64_t acquired;		/* time at which lock was acquired */
 };
 
 /**
  * Acquires a lock on path and populates the supplied proj_state_lock argument
- * with the open and locked fd, and state based on the
+ * with the open and locked fd, its attributes, and state based on the
  * PROJ_STATE_XATTR_NAME xattr.
  *
+ * The lock is held in our internal lock table, keyed by the inode of the
+ * opened fd, so it does not conflict with any flock(2) locks held by
+ * clients, and waiters are woken as soon as it is released.
+ *
+ * If another caller is projecting the same inode while we wait for the
+ * lock, and it publishes a result which is either an error or a state at
+ * least equal to want, we return that result instead of acquiring the lock;
+ * in this case, lock_fd will be -1, and state will be the shared state.
+ *
  * @param state_lock structure to fill out (zeroed by this function)
  * @param path path relative to lowerdir to lock and open
  * @param flags file flags with which to open the locked fd
+ * @param want minimum projection state required by the caller, or
+ *             LOCKTABLE_NO_SHARE to always acquire the lock
  * @return 0 or an errno
  */
 static int acquire_proj_state_lock(struct proj_state_lock *state_lock,
-				   const char *path, int flags)
+				   const char *path, int flags, int want)
 {
+	struct projfs *fs = get_fuse_context_projfs();
+	struct stat *st = &state_lock->st;
+	struct lock_result shared;
 	enum proj_state state;
-	int err, wait_ms;
-	struct timespec ts;
+	uint64_t start;
+	int err;
 
 	memset(state_lock, 0, sizeof(*state_lock));
+	state_lock->path = path;
 
-	state_lock->lock_fd = openat(get_fuse_context_lowerdir_fd(),
-				     path, flags);
+	state_lock->lock_fd = openat(fs->lowerdir_fd, path, flags);
 	if (state_lock->lock_fd == -1)
 		return errno;
 
-	wait_ms = PROJ_WAIT_MSEC;
-
-retry_flock:
-	// TODO: may conflict with locks held by clients; use internal locks
-	err = flock(state_lock->lock_fd, LOCK_EX | LOCK_NB);
-	if (err == -1) {
-		if (errno == EWOULDBLOCK && wait_ms > 0) {
-			/* sleep 100ms, retry */
-			ts.tv_sec = 0;
-			ts.tv_nsec = 1000 * 1000 * 100;
-			nanosleep(&ts, NULL);
-			wait_ms -= 100;
-			goto retry_flock;
-		}
-
+	if (fstat(state_lock->lock_fd, st) == -1) {
 		err = errno;
 		goto out_close;
 	}
 
-	state = get_proj_state_xattr(state_lock->lock_fd);
+	PROJFS_PROBE3(lock__wait, path, get_fuse_context_pid(),
+		      (uint64_t)st->st_ino);
+	start = opstats_now();
+	err = locktable_lock(fs->locktable, st->st_dev, st->st_ino, want,
+			     PROJ_WAIT_MSEC, &shared);
+	state_lock->acquired = opstats_now();
+	PROJFS_PROBE4(lock__acquire, path, get_fuse_context_pid(), err,
+		      state_lock->acquired - start);
+	opstats_record(fs->opstats, PROJFS_STATS_LOCK_WAIT,
+		       state_lock->acquired - start, err > 0);
+	if (err == LOCKTABLE_SHARED) {
+		state_lock->state = shared.state;
+		err = shared.err;
+		goto out_close;
+	} else if (err != 0) {
+		goto out_close;
+	}
+
+	state = get_proj_state_xattr(fs, state_lock->lock_fd, st);
 	if (state == PROJ_STATE_ERROR) {
 		err = errno;
-		goto out_close;
+		goto out_unlock;
 	}
 
 	state_lock->state = state;
 	return 0;
 
+out_unlock:
+	locktable_unlock(fs->locktable, st->st_dev, st->st_ino, NULL);
 out_close:
 	close(state_lock->lock_fd);
 	state_lock->lock_fd = -1;
@@ -488,20 +1098,69 @@ out_close:
 }
 
 /**
- * Closes the open fd associated with state_lock, which in turn releases any
- * locks associated with the lock_fd.
+ * Releases the lock associated with state_lock, waking the next waiter (if
+ * any), and closes the open lock_fd.  If the lock holder projected the
+ * inode, its result is shared with any waiters which can accept it.
  *
  * @param state_lock projection state structure to clean up
  */
 static void release_proj_state_lock(struct proj_state_lock *state_lock)
 {
+	struct projfs *fs = get_fuse_context_projfs();
+
 	if (state_lock->lock_fd == -1)
 		return;
 
+	PROJFS_PROBE3(lock__release, state_lock->path, get_fuse_context_pid(),
+		      opstats_now() - state_lock->acquired);
+	locktable_unlock(fs->locktable, state_lock->st.st_dev,
+			 state_lock->st.st_ino,
+			 state_lock->publish ? &state_lock->result : NULL);
 	close(state_lock->lock_fd);
 	state_lock->lock_fd = -1;
 }
 
+/**
+ * Updates the projection state of a path once the provider has projected it,
+ * and records the change in the state index and for the evictor.
+ *
+ * @param fd file descriptor of inode whose projection state should be updated
+ * @param st stat(2) buffer of the inode
+ * @param path the path of the inode whose projection state should be updated
+ * @param isdir 1 if the path is a directory; 0 otherwise
+ * @param from current projection state of the inode
+ * @param to projection state to which the inode should be updated
+ * @param event_mask mask of the event sent to the provider, for tracing
+ * @param start time at which the projection began, for tracing
+ * @return 0 or an errno
+ */
+static int change_proj_state(int fd, const struct stat *st, const char *path,
+			     int isdir, enum proj_state from,
+			     enum proj_state to, uint64_t event_mask,
+			     uint64_t start)
+{
+	struct projfs *fs = get_fuse_context_projfs();
+
+	if (set_proj_state_xattr(fs, fd, st, to,
+				 (to == PROJ_STATE_POPULATED) ? XATTR_REPLACE
+							      : 0) == -1)
+		return errno;
+
+	PROJFS_PROBE6(state__change, path, get_fuse_context_pid(), event_mask,
+		      from, to, opstats_now() - start);
+	queue_inval_path(fs, path, 0);
+
+	index_path_state(fs, path, isdir,
+			 (to == PROJ_STATE_MODIFIED) ? STATEINDEX_MODIFIED
+						     : STATEINDEX_POPULATED);
+
+	// modified files are never dehydrated
+	if (!isdir && to == PROJ_STATE_MODIFIED && fs->evictor != NULL)
+		evictor_remove(fs->evictor, path);
+
+	return 0;
+}
+
 /**
  * Projects a path by notifying the provider with the given event mask.  If the
  * provider succeeds, updates the projection state on the path.
@@ -517,32 +1176,39 @@ static int project_locked_path(struct proj_state_lock *state_lock, int fd,
 			       const char *path, int isdir,
 			       enum proj_state state)
 {
+	uint64_t start = opstats_now();
+	uint64_t event_mask;
+	int perm = 0;
 	int res;
 
 	if (isdir || state == PROJ_STATE_POPULATED) {
-		uint64_t event_mask = PROJFS_CREATE;
-
+		event_mask = PROJFS_CREATE;
 		if (isdir)
 			event_mask |= PROJFS_ONDIR;
 		res = send_proj_event(event_mask, path, fd);
 	} else {
-		res = send_perm_event(PROJFS_OPEN_PERM, path, NULL);
+		event_mask = PROJFS_OPEN_PERM;
+		res = send_perm_event(event_mask, path, NULL);
+		perm = 1;
 	}
 
-	if (res < 0)
+	// permission is per-process, so never share a denial with waiters
+	if (res < 0) {
+		if (!perm)
+			goto out_publish;
 		return -res;
-
-	if (state == PROJ_STATE_POPULATED) {
-		res = set_proj_state_xattr(fd, state, XATTR_REPLACE);
-	} else {
-		res = set_proj_state_xattr(fd, state, 0);
 	}
 
-	if (res == -1)
-		return errno;
+	res = -change_proj_state(fd, &state_lock->st, path, isdir,
+				 state_lock->state, state, event_mask, start);
+	if (res == 0)
+		state_lock->state = state;
 
-	state_lock->state = state;
-	return 0;
+out_publish:
+	state_lock->publish = 1;
+	state_lock->result.state = state_lock->state;
+	state_lock->result.err = -res;
+	return -res;
 }
 
 /**
@@ -583,6 +1249,60 @@ static int fchmod_user_write_stat(int fd, struct stat *st, int set)
 	return fchmod_user_write(fd, st->st_mode, set);
 }
 
+/**
+ * Records the hydration of a file or directory in the hydration trace, and
+ * for the prefetcher, unless it was hydrated by a worker thread.
+ */
+static void record_hydration(struct projfs *fs, const char *path, int isdir)
+{
+	char *dir;
+
+	if (fs->hydtrace != NULL) {
+		(void)hydtrace_record(fs->hydtrace, isdir, path);
+		if (worker_fs == NULL)
+			hydtrace_note_foreground(fs->hydtrace, path);
+	}
+
+	if (isdir || fs->prefetch == NULL || worker_fs != NULL)
+		return;
+
+	dir = get_path_parent(path);
+	if (dir == NULL)
+		return;
+	prefetch_record(fs->prefetch, dir, get_fuse_context_tgid());
+	free(dir);
+}
+
+// counts data projected into files, as reported by the stats file
+static inline void count_projected(struct projfs *fs, uint64_t files,
+				   uint64_t bytes)
+{
+	__atomic_add_fetch(&fs->projected_files, files, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&fs->projected_bytes, bytes, __ATOMIC_RELAXED);
+}
+
+/**
+ * Counts a newly populated file, and records it for the evictor, if any,
+ * with the size of the blocks allocated by its hydration.
+ *
+ * @param ranged 1 if the file's data was counted as each range of it was
+ *               projected; 0 otherwise
+ */
+static void record_populated_file(struct projfs *fs, const char *path, int fd,
+				  int ranged)
+{
+	struct stat st;
+
+	if (fstat(fd, &st) == -1)
+		return;
+
+	count_projected(fs, 1, ranged ? 0 : st.st_size);
+	if (fs->evictor != NULL) {
+		(void)evictor_record(fs->evictor, path,
+				     (uint64_t)st.st_blocks * 512);
+	}
+}
+
 /**
  * Project a directory. Takes the path, and a flag indicating whether the
  * directory is the parent of the path, or the path itself.
@@ -600,7 +1320,7 @@ static int project_dir(const char *op, const char *path, int parent)
 	struct stat st;
 	int log = 0;
 	int reset_mode, lock_fd;
-	int res;
+	int res = 0;
 
 	if (parent)
 		lock_path = get_path_parent(path);
@@ -609,8 +1329,15 @@ static int project_dir(const char *op, const char *path, int parent)
 	if (lock_path == NULL)
 		return errno;
 
+	// skip locking and reading the xattr if already fully local
+	if (get_cached_proj_state(lock_path, &st) == PROJ_STATE_MODIFIED &&
+	    S_ISDIR(st.st_mode))
+		goto out;
+
 	res = acquire_proj_state_lock(&state_lock, lock_path,
-				      O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+				      O_RDONLY | O_DIRECTORY | O_NOFOLLOW,
+				      S_ISDIR(st.st_mode) ? PROJ_STATE_MODIFIED
+							  : LOCKTABLE_NO_SHARE);
 	if (res != 0)
 		goto out;
 
@@ -619,16 +1346,15 @@ static int project_dir(const char *op, const char *path, int parent)
 
 	// fsetxattr() requires S_IWUSR, so check and temporarily set if needed
 	lock_fd = state_lock.lock_fd;
-	if (fstat(lock_fd, &st) == -1) {
-		res = errno;
-		goto out_release;
-	}
+	st = state_lock.st;
 	reset_mode = fchmod_user_write_stat(lock_fd, &st, 1);
 
 	// directories skip intermediate state; either empty or fully local
 	res = project_locked_path(&state_lock, lock_fd, lock_path, 1,
 				  PROJ_STATE_MODIFIED);
 	log = (res == 0);
+	if (res == 0)
+		record_hydration(get_fuse_context_projfs(), lock_path, 1);
 
 	if (reset_mode)
 		 fchmod_user_write_stat(lock_fd, &st, 0);
@@ -637,7 +1363,8 @@ out_release:
 	release_proj_state_lock(&state_lock);
 
 	if (log) {
-		log_printf_fuse_context("directory projected to "
+		log_printf_fuse_context(LOG_LEVEL_INFO,
+					"directory projected to "
 					"'modified' state in '%s' op: %s",
 					op, lock_path);
 	}
@@ -648,6 +1375,10 @@ out:
 	return res;
 }
 
+// ceil(log10(INT_MAX)) = ceil(log10(2) * sizeof(int) * CHAR_BIT)
+//			<     (   1/3   * sizeof(int) * CHAR_BIT) + 1
+#define INT_FMT_LEN ((sizeof(int) * CHAR_BIT) / 3 + 1)
+
 #define PROC_SELF_FD_PATH_FMT "/proc/self/fd/%d"
 #define MAX_PROC_SELF_FD_PATH_LEN \
 	(sizeof(PROC_SELF_FD_PATH_FMT) + INT_FMT_LEN - 3)
@@ -665,6 +1396,7 @@ static int project_file(const char *op, const char *path,
 {
 	char self_fd_path[MAX_PROC_SELF_FD_PATH_LEN + 1];
 	struct proj_state_lock state_lock;
+	enum proj_state cached;
 	struct stat st;
 	int reset_mode = 0;
 	int log = 0;
@@ -674,11 +1406,19 @@ static int project_file(const char *op, const char *path,
 	if (state != PROJ_STATE_POPULATED && state != PROJ_STATE_MODIFIED)
 		return EINVAL;
 
+	// skip locking and reading the xattr if already in a sufficient state
+	cached = get_cached_proj_state(path, &st);
+	if (cached != PROJ_STATE_ERROR && cached >= state &&
+	    S_ISREG(st.st_mode))
+		return 0;
+
 	/* Pass O_NOFOLLOW so we receive ELOOP if path is an existing symlink,
 	 * which we want to ignore.
 	 */
 	res = acquire_proj_state_lock(&state_lock, path,
-				      O_RDONLY | O_NOFOLLOW | O_NONBLOCK);
+				      O_RDONLY | O_NOFOLLOW | O_NONBLOCK,
+				      S_ISREG(st.st_mode) ? (int)state
+							  : LOCKTABLE_NO_SHARE);
 	if (res != 0) {
 		if (res == ELOOP)
 			return 0;
@@ -687,11 +1427,8 @@ static int project_file(const char *op, const char *path,
 	}
 
 	lock_fd = state_lock.lock_fd;
-	if (fstat(lock_fd, &st) == -1) {
-		res = errno;
-		goto out_release;
-	}
-	else if (!S_ISREG(st.st_mode)) {
+	st = state_lock.st;
+	if (!S_ISREG(st.st_mode)) {
 		if (S_ISDIR(st.st_mode))
 			res = EISDIR;
 		else
@@ -700,10 +1437,8 @@ static int project_file(const char *op, const char *path,
 	}
 
 	// check after fstat() because we need to return EISDIR if not a file
-	if (state_lock.state == state ||
-	    state_lock.state == PROJ_STATE_MODIFIED) {
+	if (state_lock.state >= state)
 		goto out_release;
-	}
 
 	// TODO: for non-Linux, may need to use other technique to reopen file
 	sprintf(self_fd_path, PROC_SELF_FD_PATH_FMT, lock_fd);
@@ -735,6 +1470,14 @@ static int project_file(const char *op, const char *path,
 			memcpy(&times[1], &st.st_mtim, sizeof(times[1]));
 
 			futimens(lock_fd, times);		// best effort
+
+			// discard any record of a partial hydration
+			if (get_fuse_context_projfs()->chunk_shift > 0)
+				fremovexattr(fd, PROJ_CHUNKS_XATTR_NAME);
+
+			record_hydration(get_fuse_context_projfs(), path, 0);
+			record_populated_file(get_fuse_context_projfs(),
+					      path, fd, 0);
 		}
 	}
 
@@ -754,7 +1497,8 @@ out_release:
 	release_proj_state_lock(&state_lock);
 
 	if (log) {
-		log_printf_fuse_context("file projected to '%s' state "
+		log_printf_fuse_context(LOG_LEVEL_INFO,
+					"file projected to '%s' state "
 					"in '%s' op: %s",
 					(state == PROJ_STATE_POPULATED)
 						? "populated" : "modified",
@@ -764,6 +1508,212 @@ out_release:
 	return res;
 }
 
+/**
+ * Dehydrate a file, discarding its contents by punching a hole over them,
+ * and returning it to the EMPTY state, so that it will be projected again
+ * when next opened.  Any chunks of a partially populated file are
+ * discarded likewise.  Modified files are never dehydrated, nor are files
+ * open for reading, since their readers would then see only zeroes.
+ *
+ * The file is marked EMPTY before we check whether it is open, and an open
+ * is counted before the file's state is checked again, so that any open
+ * we do not see will find the file EMPTY and wait on our lock to hydrate it.
+ *
+ * @param fs projfs handle
+ * @param path path relative to lowerdir
+ * @return 0 or an errno: EPERM if the file is modified, EBUSY if it is open
+ */
+static int dehydrate_file(struct projfs *fs, const char *path)
+{
+	char self_fd_path[MAX_PROC_SELF_FD_PATH_LEN + 1];
+	struct lock_result shared;
+	struct timespec times[2];
+	enum proj_state state = PROJ_STATE_ERROR;
+	struct stat st;
+	int reset_mode = 0;
+	int lock_fd, fd;
+	int res;
+
+	lock_fd = openat(fs->lowerdir_fd, path,
+			 O_RDONLY | O_NOFOLLOW | O_NONBLOCK);
+	if (lock_fd == -1)
+		return (errno == ELOOP) ? EINVAL : errno;
+
+	if (fstat(lock_fd, &st) == -1) {
+		res = errno;
+		goto out_close;
+	}
+	if (!S_ISREG(st.st_mode)) {
+		res = S_ISDIR(st.st_mode) ? EISDIR : EINVAL;
+		goto out_close;
+	}
+
+	res = locktable_lock(fs->locktable, st.st_dev, st.st_ino,
+			     LOCKTABLE_NO_SHARE, PROJ_WAIT_MSEC, &shared);
+	if (res != 0)
+		goto out_close;
+
+	state = get_proj_state_xattr(fs, lock_fd, &st);
+	if (state == PROJ_STATE_ERROR) {
+		res = errno;
+		goto out_unlock;
+	} else if (state == PROJ_STATE_MODIFIED) {
+		res = EPERM;
+		goto out_unlock;
+	} else if (state == PROJ_STATE_EMPTY && fs->chunk_shift == 0) {
+		goto out_unlock;
+	}
+
+	sprintf(self_fd_path, PROC_SELF_FD_PATH_FMT, lock_fd);
+	fd = open(self_fd_path, O_WRONLY | O_NONBLOCK);
+	if (fd == -1) {
+		res = errno;
+		reset_mode = fchmod_user_write_stat(lock_fd, &st, 1);
+		if (!reset_mode)
+			goto out_unlock;
+		res = 0;
+
+		fd = open(self_fd_path, O_WRONLY | O_NONBLOCK);
+		if (fd == -1) {
+			res = errno;
+			goto out_mode;
+		}
+	}
+
+	if (set_proj_state_xattr(fs, fd, &st, PROJ_STATE_EMPTY,
+				 XATTR_REPLACE) == -1) {
+		res = errno;
+		goto out_fd;
+	}
+
+	if (opentable_count(fs->opentable, st.st_dev, st.st_ino) > 0) {
+		res = EBUSY;
+		goto out_restore;
+	}
+
+	if (fremovexattr(fd, PROJ_CHUNKS_XATTR_NAME) == -1 &&
+	    errno != ENOATTR) {
+		res = errno;
+		goto out_restore;
+	}
+
+	if (st.st_size > 0 &&
+	    fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+		      0, st.st_size) == -1) {
+		res = errno;
+		goto out_restore;
+	}
+
+	times[0].tv_nsec = UTIME_OMIT;
+	memcpy(&times[1], &st.st_mtim, sizeof(times[1]));
+	futimens(lock_fd, times);			// best effort
+
+	queue_inval_path(fs, path, 0);
+	index_path_state(fs, path, 0, STATEINDEX_NONE);
+
+out_restore:
+	// the contents are intact unless the hole was punched
+	if (res != 0 && state == PROJ_STATE_POPULATED) {
+		set_proj_state_xattr(fs, fd, &st, PROJ_STATE_POPULATED,
+				     XATTR_REPLACE);		// best effort
+	}
+out_fd:
+	close(fd);
+out_mode:
+	if (reset_mode)
+		fchmod_user_write_stat(lock_fd, &st, 0);	// best effort
+out_unlock:
+	locktable_unlock(fs->locktable, st.st_dev, st.st_ino, NULL);
+out_close:
+	close(lock_fd);
+
+	if (res == 0 && state == PROJ_STATE_POPULATED) {
+		log_printf_level(fs, LOG_LEVEL_INFO,
+				 "file dehydrated to 'empty' state: %s", path);
+	}
+
+	return res;
+}
+
+/**
+ * Dehydrates a least recently used file; called by the evictor thread.
+ */
+static int evict_file(void *data, const char *path)
+{
+	return dehydrate_file((struct projfs *)data, path);
+}
+
+/**
+ * Hydrates each unpopulated regular file in a directory; called by the
+ * prefetch worker threads.
+ *
+ * @param data projfs handle
+ * @param dir path of directory relative to lowerdir
+ * @param pid process ID whose hydrations prompted the prefetch
+ */
+static void prefetch_dir(void *data, const char *dir, pid_t pid)
+{
+	struct projfs *fs = (struct projfs *)data;
+	struct dirent *ent;
+	DIR *dirp;
+	char *path;
+	int fd;
+
+	worker_fs = fs;
+	worker_pid = pid;
+
+	fd = openat(fs->lowerdir_fd, dir,
+		    O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+	if (fd == -1)
+		return;
+	dirp = fdopendir(fd);
+	if (dirp == NULL) {
+		close(fd);
+		return;
+	}
+
+	while ((ent = readdir(dirp)) != NULL &&
+	       !prefetch_is_stopping(fs->prefetch)) {
+		if (ent->d_type != DT_REG && ent->d_type != DT_UNKNOWN)
+			continue;
+
+		if (strcmp(dir, ".") == 0) {
+			path = strdup(ent->d_name);
+		} else {
+			path = malloc(strlen(dir) + strlen(ent->d_name) + 2);
+			if (path != NULL)
+				sprintf(path, "%s/%s", dir, ent->d_name);
+		}
+		if (path == NULL)
+			break;
+
+		// skips files already populated, per the state cache
+		(void)project_file("prefetch", path, PROJ_STATE_POPULATED);
+		free(path);
+	}
+
+	closedir(dirp);
+}
+
+/**
+ * Hydrates a path from the hydration trace of a previous mount; called by
+ * the trace replay thread.
+ *
+ * @param data projfs handle
+ * @param isdir 1 if the path was a directory; 0 otherwise
+ * @param path path relative to lowerdir
+ */
+static void replay_hydration(void *data, int isdir, const char *path)
+{
+	worker_fs = (struct projfs *)data;
+	worker_pid = getpid();
+
+	if (isdir)
+		(void)project_dir("replay", path, 0);
+	else
+		(void)project_file("replay", path, PROJ_STATE_POPULATED);
+}
+
 /**
  * Makes a path from FUSE usable as a relative path to lowerdir_fd.  Removes
  * any leading forward slashes.  If the resulting path is empty, returns ".".
@@ -777,17 +1727,261 @@ static inline const char *make_relative_path(const char *path)
 	return path;
 }
 
+struct projfs_fh {
+	int fd;
+	int partial;			/* hydrated by range on read */
+};
+
+#define get_fh(fi) ((struct projfs_fh *)(uintptr_t)(fi)->fh)
+#define get_fh_fd(fi) (get_fh(fi)->fd)
+
+/**
+ * @param fi file info to store the new handle in
+ * @param fd open file descriptor
+ * @param partial 1 if the file is hydrated by range; 0 otherwise
+ * @return 0 or an errno
+ */
+static int set_fh(struct fuse_file_info *fi, int fd, int partial)
+{
+	struct projfs_fh *fh;
+
+	fh = malloc(sizeof(*fh));
+	if (fh == NULL)
+		return ENOMEM;
+	fh->fd = fd;
+	fh->partial = partial;
+
+	fi->fh = (uintptr_t)fh;
+	return 0;
+}
+
+static void free_fh(struct fuse_file_info *fi)
+{
+	free(get_fh(fi));
+	fi->fh = 0;
+}
+
+/* The reserved directory VIRTUAL_DIR at the root of the mount holds files
+ * generated from our in-memory counters, so that operators may read them
+ * (e.g., "cat $MOUNT/.projfs/stats") without any separate interface.
+ * Reserved paths are never passed to the lower directory, and the
+ * directory is not listed by readdir; any lower entry of the same name is
+ * hidden.
+ *
+ * When a virtual file is opened we write a snapshot of its contents into
+ * an anonymous memory file, whose descriptor then serves as the file
+ * handle, so that reads and other operations on the handle need no
+ * special treatment.
+ */
+#define VIRTUAL_DIR ".projfs"
+#define VIRTUAL_STATS "stats"
+
+enum virtual_path {
+	VIRTUAL_NONE,			/* not a reserved path */
+	VIRTUAL_DIR_PATH,
+	VIRTUAL_STATS_PATH,
+	VIRTUAL_MISSING_PATH		/* reserved, but nonexistent */
+};
+
+// takes a path from make_relative_path()
+static enum virtual_path get_virtual_path(const char *path)
+{
+	size_t len = strlen(VIRTUAL_DIR);
+
+	if (strncmp(path, VIRTUAL_DIR, len) != 0)
+		return VIRTUAL_NONE;
+	if (path[len] == '\0')
+		return VIRTUAL_DIR_PATH;
+	if (path[len] != '/')
+		return VIRTUAL_NONE;
+	if (strcmp(path + len + 1, VIRTUAL_STATS) == 0)
+		return VIRTUAL_STATS_PATH;
+	return VIRTUAL_MISSING_PATH;
+}
+
+#define is_virtual_path(path) (get_virtual_path(path) != VIRTUAL_NONE)
+
+static int get_virtual_attr(enum virtual_path vpath, struct stat *attr)
+{
+	if (vpath == VIRTUAL_MISSING_PATH)
+		return ENOENT;
+
+	memset(attr, 0, sizeof(*attr));
+	if (vpath == VIRTUAL_DIR_PATH) {
+		attr->st_mode = S_IFDIR | 0555;
+		attr->st_nlink = 2;
+	} else {
+		// as in procfs, the size is unknown until the file is read
+		attr->st_mode = S_IFREG | 0444;
+		attr->st_nlink = 1;
+	}
+	attr->st_uid = getuid();
+	attr->st_gid = getgid();
+	clock_gettime(CLOCK_REALTIME, &attr->st_mtim);
+	attr->st_atim = attr->st_mtim;
+	attr->st_ctim = attr->st_mtim;
+
+	return 0;
+}
+
+/**
+ * Writes the contents of the stats file, one "name value" pair per line,
+ * followed by a line for each kind of operation which has occurred, of
+ * the form "op name count errors total_nsec max_nsec".
+ *
+ * @return 0 or an errno
+ */
+static int write_stats(struct projfs *fs, int fd)
+{
+	const struct projfs_op_stats *lock, *proj, *notify, *perm, *op;
+	struct projfs_notify_stats queue;
+	struct evictor_stats evict;
+	struct projfs_stats *stats;
+	unsigned int fds_used, fds_size;
+	unsigned int i;
+	int res;
+
+	stats = malloc(sizeof(*stats));
+	if (stats == NULL)
+		return ENOMEM;
+
+	res = projfs_get_stats(fs, stats);
+	if (res != 0)
+		goto out;
+	(void)projfs_get_notify_stats(fs, &queue);
+	fdtable_get_usage(fs->fdtable, &fds_used, &fds_size);
+
+	lock = &stats->ops[PROJFS_STATS_LOCK_WAIT];
+	proj = &stats->ops[PROJFS_STATS_PROJ_HANDLER];
+	notify = &stats->ops[PROJFS_STATS_NOTIFY_HANDLER];
+	perm = &stats->ops[PROJFS_STATS_PERM_HANDLER];
+
+	if (dprintf(fd,
+		    "files_projected %" PRIu64 "\n"
+		    "bytes_projected %" PRIu64 "\n"
+		    "proj_handler_calls %" PRIu64 "\n"
+		    "proj_handler_errors %" PRIu64 "\n"
+		    "notify_handler_calls %" PRIu64 "\n"
+		    "notify_handler_errors %" PRIu64 "\n"
+		    "perm_handler_calls %" PRIu64 "\n"
+		    "perm_handler_errors %" PRIu64 "\n"
+		    "lock_waits %" PRIu64 "\n"
+		    "lock_wait_timeouts %" PRIu64 "\n"
+		    "lock_wait_nsec %" PRIu64 "\n"
+		    "lock_wait_max_nsec %" PRIu64 "\n"
+		    "fdtable_entries %u\n"
+		    "fdtable_slots %u\n"
+		    "notify_queued %" PRIu64 "\n"
+		    "notify_dropped %" PRIu64 "\n"
+		    "notify_queue_depth %u\n",
+		    __atomic_load_n(&fs->projected_files, __ATOMIC_RELAXED),
+		    __atomic_load_n(&fs->projected_bytes, __ATOMIC_RELAXED),
+		    proj->count, proj->errors,
+		    notify->count, notify->errors,
+		    perm->count, perm->errors,
+		    lock->count, lock->errors,
+		    lock->total_nsec, lock->max_nsec,
+		    fds_used, fds_size,
+		    queue.queued, queue.dropped, queue.depth) < 0)
+		goto out_errno;
+
+	if (fs->evictor != NULL) {
+		evictor_get_stats(fs->evictor, &evict);
+		if (dprintf(fd,
+			    "evict_tracked_bytes %" PRIu64 "\n"
+			    "evict_tracked_files %u\n"
+			    "evicted_bytes %" PRIu64 "\n"
+			    "evicted_files %" PRIu64 "\n",
+			    evict.tracked_bytes, evict.tracked_files,
+			    evict.evicted_bytes, evict.evicted_files) < 0)
+			goto out_errno;
+	}
+
+	for (i = 0; i < PROJFS_STATS_MAX; ++i) {
+		op = &stats->ops[i];
+		if (op->count == 0)
+			continue;
+		if (dprintf(fd, "op %s %" PRIu64 " %" PRIu64 " %" PRIu64
+				" %" PRIu64 "\n",
+			    projfs_stats_op_name(i), op->count, op->errors,
+			    op->total_nsec, op->max_nsec) < 0)
+			goto out_errno;
+	}
+
+	goto out;
+
+out_errno:
+	res = errno;
+out:
+	free(stats);
+	return res;
+}
+
+static int open_virtual_file(enum virtual_path vpath,
+			     struct fuse_file_info *fi)
+{
+	int res;
+	int fd;
+
+	if (vpath == VIRTUAL_MISSING_PATH)
+		return ENOENT;
+	if (vpath == VIRTUAL_DIR_PATH)
+		return EISDIR;
+	if ((fi->flags & O_ACCMODE) != O_RDONLY || (fi->flags & O_TRUNC))
+		return EACCES;
+
+	fd = memfd_create(VIRTUAL_STATS, MFD_CLOEXEC);
+	if (fd == -1)
+		return errno;
+
+	res = write_stats(get_fuse_context_projfs(), fd);
+	if (res != 0) {
+		close(fd);
+		return res;
+	}
+
+	res = set_fh(fi, fd, 0);
+	if (res != 0) {
+		close(fd);
+		return res;
+	}
+	// the file has no fixed size, so bypass the page cache
+	fi->direct_io = 1;
+	return 0;
+}
+
+static int fill_virtual_dir(void *buf, fuse_fill_dir_t filler, off_t off)
+{
+	static const char *const names[] = { ".", "..", VIRTUAL_STATS };
+	off_t i;
+
+	for (i = off; i < (off_t)(sizeof(names) / sizeof(names[0])); ++i) {
+		if (filler(buf, names[i], NULL, i + 1, 0))
+			break;
+	}
+
+	return 0;
+}
+
 // filesystem ops
 
 static int projfs_op_getattr(char const *path, struct stat *attr,
                              struct fuse_file_info *fi)
 {
+	enum virtual_path vpath = VIRTUAL_NONE;
 	int res;
 
+	// libfuse may pass a NULL path if fi is provided
+	if (path != NULL) {
+		path = make_relative_path(path);
+		vpath = get_virtual_path(path);
+	}
+	if (vpath != VIRTUAL_NONE)
+		return -get_virtual_attr(vpath, attr);
+
 	if (fi)
-		res = fstat(fi->fh, attr);
+		res = fstat(get_fh_fd(fi), attr);
 	else {
-		path = make_relative_path(path);
 		if (strcmp(path, ".") != 0) {
 			res = project_dir("getattr", path, 1);
 			if (res)
@@ -804,6 +1998,8 @@ static int projfs_op_readlink(char const *path, char *buf, size_t size)
 	int res;
 
 	path = make_relative_path(path);
+	if (is_virtual_path(path))
+		return -EINVAL;
 	res = project_dir("readlink", path, 1);
 	if (res)
 		return -res;
@@ -823,6 +2019,9 @@ static int projfs_op_link(char const *src, char const *dst)
 	 *       fail when src is an empty path, as we expect.
 	 */
 	src = make_relative_path(src);
+	dst = make_relative_path(dst);
+	if (is_virtual_path(src) || is_virtual_path(dst))
+		return -EPERM;
 	res = project_dir("link", src, 1);
 	if (res)
 		return -res;
@@ -834,7 +2033,6 @@ static int projfs_op_link(char const *src, char const *dst)
 	if (res)
 		return -res;
 
-	dst = make_relative_path(dst);
 	res = project_dir("link2", dst, 1);
 	if (res)
 		return -res;
@@ -844,6 +2042,9 @@ static int projfs_op_link(char const *src, char const *dst)
 	if (res == -1)
 		return -errno;
 
+	index_path_state(get_fuse_context_projfs(), dst, 0,
+			 STATEINDEX_MODIFIED);
+
 	// do not report event handler errors after successful link op
 	(void)send_notify_event(PROJFS_CREATE | PROJFS_ONLINK, 0, src, dst);
 	return 0;
@@ -852,14 +2053,23 @@ static int projfs_op_link(char const *src, char const *dst)
 static void *projfs_op_init(struct fuse_conn_info *conn,
                             struct fuse_config *cfg)
 {
+	struct projfs *fs = get_fuse_context_projfs();
+
 	(void)conn;
 
-	cfg->entry_timeout = 0;
-	cfg->attr_timeout = 0;
-	cfg->negative_timeout = 0;
+	// only allow kernel caching if we can invalidate its caches
+	if (fs->inval_running) {
+		cfg->entry_timeout = fs->config.entry_timeout;
+		cfg->attr_timeout = fs->config.attr_timeout;
+		cfg->negative_timeout = fs->config.negative_timeout;
+	} else {
+		cfg->entry_timeout = 0;
+		cfg->attr_timeout = 0;
+		cfg->negative_timeout = 0;
+	}
 	cfg->use_ino = 1;
 
-	return get_fuse_context_projfs();
+	return fs;
 }
 
 #define has_write_mode(fi) ((fi)->flags & (O_WRONLY | O_RDWR))
@@ -868,13 +2078,13 @@ static int projfs_op_flush(char const *path, struct fuse_file_info *fi)
 {
 	int res, err;
 
-	res = close(dup(fi->fh));
+	res = close(dup(get_fh_fd(fi)));
 	err = errno;		// errno may be changed by fdtable realloc
 
 	if (has_write_mode(fi)) {
 		// do not report table realloc errors after successful close op
 		(void)fdtable_replace(get_fuse_context_projfs()->fdtable,
-				      fi->fh, get_fuse_context_tgid());
+				      get_fh_fd(fi), get_fuse_context_tgid());
 	}
 
 	return res == -1 ? -err : 0;
@@ -887,9 +2097,9 @@ static int projfs_op_fsync(char const *path, int datasync,
 
 	(void)path;
 	if (datasync)
-		res = fdatasync(fi->fh);
+		res = fdatasync(get_fh_fd(fi));
 	else
-		res = fsync(fi->fh);
+		res = fsync(get_fh_fd(fi));
 	return res == -1 ? -errno : 0;
 }
 
@@ -902,6 +2112,8 @@ static int projfs_op_mknod(char const *path, mode_t mode, dev_t rdev)
 	(void)rdev;
 
 	path = make_relative_path(path);
+	if (is_virtual_path(path))
+		return -EPERM;
 	res = project_dir("mknod", path, 1);
 	if (res)
 		return -res;
@@ -911,7 +2123,12 @@ static int projfs_op_mknod(char const *path, mode_t mode, dev_t rdev)
 		res = mkfifoat(get_fuse_context_lowerdir_fd(), path, mode);
 	else
 		return -ENOSYS;
-	return res == -1 ? -errno : 0;
+	if (res == -1)
+		return -errno;
+
+	index_path_state(get_fuse_context_projfs(), path, 0,
+			 STATEINDEX_MODIFIED);
+	return 0;
 }
 
 static int projfs_op_symlink(char const *link, char const *path)
@@ -919,11 +2136,18 @@ static int projfs_op_symlink(char const *link, char const *path)
 	int res;
 
 	path = make_relative_path(path);
+	if (is_virtual_path(path))
+		return -EPERM;
 	res = project_dir("symlink", path, 1);
 	if (res)
 		return -res;
 	res = symlinkat(link, get_fuse_context_lowerdir_fd(), path);
-	return res == -1 ? -errno : 0;
+	if (res == -1)
+		return -errno;
+
+	index_path_state(get_fuse_context_projfs(), path, 0,
+			 STATEINDEX_MODIFIED);
+	return 0;
 }
 
 static int projfs_op_create(char const *path, mode_t mode,
@@ -941,6 +2165,8 @@ static int projfs_op_create(char const *path, mode_t mode,
 	int fd;
 
 	path = make_relative_path(path);
+	if (is_virtual_path(path))
+		return -EPERM;
 	res = project_dir("create", path, 1);
 	if (res)
 		return -res;
@@ -952,7 +2178,11 @@ static int projfs_op_create(char const *path, mode_t mode,
 	fd = openat(get_fuse_context_lowerdir_fd(), path, flags, mode);
 	if (fd == -1)
 		return -errno;
-	fi->fh = fd;
+	res = set_fh(fi, fd, 0);
+	if (res != 0) {
+		close(fd);
+		return -res;
+	}
 
 	if (has_write_mode(fi)) {
 		// do not report table realloc errors after successful open op
@@ -960,22 +2190,115 @@ static int projfs_op_create(char const *path, mode_t mode,
 				     fd, get_fuse_context_tgid());
 	 }
 
+	index_path_state(get_fuse_context_projfs(), path, 0,
+			 STATEINDEX_MODIFIED);
+
 	// do not report event handler errors after successful open op
 	(void)send_notify_event(PROJFS_CREATE, 0, path, NULL);
 	return 0;
 }
 
+/**
+ * @return 1 if fd is an unpopulated regular file larger than one chunk
+ */
+static int is_partial_file(int fd)
+{
+	struct projfs *fs = get_fuse_context_projfs();
+	struct stat st;
+	int state;
+
+	if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) ||
+	    st.st_size <= ((off_t)1 << fs->chunk_shift))
+		return 0;
+
+	state = statecache_lookup(fs->statecache, st.st_dev, st.st_ino);
+	if (state == STATECACHE_MISS)
+		state = get_proj_state_xattr(fs, fd, &st);
+
+	return (state == PROJ_STATE_EMPTY);
+}
+
+/**
+ * Counts a file handle open for reading, so that the file is not dehydrated
+ * while it remains open, and hydrates the file again if it was dehydrated
+ * before it was counted.
+ *
+ * @param path path relative to lowerdir
+ * @param fd file descriptor opened for reading
+ * @param partial 1 if the file is hydrated by range; 0 otherwise
+ * @return 0 or an errno
+ */
+static int count_open_file(const char *path, int fd, int partial)
+{
+	struct projfs *fs = get_fuse_context_projfs();
+	struct stat st;
+	int state;
+	int res;
+
+	if (fstat(fd, &st) == -1)
+		return errno;
+	if (!S_ISREG(st.st_mode))
+		return 0;
+
+	res = opentable_add(fs->opentable, st.st_dev, st.st_ino);
+	if (res != 0 || partial)
+		return res;
+
+	state = statecache_lookup(fs->statecache, st.st_dev, st.st_ino);
+	if (state == STATECACHE_MISS)
+		state = get_proj_state_xattr(fs, fd, &st);
+	if (state == PROJ_STATE_EMPTY) {
+		res = project_file("open", path, PROJ_STATE_POPULATED);
+		if (res != 0) {
+			opentable_remove(fs->opentable, st.st_dev, st.st_ino);
+			return res;
+		}
+	}
+
+	if (fs->evictor != NULL)
+		evictor_touch(fs->evictor, path);
+	return 0;
+}
+
 static int projfs_op_open(char const *path, struct fuse_file_info *fi)
 {
 	int flags = fi->flags & ~O_NOFOLLOW;
+	enum virtual_path vpath;
 	int res;
 	int fd;
 
 	path = make_relative_path(path);
+	vpath = get_virtual_path(path);
+	if (vpath != VIRTUAL_NONE)
+		return -open_virtual_file(vpath, fi);
 	res = project_dir("open", path, 1);
 	if (res)
 		return -res;
 
+	/* With range hydration, a large unpopulated file opened for reading
+	 * is not projected here; instead, each read projects the chunks it
+	 * requires.  A file opened with O_TRUNC, even for reading only, is
+	 * projected in full first, as it would be truncated by our openat(2).
+	 */
+	if (!has_write_mode(fi) && !(flags & O_TRUNC) &&
+	    get_fuse_context_projfs()->chunk_shift > 0) {
+		fd = openat(get_fuse_context_lowerdir_fd(), path, flags);
+		if (fd != -1) {
+			if (is_partial_file(fd)) {
+				res = set_fh(fi, fd, 1);
+				if (res == 0)
+					res = count_open_file(path, fd, 1);
+				if (res != 0) {
+					free_fh(fi);
+					close(fd);
+					return -res;
+				}
+				return 0;
+			}
+			close(fd);
+		}
+	}
+
 	/* Per above, allow hydration to fail with ENOENT; if the file
 	 * operation should fail for that reason (i.e. O_CREAT is not specified
 	 * and the file doesn't exist), we'll return the failure from openat(2)
@@ -995,14 +2318,25 @@ static int projfs_op_open(char const *path, struct fuse_file_info *fi)
 	fd = openat(get_fuse_context_lowerdir_fd(), path, flags);
 	if (fd == -1)
 		return -errno;
+	res = set_fh(fi, fd, 0);
+	if (res != 0) {
+		close(fd);
+		return -res;
+	}
 
 	if (has_write_mode(fi)) {
 		// do not report table realloc errors after successful open op
 		(void)fdtable_insert(get_fuse_context_projfs()->fdtable,
 				     fd, get_fuse_context_tgid());
+	} else {
+		res = count_open_file(path, fd, 0);
+		if (res != 0) {
+			free_fh(fi);
+			close(fd);
+			return -res;
+		}
 	}
 
-	fi->fh = fd;
 	return 0;
 }
 
@@ -1016,21 +2350,173 @@ static int projfs_op_statfs(char const *path, struct statvfs *buf)
 	return res == -1 ? -errno : 0;
 }
 
+/**
+ * Projects any unpopulated chunks of a partially hydrated file which overlap
+ * a byte range, so that the range may be read, and records them as populated
+ * in the file's chunk map.  Once all its chunks are populated, the file is
+ * changed to the populated state.
+ *
+ * As the file is already open, we lock its inode directly, rather than
+ * opening it again by path.
+ *
+ * @param fd open file descriptor of the partially hydrated file
+ * @param path current path of the file relative to lowerdir
+ * @param off offset of the start of the range
+ * @param size length of the range
+ * @return 0 or an errno
+ */
+static int project_file_range(int fd, const char *path, off_t off,
+			      size_t size)
+{
+	struct projfs *fs = get_fuse_context_projfs();
+	char self_fd_path[MAX_PROC_SELF_FD_PATH_LEN + 1];
+	struct lock_result shared;
+	struct chunkmap map;
+	struct stat st;
+	uint64_t first, count;
+	uint64_t proj_start;
+	int reset_mode = 0;
+	int log = 0;
+	int state, wfd, res;
+
+	if (fstat(fd, &st) == -1)
+		return errno;
+	if (off >= st.st_size)
+		return 0;
+
+	state = statecache_lookup(fs->statecache, st.st_dev, st.st_ino);
+	if (state == STATECACHE_MISS)
+		state = get_proj_state_xattr(fs, fd, &st);
+	if (state != PROJ_STATE_EMPTY)
+		return (state == PROJ_STATE_ERROR) ? errno : 0;
+
+	// most reads will find their chunks populated, so check before locking
+	res = get_proj_chunks_xattr(fs, fd, &st, &map);
+	if (res != 0)
+		return res;
+	count = chunkmap_find_missing(&map, off, size, &first);
+	chunkmap_free(&map);
+	if (count == 0)
+		return 0;
+
+	res = locktable_lock(fs->locktable, st.st_dev, st.st_ino,
+			     LOCKTABLE_NO_SHARE, PROJ_WAIT_MSEC, &shared);
+	if (res != 0)
+		return res;
+	proj_start = opstats_now();
+
+	// the file may have been projected while we waited for the lock
+	state = get_proj_state_xattr(fs, fd, &st);
+	if (state != PROJ_STATE_EMPTY) {
+		res = (state == PROJ_STATE_ERROR) ? errno : 0;
+		goto out_unlock;
+	}
+	res = get_proj_chunks_xattr(fs, fd, &st, &map);
+	if (res != 0)
+		goto out_unlock;
+
+	sprintf(self_fd_path, PROC_SELF_FD_PATH_FMT, fd);
+	wfd = open(self_fd_path, O_WRONLY | O_NONBLOCK);
+	if (wfd == -1) {
+		res = errno;
+		reset_mode = fchmod_user_write_stat(fd, &st, 1);
+		if (!reset_mode)
+			goto out_map;
+		res = 0;
+
+		wfd = open(self_fd_path, O_WRONLY | O_NONBLOCK);
+		if (wfd == -1) {
+			res = errno;
+			goto out_mode;
+		}
+	}
+
+	while ((count = chunkmap_find_missing(&map, off, size, &first)) > 0) {
+		off_t start = chunkmap_offset(&map, first);
+		off_t end = chunkmap_offset(&map, first + count);
+
+		if (end > st.st_size)
+			end = st.st_size;
+		res = send_proj_range_event(path, wfd, start, end - start);
+		if (res < 0) {
+			res = -res;
+			break;
+		}
+		res = 0;
+		chunkmap_set(&map, first, count);
+		count_projected(fs, 0, end - start);
+		log = 1;
+	}
+
+	if (log) {
+		struct timespec times[2];
+
+		times[0].tv_nsec = UTIME_OMIT;
+		memcpy(&times[1], &st.st_mtim, sizeof(times[1]));
+		futimens(fd, times);			// best effort
+
+		if (!chunkmap_is_full(&map)) {
+			// on failure, chunks will only be projected again
+			(void)set_proj_chunks_xattr(wfd, &map);
+			log = 0;
+		} else if (change_proj_state(wfd, &st, path, 0,
+					     PROJ_STATE_EMPTY,
+					     PROJ_STATE_POPULATED,
+					     PROJFS_CREATE | PROJFS_ONRANGE,
+					     proj_start) == 0) {
+			fremovexattr(wfd, PROJ_CHUNKS_XATTR_NAME);
+			record_hydration(fs, path, 0);
+			record_populated_file(fs, path, wfd, 1);
+		} else {
+			(void)set_proj_chunks_xattr(wfd, &map);
+			log = 0;
+		}
+	}
+
+	close(wfd);
+
+out_mode:
+	if (reset_mode)
+		fchmod_user_write_stat(fd, &st, 0);		// best effort
+out_map:
+	chunkmap_free(&map);
+out_unlock:
+	locktable_unlock(fs->locktable, st.st_dev, st.st_ino, NULL);
+
+	if (log) {
+		log_printf_fuse_context(LOG_LEVEL_INFO,
+					"file projected to 'populated' state "
+					"in 'read' op: %s", path);
+	}
+
+	return res;
+}
+
 static int projfs_op_read_buf(char const *path, struct fuse_bufvec **bufp,
 			      size_t size, off_t off,
 			      struct fuse_file_info *fi)
 {
-	struct fuse_bufvec *src = malloc(sizeof(*src));
+	struct fuse_bufvec *src;
+	int res;
 
-	(void) path;
+	if (get_fh(fi)->partial) {
+		// path is NULL if libfuse can no longer find the file
+		if (path == NULL)
+			return -ENOENT;
+		res = project_file_range(get_fh_fd(fi),
+					 make_relative_path(path), off, size);
+		if (res)
+			return -res;
+	}
 
+	src = malloc(sizeof(*src));
 	if (!src)
 		return -errno;
 
 	*src = FUSE_BUFVEC_INIT(size);
 
 	src->buf[0].flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK;
-	src->buf[0].fd = fi->fh;
+	src->buf[0].fd = get_fh_fd(fi);
 	src->buf[0].pos = off;
 
 	*bufp = src;
@@ -1045,7 +2531,7 @@ static int projfs_op_write_buf(char const *path, struct fuse_bufvec *src,
 
 	(void)path;
 	buf.buf[0].flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK;
-	buf.buf[0].fd = fi->fh;
+	buf.buf[0].fd = get_fh_fd(fi);
 	buf.buf[0].pos = off;
 
 	return fuse_buf_copy(&buf, src, FUSE_BUF_SPLICE_NONBLOCK);
@@ -1053,35 +2539,47 @@ static int projfs_op_write_buf(char const *path, struct fuse_bufvec *src,
 
 static int projfs_op_release(char const *path, struct fuse_file_info *fi)
 {
+	struct projfs *fs = get_fuse_context_projfs();
+	struct stat st;
 	int res, err;
 	pid_t pid = 0;
 
-	res = close(fi->fh);
+	if (!has_write_mode(fi) && fstat(get_fh_fd(fi), &st) == 0 &&
+	    S_ISREG(st.st_mode))
+		opentable_remove(fs->opentable, st.st_dev, st.st_ino);
+
+	res = close(get_fh_fd(fi));
 	err = errno;		// errno may be changed by fdtable realloc
 
 	if (has_write_mode(fi)) {
 		// do not report table realloc errors after successful close op
-		(void)fdtable_remove(get_fuse_context_projfs()->fdtable,
-				     fi->fh, &pid);
+		(void)fdtable_remove(fs->fdtable, get_fh_fd(fi), &pid);
 	}
 
 	// return value is ignored by libfuse, but be consistent anyway
-	if (res == -1)
+	if (res == -1) {
+		free_fh(fi);
 		return -err;
+	}
 
-	if (has_write_mode(fi)) {
+	// path is NULL if libfuse can no longer find the file's current path
+	if (has_write_mode(fi) && path != NULL) {
 		// do not report event handler errors after successful close op
 		(void)send_notify_event(PROJFS_CLOSE_WRITE, pid,
 					make_relative_path(path), NULL);
 	}
+	free_fh(fi);
 	return 0;
 }
 
 static int projfs_op_unlink(char const *path)
 {
+	struct stat st;
 	int res;
 
 	path = make_relative_path(path);
+	if (is_virtual_path(path))
+		return -EPERM;
 	res = send_perm_event(PROJFS_DELETE_PERM, path, NULL);
 	if (res < 0)
 		return res;
@@ -1089,9 +2587,16 @@ static int projfs_op_unlink(char const *path)
 	if (res)
 		return -res;
 
+	stat_removed_path(path, &st);
 	res = unlinkat(get_fuse_context_lowerdir_fd(), path, 0);
 	if (res == -1)
 		return -errno;
+	uncache_proj_state(&st);
+
+	index_path_state(get_fuse_context_projfs(), path, 0,
+			 STATEINDEX_DELETED);
+	if (get_fuse_context_projfs()->evictor != NULL)
+		evictor_remove(get_fuse_context_projfs()->evictor, path);
 
 	// do not report event handler errors after successful unlink op
 	(void)send_notify_event(PROJFS_DELETE, 0, path, NULL);
@@ -1103,6 +2608,8 @@ static int projfs_op_mkdir(char const *path, mode_t mode)
 	int res;
 
 	path = make_relative_path(path);
+	if (is_virtual_path(path))
+		return -EPERM;
 	res = project_dir("mkdir", path, 1);
 	if (res)
 		return -res;
@@ -1112,6 +2619,9 @@ static int projfs_op_mkdir(char const *path, mode_t mode)
 	if (res == -1)
 		return -errno;
 
+	index_path_state(get_fuse_context_projfs(), path, 1,
+			 STATEINDEX_MODIFIED);
+
 	// do not report event handler errors after successful mkdir op
 	(void)send_notify_event(PROJFS_CREATE | PROJFS_ONDIR, 0, path, NULL);
 	return 0;
@@ -1119,9 +2629,12 @@ static int projfs_op_mkdir(char const *path, mode_t mode)
 
 static int projfs_op_rmdir(char const *path)
 {
+	struct stat st;
 	int res;
 
 	path = make_relative_path(path);
+	if (is_virtual_path(path))
+		return -EPERM;
 	res = send_perm_event(PROJFS_DELETE_PERM | PROJFS_ONDIR, path, NULL);
 	if (res < 0)
 		return res;
@@ -1129,23 +2642,52 @@ static int projfs_op_rmdir(char const *path)
 	if (res)
 		return -res;
 
+	stat_removed_path(path, &st);
 	res = unlinkat(get_fuse_context_lowerdir_fd(), path, AT_REMOVEDIR);
 	if (res == -1)
 		return -errno;
+	uncache_proj_state(&st);
+
+	index_path_state(get_fuse_context_projfs(), path, 1,
+			 STATEINDEX_DELETED);
 
 	// do not report event handler errors after successful rmdir op
 	(void)send_notify_event(PROJFS_DELETE | PROJFS_ONDIR, 0, path, NULL);
 	return 0;
 }
 
+static void index_rename(const char *src, int src_isdir, const char *dst,
+			 unsigned int flags)
+{
+	struct projfs *fs = get_fuse_context_projfs();
+	int exchange = (flags & RENAME_EXCHANGE) != 0;
+	int dst_isdir = 0;
+	struct stat st;
+
+	if (fs->stateindex == NULL)
+		return;
+
+	// after an exchange, the former destination is found at src
+	if (exchange && fstatat(fs->lowerdir_fd, src, &st,
+				AT_SYMLINK_NOFOLLOW) == 0)
+		dst_isdir = S_ISDIR(st.st_mode);
+
+	(void)stateindex_rename(fs->stateindex, src, src_isdir, dst,
+				dst_isdir, exchange);
+}
+
 static int projfs_op_rename(char const *src, char const *dst,
                             unsigned int flags)
 {
 	uint64_t dir_mask = 0;
+	struct stat st;
 	int lowerdir_fd;
 	int res;
 
 	src = make_relative_path(src);
+	dst = make_relative_path(dst);
+	if (is_virtual_path(src) || is_virtual_path(dst))
+		return -EPERM;
 	res = project_dir("rename", src, 1);
 	if (res)
 		return -res;
@@ -1156,7 +2698,6 @@ static int projfs_op_rename(char const *src, char const *dst,
 	else if (res)
 		return -res;
 
-	dst = make_relative_path(dst);
 	res = project_dir("rename2", dst, 1);
 	if (res)
 		return -res;
@@ -1165,12 +2706,24 @@ static int projfs_op_rename(char const *src, char const *dst,
 	if (res < 0)
 		return res;
 
+	// an exchange leaves both inodes in place
+	st.st_mode = 0;
+	if (!(flags & RENAME_EXCHANGE))
+		stat_removed_path(dst, &st);
+
 	// TODO: for non Linux, use renameat(); fail if flags != 0
 	lowerdir_fd = get_fuse_context_lowerdir_fd();
 	res = syscall(SYS_renameat2, lowerdir_fd, src, lowerdir_fd, dst,
 		      flags);
 	if (res == -1)
 		return -errno;
+	uncache_proj_state(&st);
+
+	index_rename(src, dir_mask != 0, dst, flags);
+	if (get_fuse_context_projfs()->evictor != NULL) {
+		evictor_rename(get_fuse_context_projfs()->evictor, src, dst,
+			       (flags & RENAME_EXCHANGE) != 0);
+	}
 
 	// do not report event handler errors after successful rename op
 	(void)send_notify_event(PROJFS_MOVE | dir_mask, 0, src, dst);
@@ -1180,12 +2733,26 @@ static int projfs_op_rename(char const *src, char const *dst,
 static int projfs_op_opendir(char const *path, struct fuse_file_info *fi)
 {
 	int flags = O_DIRECTORY | O_NOFOLLOW | O_RDONLY;
+	enum virtual_path vpath;
 	struct projfs_dir *d;
 	int fd;
 	int res = 0;
 	int err = 0;
 
 	path = make_relative_path(path);
+	vpath = get_virtual_path(path);
+	if (vpath == VIRTUAL_MISSING_PATH)
+		return -ENOENT;
+	else if (vpath == VIRTUAL_STATS_PATH)
+		return -ENOTDIR;
+	else if (vpath == VIRTUAL_DIR_PATH) {
+		d = calloc(1, sizeof(*d));
+		if (!d)
+			return -ENOMEM;
+		fi->fh = (uintptr_t)d;
+		return 0;
+	}
+
 	res = project_dir("opendir", path, 1);
 	if (res)
 		return -res;
@@ -1211,6 +2778,7 @@ static int projfs_op_opendir(char const *path, struct fuse_file_info *fi)
 		err = errno;
 		goto out_close;
 	}
+	d->root = (strcmp(path, ".") == 0);
 
 	fi->fh = (uintptr_t)d;
 	goto out;
@@ -1233,6 +2801,9 @@ static int projfs_op_readdir(char const *path, void *buf,
 
 	(void)path;
 
+	if (d->dir == NULL)
+		return fill_virtual_dir(buf, filler, off);
+
 	if (off != d->loc) {
 		seekdir(d->dir, off);
 		d->ent = NULL;
@@ -1252,6 +2823,13 @@ static int projfs_op_readdir(char const *path, void *buf,
 			}
 		}
 
+		// hide any lower entry shadowed by our reserved directory
+		if (d->root && strcmp(d->ent->d_name, VIRTUAL_DIR) == 0) {
+			d->loc = d->ent->d_off;
+			d->ent = NULL;
+			continue;
+		}
+
 		if (flags & FUSE_READDIR_PLUS) {
 			int res = fstatat(
 					dirfd(d->dir), d->ent->d_name, &attr,
@@ -1279,7 +2857,7 @@ static int projfs_op_readdir(char const *path, void *buf,
 static int projfs_op_releasedir(char const *path, struct fuse_file_info *fi)
 {
 	struct projfs_dir *d = (struct projfs_dir *)fi->fh;
-	int res = closedir(d->dir);
+	int res = (d->dir != NULL) ? closedir(d->dir) : 0;
 
 	(void)path;
 	free(d);
@@ -1295,9 +2873,11 @@ static int projfs_op_chmod(char const *path, mode_t mode,
 	mode = enforce_user_read(mode);
 
 	if (fi)
-		res = fchmod(fi->fh, mode);
+		res = fchmod(get_fh_fd(fi), mode);
 	else {
 		path = make_relative_path(path);
+		if (is_virtual_path(path))
+			return -EPERM;
 		res = project_dir("chmod", path, 1);
 		if (res)
 			return -res;
@@ -1311,9 +2891,11 @@ static int projfs_op_chown(char const *path, uid_t uid, gid_t gid,
 {
 	int res;
 	if (fi)
-		res = fchown(fi->fh, uid, gid);
+		res = fchown(get_fh_fd(fi), uid, gid);
 	else {
 		path = make_relative_path(path);
+		if (is_virtual_path(path))
+			return -EPERM;
 		res = project_dir("chown", path, 1);
 		if (res)
 			return -res;
@@ -1329,11 +2911,13 @@ static int projfs_op_truncate(char const *path, off_t off,
 {
 	int res, err = 0;
 	if (fi)
-		res = ftruncate(fi->fh, off);
+		res = ftruncate(get_fh_fd(fi), off);
 	else {
 		int fd;
 
 		path = make_relative_path(path);
+		if (is_virtual_path(path))
+			return -EPERM;
 		res = project_dir("truncate", path, 1);
 		if (res)
 			return -res;
@@ -1363,9 +2947,11 @@ static int projfs_op_utimens(char const *path, const struct timespec tv[2],
 {
 	int res;
 	if (fi)
-		res = futimens(fi->fh, tv);
+		res = futimens(get_fh_fd(fi), tv);
 	else {
 		path = make_relative_path(path);
+		if (is_virtual_path(path))
+			return -EPERM;
 		res = project_dir("utimens", path, 1);
 		if (res)
 			return -res;
@@ -1387,6 +2973,8 @@ static int projfs_op_setxattr(char const *path, char const *name,
 		return -EPERM;
 
 	path = make_relative_path(path);
+	if (is_virtual_path(path))
+		return -EPERM;
 	res = project_dir("setxattr", path, 1);
 	if (res)
 		return -res;
@@ -1413,6 +3001,8 @@ static int projfs_op_getxattr(char const *path, char const *name,
 	int fd;
 
 	path = make_relative_path(path);
+	if (is_virtual_path(path))
+		return -ENODATA;
 	res = project_dir("getxattr", path, 1);
 	if (res)
 		return -res;
@@ -1438,6 +3028,8 @@ static int projfs_op_listxattr(char const *path, char *list, size_t size)
 	int fd;
 
 	path = make_relative_path(path);
+	if (is_virtual_path(path))
+		return 0;
 	res = project_dir("listxattr", path, 1);
 	if (res)
 		return -res;
@@ -1466,6 +3058,8 @@ static int projfs_op_removexattr(char const *path, char const *name)
 		return -EPERM;
 
 	path = make_relative_path(path);
+	if (is_virtual_path(path))
+		return -EPERM;
 	res = project_dir("removexattr", path, 1);
 	if (res)
 		return -res;
@@ -1489,6 +3083,8 @@ static int projfs_op_access(char const *path, int mode)
 	int res;
 
 	path = make_relative_path(path);
+	if (is_virtual_path(path))
+		return (mode & W_OK) ? -EACCES : 0;
 	res = project_dir("access", path, 1);
 	if (res)
 		return -res;
@@ -1499,7 +3095,7 @@ static int projfs_op_access(char const *path, int mode)
 
 static int projfs_op_flock(char const *path, struct fuse_file_info *fi, int op)
 {
-	int res = flock(fi->fh, op);
+	int res = flock(get_fh_fd(fi), op);
 
 	(void)path;
 	return res == -1 ? -errno : 0;
@@ -1511,42 +3107,207 @@ static int projfs_op_fallocate(char const *path, int mode, off_t off,
 	(void)path;
 	if (mode)
 		return -EOPNOTSUPP;
-	return -posix_fallocate(fi->fh, off, len);
+	return -posix_fallocate(get_fh_fd(fi), off, len);
+}
+
+/* Each FUSE operation is wrapped so as to record its latency, and whether it
+ * failed, in our per-thread operation statistics (see opstats.c), and to
+ * fire the op__entry and op__exit tracepoints (see probes.h).
+ */
+#define PROJFS_TIMED_OP(name, stat, params, args, path)			\
+static int projfs_timed_##name params					\
+{									\
+	uint64_t start, nsec;						\
+	int res;							\
+									\
+	PROJFS_PROBE3(op__entry, #name, path, get_fuse_context_pid());	\
+	start = opstats_now();						\
+	res = projfs_op_##name args;					\
+	nsec = opstats_now() - start;					\
+	PROJFS_PROBE5(op__exit, #name, path, get_fuse_context_pid(),	\
+		      res, nsec);					\
+	opstats_record(get_fuse_context_projfs()->opstats, stat, nsec,	\
+		       res < 0);					\
+	log_printf_fuse_context(LOG_LEVEL_DEBUG,			\
+				"'%s' op: %s: %d in %" PRIu64 " nsec",	\
+				#name, path, res, nsec);		\
+	return res;							\
 }
 
+PROJFS_TIMED_OP(getattr, PROJFS_STATS_GETATTR,
+		(char const *path, struct stat *attr,
+		 struct fuse_file_info *fi),
+		(path, attr, fi),
+		path)
+PROJFS_TIMED_OP(readlink, PROJFS_STATS_READLINK,
+		(char const *path, char *buf, size_t size),
+		(path, buf, size),
+		path)
+PROJFS_TIMED_OP(mknod, PROJFS_STATS_MKNOD,
+		(char const *path, mode_t mode, dev_t rdev),
+		(path, mode, rdev),
+		path)
+PROJFS_TIMED_OP(mkdir, PROJFS_STATS_MKDIR,
+		(char const *path, mode_t mode),
+		(path, mode),
+		path)
+PROJFS_TIMED_OP(unlink, PROJFS_STATS_UNLINK,
+		(char const *path),
+		(path),
+		path)
+PROJFS_TIMED_OP(rmdir, PROJFS_STATS_RMDIR,
+		(char const *path),
+		(path),
+		path)
+PROJFS_TIMED_OP(symlink, PROJFS_STATS_SYMLINK,
+		(char const *link, char const *path),
+		(link, path),
+		path)
+PROJFS_TIMED_OP(rename, PROJFS_STATS_RENAME,
+		(char const *src, char const *dst,
+		 unsigned int flags),
+		(src, dst, flags),
+		src)
+PROJFS_TIMED_OP(link, PROJFS_STATS_LINK,
+		(char const *src, char const *dst),
+		(src, dst),
+		src)
+PROJFS_TIMED_OP(chmod, PROJFS_STATS_CHMOD,
+		(char const *path, mode_t mode,
+		 struct fuse_file_info *fi),
+		(path, mode, fi),
+		path)
+PROJFS_TIMED_OP(chown, PROJFS_STATS_CHOWN,
+		(char const *path, uid_t uid, gid_t gid,
+		 struct fuse_file_info *fi),
+		(path, uid, gid, fi),
+		path)
+PROJFS_TIMED_OP(truncate, PROJFS_STATS_TRUNCATE,
+		(char const *path, off_t off,
+		 struct fuse_file_info *fi),
+		(path, off, fi),
+		path)
+PROJFS_TIMED_OP(open, PROJFS_STATS_OPEN,
+		(char const *path, struct fuse_file_info *fi),
+		(path, fi),
+		path)
+PROJFS_TIMED_OP(statfs, PROJFS_STATS_STATFS,
+		(char const *path, struct statvfs *buf),
+		(path, buf),
+		path)
+PROJFS_TIMED_OP(flush, PROJFS_STATS_FLUSH,
+		(char const *path, struct fuse_file_info *fi),
+		(path, fi),
+		path)
+PROJFS_TIMED_OP(release, PROJFS_STATS_RELEASE,
+		(char const *path, struct fuse_file_info *fi),
+		(path, fi),
+		path)
+PROJFS_TIMED_OP(fsync, PROJFS_STATS_FSYNC,
+		(char const *path, int datasync,
+		 struct fuse_file_info *fi),
+		(path, datasync, fi),
+		path)
+PROJFS_TIMED_OP(setxattr, PROJFS_STATS_SETXATTR,
+		(char const *path, char const *name,
+		 char const *value, size_t size, int flags),
+		(path, name, value, size, flags),
+		path)
+PROJFS_TIMED_OP(getxattr, PROJFS_STATS_GETXATTR,
+		(char const *path, char const *name,
+		 char *value, size_t size),
+		(path, name, value, size),
+		path)
+PROJFS_TIMED_OP(listxattr, PROJFS_STATS_LISTXATTR,
+		(char const *path, char *list, size_t size),
+		(path, list, size),
+		path)
+PROJFS_TIMED_OP(removexattr, PROJFS_STATS_REMOVEXATTR,
+		(char const *path, char const *name),
+		(path, name),
+		path)
+PROJFS_TIMED_OP(opendir, PROJFS_STATS_OPENDIR,
+		(char const *path, struct fuse_file_info *fi),
+		(path, fi),
+		path)
+PROJFS_TIMED_OP(readdir, PROJFS_STATS_READDIR,
+		(char const *path, void *buf,
+		 fuse_fill_dir_t filler, off_t off,
+		 struct fuse_file_info *fi,
+		 enum fuse_readdir_flags flags),
+		(path, buf, filler, off, fi, flags),
+		path)
+PROJFS_TIMED_OP(releasedir, PROJFS_STATS_RELEASEDIR,
+		(char const *path, struct fuse_file_info *fi),
+		(path, fi),
+		path)
+PROJFS_TIMED_OP(access, PROJFS_STATS_ACCESS,
+		(char const *path, int mode),
+		(path, mode),
+		path)
+PROJFS_TIMED_OP(create, PROJFS_STATS_CREATE,
+		(char const *path, mode_t mode,
+		 struct fuse_file_info *fi),
+		(path, mode, fi),
+		path)
+PROJFS_TIMED_OP(utimens, PROJFS_STATS_UTIMENS,
+		(char const *path, const struct timespec tv[2],
+		 struct fuse_file_info *fi),
+		(path, tv, fi),
+		path)
+PROJFS_TIMED_OP(write_buf, PROJFS_STATS_WRITE_BUF,
+		(char const *path, struct fuse_bufvec *src,
+		 off_t off, struct fuse_file_info *fi),
+		(path, src, off, fi),
+		path)
+PROJFS_TIMED_OP(read_buf, PROJFS_STATS_READ_BUF,
+		(char const *path, struct fuse_bufvec **bufp,
+		 size_t size, off_t off, struct fuse_file_info *fi),
+		(path, bufp, size, off, fi),
+		path)
+PROJFS_TIMED_OP(flock, PROJFS_STATS_FLOCK,
+		(char const *path, struct fuse_file_info *fi, int op),
+		(path, fi, op),
+		path)
+PROJFS_TIMED_OP(fallocate, PROJFS_STATS_FALLOCATE,
+		(char const *path, int mode, off_t off,
+		 off_t len, struct fuse_file_info *fi),
+		(path, mode, off, len, fi),
+		path)
+
 static struct fuse_operations projfs_ops = {
-	.getattr	= projfs_op_getattr,
-	.readlink	= projfs_op_readlink,
-	.mknod		= projfs_op_mknod,
-	.mkdir		= projfs_op_mkdir,
-	.unlink		= projfs_op_unlink,
-	.rmdir		= projfs_op_rmdir,
-	.symlink	= projfs_op_symlink,
-	.rename		= projfs_op_rename,
-	.link		= projfs_op_link,
-	.chmod		= projfs_op_chmod,
-	.chown		= projfs_op_chown,
-	.truncate	= projfs_op_truncate,
-	.open		= projfs_op_open,
-	.statfs		= projfs_op_statfs,
-	.flush		= projfs_op_flush,
-	.release	= projfs_op_release,
-	.fsync		= projfs_op_fsync,
-	.setxattr	= projfs_op_setxattr,
-	.getxattr	= projfs_op_getxattr,
-	.listxattr	= projfs_op_listxattr,
-	.removexattr	= projfs_op_removexattr,
-	.opendir	= projfs_op_opendir,
-	.readdir	= projfs_op_readdir,
-	.releasedir	= projfs_op_releasedir,
+	.getattr	= projfs_timed_getattr,
+	.readlink	= projfs_timed_readlink,
+	.mknod		= projfs_timed_mknod,
+	.mkdir		= projfs_timed_mkdir,
+	.unlink		= projfs_timed_unlink,
+	.rmdir		= projfs_timed_rmdir,
+	.symlink	= projfs_timed_symlink,
+	.rename		= projfs_timed_rename,
+	.link		= projfs_timed_link,
+	.chmod		= projfs_timed_chmod,
+	.chown		= projfs_timed_chown,
+	.truncate	= projfs_timed_truncate,
+	.open		= projfs_timed_open,
+	.statfs		= projfs_timed_statfs,
+	.flush		= projfs_timed_flush,
+	.release	= projfs_timed_release,
+	.fsync		= projfs_timed_fsync,
+	.setxattr	= projfs_timed_setxattr,
+	.getxattr	= projfs_timed_getxattr,
+	.listxattr	= projfs_timed_listxattr,
+	.removexattr	= projfs_timed_removexattr,
+	.opendir	= projfs_timed_opendir,
+	.readdir	= projfs_timed_readdir,
+	.releasedir	= projfs_timed_releasedir,
 	.init		= projfs_op_init,
-	.access		= projfs_op_access,
-	.create		= projfs_op_create,
-	.utimens	= projfs_op_utimens,
-	.write_buf	= projfs_op_write_buf,
-	.read_buf	= projfs_op_read_buf,
-	.flock		= projfs_op_flock,
-	.fallocate	= projfs_op_fallocate,
+	.access		= projfs_timed_access,
+	.create		= projfs_timed_create,
+	.utimens	= projfs_timed_utimens,
+	.write_buf	= projfs_timed_write_buf,
+	.read_buf	= projfs_timed_read_buf,
+	.flock		= projfs_timed_flock,
+	.fallocate	= projfs_timed_fallocate,
 	// copy_file_range
 };
 
@@ -1560,6 +3321,21 @@ static void projfs_set_session(struct projfs *fs, struct fuse_session *se)
 	pthread_mutex_unlock(&fs->mutex);
 }
 
+static int get_notify_policy(const char *name,
+			     enum notifyqueue_policy *policy)
+{
+	if (name == NULL || strcmp(name, "block") == 0)
+		*policy = NOTIFYQUEUE_BLOCK;
+	else if (strcmp(name, "drop") == 0)
+		*policy = NOTIFYQUEUE_DROP;
+	else if (strcmp(name, "coalesce") == 0)
+		*policy = NOTIFYQUEUE_COALESCE;
+	else
+		return -1;
+
+	return 0;
+}
+
 struct projfs *projfs_new(const char *lowerdir, const char *mountdir,
 		const struct projfs_handlers *handlers,
 		size_t handlers_size, void *user_data,
@@ -1623,39 +3399,253 @@ struct projfs *projfs_new(const char *lowerdir, const char *mountdir,
 	if (pthread_mutex_init(&fs->mutex, NULL) > 0)
 		goto out_mount;
 
+	if (pthread_cond_init(&fs->inval_cond, NULL) > 0)
+		goto out_mutex;
+	fs->inval_tail = &fs->inval_head;
+
 	fs->fdtable = fdtable_create();
 	if (fs->fdtable == NULL) {
 		log_printf(fs, LOG_STDERR_ONLY,
 			   "failed to allocate file descriptor table");
-		goto out_mutex;
+		goto out_cond;
+	}
+
+	fs->statecache = statecache_create();
+	if (fs->statecache == NULL) {
+		log_printf(fs, LOG_STDERR_ONLY,
+			   "failed to allocate projection state cache");
+		goto out_fdtable;
+	}
+
+	fs->locktable = locktable_create();
+	if (fs->locktable == NULL) {
+		log_printf(fs, LOG_STDERR_ONLY,
+			   "failed to allocate projection lock table");
+		goto out_statecache;
+	}
+
+	fs->opentable = opentable_create();
+	if (fs->opentable == NULL) {
+		log_printf(fs, LOG_STDERR_ONLY,
+			   "failed to allocate open file table");
+		goto out_locktable;
+	}
+
+	fs->opstats = opstats_create(PROJFS_STATS_MAX);
+	if (fs->opstats == NULL) {
+		log_printf(fs, LOG_STDERR_ONLY,
+			   "failed to allocate operation statistics");
+		goto out_opentable;
+	}
+
+	fs->tgidcache = tgidcache_create();
+	if (fs->tgidcache == NULL) {
+		log_printf(fs, LOG_STDERR_ONLY,
+			   "failed to allocate process ID cache");
+		goto out_opstats;
+	}
+
+	fs->pendtable = pendtable_create();
+	if (fs->pendtable == NULL) {
+		log_printf(fs, LOG_STDERR_ONLY,
+			   "failed to allocate pending event table");
+		goto out_tgidcache;
 	}
 
 	if (fuse_opt_add_arg(&fs->args, "projfs") != 0) {
 		log_printf(fs, LOG_STDERR_ONLY,
 			   "failed to allocate argument");
-		goto out_fdtable;
+		goto out_pendtable;
 	}
 
 	for (i = 0; i < argc; ++i) {
 		if (fuse_opt_add_arg(&fs->args, argv[i]) != 0) {
 			log_printf(fs, LOG_STDERR_ONLY,
 				   "failed to allocate argument");
-			goto out_fdtable;
+			goto out_pendtable;
+		}
+	}
+
+	if (fuse_opt_parse(&fs->args, &fs->config, projfs_opts, NULL) == -1) {
+		log_printf(fs, LOG_STDERR_ONLY,
+			   "unable to parse arguments");
+		goto out_pendtable;
+	}
+
+	if (get_log_level(fs->config.log_level, &fs->log_level) == -1) {
+		log_printf(fs, LOG_STDERR_ONLY,
+			   "invalid log level: %s", fs->config.log_level);
+		goto out_pendtable;
+	}
+
+	if (fs->config.entry_timeout < 0 || fs->config.attr_timeout < 0 ||
+	    fs->config.negative_timeout < 0) {
+		log_printf(fs, LOG_STDERR_ONLY,
+			   "cache timeouts must not be negative");
+		goto out_pendtable;
+	}
+
+	if (fs->config.chunk_size > 0) {
+		unsigned int size = fs->config.chunk_size;
+
+		while (fs->chunk_shift < CHUNKMAP_MAX_SHIFT &&
+		       (1U << fs->chunk_shift) < size)
+			++fs->chunk_shift;
+		if ((1U << fs->chunk_shift) != size ||
+		    fs->chunk_shift < CHUNKMAP_MIN_SHIFT ||
+		    fs->chunk_shift > CHUNKMAP_MAX_SHIFT) {
+			log_printf(fs, LOG_STDERR_ONLY,
+				   "chunk size must be a power of two "
+				   "from %u to %u bytes",
+				   1U << CHUNKMAP_MIN_SHIFT,
+				   1U << CHUNKMAP_MAX_SHIFT);
+			goto out_pendtable;
+		}
+	}
+
+	if (fs->config.max_hydrations > 0) {
+		fs->hydsched = hydsched_create(fs->config.max_hydrations);
+		if (fs->hydsched == NULL) {
+			log_printf(fs, LOG_STDERR_ONLY,
+				   "failed to allocate hydration scheduler");
+			goto out_pendtable;
+		}
+	}
+
+	if (fs->config.prefetch_threshold > 0) {
+		unsigned int threads = fs->config.prefetch_threads;
+		unsigned int window = fs->config.prefetch_window_msec;
+
+		fs->prefetch = prefetch_create(
+			fs->config.prefetch_threshold,
+			(window > 0) ? window : PREFETCH_DEFAULT_WINDOW_MSEC,
+			(threads > 0) ? threads : PREFETCH_DEFAULT_THREADS,
+			prefetch_dir, fs);
+		if (fs->prefetch == NULL) {
+			log_printf(fs, LOG_STDERR_ONLY,
+				   "failed to allocate prefetch workers");
+			goto out_hydsched;
+		}
+	}
+
+	if (fs->config.hydration_trace != NULL) {
+		fs->hydtrace = hydtrace_create(fs->config.hydration_trace);
+		if (fs->hydtrace == NULL) {
+			log_printf(fs, LOG_STDERR_ONLY,
+				   "unable to load hydration trace: %s: %s",
+				   fs->config.hydration_trace,
+				   strerror(errno));
+			goto out_prefetch;
+		}
+		if (hydtrace_was_invalid(fs->hydtrace)) {
+			log_printf(fs, LOG_STDERR_FALLBACK,
+				   "ignoring invalid hydration trace: %s",
+				   fs->config.hydration_trace);
+		}
+	}
+
+	if (fs->config.state_index != NULL) {
+		fs->stateindex = stateindex_create(fs->config.state_index);
+		if (fs->stateindex == NULL) {
+			log_printf(fs, LOG_STDERR_ONLY,
+				   "unable to load state index: %s: %s",
+				   fs->config.state_index, strerror(errno));
+			goto out_hydtrace;
+		}
+	}
+
+	if (fs->config.evict_budget_mb > 0) {
+		fs->evictor = evictor_create(
+			(uint64_t)fs->config.evict_budget_mb << 20,
+			evict_file, fs);
+		if (fs->evictor == NULL) {
+			log_printf(fs, LOG_STDERR_ONLY,
+				   "failed to allocate evictor");
+			goto out_stateindex;
+		}
+	}
+
+	if (fs->config.io_uring) {
+		fs->uringexec = uringexec_create();
+		if (fs->uringexec == NULL) {
+			log_printf(fs, LOG_STDERR_ONLY,
+				   "io_uring unavailable, using system "
+				   "calls: %s", strerror(errno));
+		}
+	}
+
+	if (fs->handlers.handle_notify_batch ||
+	    (fs->config.notify_async && fs->handlers.handle_notify_event)) {
+		enum notifyqueue_policy policy;
+		unsigned int size = fs->config.notify_queue_size;
+		unsigned int batch_size = fs->config.notify_batch_size;
+		unsigned int batch_msec = fs->config.notify_batch_msec;
+
+		if (get_notify_policy(fs->config.notify_overflow,
+				      &policy) == -1) {
+			log_printf(fs, LOG_STDERR_ONLY,
+				   "invalid notification overflow policy: %s",
+				   fs->config.notify_overflow);
+			goto out_uringexec;
+		}
+
+		fs->notifyqueue = notifyqueue_create(
+			(size > 0) ? size : NOTIFYQUEUE_DEFAULT_SIZE,
+			policy, deliver_notify_events, fs);
+		if (fs->notifyqueue == NULL) {
+			log_printf(fs, LOG_STDERR_ONLY,
+				   "failed to allocate notification queue");
+			goto out_uringexec;
 		}
-	}
 
-	if (fuse_opt_parse(&fs->args, &fs->config, projfs_opts, NULL) == -1) {
-		log_printf(fs, LOG_STDERR_ONLY,
-			   "unable to parse arguments");
-		goto out_fdtable;
+		// batching is only the default when a batch handler is used
+		if (fs->handlers.handle_notify_batch) {
+			if (batch_size == 0)
+				batch_size = NOTIFYQUEUE_DEFAULT_BATCH_SIZE;
+			if (batch_msec == 0)
+				batch_msec = NOTIFYQUEUE_DEFAULT_BATCH_MSEC;
+		}
+		if (batch_size > 0)
+			(void)notifyqueue_set_batch(fs->notifyqueue,
+						    batch_size, batch_msec);
 	}
 
 	return fs;
 
-out_fdtable:
+out_uringexec:
+	if (fs->uringexec != NULL)
+		uringexec_destroy(fs->uringexec);
+	if (fs->evictor != NULL)
+		evictor_destroy(fs->evictor);
+out_stateindex:
+	if (fs->stateindex != NULL)
+		stateindex_destroy(fs->stateindex);
+out_hydtrace:
+	if (fs->hydtrace != NULL)
+		hydtrace_destroy(fs->hydtrace);
+out_prefetch:
+	if (fs->prefetch != NULL)
+		prefetch_destroy(fs->prefetch);
+out_hydsched:
+	if (fs->hydsched != NULL)
+		hydsched_destroy(fs->hydsched);
+out_pendtable:
 	fuse_opt_free_args(&fs->args);
+	pendtable_destroy(fs->pendtable);
+out_tgidcache:
+	tgidcache_destroy(fs->tgidcache);
+out_opstats:
+	opstats_destroy(fs->opstats);
+out_opentable:
+	opentable_destroy(fs->opentable);
+out_locktable:
+	locktable_destroy(fs->locktable);
+out_statecache:
+	statecache_destroy(fs->statecache);
+out_fdtable:
 	fdtable_destroy(fs->fdtable);
-
+out_cond:
+	pthread_cond_destroy(&fs->inval_cond);
 out_mutex:
 	pthread_mutex_destroy(&fs->mutex);
 out_mount:
@@ -1728,6 +3718,125 @@ close:
 	return res;
 }
 
+/**
+ * Adds to the state index each path beneath a lowerdir directory which is
+ * in the MODIFIED or POPULATED state, descending only into directories
+ * which have been projected, since unprojected ones contain nothing but
+ * empty placeholders.  Symlinks are skipped: they cannot hold a state
+ * xattr, so one created by the user cannot be told apart from one the
+ * provider projected, and we do not index the latter at runtime either.
+ *
+ * @param path buffer of PATH_MAX bytes holding the directory's path,
+ *             beginning with lowerdir
+ * @param len length of the directory's path
+ * @param root_len length of lowerdir in the path
+ * @return 0 or an errno
+ */
+static int scan_state_index(struct projfs *fs, char *path, size_t len,
+			    size_t root_len)
+{
+	struct dirent *ent;
+	struct stat st;
+	DIR *dirp;
+	char value;
+	int isdir, islnk;
+	int err = 0;
+
+	dirp = opendir(path);
+	if (dirp == NULL)
+		return errno;
+
+	while (err == 0 && (ent = readdir(dirp)) != NULL) {
+		size_t name_len = strlen(ent->d_name);
+
+		if (strcmp(ent->d_name, ".") == 0 ||
+		    strcmp(ent->d_name, "..") == 0)
+			continue;
+
+		if (len + name_len + 1 >= PATH_MAX) {
+			err = ENAMETOOLONG;
+			break;
+		}
+		path[len] = '/';
+		memcpy(path + len + 1, ent->d_name, name_len + 1);
+
+		if (ent->d_type == DT_UNKNOWN) {
+			if (lstat(path, &st) == -1) {
+				err = errno;
+				break;
+			}
+			isdir = S_ISDIR(st.st_mode);
+			islnk = S_ISLNK(st.st_mode);
+		} else {
+			isdir = (ent->d_type == DT_DIR);
+			islnk = (ent->d_type == DT_LNK);
+		}
+
+		if (islnk)
+			continue;
+
+		if (lgetxattr(path, PROJ_STATE_XATTR_NAME, &value,
+			      sizeof(value)) != -1) {
+			if (isdir || value != PROJ_STATE_XATTR_VALUE_POPULATED)
+				continue;
+			err = stateindex_set(fs->stateindex,
+					     path + root_len + 1, 0,
+					     STATEINDEX_POPULATED);
+			continue;
+		}
+		if (errno != ENOATTR) {
+			err = errno;
+			break;
+		}
+
+		err = stateindex_set(fs->stateindex, path + root_len + 1,
+				     isdir, STATEINDEX_MODIFIED);
+		if (err == 0 && isdir) {
+			err = scan_state_index(fs, path, len + name_len + 1,
+					       root_len);
+		}
+	}
+
+	closedir(dirp);
+	return err;
+}
+
+static int rebuild_state_index(struct projfs *fs)
+{
+	char path[PATH_MAX];
+	size_t len = strlen(fs->lowerdir);
+	int err = 0;
+
+	if (len >= PATH_MAX)
+		return ENAMETOOLONG;
+	memcpy(path, fs->lowerdir, len + 1);
+
+	if (get_proj_state_xattr(fs, fs->lowerdir_fd, NULL) != PROJ_STATE_EMPTY)
+		err = scan_state_index(fs, path, len, len);
+	if (err == 0)
+		err = stateindex_finish_rebuild(fs->stateindex);
+
+	return err;
+}
+
+/**
+ * Records a populated file from the state index for the evictor; since
+ * we have no record of their recency, files are seeded in directory order.
+ */
+static int seed_evictor(void *data, const char *path, int isdir)
+{
+	struct projfs *fs = (struct projfs *)data;
+	struct stat st;
+
+	if (isdir || fstatat(fs->lowerdir_fd, path, &st,
+			     AT_SYMLINK_NOFOLLOW) == -1 || !S_ISREG(st.st_mode))
+		return 0;
+
+	(void)evictor_record(fs->evictor, path, (uint64_t)st.st_blocks * 512);
+
+	return 0;
+}
+
 static void *projfs_loop(void *data)
 {
 	struct projfs *fs = (struct projfs *)data;
@@ -1753,8 +3862,8 @@ static void *projfs_loop(void *data)
 		goto out;
 	}
 
-	if (get_proj_state_xattr(fs->lowerdir_fd) == PROJ_STATE_ERROR &&
-	    errno == ENOTSUP) {
+	if (get_proj_state_xattr(fs, fs->lowerdir_fd, NULL) ==
+	    PROJ_STATE_ERROR && errno == ENOTSUP) {
 		log_printf(fs, LOG_STDERR_FALLBACK,
 			   "xattr support check on lowerdir failed: %s: %s",
 			fs->lowerdir, strerror(errno));
@@ -1779,7 +3888,7 @@ static void *projfs_loop(void *data)
 	}
 
 	if (fs->config.initial == 1) {
-		if (set_proj_state_xattr(fs->lowerdir_fd,
+		if (set_proj_state_xattr(fs, fs->lowerdir_fd, NULL,
 					 PROJ_STATE_EMPTY, 0) == -1) {
 			log_printf(fs, LOG_STDERR_FALLBACK,
 				   "could not set projection flag "
@@ -1790,6 +3899,19 @@ static void *projfs_loop(void *data)
 		}
 	}
 
+	// an incomplete index is not fatal, and is rebuilt at the next mount
+	if (fs->stateindex != NULL &&
+	    stateindex_needs_rebuild(fs->stateindex) &&
+	    (err = rebuild_state_index(fs)) != 0) {
+		log_printf(fs, LOG_STDERR_FALLBACK,
+			   "unable to rebuild state index: %s: %s",
+			   fs->config.state_index, strerror(err));
+	}
+
+	if (fs->evictor != NULL && fs->stateindex != NULL)
+		(void)stateindex_iterate(fs->stateindex, STATEINDEX_POPULATED,
+					 seed_evictor, fs);
+
 	fuse = fuse_new(&fs->args, &projfs_ops, sizeof(projfs_ops), fs);
 	if (fuse == NULL) {
 		res = 5;
@@ -1811,6 +3933,49 @@ static void *projfs_loop(void *data)
 		goto out_signal;
 	}
 
+	if ((err = start_inval_thread(fs, fuse)) != 0) {
+		log_printf(fs, LOG_STDERR_FALLBACK,
+			   "error creating cache invalidation thread, "
+			   "disabling kernel caching: %s", strerror(err));
+	}
+
+	if (fs->notifyqueue != NULL &&
+	    (err = notifyqueue_start(fs->notifyqueue)) != 0) {
+		log_printf(fs, LOG_STDERR_FALLBACK,
+			   "error creating notification thread: %s",
+			   strerror(err));
+		res = 9;
+		goto out_inval;
+	}
+
+	if (fs->prefetch != NULL &&
+	    (err = prefetch_start(fs->prefetch)) != 0) {
+		log_printf(fs, LOG_STDERR_FALLBACK,
+			   "error creating prefetch threads: %s",
+			   strerror(err));
+		res = 10;
+		goto out_notify;
+	}
+
+	if (fs->hydtrace != NULL &&
+	    (err = hydtrace_start_replay(fs->hydtrace, replay_hydration,
+					 fs)) != 0) {
+		log_printf(fs, LOG_STDERR_FALLBACK,
+			   "error creating trace replay thread: %s",
+			   strerror(err));
+		res = 11;
+		goto out_prefetch;
+	}
+
+	if (fs->evictor != NULL &&
+	    (err = evictor_start(fs->evictor)) != 0) {
+		log_printf(fs, LOG_STDERR_FALLBACK,
+			   "error creating eviction thread: %s",
+			   strerror(err));
+		res = 12;
+		goto out_replay;
+	}
+
 	// TODO: support configs; ideally libfuse's full suite
 	loop.clone_fd = 0;
 	loop.max_idle_threads = 10;
@@ -1824,6 +3989,25 @@ static void *projfs_loop(void *data)
 		res = 8;
 	}
 
+	if (fs->evictor != NULL)
+		evictor_stop(fs->evictor);
+
+out_replay:
+	if (fs->hydtrace != NULL)
+		hydtrace_stop_replay(fs->hydtrace);
+
+out_prefetch:
+	if (fs->prefetch != NULL)
+		prefetch_stop(fs->prefetch);
+
+out_notify:
+	// deliver any remaining notifications before unmounting
+	if (fs->notifyqueue != NULL)
+		notifyqueue_stop(fs->notifyqueue);
+
+out_inval:
+	stop_inval_thread(fs);
+
 	fuse_session_unmount(se);
 out_signal:
 	fuse_remove_signal_handlers(se);
@@ -1894,6 +4078,9 @@ void *projfs_stop(struct projfs *fs)
 	pthread_mutex_unlock(&fs->mutex);
 	// TODO: barrier/fence to ensure all CPUs see exit flag?
 
+	// release any worker threads waiting on pending projections
+	pendtable_cancel(fs->pendtable, -EIO);
+
 	/* could send a USR1 signal and have a no-op handler installed by
 	 * projfs_loop(), but this is a simpler way to trigger fuse_do_work()
 	 * to exit, which semaphores fuse_session_loop_mt() to exit as well;
@@ -1916,8 +4103,29 @@ void *projfs_stop(struct projfs *fs)
 
 	fuse_opt_free_args(&fs->args);
 
+	if (fs->notifyqueue != NULL)
+		notifyqueue_destroy(fs->notifyqueue);
+	if (fs->uringexec != NULL)
+		uringexec_destroy(fs->uringexec);
+	if (fs->evictor != NULL)
+		evictor_destroy(fs->evictor);
+	if (fs->stateindex != NULL)
+		stateindex_destroy(fs->stateindex);
+	if (fs->hydtrace != NULL)
+		hydtrace_destroy(fs->hydtrace);
+	if (fs->prefetch != NULL)
+		prefetch_destroy(fs->prefetch);
+	if (fs->hydsched != NULL)
+		hydsched_destroy(fs->hydsched);
+	pendtable_destroy(fs->pendtable);
+	tgidcache_destroy(fs->tgidcache);
+	opstats_destroy(fs->opstats);
+	opentable_destroy(fs->opentable);
+	locktable_destroy(fs->locktable);
+	statecache_destroy(fs->statecache);
 	fdtable_destroy(fs->fdtable);
 
+	pthread_cond_destroy(&fs->inval_cond);
 	pthread_mutex_destroy(&fs->mutex);
 
 	free(fs->mountdir);
@@ -1928,6 +4136,135 @@ void *projfs_stop(struct projfs *fs)
 	return user_data;
 }
 
+int projfs_get_notify_stats(struct projfs *fs,
+			    struct projfs_notify_stats *stats)
+{
+	struct notifyqueue_stats queue_stats;
+
+	memset(stats, 0, sizeof(*stats));
+	if (fs->notifyqueue == NULL)
+		return 0;
+
+	notifyqueue_get_stats(fs->notifyqueue, &queue_stats);
+	stats->queued = queue_stats.queued;
+	stats->dropped = queue_stats.dropped;
+	stats->coalesced = queue_stats.coalesced;
+	stats->batches = queue_stats.batches;
+	stats->depth = queue_stats.depth;
+	stats->max_depth = queue_stats.max_depth;
+
+	return 0;
+}
+
+int projfs_get_stats(struct projfs *fs, struct projfs_stats *stats)
+{
+	struct opstats_counter *counters;
+	unsigned int i;
+
+	counters = calloc(PROJFS_STATS_MAX, sizeof(*counters));
+	if (counters == NULL)
+		return ENOMEM;
+
+	opstats_merge(fs->opstats, counters);
+	for (i = 0; i < PROJFS_STATS_MAX; ++i) {
+		struct projfs_op_stats *op = &stats->ops[i];
+
+		op->count = counters[i].count;
+		op->errors = counters[i].errors;
+		op->total_nsec = counters[i].total_nsec;
+		op->max_nsec = counters[i].max_nsec;
+		memcpy(op->buckets, counters[i].buckets, sizeof(op->buckets));
+	}
+
+	free(counters);
+	return 0;
+}
+
+static const char *const stats_op_names[PROJFS_STATS_MAX] = {
+	[PROJFS_STATS_GETATTR]		= "getattr",
+	[PROJFS_STATS_READLINK]		= "readlink",
+	[PROJFS_STATS_MKNOD]		= "mknod",
+	[PROJFS_STATS_MKDIR]		= "mkdir",
+	[PROJFS_STATS_UNLINK]		= "unlink",
+	[PROJFS_STATS_RMDIR]		= "rmdir",
+	[PROJFS_STATS_SYMLINK]		= "symlink",
+	[PROJFS_STATS_RENAME]		= "rename",
+	[PROJFS_STATS_LINK]		= "link",
+	[PROJFS_STATS_CHMOD]		= "chmod",
+	[PROJFS_STATS_CHOWN]		= "chown",
+	[PROJFS_STATS_TRUNCATE]		= "truncate",
+	[PROJFS_STATS_OPEN]		= "open",
+	[PROJFS_STATS_STATFS]		= "statfs",
+	[PROJFS_STATS_FLUSH]		= "flush",
+	[PROJFS_STATS_RELEASE]		= "release",
+	[PROJFS_STATS_FSYNC]		= "fsync",
+	[PROJFS_STATS_SETXATTR]		= "setxattr",
+	[PROJFS_STATS_GETXATTR]		= "getxattr",
+	[PROJFS_STATS_LISTXATTR]	= "listxattr",
+	[PROJFS_STATS_REMOVEXATTR]	= "removexattr",
+	[PROJFS_STATS_OPENDIR]		= "opendir",
+	[PROJFS_STATS_READDIR]		= "readdir",
+	[PROJFS_STATS_RELEASEDIR]	= "releasedir",
+	[PROJFS_STATS_ACCESS]		= "access",
+	[PROJFS_STATS_CREATE]		= "create",
+	[PROJFS_STATS_UTIMENS]		= "utimens",
+	[PROJFS_STATS_WRITE_BUF]	= "write_buf",
+	[PROJFS_STATS_READ_BUF]		= "read_buf",
+	[PROJFS_STATS_FLOCK]		= "flock",
+	[PROJFS_STATS_FALLOCATE]	= "fallocate",
+	[PROJFS_STATS_LOCK_WAIT]	= "lock_wait",
+	[PROJFS_STATS_PROJ_HANDLER]	= "proj_handler",
+	[PROJFS_STATS_NOTIFY_HANDLER]	= "notify_handler",
+	[PROJFS_STATS_PERM_HANDLER]	= "perm_handler"
+};
+
+const char *projfs_stats_op_name(enum projfs_stats_op op)
+{
+	if ((unsigned int)op >= PROJFS_STATS_MAX)
+		return NULL;
+
+	return stats_op_names[op];
+}
+
+int projfs_iterate_state(struct projfs *fs, enum projfs_state state,
+			 projfs_state_iter_t iter, void *data)
+{
+	enum stateindex_state index_state;
+
+	if (fs->stateindex == NULL)
+		return ENOTSUP;
+
+	switch (state) {
+	case PROJFS_STATE_MODIFIED:
+		index_state = STATEINDEX_MODIFIED;
+		break;
+	case PROJFS_STATE_DELETED:
+		index_state = STATEINDEX_DELETED;
+		break;
+	case PROJFS_STATE_POPULATED:
+		index_state = STATEINDEX_POPULATED;
+		break;
+	default:
+		return EINVAL;
+	}
+
+	return stateindex_iterate(fs->stateindex, index_state, iter, data);
+}
+
+int projfs_complete_event(struct projfs *fs, uint64_t cookie, int result)
+{
+	if (cookie == 0 || result > 0)
+		return EINVAL;
+
+	return pendtable_complete(fs->pendtable, cookie, result);
+}
+
+int projfs_copy_from_fd(int fd, off_t offset, int src_fd, off_t src_offset,
+			size_t length)
+{
+	return fdcopy_range(fd, offset, src_fd, src_offset, length);
+}
+
 static int check_safe_rel_path(const char *path)
 {
 	const char *s = path;
@@ -1947,18 +4284,25 @@ static int check_safe_rel_path(const char *path)
 	return 1;
 }
 
-static char *make_user_xattr_name(const char *segments)
+#define MAX_USER_XATTR_SEGMENTS_LEN (XATTR_NAME_MAX - PROJ_XATTR_PRE_LEN)
+
+/**
+ * Makes the full name of a user projection attribute in the supplied
+ * buffer, which must be at least XATTR_NAME_MAX + 1 bytes long.
+ *
+ * @return 0 or ERANGE if the name is too long
+ */
+static int make_user_xattr_name(char *name, const char *segments)
 {
-	char *name;
+	size_t len = strlen(segments);
 
-	name = malloc(PROJ_XATTR_PRE_LEN + strlen(segments) + 1);
-	if (name == NULL)
-		return NULL;
+	if (len > MAX_USER_XATTR_SEGMENTS_LEN)
+		return ERANGE;
 
 	memcpy(name, PROJ_XATTR_PRE_NAME, PROJ_XATTR_PRE_LEN);
-	strcpy(name + PROJ_XATTR_PRE_LEN, segments);
+	memcpy(name + PROJ_XATTR_PRE_LEN, segments, len + 1);
 
-	return name;
+	return 0;
 }
 
 #define PROJ_XATTR_READ 0x00
@@ -1969,6 +4313,7 @@ static int iter_user_xattrs(int fd, struct projfs_attr *attrs,
 			    unsigned int nattrs, unsigned int flags)
 {
 	int set_flags = (flags & PROJ_XATTR_CREATE) ? XATTR_CREATE : 0;
+	char name[XATTR_NAME_MAX + 1];
 	int res;
 	unsigned int i;
 
@@ -1976,12 +4321,11 @@ static int iter_user_xattrs(int fd, struct projfs_attr *attrs,
 		return 0;
 
 	for (i = 0; i < nattrs; i++) {
-		char *name;
 		struct projfs_attr *attr = &attrs[i];
 
-		name = make_user_xattr_name(attr->name);
-		if (name == NULL)
-			return errno;
+		res = make_user_xattr_name(name, attr->name);
+		if (res != 0)
+			return res;
 
 		if (flags & PROJ_XATTR_WRITE) {
 			// do not permit alteration of our reserved xattrs
@@ -1997,7 +4341,6 @@ static int iter_user_xattrs(int fd, struct projfs_attr *attrs,
 			res = get_xattr(fd, name, attr->value, &attr->size);
 		}
 
-		free(name);
 		if (res == -1)
 			return errno;
 	}
@@ -2008,6 +4351,7 @@ static int iter_user_xattrs(int fd, struct projfs_attr *attrs,
 int projfs_create_proj_dir(struct projfs *fs, const char *path, mode_t mode,
 			   struct projfs_attr *attrs, unsigned int nattrs)
 {
+	struct stat st;
 	int reset_mode;
 	int fd, res;
 
@@ -2023,8 +4367,15 @@ int projfs_create_proj_dir(struct projfs *fs, const char *path, mode_t mode,
 	if (fd == -1)
 		return errno;
 
+	if (fstat(fd, &st) == -1) {
+		res = errno;
+		close(fd);
+		return res;
+	}
+
 	reset_mode = fchmod_user_write(fd, mode, 1);
-	if (set_proj_state_xattr(fd, PROJ_STATE_EMPTY, XATTR_CREATE) == -1) {
+	if (set_proj_state_xattr(fs, fd, &st, PROJ_STATE_EMPTY,
+				 XATTR_CREATE) == -1) {
 		res = errno;
 		goto out_mode;
 	}
@@ -2036,6 +4387,8 @@ out_mode:
 	if (reset_mode)
 		reset_mode = fchmod_user_write(fd, mode, 0);
 	close(fd);
+	if (res == 0)
+		queue_inval_path(fs, path, 1);
 	return res;
 }
 
@@ -2043,6 +4396,7 @@ int projfs_create_proj_file(struct projfs *fs, const char *path, off_t size,
 			    mode_t mode, struct projfs_attr *attrs,
 			    unsigned int nattrs)
 {
+	struct stat st;
 	int reset_mode;
 	int fd, res;
 
@@ -2054,13 +4408,14 @@ int projfs_create_proj_file(struct projfs *fs, const char *path, off_t size,
 	if (fd == -1)
 		return errno;
 
-	if (ftruncate(fd, size) == -1) {
+	if (ftruncate(fd, size) == -1 || fstat(fd, &st) == -1) {
 		res = errno;
 		goto out_close;
 	}
 
 	reset_mode = fchmod_user_write(fd, mode, 1);
-	if (set_proj_state_xattr(fd, PROJ_STATE_EMPTY, XATTR_CREATE) == -1) {
+	if (set_proj_state_xattr(fs, fd, &st, PROJ_STATE_EMPTY,
+				 XATTR_CREATE) == -1) {
 		res = errno;
 		goto out_mode;
 	}
@@ -2075,6 +4430,8 @@ out_close:
 	close(fd);
 	if (res > 0)
 		unlinkat(fs->lowerdir_fd, path, 0);	// best effort
+	else
+		queue_inval_path(fs, path, 1);
 	return res;
 }
 
@@ -2090,9 +4447,250 @@ int projfs_create_proj_symlink(struct projfs *fs, const char *path,
 	if (res == -1)
 		return errno;
 
+	queue_inval_path(fs, path, 1);
 	return 0;
 }
 
+static int is_entry_name(const char *name)
+{
+	return (name != NULL && *name != '\0' && strchr(name, '/') == NULL &&
+		strcmp(name, ".") != 0 && strcmp(name, "..") != 0);
+}
+
+/**
+ * Creates a single placeholder directory or file, relative to a parent
+ * directory fd.  Unlike projfs_create_proj_dir() and
+ * projfs_create_proj_file(), the inode is created with user write
+ * permission from the outset, so that only one fchmod(2) is needed, and
+ * only if the requested mode lacks that permission; a file of zero size
+ * is also not truncated.
+ *
+ * @return 0 or an errno
+ */
+static int create_proj_entry(struct projfs *fs, int dir_fd,
+			     const struct projfs_entry *entry)
+{
+	int isdir = S_ISDIR(entry->mode);
+	struct stat st;
+	mode_t mode;
+	int fd, res = 0;
+
+	mode = enforce_user_read(entry->mode & ~S_IFMT);
+	if (isdir) {
+		if (mkdirat(dir_fd, entry->name, mode | S_IWUSR) == -1)
+			return errno;
+		fd = openat(dir_fd, entry->name,
+			    O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+	} else {
+		fd = openat(dir_fd, entry->name,
+			    O_WRONLY | O_CREAT | O_EXCL, mode | S_IWUSR);
+		if (fd == -1)
+			return errno;	// never remove an existing file
+	}
+	if (fd == -1) {
+		res = errno;
+		goto out_remove;
+	}
+
+	if ((!isdir && entry->size > 0 &&
+	     ftruncate(fd, entry->size) == -1) ||
+	    fstat(fd, &st) == -1) {
+		res = errno;
+		goto out_close;
+	}
+
+	if (set_proj_state_xattr(fs, fd, &st, PROJ_STATE_EMPTY,
+				 XATTR_CREATE) == -1) {
+		res = errno;
+		goto out_close;
+	}
+
+	res = iter_user_xattrs(fd, entry->attrs, entry->nattrs,
+			       PROJ_XATTR_WRITE | PROJ_XATTR_CREATE);
+	if (res == 0 && !(mode & S_IWUSR) && fchmod(fd, mode) == -1)
+		res = errno;
+
+out_close:
+	close(fd);
+out_remove:
+	if (res != 0)
+		unlinkat(dir_fd, entry->name, isdir ? AT_REMOVEDIR : 0);
+	return res;
+}
+
+/**
+ * @return 1 if an entry may be created with io_uring; 0 if it must be
+ *         created with create_proj_entry() (e.g., because its mode
+ *         lacks user write permission, or it is invalid, in which case
+ *         create_proj_entry() reports the error)
+ */
+static int is_uring_entry(const struct projfs_entry *entry)
+{
+	char name[XATTR_NAME_MAX + 1];
+	unsigned int i;
+
+	if (!is_entry_name(entry->name) ||
+	    (!S_ISDIR(entry->mode) && !S_ISREG(entry->mode)) ||
+	    !(entry->mode & S_IWUSR) ||
+	    (entry->attrs == NULL && entry->nattrs > 0) ||
+	    entry->nattrs >= (unsigned int)uringexec_max_xattrs())
+		return 0;
+
+	for (i = 0; i < entry->nattrs; ++i) {
+		const struct projfs_attr *attr = &entry->attrs[i];
+
+		if (attr->value == NULL || attr->size <= 0 ||
+		    make_user_xattr_name(name, attr->name) != 0 ||
+		    xattr_name_is_reserved(name))
+			return 0;
+	}
+
+	return 1;
+}
+
+/**
+ * Creates placeholders with io_uring, setting the result of each entry.
+ *
+ * @param index indices of the entries to create
+ * @param n number of indices, at most URINGEXEC_MAX_CHAINS
+ */
+static void create_uring_entries(struct projfs *fs, int dir_fd,
+				 struct projfs_entry *entries,
+				 const unsigned int *index, unsigned int n)
+{
+	static const char state_value = PROJ_STATE_XATTR_VALUE_EMPTY;
+	struct uringexec_chain chains[URINGEXEC_MAX_CHAINS];
+	struct uringexec_xattr *xattrs;
+	char (*names)[XATTR_NAME_MAX + 1];
+	unsigned int i, j, k = 0;
+	int res;
+
+	for (i = 0; i < n; ++i)
+		k += 1 + entries[index[i]].nattrs;
+
+	xattrs = calloc(k, sizeof(*xattrs));
+	names = calloc(k, sizeof(*names));
+	if (xattrs == NULL || names == NULL) {
+		res = ENOMEM;
+		goto out;
+	}
+
+	for (i = 0, k = 0; i < n; ++i) {
+		const struct projfs_entry *entry = &entries[index[i]];
+		struct uringexec_chain *chain = &chains[i];
+
+		chain->name = entry->name;
+		chain->mode = enforce_user_read(entry->mode);
+		chain->size = entry->size;
+		chain->xattrs = &xattrs[k];
+		chain->nxattrs = 1 + entry->nattrs;
+
+		xattrs[k].name = PROJ_STATE_XATTR_NAME;
+		xattrs[k].value = &state_value;
+		xattrs[k].size = sizeof(state_value);
+		++k;
+
+		for (j = 0; j < entry->nattrs; ++j, ++k) {
+			// names were checked by is_uring_entry()
+			(void)make_user_xattr_name(names[k],
+						   entry->attrs[j].name);
+			xattrs[k].name = names[k];
+			xattrs[k].value = entry->attrs[j].value;
+			xattrs[k].size = entry->attrs[j].size;
+		}
+	}
+
+	res = uringexec_create_entries(fs->uringexec, dir_fd, chains, n);
+	if (res == 0) {
+		for (i = 0; i < n; ++i) {
+			entries[index[i]].result = chains[i].result;
+			if (chains[i].result == 0) {
+				statecache_update(fs->statecache,
+						  chains[i].dev, chains[i].ino,
+						  PROJ_STATE_EMPTY);
+			}
+		}
+	}
+
+out:
+	if (res != 0) {
+		for (i = 0; i < n; ++i)
+			entries[index[i]].result = res;
+	}
+	free(names);
+	free(xattrs);
+}
+
+int projfs_create_proj_entries(struct projfs *fs, const char *parent,
+			       struct projfs_entry *entries, unsigned int n)
+{
+	unsigned int index[URINGEXEC_MAX_CHAINS];
+	unsigned int i, nindex = 0;
+	int dir_fd;
+	int res = 0;
+
+	if (!check_safe_rel_path(parent) || (entries == NULL && n > 0))
+		return EINVAL;
+
+	dir_fd = openat(fs->lowerdir_fd, parent,
+			O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+	if (dir_fd == -1)
+		return errno;
+
+	for (i = 0; i < n; ++i) {
+		struct projfs_entry *entry = &entries[i];
+
+		if (fs->uringexec != NULL && is_uring_entry(entry)) {
+			index[nindex++] = i;
+			if (nindex == URINGEXEC_MAX_CHAINS) {
+				create_uring_entries(fs, dir_fd, entries,
+						     index, nindex);
+				nindex = 0;
+			}
+			continue;
+		}
+
+		// create all earlier entries first, in the order given
+		if (nindex > 0) {
+			create_uring_entries(fs, dir_fd, entries, index,
+					     nindex);
+			nindex = 0;
+		}
+
+		if (!is_entry_name(entry->name)) {
+			entry->result = EINVAL;
+		} else if (S_ISLNK(entry->mode)) {
+			entry->result = 0;
+			if (entry->target == NULL)
+				entry->result = EINVAL;
+			else if (symlinkat(entry->target, dir_fd,
+					   entry->name) == -1)
+				entry->result = errno;
+		} else if (S_ISDIR(entry->mode) || S_ISREG(entry->mode)) {
+			entry->result = create_proj_entry(fs, dir_fd, entry);
+		} else {
+			entry->result = EINVAL;
+		}
+	}
+
+	if (nindex > 0)
+		create_uring_entries(fs, dir_fd, entries, index, nindex);
+
+	close(dir_fd);
+
+	for (i = 0; i < n; ++i) {
+		if (entries[i].result != 0) {
+			res = entries[i].result;
+			break;
+		}
+	}
+
+	// the kernel need only revalidate the parent's entries once
+	if (n > 0)
+		queue_inval_path(fs, parent, 0);
+	return res;
+}
+
 static int iter_attrs(struct projfs *fs, const char *path,
 		      struct projfs_attr *attrs, unsigned int nattrs,
 		      unsigned int flags)
@@ -2136,3 +4734,17 @@ int projfs_set_attrs(struct projfs *fs, const char *path,
 {
 	return iter_attrs(fs, path, attrs, nattrs, PROJ_XATTR_WRITE);
 }
+
+int projfs_dehydrate(struct projfs *fs, const char *path)
+{
+	int res;
+
+	if (!check_safe_rel_path(path))
+		return EINVAL;
+
+	res = dehydrate_file(fs, path);
+	if (res == 0 && fs->evictor != NULL)
+		evictor_remove(fs->evictor, path);
+
+	return res;
+}
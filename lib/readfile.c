@@ -0,0 +1,92 @@
+/* Linux Projected Filesystem
+   Copyright (C) 2019 GitHub, Inc.
+
+   See the NOTICE file distributed with this library for additional
+   information regarding copyright ownership.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library, in the file COPYING; if not,
+   see <http://www.gnu.org/licenses/>.
+*/
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "readfile.h"
+
+/*
+ * We load the whole of a small file written by a previous mount, such as
+ * a hydration trace or state index, into a buffer in one pass.  These
+ * files consist of NUL-terminated records, and may have been left
+ * incomplete by a crash, so the buffer always has a terminating NUL
+ * appended after the data, and callers parse only complete records.
+ */
+
+/**
+ * Reads the entire contents of a file into a newly allocated buffer,
+ * which the caller must free.  A short read (e.g., of a file truncated
+ * while it is being read) returns the data read so far.
+ *
+ * @param path path of file to read
+ * @param bufp set to the buffer, or NULL on error
+ * @param lenp set to the length of the data, excluding the terminating NUL
+ * @return 0 or an errno
+ */
+int readfile_load(const char *path, char **bufp, size_t *lenp)
+{
+	struct stat st;
+	char *buf;
+	size_t len = 0;
+	ssize_t res;
+	int fd, err = 0;
+
+	*bufp = NULL;
+	*lenp = 0;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return errno;
+
+	if (fstat(fd, &st) == -1) {
+		err = errno;
+		goto out_close;
+	}
+
+	buf = malloc(st.st_size + 1);
+	if (buf == NULL) {
+		err = ENOMEM;
+		goto out_close;
+	}
+
+	while (len < (size_t)st.st_size) {
+		res = read(fd, buf + len, st.st_size - len);
+		if (res == -1 && errno == EINTR)
+			continue;
+		if (res <= 0)
+			break;
+		len += res;
+	}
+	buf[len] = '\0';
+
+	*bufp = buf;
+	*lenp = len;
+
+out_close:
+	close(fd);
+	return err;
+}
@@ -0,0 +1,176 @@
+/* Linux Projected Filesystem
+   Copyright (C) 2019 GitHub, Inc.
+
+   See the NOTICE file distributed with this library for additional
+   information regarding copyright ownership.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library, in the file COPYING; if not,
+   see <http://www.gnu.org/licenses/>.
+*/
+
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "statecache.h"
+
+/*
+ * We implement a fixed-size, direct-mapped cache of projection states
+ * keyed by device and inode number.  Each key hashes to exactly one slot,
+ * and a new entry simply evicts whatever entry previously occupied its
+ * slot, so lookups and updates never probe more than a single entry.
+ *
+ * The cache is strictly advisory: a miss (including one caused by an
+ * eviction) only means the caller must fall back to reading the
+ * projection state xattr from the lower filesystem.  Correctness therefore
+ * depends only on every change to a state xattr also being written through
+ * to the cache, which also covers the case where the lower filesystem
+ * recycles an inode number for a newly created placeholder.  Other files
+ * may also reuse the inode number of a removed placeholder without any
+ * state xattr being written, so entries are invalidated when their paths
+ * are removed.
+ *
+ * Lookups are made on nearly every path-based operation, by all threads,
+ * so they take no lock.  Instead each slot has a sequence counter, which
+ * is odd while a writer is changing the slot (writers to the same slot
+ * wait for each other), and a lookup which finds the counter odd or
+ * changed after reading the slot simply reports a miss.
+ *
+ * Inode numbers are never zero on Linux, so we use a zero inode number to
+ * mark empty slots.
+ *
+ * As with our fdtable, the key is reduced to a slot index by Knuth's
+ * multiplicative (Fibonacci) hashing, here using the 64-bit golden ratio
+ * constant and the high bits of the product.
+ */
+
+struct state_entry {
+	unsigned int seq;		/* odd while being written */
+	int state;
+	dev_t dev;
+	ino_t ino;
+};
+
+struct statecache {
+	struct state_entry *array;
+};
+
+#define STATECACHE_BITS 15
+
+#if (1 << STATECACHE_BITS) != STATECACHE_SIZE
+#error "STATECACHE_BITS does not match STATECACHE_SIZE"
+#endif
+
+struct statecache *statecache_create(void)
+{
+	struct statecache *cache;
+
+	cache = calloc(1, sizeof(*cache));
+	if (cache == NULL)
+		return NULL;
+
+	cache->array = calloc(STATECACHE_SIZE, sizeof(*cache->array));
+	if (cache->array == NULL) {
+		free(cache);
+		return NULL;
+	}
+
+	return cache;
+}
+
+// 2^64 / golden ratio
+#define GOLDEN_RATIO_64 0x9E3779B97F4A7C15ULL
+
+static inline unsigned int hash_index(dev_t dev, ino_t ino)
+{
+	uint64_t key = (uint64_t)ino ^ ((uint64_t)dev << 32);
+
+	return (key * GOLDEN_RATIO_64) >> (64 - STATECACHE_BITS);
+}
+
+int statecache_lookup(struct statecache *cache, dev_t dev, ino_t ino)
+{
+	struct state_entry *entry = &cache->array[hash_index(dev, ino)];
+	unsigned int seq;
+	dev_t entry_dev;
+	ino_t entry_ino;
+	int state;
+
+	seq = __atomic_load_n(&entry->seq, __ATOMIC_ACQUIRE);
+	if (seq & 1)
+		return STATECACHE_MISS;
+
+	entry_dev = __atomic_load_n(&entry->dev, __ATOMIC_RELAXED);
+	entry_ino = __atomic_load_n(&entry->ino, __ATOMIC_RELAXED);
+	state = __atomic_load_n(&entry->state, __ATOMIC_RELAXED);
+
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	if (__atomic_load_n(&entry->seq, __ATOMIC_RELAXED) != seq ||
+	    entry_ino != ino || entry_dev != dev)
+		return STATECACHE_MISS;
+
+	return state;
+}
+
+// returns the slot's even sequence number from before the write
+static unsigned int begin_write(struct state_entry *entry)
+{
+	unsigned int seq = __atomic_load_n(&entry->seq, __ATOMIC_RELAXED);
+
+	do {
+		while (seq & 1)
+			seq = __atomic_load_n(&entry->seq, __ATOMIC_RELAXED);
+	} while (!__atomic_compare_exchange_n(&entry->seq, &seq, seq + 1, 1,
+					      __ATOMIC_RELAXED,
+					      __ATOMIC_RELAXED));
+
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	return seq;
+}
+
+static void end_write(struct state_entry *entry, unsigned int seq)
+{
+	__atomic_store_n(&entry->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+void statecache_update(struct statecache *cache, dev_t dev, ino_t ino,
+		       int state)
+{
+	struct state_entry *entry = &cache->array[hash_index(dev, ino)];
+	unsigned int seq;
+
+	seq = begin_write(entry);
+	__atomic_store_n(&entry->dev, dev, __ATOMIC_RELAXED);
+	__atomic_store_n(&entry->ino, ino, __ATOMIC_RELAXED);
+	__atomic_store_n(&entry->state, state, __ATOMIC_RELAXED);
+	end_write(entry, seq);
+}
+
+void statecache_invalidate(struct statecache *cache, dev_t dev, ino_t ino)
+{
+	struct state_entry *entry = &cache->array[hash_index(dev, ino)];
+	unsigned int seq;
+
+	seq = begin_write(entry);
+	if (entry->ino == ino && entry->dev == dev)
+		__atomic_store_n(&entry->ino, 0, __ATOMIC_RELAXED);
+	end_write(entry, seq);
+}
+
+void statecache_destroy(struct statecache *cache)
+{
+	free(cache->array);
+	free(cache);
+}
@@ -0,0 +1,41 @@
+/* Linux Projected Filesystem
+   Copyright (C) 2019 GitHub, Inc.
+
+   See the NOTICE file distributed with this library for additional
+   information regarding copyright ownership.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library, in the file COPYING; if not,
+   see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _STATECACHE_H
+#define _STATECACHE_H
+
+#include <sys/types.h>
+
+#define STATECACHE_SIZE 32768
+
+#define STATECACHE_MISS -1
+
+struct statecache;
+
+struct statecache *statecache_create(void);
+void statecache_destroy(struct statecache *cache);
+
+int statecache_lookup(struct statecache *cache, dev_t dev, ino_t ino);
+void statecache_update(struct statecache *cache, dev_t dev, ino_t ino,
+		       int state);
+void statecache_invalidate(struct statecache *cache, dev_t dev, ino_t ino);
+
+#endif /* _STATECACHE_H */
@@ -0,0 +1,780 @@
+/* Linux Projected Filesystem
+   Copyright (C) 2019 GitHub, Inc.
+
+   See the NOTICE file distributed with this library for additional
+   information regarding copyright ownership.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library, in the file COPYING; if not,
+   see <http://www.gnu.org/licenses/>.
+*/
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "pathhash.h"
+#include "readfile.h"
+#include "stateindex.h"
+
+/*
+ * We maintain an index of the paths which have been created, modified,
+ * or removed within the filesystem, and of the files which have been
+ * projected (populated) but not modified, so that a provider can find the
+ * paths which differ from its projection, or which must be refreshed when
+ * its projection changes, without reading the projection state xattr of
+ * every inode in lowerdir.
+ *
+ * The index is held in memory in an open-addressed hash table keyed by
+ * path, and on disk in an append-only file, which consists of a header
+ * followed by one record per change of a path's state.  Each record is a
+ * state character ('M' for modified, 'X' for deleted, 'P' for populated,
+ * or '-' for not indexed), a type character ('d' or 'f'), and the path
+ * relative to lowerdir, terminated by a NUL character.  A record is
+ * appended with a single write(2) as soon as the change is made, so the
+ * file is complete even if our process is killed; on loading, reading
+ * stops at the first invalid or truncated record.
+ *
+ * Records written shortly before a system crash may never reach the disk,
+ * however.  The header therefore contains a flag which is set to 'c' only
+ * when the index is closed cleanly, and otherwise to 'o' (open) along with
+ * the kernel's boot ID.  If the file is loaded after a different boot
+ * while still flagged as open, or if it does not yet exist or its header
+ * is invalid or truncated, the index may be incomplete, and the caller
+ * should rebuild it by scanning lowerdir; until it does so, the index is
+ * flagged 'r' (rebuilding) so that an interrupted rebuild is repeated.
+ *
+ * The file is compacted (i.e., rewritten with one record per indexed
+ * path) when it is loaded and when it is closed, and whenever the number
+ * of superseded records grows large.  As with our hydration traces, it is
+ * written to a temporary file and then renamed over the old one, so the
+ * old index survives a crash during compaction.
+ *
+ * The records of a compacted file are written in directory order, as are
+ * the paths passed to an iterator: paths are sorted bytewise, except that
+ * a slash sorts before any other character, so that the paths beneath
+ * each directory immediately follow it.  A provider refreshing its
+ * placeholders can then visit each directory's contents together.
+ *
+ * When a directory is renamed, the paths indexed beneath it are moved as
+ * well, and their old paths are recorded as deleted; but paths beneath it
+ * which were not indexed are represented only by the directory's own
+ * deleted and modified entries.  Entries are never removed from the hash
+ * table, only marked as not indexed, so their paths remain valid while
+ * they are passed to an iterator.
+ */
+
+#define STATEINDEX_MAGIC "projfs-index-1"
+#define STATEINDEX_MAGIC_LEN sizeof(STATEINDEX_MAGIC)	/* including NUL */
+
+#define STATEINDEX_TMP_SUFFIX ".new"
+
+#define FLAG_OPEN 'o'
+#define FLAG_CLEAN 'c'
+#define FLAG_REBUILD 'r'
+
+#define BOOT_ID_PATH "/proc/sys/kernel/random/boot_id"
+#define BOOT_ID_LEN 36			/* excluding newline */
+
+#define DEFAULT_TABLE_SIZE 64
+
+struct index_entry {
+	char *path;			/* NULL if slot is unused */
+	uint32_t hash;
+	unsigned char state;
+	unsigned char isdir;
+};
+
+struct stateindex {
+	char *path;
+	char *tmp_path;
+	int fd;				/* appends, or -1 after an error */
+	int needs_rebuild;
+	char boot_id[BOOT_ID_LEN + 1];
+	struct index_entry *entries;
+	unsigned int size;
+	uint32_t mask;
+	unsigned int used;		/* slots with a path */
+	unsigned int num_indexed;	/* entries not in STATEINDEX_NONE */
+	unsigned int num_records;	/* records in the file */
+	pthread_mutex_t mutex;
+};
+
+static const char state_chars[] = {
+	[STATEINDEX_NONE] = '-',
+	[STATEINDEX_MODIFIED] = 'M',
+	[STATEINDEX_DELETED] = 'X',
+	[STATEINDEX_POPULATED] = 'P'
+};
+
+#define NUM_STATES (sizeof(state_chars) / sizeof(state_chars[0]))
+
+static int get_state(char c, enum stateindex_state *state)
+{
+	unsigned int i;
+
+	for (i = 0; i < NUM_STATES; ++i) {
+		if (state_chars[i] == c) {
+			*state = i;
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+static void read_boot_id(char *boot_id)
+{
+	ssize_t len = 0;
+	int fd;
+
+	fd = open(BOOT_ID_PATH, O_RDONLY | O_CLOEXEC);
+	if (fd != -1) {
+		len = read(fd, boot_id, BOOT_ID_LEN);
+		close(fd);
+	}
+
+	// an empty ID never matches, so an open index is always rebuilt
+	boot_id[(len == BOOT_ID_LEN) ? len : 0] = '\0';
+}
+
+static int resize_table(struct stateindex *index, unsigned int size)
+{
+	struct index_entry *entries;
+	unsigned int i;
+
+	entries = calloc(size, sizeof(*entries));
+	if (entries == NULL)
+		return ENOMEM;
+
+	for (i = 0; i < index->size; ++i) {
+		struct index_entry *entry = &index->entries[i];
+		uint32_t j;
+
+		if (entry->path == NULL)
+			continue;
+		j = entry->hash & (size - 1);
+		while (entries[j].path != NULL)
+			j = (j + 1) & (size - 1);
+		entries[j] = *entry;
+	}
+
+	free(index->entries);
+	index->entries = entries;
+	index->size = size;
+	index->mask = size - 1;
+
+	return 0;
+}
+
+static struct index_entry *lookup_entry(struct stateindex *index,
+					const char *path, uint32_t hash)
+{
+	uint32_t j = hash & index->mask;
+
+	while (index->entries[j].path != NULL) {
+		if (index->entries[j].hash == hash &&
+		    strcmp(index->entries[j].path, path) == 0)
+			break;
+		j = (j + 1) & index->mask;
+	}
+
+	return &index->entries[j];
+}
+
+#define max_load(sz) (2 * (sz) / 3)
+
+/**
+ * Updates the in-memory state of a path.
+ *
+ * @return 1 if the state was changed, 0 if not, or -1 if memory could
+ *         not be allocated
+ */
+static int put_entry(struct stateindex *index, const char *path, int isdir,
+		     enum stateindex_state state)
+{
+	uint32_t hash = pathhash_fnv1a(path);
+	struct index_entry *entry;
+
+	entry = lookup_entry(index, path, hash);
+	if (entry->path == NULL) {
+		if (state == STATEINDEX_NONE)
+			return 0;
+
+		if (index->used + 1 > max_load(index->size)) {
+			if (resize_table(index, index->size * 2) != 0)
+				return -1;
+			entry = lookup_entry(index, path, hash);
+		}
+
+		entry->path = strdup(path);
+		if (entry->path == NULL)
+			return -1;
+		entry->hash = hash;
+		++index->used;
+	} else if (entry->state == state &&
+		   (entry->isdir == !!isdir || state == STATEINDEX_NONE)) {
+		return 0;
+	}
+
+	if (entry->state == STATEINDEX_NONE)
+		++index->num_indexed;
+	if (state == STATEINDEX_NONE)
+		--index->num_indexed;
+	entry->state = state;
+	entry->isdir = !!isdir;
+
+	return 1;
+}
+
+static int load_index(struct stateindex *index)
+{
+	enum stateindex_state state;
+	const char *boot_id;
+	size_t len, off;
+	char *buf;
+	char flag;
+	int err;
+
+	err = readfile_load(index->path, &buf, &len);
+	if (err == ENOENT || (err == 0 && len == 0)) {
+		if (err == 0)
+			free(buf);
+		index->needs_rebuild = 1;
+		return 0;
+	} else if (err != 0) {
+		return err;
+	}
+
+	// an unrecognized or truncated header is treated as a missing file
+	off = STATEINDEX_MAGIC_LEN;
+	if (len < off + 1 ||
+	    memcmp(buf, STATEINDEX_MAGIC, STATEINDEX_MAGIC_LEN) != 0) {
+		index->needs_rebuild = 1;
+		goto out;
+	}
+
+	flag = buf[off++];
+	boot_id = buf + off;
+	off += strnlen(boot_id, len - off) + 1;
+	if (off > len) {
+		index->needs_rebuild = 1;
+		goto out;
+	}
+
+	if (flag != FLAG_CLEAN &&
+	    (flag != FLAG_OPEN || boot_id[0] == '\0' ||
+	     strcmp(boot_id, index->boot_id) != 0))
+		index->needs_rebuild = 1;
+
+	while (off < len) {
+		const char *record = buf + off;
+		size_t rec_len = strlen(record);
+
+		if (off + rec_len == len || rec_len < 3 ||
+		    get_state(record[0], &state) == -1 ||
+		    (record[1] != 'd' && record[1] != 'f'))
+			break;
+		if (put_entry(index, record + 2, (record[1] == 'd'),
+			      state) == -1) {
+			err = ENOMEM;
+			goto out;
+		}
+		off += rec_len + 1;
+	}
+
+out:
+	free(buf);
+	return err;
+}
+
+// sorts a slash before all other characters, but after the terminating NUL
+static inline int dir_order_char(unsigned char c)
+{
+	if (c == '/')
+		return 1;
+	return (c != '\0' && c < '/') ? c + 1 : c;
+}
+
+static int compare_dir_order(const char *a, const char *b)
+{
+	while (*a == *b && *a != '\0') {
+		++a;
+		++b;
+	}
+
+	return dir_order_char(*a) - dir_order_char(*b);
+}
+
+static int compare_entries(const void *a, const void *b)
+{
+	return compare_dir_order((*(struct index_entry * const *)a)->path,
+				 (*(struct index_entry * const *)b)->path);
+}
+
+static int write_record(FILE *file, const struct index_entry *entry)
+{
+	if (fputc(state_chars[entry->state], file) == EOF ||
+	    fputc(entry->isdir ? 'd' : 'f', file) == EOF ||
+	    fwrite(entry->path, strlen(entry->path) + 1, 1, file) != 1)
+		return -1;
+	return 0;
+}
+
+/**
+ * Rewrites the index file with one record per indexed path, replacing
+ * the old file only once the new one has been written to disk.
+ *
+ * @param flag header flag of the new file
+ * @return 0 or an errno
+ */
+static int compact_index(struct stateindex *index, char flag)
+{
+	struct index_entry **sorted;
+	unsigned int i, n = 0;
+	FILE *file;
+	int fd;
+
+	sorted = calloc(index->num_indexed + 1, sizeof(*sorted));
+	if (sorted == NULL)
+		return ENOMEM;
+	for (i = 0; i < index->size; ++i) {
+		struct index_entry *entry = &index->entries[i];
+
+		if (entry->path != NULL && entry->state != STATEINDEX_NONE)
+			sorted[n++] = entry;
+	}
+	qsort(sorted, n, sizeof(*sorted), compare_entries);
+
+	file = fopen(index->tmp_path, "we");
+	if (file == NULL) {
+		free(sorted);
+		return errno;
+	}
+
+	if (fwrite(STATEINDEX_MAGIC, STATEINDEX_MAGIC_LEN, 1, file) != 1 ||
+	    fputc(flag, file) == EOF ||
+	    fwrite(index->boot_id, strlen(index->boot_id) + 1, 1, file) != 1)
+		goto out_file;
+
+	for (i = 0; i < n; ++i) {
+		if (write_record(file, sorted[i]) == -1)
+			goto out_file;
+	}
+	free(sorted);
+	sorted = NULL;
+
+	if (fflush(file) == EOF || fdatasync(fileno(file)) == -1)
+		goto out_file;
+	if (fclose(file) == EOF) {
+		file = NULL;
+		goto out_file;
+	}
+	if (rename(index->tmp_path, index->path) == -1) {
+		unlink(index->tmp_path);
+		return errno;
+	}
+
+	fd = open(index->path, O_WRONLY | O_APPEND | O_CLOEXEC);
+	if (fd == -1)
+		return errno;
+	if (index->fd != -1)
+		close(index->fd);
+	index->fd = fd;
+	index->num_records = index->num_indexed;
+
+	return 0;
+
+out_file:
+	free(sorted);
+	if (file != NULL)
+		fclose(file);
+	unlink(index->tmp_path);
+	return EIO;
+}
+
+/**
+ * Disables further appends after an error, and removes the index file so
+ * that it will be rebuilt when next loaded.
+ */
+static void fail_index(struct stateindex *index)
+{
+	if (index->fd == -1)
+		return;
+	close(index->fd);
+	index->fd = -1;
+	unlink(index->path);
+}
+
+static int append_record(struct stateindex *index, const char *path,
+			 int isdir, enum stateindex_state state)
+{
+	char prefix[2] = { state_chars[state], isdir ? 'd' : 'f' };
+	struct iovec iov[2];
+	size_t len = strlen(path) + 1;
+	int err;
+
+	if (index->fd == -1)
+		return EIO;
+
+	iov[0].iov_base = prefix;
+	iov[0].iov_len = sizeof(prefix);
+	iov[1].iov_base = (void *)path;
+	iov[1].iov_len = len;
+
+	if (writev(index->fd, iov, 2) != (ssize_t)(sizeof(prefix) + len)) {
+		fail_index(index);
+		return EIO;
+	}
+	++index->num_records;
+
+	// compact once superseded records outnumber the indexed paths
+	if (index->num_records - index->num_indexed > STATEINDEX_COMPACT_MIN &&
+	    index->num_records > 2 * index->num_indexed) {
+		err = compact_index(index, index->needs_rebuild ? FLAG_REBUILD
+								: FLAG_OPEN);
+		if (err != 0) {
+			fail_index(index);
+			return err;
+		}
+	}
+
+	return 0;
+}
+
+static int set_locked(struct stateindex *index, const char *path, int isdir,
+		      enum stateindex_state state)
+{
+	int res;
+
+	res = put_entry(index, path, isdir, state);
+	if (res == -1)
+		return ENOMEM;
+	else if (res == 0)
+		return 0;
+
+	return append_record(index, path, isdir, state);
+}
+
+static void free_index(struct stateindex *index)
+{
+	unsigned int i;
+
+	for (i = 0; i < index->size; ++i)
+		free(index->entries[i].path);
+	free(index->entries);
+	free(index->tmp_path);
+	free(index->path);
+	free(index);
+}
+
+/**
+ * Loads the index file at index_path, if it exists, and compacts it.
+ *
+ * @return index, or NULL with errno set
+ */
+struct stateindex *stateindex_create(const char *index_path)
+{
+	struct stateindex *index;
+	int err;
+
+	index = calloc(1, sizeof(*index));
+	if (index == NULL)
+		return NULL;
+	index->fd = -1;
+
+	index->path = strdup(index_path);
+	index->tmp_path = malloc(strlen(index_path) +
+				 sizeof(STATEINDEX_TMP_SUFFIX));
+	if (index->path == NULL || index->tmp_path == NULL) {
+		err = ENOMEM;
+		goto out_index;
+	}
+	sprintf(index->tmp_path, "%s%s", index_path, STATEINDEX_TMP_SUFFIX);
+
+	err = resize_table(index, DEFAULT_TABLE_SIZE);
+	if (err != 0)
+		goto out_index;
+
+	read_boot_id(index->boot_id);
+
+	err = load_index(index);
+	if (err != 0)
+		goto out_index;
+
+	err = compact_index(index, index->needs_rebuild ? FLAG_REBUILD
+							: FLAG_OPEN);
+	if (err != 0)
+		goto out_index;
+
+	if (pthread_mutex_init(&index->mutex, NULL) != 0) {
+		err = ENOMEM;
+		goto out_fd;
+	}
+
+	return index;
+
+out_fd:
+	close(index->fd);
+out_index:
+	free_index(index);
+	errno = err;
+	return NULL;
+}
+
+/**
+ * @return 1 if the index may be incomplete and should be rebuilt by
+ *         adding the state of every path in lowerdir; 0 otherwise
+ */
+int stateindex_needs_rebuild(struct stateindex *index)
+{
+	return index->needs_rebuild;
+}
+
+/**
+ * Records that a rebuild of the index has been completed.
+ *
+ * @return 0 or an errno
+ */
+int stateindex_finish_rebuild(struct stateindex *index)
+{
+	int err;
+
+	pthread_mutex_lock(&index->mutex);
+	index->needs_rebuild = 0;
+	err = compact_index(index, FLAG_OPEN);
+	if (err != 0)
+		fail_index(index);
+	pthread_mutex_unlock(&index->mutex);
+
+	return err;
+}
+
+/**
+ * Records the state of a path.  After an error writing to the index file,
+ * the in-memory index is still maintained, but the file is removed so
+ * that it will be rebuilt when next loaded.
+ *
+ * @return 0 or an errno
+ */
+int stateindex_set(struct stateindex *index, const char *path, int isdir,
+		   enum stateindex_state state)
+{
+	int err;
+
+	pthread_mutex_lock(&index->mutex);
+	err = set_locked(index, path, isdir, state);
+	pthread_mutex_unlock(&index->mutex);
+
+	return err;
+}
+
+struct moved_entry {
+	const char *path;
+	size_t prefix_len;
+	const char *new_prefix;
+	enum stateindex_state state;
+	int isdir;
+};
+
+static unsigned int find_moved_entries(struct stateindex *index,
+				       const char *dir, const char *new_dir,
+				       struct moved_entry *moved)
+{
+	size_t len = strlen(dir);
+	unsigned int i, n = 0;
+
+	for (i = 0; i < index->size; ++i) {
+		const struct index_entry *entry = &index->entries[i];
+
+		// deleted paths did not move with the directory
+		if (entry->path == NULL ||
+		    entry->state == STATEINDEX_NONE ||
+		    entry->state == STATEINDEX_DELETED ||
+		    strncmp(entry->path, dir, len) != 0 ||
+		    entry->path[len] != '/')
+			continue;
+
+		if (moved != NULL) {
+			moved[n].path = entry->path;
+			moved[n].prefix_len = len;
+			moved[n].new_prefix = new_dir;
+			moved[n].state = entry->state;
+			moved[n].isdir = entry->isdir;
+		}
+		++n;
+	}
+
+	return n;
+}
+
+/**
+ * Records the renaming of a path, moving any paths indexed beneath it if
+ * it is a directory.
+ *
+ * @param src_isdir 1 if the source path was a directory; 0 otherwise
+ * @param dst_isdir 1 if the destination path was a directory, when the
+ *                  paths were exchanged; ignored otherwise
+ * @param exchange 1 if the paths were exchanged (per RENAME_EXCHANGE)
+ * @return 0 or an errno
+ */
+int stateindex_rename(struct stateindex *index, const char *src,
+		      int src_isdir, const char *dst, int dst_isdir,
+		      int exchange)
+{
+	struct moved_entry *moved = NULL;
+	unsigned int i, n = 0, nsrc = 0;
+	char *path;
+	int res, err = 0;
+
+	pthread_mutex_lock(&index->mutex);
+
+	if (src_isdir)
+		nsrc = find_moved_entries(index, src, dst, NULL);
+	n = nsrc;
+	if (exchange && dst_isdir)
+		n += find_moved_entries(index, dst, src, NULL);
+
+	if (n > 0) {
+		moved = calloc(n, sizeof(*moved));
+		if (moved == NULL) {
+			err = ENOMEM;
+			goto out;
+		}
+		if (src_isdir)
+			find_moved_entries(index, src, dst, moved);
+		if (exchange && dst_isdir)
+			find_moved_entries(index, dst, src, &moved[nsrc]);
+	}
+
+	// mark all old paths first, as exchanged paths may be reused
+	for (i = 0; i < n; ++i) {
+		res = set_locked(index, moved[i].path, moved[i].isdir,
+				 STATEINDEX_DELETED);
+		if (res != 0 && err == 0)
+			err = res;
+	}
+
+	for (i = 0; i < n; ++i) {
+		const char *suffix = moved[i].path + moved[i].prefix_len;
+
+		path = malloc(strlen(moved[i].new_prefix) + strlen(suffix) + 1);
+		if (path == NULL) {
+			err = ENOMEM;
+			goto out;
+		}
+		sprintf(path, "%s%s", moved[i].new_prefix, suffix);
+		res = set_locked(index, path, moved[i].isdir, moved[i].state);
+		if (res != 0 && err == 0)
+			err = res;
+		free(path);
+	}
+
+	if (exchange) {
+		res = set_locked(index, src, dst_isdir, STATEINDEX_MODIFIED);
+		if (res != 0 && err == 0)
+			err = res;
+	} else {
+		res = set_locked(index, src, src_isdir, STATEINDEX_DELETED);
+		if (res != 0 && err == 0)
+			err = res;
+	}
+	res = set_locked(index, dst, src_isdir, STATEINDEX_MODIFIED);
+	if (res != 0 && err == 0)
+		err = res;
+
+out:
+	pthread_mutex_unlock(&index->mutex);
+	free(moved);
+	return err;
+}
+
+struct iter_entry {
+	const char *path;
+	int isdir;
+};
+
+static int compare_iter_entries(const void *a, const void *b)
+{
+	return compare_dir_order(((const struct iter_entry *)a)->path,
+				 ((const struct iter_entry *)b)->path);
+}
+
+/**
+ * Calls an iterator function for each path in the given state, until it
+ * returns a non-zero value.  The paths are those indexed at the time of
+ * the call, and are passed in directory order.
+ *
+ * @return 0, the non-zero value returned by the iterator, or an errno
+ */
+int stateindex_iterate(struct stateindex *index, enum stateindex_state state,
+		       stateindex_iter_t iter, void *data)
+{
+	struct iter_entry *snapshot;
+	unsigned int i, n = 0;
+	int res = 0;
+
+	pthread_mutex_lock(&index->mutex);
+	snapshot = calloc(index->num_indexed + 1, sizeof(*snapshot));
+	if (snapshot != NULL) {
+		for (i = 0; i < index->size; ++i) {
+			const struct index_entry *entry = &index->entries[i];
+
+			if (entry->path == NULL || entry->state != state)
+				continue;
+			snapshot[n].path = entry->path;
+			snapshot[n].isdir = entry->isdir;
+			++n;
+		}
+	}
+	pthread_mutex_unlock(&index->mutex);
+
+	if (snapshot == NULL)
+		return ENOMEM;
+
+	qsort(snapshot, n, sizeof(*snapshot), compare_iter_entries);
+
+	// entry paths are never freed until the index is destroyed
+	for (i = 0; i < n && res == 0; ++i)
+		res = iter(data, snapshot[i].path, snapshot[i].isdir);
+
+	free(snapshot);
+	return res;
+}
+
+/**
+ * Compacts the index file, flagging it as cleanly closed unless a rebuild
+ * was not completed or an error occurred, and frees the index.
+ */
+void stateindex_destroy(struct stateindex *index)
+{
+	if (index->fd != -1) {
+		if (compact_index(index, index->needs_rebuild
+					 ? FLAG_REBUILD : FLAG_CLEAN) != 0)
+			fail_index(index);
+		else
+			close(index->fd);
+	}
+
+	pthread_mutex_destroy(&index->mutex);
+	free_index(index);
+}
@@ -0,0 +1,54 @@
+/* Linux Projected Filesystem
+   Copyright (C) 2019 GitHub, Inc.
+
+   See the NOTICE file distributed with this library for additional
+   information regarding copyright ownership.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library, in the file COPYING; if not,
+   see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _STATEINDEX_H
+#define _STATEINDEX_H
+
+// minimum number of superseded records before the index is compacted
+#define STATEINDEX_COMPACT_MIN 4096
+
+enum stateindex_state {
+	STATEINDEX_NONE,		/* not indexed */
+	STATEINDEX_MODIFIED,		/* created or modified */
+	STATEINDEX_DELETED,		/* removed or renamed away */
+	STATEINDEX_POPULATED		/* projected, but not modified */
+};
+
+struct stateindex;
+
+typedef int (*stateindex_iter_t)(void *data, const char *path, int isdir);
+
+struct stateindex *stateindex_create(const char *index_path);
+void stateindex_destroy(struct stateindex *index);
+
+int stateindex_needs_rebuild(struct stateindex *index);
+int stateindex_finish_rebuild(struct stateindex *index);
+
+int stateindex_set(struct stateindex *index, const char *path, int isdir,
+		   enum stateindex_state state);
+int stateindex_rename(struct stateindex *index, const char *src,
+		      int src_isdir, const char *dst, int dst_isdir,
+		      int exchange);
+
+int stateindex_iterate(struct stateindex *index, enum stateindex_state state,
+		       stateindex_iter_t iter, void *data);
+
+#endif /* _STATEINDEX_H */
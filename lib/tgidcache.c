@@ -0,0 +1,277 @@
+/* Linux Projected Filesystem
+   Copyright (C) 2019 GitHub, Inc.
+
+   See the NOTICE file distributed with this library for additional
+   information regarding copyright ownership.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library, in the file COPYING; if not,
+   see <http://www.gnu.org/licenses/>.
+*/
+
+#define _GNU_SOURCE
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "tgidcache.h"
+
+/*
+ * We implement a fixed-size, direct-mapped cache of thread group IDs
+ * (i.e., process IDs) keyed by thread ID, so that we need not read
+ * /proc/<tid>/status each time we report the process which caused an
+ * event.  As with our state cache, each thread ID hashes to exactly one
+ * slot, and a new entry simply evicts the previous occupant of its slot.
+ *
+ * Each entry also records the start time of its thread, as found in
+ * /proc/<tid>/stat, which the kernel never changes for the lifetime of
+ * the thread but which will differ if its thread ID is later reused.
+ * Entries are trusted without further checks for a short period after
+ * they are verified; thereafter, the next lookup re-reads the start time,
+ * and if it has changed, or the thread has exited, the entry is stale and
+ * we resolve the thread group ID afresh.
+ *
+ * Since the kernel allocates process and thread IDs cyclically, an ID can
+ * only be reused once the entire ID space has been cycled through, which
+ * cannot plausibly occur within our revalidation period.
+ *
+ * Reads from /proc are performed with a single read(2) into a buffer on
+ * the stack, since the fields we need always lie near the start of each
+ * file.  As before, errors are not reported; if we cannot determine a
+ * thread group ID, we simply return the thread ID, and do not cache it.
+ */
+
+struct tgid_entry {
+	pid_t tid;
+	pid_t tgid;
+	unsigned long long starttime;
+	uint64_t verified_ms;
+};
+
+struct tgidcache {
+	struct tgid_entry *array;
+	pthread_mutex_t mutex;
+};
+
+#define TGIDCACHE_BITS 10
+
+#if (1 << TGIDCACHE_BITS) != TGIDCACHE_SIZE
+#error "TGIDCACHE_BITS does not match TGIDCACHE_SIZE"
+#endif
+
+struct tgidcache *tgidcache_create(void)
+{
+	struct tgidcache *cache;
+
+	cache = calloc(1, sizeof(*cache));
+	if (cache == NULL)
+		return NULL;
+
+	cache->array = calloc(TGIDCACHE_SIZE, sizeof(*cache->array));
+	if (cache->array == NULL)
+		goto out_cache;
+
+	if (pthread_mutex_init(&cache->mutex, NULL) != 0)
+		goto out_array;
+
+	return cache;
+
+out_array:
+	free(cache->array);
+out_cache:
+	free(cache);
+	return NULL;
+}
+
+// 2^32 / golden ratio
+#define GOLDEN_RATIO_32 0x61C88647
+
+static inline unsigned int hash_index(pid_t tid)
+{
+	return ((uint32_t)tid * GOLDEN_RATIO_32) >> (32 - TGIDCACHE_BITS);
+}
+
+static uint64_t get_time_ms(void)
+{
+	struct timespec ts;
+
+	// a coarse clock suffices and avoids any need for a syscall
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / (1000 * 1000);
+}
+
+// ceil(log10(INT_MAX)) = ceil(log10(2) * sizeof(int) * CHAR_BIT)
+//			<     (   1/3   * sizeof(int) * CHAR_BIT) + 1
+#define INT_FMT_LEN ((sizeof(int) * CHAR_BIT) / 3 + 1)
+
+#define PROC_PATH_FMT "/proc/%d/%s"
+#define MAX_PROC_NAME_LEN (sizeof("status") - 1)
+#define MAX_PROC_PATH_LEN \
+	(sizeof(PROC_PATH_FMT) + INT_FMT_LEN + MAX_PROC_NAME_LEN - 5)
+
+// both fields we want fall well within the first few hundred bytes
+#define PROC_BUF_SIZE 512
+
+static ssize_t read_proc_file(pid_t tid, const char *name, char *buf)
+{
+	char path[MAX_PROC_PATH_LEN + 1];
+	ssize_t len;
+	int fd;
+
+	sprintf(path, PROC_PATH_FMT, tid, name);
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return -1;
+	len = read(fd, buf, PROC_BUF_SIZE - 1);
+	close(fd);
+
+	if (len > 0)
+		buf[len] = '\0';
+	return len;
+}
+
+#define PROC_STATUS_TGID_KEY "\nTgid:"
+#define PROC_STATUS_TGID_KEY_LEN (sizeof(PROC_STATUS_TGID_KEY) - 1)
+
+static pid_t read_proc_tgid(pid_t tid)
+{
+	char buf[PROC_BUF_SIZE];
+	unsigned long val = 0;
+	char *s;
+
+	if (read_proc_file(tid, "status", buf) <= 0)
+		return 0;
+
+	s = strstr(buf, PROC_STATUS_TGID_KEY);
+	if (s == NULL)
+		return 0;
+	s += PROC_STATUS_TGID_KEY_LEN;
+
+	while (isblank(*s))
+		++s;
+	while (isdigit(*s) && val < INT_MAX)
+		val = val * 10 + (*s++ - '0');
+	while (isblank(*s))
+		++s;
+	if (*s != '\n' || val == 0 || val >= INT_MAX)
+		return 0;
+
+	return val;
+}
+
+// starttime is field 22, and the command name in field 2 is followed by
+// field 3, so 19 fields separate the name from the start time
+#define PROC_STAT_STARTTIME_SKIP 19
+
+static unsigned long long read_proc_starttime(pid_t tid)
+{
+	char buf[PROC_BUF_SIZE];
+	unsigned long long val = 0;
+	char *s;
+	int i;
+
+	if (read_proc_file(tid, "stat", buf) <= 0)
+		return 0;
+
+	// the command name may contain spaces and parentheses
+	s = strrchr(buf, ')');
+	if (s == NULL)
+		return 0;
+	++s;
+
+	for (i = 0; i < PROC_STAT_STARTTIME_SKIP; ++i) {
+		s = strchr(s + 1, ' ');
+		if (s == NULL)
+			return 0;
+	}
+	++s;
+
+	if (!isdigit(*s))
+		return 0;
+	while (isdigit(*s))
+		val = val * 10 + (*s++ - '0');
+	if (*s != ' ')
+		return 0;
+
+	return val;
+}
+
+pid_t tgidcache_lookup(struct tgidcache *cache, pid_t tid)
+{
+	struct tgid_entry *entry = &cache->array[hash_index(tid)];
+	uint64_t now = get_time_ms();
+	unsigned long long starttime = 0;
+	pid_t tgid = 0;
+
+	pthread_mutex_lock(&cache->mutex);
+	if (entry->tid == tid) {
+		if (now - entry->verified_ms < TGIDCACHE_REVALIDATE_MSEC)
+			tgid = entry->tgid;
+		else
+			starttime = entry->starttime;
+	}
+	pthread_mutex_unlock(&cache->mutex);
+
+	if (tgid > 0)
+		return tgid;
+
+	if (starttime > 0) {
+		unsigned long long cur_starttime = read_proc_starttime(tid);
+
+		pthread_mutex_lock(&cache->mutex);
+		if (entry->tid == tid && entry->starttime == cur_starttime) {
+			entry->verified_ms = now;
+			tgid = entry->tgid;
+		}
+		pthread_mutex_unlock(&cache->mutex);
+
+		if (tgid > 0)
+			return tgid;
+		if (cur_starttime == 0)
+			return tid;		// thread has exited
+	}
+
+	// if the thread ID is reused between these reads, the start time
+	// will not match at the next revalidation and we will try again
+	starttime = read_proc_starttime(tid);
+	if (starttime == 0)
+		return tid;		// best effort
+	tgid = read_proc_tgid(tid);
+	if (tgid == 0)
+		return tid;
+
+	pthread_mutex_lock(&cache->mutex);
+	entry->tid = tid;
+	entry->tgid = tgid;
+	entry->starttime = starttime;
+	entry->verified_ms = now;
+	pthread_mutex_unlock(&cache->mutex);
+
+	return tgid;
+}
+
+void tgidcache_destroy(struct tgidcache *cache)
+{
+	pthread_mutex_destroy(&cache->mutex);
+	free(cache->array);
+	free(cache);
+}
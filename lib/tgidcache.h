@@ -0,0 +1,38 @@
+/* Linux Projected Filesystem
+   Copyright (C) 2019 GitHub, Inc.
+
+   See the NOTICE file distributed with this library for additional
+   information regarding copyright ownership.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library, in the file COPYING; if not,
+   see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _TGIDCACHE_H
+#define _TGIDCACHE_H
+
+#include <sys/types.h>
+
+#define TGIDCACHE_SIZE 1024
+
+#define TGIDCACHE_REVALIDATE_MSEC 1000
+
+struct tgidcache;
+
+struct tgidcache *tgidcache_create(void);
+void tgidcache_destroy(struct tgidcache *cache);
+
+pid_t tgidcache_lookup(struct tgidcache *cache, pid_t tid);
+
+#endif /* _TGIDCACHE_H */
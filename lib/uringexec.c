@@ -0,0 +1,453 @@
+/* Linux Projected Filesystem
+   Copyright (C) 2019 GitHub, Inc.
+
+   See the NOTICE file distributed with this library for additional
+   information regarding copyright ownership.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library, in the file COPYING; if not,
+   see <http://www.gnu.org/licenses/>.
+*/
+
+#define _GNU_SOURCE
+
+#include <config.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+
+#ifdef HAVE_LIBURING
+#include <attr/xattr.h>
+#include <liburing.h>
+#endif
+
+#include "uringexec.h"
+
+/*
+ * When built with liburing, we can create placeholder files and
+ * directories by submitting the fixed sequence of system calls each one
+ * requires to an io_uring(7) instance, so that the placeholders for a
+ * whole directory are created with a few calls to io_uring_enter(2)
+ * rather than several system calls apiece, which matters most on kernels
+ * where each system call is made more costly by speculative execution
+ * mitigations.
+ *
+ * The calls for each placeholder form a chain of linked submission
+ * entries, so that each runs only if the previous one succeeded:
+ *
+ * - for a directory, mkdirat(2), then openat(2) of the new directory;
+ *   for a file, openat(2) with O_CREAT and O_EXCL, then ftruncate(2)
+ *   if the file is not empty
+ * - statx(2), to obtain the device and inode numbers
+ * - fsetxattr(2) for each extended attribute
+ *
+ * Each placeholder is opened into a slot in a table of registered ("direct")
+ * file descriptors, so the later calls in its chain can refer to it before
+ * its opening has completed, and the slots are closed together in a second
+ * submission once all the chains have completed.  Up to
+ * URINGEXEC_MAX_CHAINS chains are submitted at once.
+ *
+ * If a chain fails after its placeholder was created, the placeholder is
+ * removed, so the caller never sees a partially created placeholder; but
+ * one which could not be created (e.g., because a file of the same name
+ * exists) is never removed.
+ *
+ * The chains rely on operations added in Linux 6.9 (for ftruncate(2)), so
+ * we probe for all the operations we need when the instance is created,
+ * and if any is unsupported, creation fails with ENOSYS and the caller
+ * should make the system calls itself.  Without liburing, creation always
+ * fails in this way.  Since only one thread may submit to an instance at
+ * a time, submissions are serialized by a mutex.
+ *
+ * We always reap a completion for every entry submitted, retrying if a
+ * wait is interrupted by a signal, and close any slots opened and remove
+ * any placeholders created by chains whose completions say they failed,
+ * even if a submission fails.  Should the ring be left holding entries
+ * which were never submitted, or completions which were never reaped, it
+ * is unusable, as they would be confused with those of later chains, so
+ * every later submission fails with the same error.
+ */
+
+#ifdef HAVE_LIBURING
+
+struct uringexec {
+	struct io_uring ring;
+	pthread_mutex_t mutex;
+	struct statx stx[URINGEXEC_MAX_CHAINS];
+	unsigned char created[URINGEXEC_MAX_CHAINS];
+	unsigned char opened[URINGEXEC_MAX_CHAINS];
+	int failed;			/* errno once the ring is unusable */
+};
+
+enum chain_step {
+	STEP_CREATE,		/* mkdirat(2), or openat(2) of a file */
+	STEP_OPEN,		/* openat(2) of a directory */
+	STEP_OTHER,
+	STEP_CLOSE
+};
+
+#define make_data(i, step) (((uint64_t)(i) << 8) | (step))
+#define get_data_index(data) ((unsigned int)((data) >> 8))
+#define get_data_step(data) ((enum chain_step)((data) & 0xFF))
+
+static const int required_ops[] = {
+	IORING_OP_OPENAT,
+	IORING_OP_CLOSE,
+	IORING_OP_STATX,
+	IORING_OP_MKDIRAT,
+	IORING_OP_FSETXATTR,
+	IORING_OP_FTRUNCATE
+};
+
+#define NUM_REQUIRED_OPS (sizeof(required_ops) / sizeof(required_ops[0]))
+
+static int check_probe(struct io_uring *ring)
+{
+	struct io_uring_probe *probe;
+	unsigned int i;
+	int res = 0;
+
+	probe = io_uring_get_probe_ring(ring);
+	if (probe == NULL)
+		return ENOSYS;
+
+	for (i = 0; i < NUM_REQUIRED_OPS; ++i) {
+		if (!io_uring_opcode_supported(probe, required_ops[i])) {
+			res = ENOSYS;
+			break;
+		}
+	}
+	io_uring_free_probe(probe);
+
+	return res;
+}
+
+struct uringexec *uringexec_create(void)
+{
+	struct uringexec *ex;
+	int err;
+
+	ex = calloc(1, sizeof(*ex));
+	if (ex == NULL)
+		return NULL;
+
+	err = -io_uring_queue_init(URINGEXEC_QUEUE_DEPTH, &ex->ring, 0);
+	if (err != 0)
+		goto out_ex;
+
+	err = check_probe(&ex->ring);
+	if (err != 0)
+		goto out_ring;
+
+	err = -io_uring_register_files_sparse(&ex->ring,
+					      URINGEXEC_MAX_CHAINS);
+	if (err != 0)
+		goto out_ring;
+
+	if (pthread_mutex_init(&ex->mutex, NULL) != 0) {
+		err = ENOMEM;
+		goto out_ring;
+	}
+
+	return ex;
+
+out_ring:
+	io_uring_queue_exit(&ex->ring);
+out_ex:
+	free(ex);
+	errno = err;
+	return NULL;
+}
+
+/**
+ * @return maximum number of extended attributes in a single chain
+ */
+int uringexec_max_xattrs(void)
+{
+	// allow for mkdirat() or ftruncate(), openat(), and statx()
+	return URINGEXEC_QUEUE_DEPTH - 3;
+}
+
+static unsigned int count_chain_sqes(const struct uringexec_chain *chain)
+{
+	unsigned int n = 2 + chain->nxattrs;		// open and statx
+
+	if (S_ISDIR(chain->mode) || chain->size > 0)
+		++n;					// mkdirat or ftruncate
+	return n;
+}
+
+static struct io_uring_sqe *get_sqe(struct uringexec *ex, unsigned int i,
+				    enum chain_step step)
+{
+	// queue depth is never exceeded, so this should not fail
+	struct io_uring_sqe *sqe = io_uring_get_sqe(&ex->ring);
+
+	io_uring_sqe_set_data64(sqe, make_data(i, step));
+	return sqe;
+}
+
+static unsigned int prep_chain(struct uringexec *ex, int dir_fd,
+			       unsigned int i,
+			       const struct uringexec_chain *chain)
+{
+	struct io_uring_sqe *sqe;
+	unsigned int j;
+
+	if (S_ISDIR(chain->mode)) {
+		sqe = get_sqe(ex, i, STEP_CREATE);
+		io_uring_prep_mkdirat(sqe, dir_fd, chain->name,
+				      chain->mode & ~S_IFMT);
+		sqe->flags |= IOSQE_IO_LINK;
+
+		sqe = get_sqe(ex, i, STEP_OPEN);
+		io_uring_prep_openat_direct(sqe, dir_fd, chain->name,
+					    O_RDONLY | O_DIRECTORY |
+					    O_NOFOLLOW, 0, i);
+		sqe->flags |= IOSQE_IO_LINK;
+	} else {
+		sqe = get_sqe(ex, i, STEP_CREATE);
+		io_uring_prep_openat_direct(sqe, dir_fd, chain->name,
+					    O_WRONLY | O_CREAT | O_EXCL,
+					    chain->mode & ~S_IFMT, i);
+		sqe->flags |= IOSQE_IO_LINK;
+
+		if (chain->size > 0) {
+			sqe = get_sqe(ex, i, STEP_OTHER);
+			io_uring_prep_ftruncate(sqe, i, chain->size);
+			sqe->flags |= IOSQE_FIXED_FILE | IOSQE_IO_LINK;
+		}
+	}
+
+	sqe = get_sqe(ex, i, STEP_OTHER);
+	io_uring_prep_statx(sqe, dir_fd, chain->name, AT_SYMLINK_NOFOLLOW,
+			    STATX_INO, &ex->stx[i]);
+
+	for (j = 0; j < chain->nxattrs; ++j) {
+		const struct uringexec_xattr *xattr = &chain->xattrs[j];
+
+		sqe->flags |= IOSQE_IO_LINK;
+		sqe = get_sqe(ex, i, STEP_OTHER);
+		io_uring_prep_fsetxattr(sqe, i, xattr->name, xattr->value,
+					XATTR_CREATE, xattr->size);
+		sqe->flags |= IOSQE_FIXED_FILE;
+	}
+
+	return count_chain_sqes(chain);
+}
+
+/**
+ * Submits the prepared entries and reaps a completion for each one that
+ * was submitted, recording the results of the chains.
+ *
+ * @param chains chains of the entries, or NULL if only closing slots
+ * @param nsqes number of entries prepared
+ * @return 0, or an errno if not all the entries were submitted and
+ *         completed, in which case the ring is marked as failed
+ */
+static int reap_cqes(struct uringexec *ex, struct uringexec_chain *chains,
+		     unsigned int nsqes)
+{
+	unsigned int nsubmitted = 0;
+	struct io_uring_cqe *cqe;
+	int res;
+
+	while (nsubmitted < nsqes) {
+		res = io_uring_submit(&ex->ring);
+		if (res == -EINTR)
+			continue;
+		if (res <= 0) {
+			ex->failed = (res < 0) ? -res : EIO;
+			break;
+		}
+		nsubmitted += res;
+	}
+
+	while (nsubmitted > 0) {
+		uint64_t data;
+		unsigned int i;
+		int err;
+
+		res = io_uring_wait_cqe(&ex->ring, &cqe);
+		if (res == -EINTR)
+			continue;
+		if (res < 0) {
+			ex->failed = -res;
+			break;
+		}
+		--nsubmitted;
+
+		data = io_uring_cqe_get_data64(cqe);
+		i = get_data_index(data);
+		err = (cqe->res < 0) ? -cqe->res : 0;
+		io_uring_cqe_seen(&ex->ring, cqe);
+
+		switch (get_data_step(data)) {
+		case STEP_CREATE:
+			ex->created[i] = (err == 0);
+			ex->opened[i] = (err == 0 &&
+					 !S_ISDIR(chains[i].mode));
+			break;
+		case STEP_OPEN:
+			ex->opened[i] = (err == 0);
+			break;
+		case STEP_CLOSE:
+			continue;
+		default:
+		case STEP_OTHER:
+			break;
+		}
+
+		// later steps are cancelled once one fails
+		if (err != 0 && (chains[i].result == 0 ||
+				 chains[i].result == ECANCELED))
+			chains[i].result = err;
+	}
+
+	return ex->failed;
+}
+
+static int close_slots(struct uringexec *ex, unsigned int n)
+{
+	struct io_uring_sqe *sqe;
+	unsigned int i, nsqes = 0;
+
+	for (i = 0; i < n && ex->failed == 0; ++i) {
+		if (!ex->opened[i])
+			continue;
+		sqe = get_sqe(ex, i, STEP_CLOSE);
+		io_uring_prep_close_direct(sqe, i);
+		++nsqes;
+	}
+
+	if (nsqes > 0)
+		(void)reap_cqes(ex, NULL, nsqes);
+
+	// nothing more may be submitted, so close all the slots at once
+	if (ex->failed != 0)
+		(void)io_uring_unregister_files(&ex->ring);	// best effort
+
+	return ex->failed;
+}
+
+/**
+ * Records the device and inode of each placeholder created by a
+ * successful chain, and removes those created by failed chains.
+ *
+ * @param err errno with which to fail any chains not known to have
+ *            failed, if their entries were not all submitted and completed
+ */
+static void finish_chains(struct uringexec *ex, int dir_fd,
+			  struct uringexec_chain *chains, unsigned int n,
+			  int err)
+{
+	unsigned int i;
+
+	for (i = 0; i < n; ++i) {
+		struct uringexec_chain *chain = &chains[i];
+
+		if (chain->result == 0)
+			chain->result = err;
+
+		if (chain->result == 0) {
+			chain->dev = makedev(ex->stx[i].stx_dev_major,
+					     ex->stx[i].stx_dev_minor);
+			chain->ino = ex->stx[i].stx_ino;
+		} else if (ex->created[i]) {
+			unlinkat(dir_fd, chain->name,
+				 S_ISDIR(chain->mode) ? AT_REMOVEDIR : 0);
+		}
+	}
+}
+
+/**
+ * Creates placeholder directories and files within a directory, setting
+ * the given extended attributes on each.  Each chain's result is set to
+ * zero or an errno; the chains must not have more extended attributes
+ * than uringexec_max_xattrs() permits.
+ *
+ * @return 0, or an errno if the submissions themselves failed, in which
+ *         case the chains which did not fail otherwise have that result,
+ *         and the results of the remaining chains are not set
+ */
+int uringexec_create_entries(struct uringexec *ex, int dir_fd,
+			     struct uringexec_chain *chains, unsigned int n)
+{
+	unsigned int i, k, nsqes;
+	int res, err;
+
+	pthread_mutex_lock(&ex->mutex);
+	res = ex->failed;
+	for (i = 0; i < n && res == 0; i += k) {
+		struct uringexec_chain *round = &chains[i];
+
+		nsqes = 0;
+		for (k = 0; i + k < n && k < URINGEXEC_MAX_CHAINS; ++k) {
+			unsigned int m = count_chain_sqes(&round[k]);
+
+			if (nsqes + m > URINGEXEC_QUEUE_DEPTH)
+				break;
+			round[k].result = 0;
+			ex->created[k] = 0;
+			ex->opened[k] = 0;
+			nsqes += prep_chain(ex, dir_fd, k, &round[k]);
+		}
+
+		res = reap_cqes(ex, round, nsqes);
+		err = close_slots(ex, k);
+		if (res == 0)
+			res = err;
+		finish_chains(ex, dir_fd, round, k, res);
+	}
+	pthread_mutex_unlock(&ex->mutex);
+
+	return res;
+}
+
+void uringexec_destroy(struct uringexec *ex)
+{
+	io_uring_queue_exit(&ex->ring);
+	pthread_mutex_destroy(&ex->mutex);
+	free(ex);
+}
+
+#else /* HAVE_LIBURING */
+
+struct uringexec *uringexec_create(void)
+{
+	errno = ENOSYS;
+	return NULL;
+}
+
+int uringexec_max_xattrs(void)
+{
+	return 0;
+}
+
+int uringexec_create_entries(struct uringexec *ex, int dir_fd,
+			     struct uringexec_chain *chains, unsigned int n)
+{
+	return ENOSYS;
+}
+
+void uringexec_destroy(struct uringexec *ex)
+{
+}
+
+#endif /* HAVE_LIBURING */
@@ -0,0 +1,58 @@
+/* Linux Projected Filesystem
+   Copyright (C) 2019 GitHub, Inc.
+
+   See the NOTICE file distributed with this library for additional
+   information regarding copyright ownership.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library, in the file COPYING; if not,
+   see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _URINGEXEC_H
+#define _URINGEXEC_H
+
+#include <sys/types.h>
+
+// placeholders created, and submission entries used, per submission
+#define URINGEXEC_MAX_CHAINS 64
+#define URINGEXEC_QUEUE_DEPTH 512
+
+struct uringexec;
+
+struct uringexec_xattr {
+	const char *name;
+	const void *value;
+	size_t size;
+};
+
+struct uringexec_chain {
+	const char *name;		/* name within the parent directory */
+	mode_t mode;			/* S_IFDIR or S_IFREG, and mode */
+	off_t size;			/* size of a file */
+	const struct uringexec_xattr *xattrs;
+	unsigned int nxattrs;
+	dev_t dev;			/* device and inode, on success */
+	ino_t ino;
+	int result;			/* zero or an errno, on return */
+};
+
+struct uringexec *uringexec_create(void);
+void uringexec_destroy(struct uringexec *ex);
+
+int uringexec_max_xattrs(void);
+
+int uringexec_create_entries(struct uringexec *ex, int dir_fd,
+			     struct uringexec_chain *chains, unsigned int n);
+
+#endif /* _URINGEXEC_H */
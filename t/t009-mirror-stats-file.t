@@ -0,0 +1,64 @@
+#!/bin/sh
+#
+# Copyright (C) 2018-2019 GitHub, Inc.
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see http://www.gnu.org/licenses/ .
+
+test_description='projfs filesystem mirroring stats file tests
+
+Check that the virtual stats file reports live counters, is read-only,
+is not listed by readdir, and is never created in the lower directory.
+'
+
+. ./test-lib.sh
+
+projfs_start test_simple source target || exit 1
+
+test_expect_success 'create source tree' '
+	echo file > source/file
+'
+
+test_expect_success 'check stats file' '
+	cat target/file >/dev/null &&
+	cat target/.projfs/stats >stats &&
+	grep "^files_projected [0-9][0-9]*$" stats &&
+	grep "^fdtable_entries [0-9][0-9]*$" stats &&
+	grep "^op getattr [0-9]" stats
+'
+
+test_expect_success 'check stats directory listing' '
+	ls -a target/.projfs >list &&
+	printf ".\n..\nstats\n" >list.expect &&
+	test_cmp list.expect list
+'
+
+test_expect_success 'check reserved directory is hidden' '
+	ls -a target >list &&
+	test_must_fail grep "^\.projfs$" list
+'
+
+test_expect_success 'check stats file is read-only' '
+	test_must_fail sh -c "echo x >target/.projfs/stats" &&
+	test_must_fail mkdir target/.projfs/dir &&
+	test_must_fail rm target/.projfs/stats &&
+	test_path_is_missing target/.projfs/missing
+'
+
+test_expect_success 'check lower directory is untouched' '
+	test_path_is_missing source/.projfs
+'
+
+projfs_stop || exit 1
+
+test_done
@@ -17,7 +17,8 @@
 
 test_description='projfs file descriptor table fill test
 
-Check that the file descriptor hash table grows to its maximum size.
+Check that the file descriptor hash table grows beyond its former maximum
+size, and shrinks again, while retaining all its entries.
 '
 
 . ./test-lib.sh
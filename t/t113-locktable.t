@@ -0,0 +1,33 @@
+#!/bin/sh
+#
+# Copyright (C) 2019 GitHub, Inc.
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see http://www.gnu.org/licenses/ .
+
+test_description='projfs lock table test
+
+Check that a lock on an inode which is not released in time is not
+acquired, that a waiter acquires a lock as soon as it is released, and
+that locks on distinct inodes are independent.  Also check that a result
+published on release is shared with concurrent waiters which accept it,
+and that other waiters acquire the lock in turn.
+'
+
+. ./test-lib.sh
+
+test_expect_success 'check lock table operations' '
+	"$TEST_DIRECTORY/test_locktable"
+'
+
+test_done
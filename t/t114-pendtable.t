@@ -0,0 +1,31 @@
+#!/bin/sh
+#
+# Copyright (C) 2019 GitHub, Inc.
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see http://www.gnu.org/licenses/ .
+
+test_description='projfs pending event table test
+
+Check that a pending event returns the result with which it is completed,
+fails with ETIMEDOUT if not completed in time, and returns the given
+result once the table is cancelled.
+'
+
+. ./test-lib.sh
+
+test_expect_success 'check pending event table operations' '
+	"$TEST_DIRECTORY/test_pendtable"
+'
+
+test_done
@@ -0,0 +1,67 @@
+#!/bin/sh
+#
+# Copyright (C) 2019 GitHub, Inc.
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see http://www.gnu.org/licenses/ .
+
+test_description='projfs asynchronous event notification tests
+
+Check that projfs file operation notification events are delivered
+in order when dispatched asynchronously, while permission request
+events continue to be handled synchronously.
+'
+
+. ./test-lib.sh
+. "$TEST_DIRECTORY"/test-lib-event.sh
+
+projfs_start test_handlers source target --notify-async \
+	--notify-queue-size=4 || exit 1
+
+test_expect_success 'test file operations with asynchronous notification' '
+	mkdir target/d1 &&
+	touch target/d1/f1.txt &&
+	mv target/d1/f1.txt target/d1/f2.txt &&
+	rm target/d1/f2.txt &&
+	rmdir target/d1 &&
+	test_path_is_missing target/d1
+'
+
+projfs_stop || exit 1
+
+# queued notifications are all delivered before the filesystem is unmounted
+test_expect_success 'check all event notifications delivered in order' '
+	sed -n "s/^  $event_msg_notify \(.*\), [0-9]*\$/\1/p" \
+		test_handlers.out >actual &&
+	cat >expect <<-EOF &&
+	d1: $event_notify_create_dir
+	d1/f1.txt: $event_notify_create_file
+	d1/f1.txt: $event_notify_close_file
+	d1/f1.txt, d1/f2.txt: $event_notify_rename_file
+	d1/f2.txt: $event_notify_delete_file
+	d1: $event_notify_delete_dir
+	EOF
+	test_cmp expect actual
+'
+
+test_expect_success 'check permission requests handled synchronously' '
+	grep -c "^  $event_msg_perm " test_handlers.out >actual &&
+	echo 3 >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'check no unexpected error output' '
+	test_must_be_empty test_handlers.err
+'
+
+test_done
@@ -0,0 +1,64 @@
+#!/bin/sh
+#
+# Copyright (C) 2019 GitHub, Inc.
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see http://www.gnu.org/licenses/ .
+
+test_description='projfs batched event notification tests
+
+Check that projfs file operation notification events are delivered
+in batches to a batch notification handler, with repeated events
+coalesced.
+'
+
+. ./test-lib.sh
+. "$TEST_DIRECTORY"/test-lib-event.sh
+
+# use a long batch window so all events are delivered in one batch,
+# which is flushed when the filesystem is unmounted
+projfs_start test_notify_batch source target --notify-batch-size=1000 \
+	--notify-batch-msec=60000 || exit 1
+
+test_expect_success 'test file operations with batched notification' '
+	touch target/f1.txt &&
+	echo a >>target/f1.txt &&
+	echo b >>target/f1.txt &&
+	mkdir target/d1 &&
+	echo c >>target/f1.txt &&
+	rm target/f1.txt &&
+	touch target/f1.txt &&
+	test_path_is_file target/f1.txt
+'
+
+projfs_stop || exit 1
+
+test_expect_success 'check event notifications batched and coalesced' '
+	sed -e "s/, [0-9]*\$//" test_notify_batch.out >actual &&
+	cat >expect <<-EOF &&
+	  test event notification batch of 6
+	  $event_msg_notify f1.txt: $event_notify_create_file
+	  $event_msg_notify f1.txt: $event_notify_close_file
+	  $event_msg_notify d1: $event_notify_create_dir
+	  $event_msg_notify f1.txt: $event_notify_delete_file
+	  $event_msg_notify f1.txt: $event_notify_create_file
+	  $event_msg_notify f1.txt: $event_notify_close_file
+	EOF
+	test_cmp expect actual
+'
+
+test_expect_success 'check no unexpected error output' '
+	test_must_be_empty test_notify_batch.err
+'
+
+test_done
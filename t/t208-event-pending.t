@@ -0,0 +1,48 @@
+#!/bin/sh
+#
+# Copyright (C) 2019 GitHub, Inc.
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see http://www.gnu.org/licenses/ .
+
+test_description='projfs deferred projection completion tests
+
+Check that projection requests may be completed asynchronously after
+their event handler has returned.
+'
+
+. ./test-lib.sh
+. "$TEST_DIRECTORY"/test-lib-event.sh
+
+projfs_start test_handlers source target --initial --retval pending || exit 1
+
+test_expect_success 'test directory projection completed asynchronously' '
+	ls target &&
+	mkdir target/d1 &&
+	test_path_is_dir target/d1
+'
+
+projfs_stop || exit 1
+
+test_expect_success 'check projection requested only once' '
+	grep -c "^  test projection request for \.: 0x0000-40000100, " \
+		test_handlers.out >actual &&
+	echo 1 >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'check no unexpected error output' '
+	test_must_be_empty test_handlers.err
+'
+
+test_done
@@ -0,0 +1,85 @@
+#!/bin/sh
+#
+# Copyright (C) 2019 GitHub, Inc.
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see http://www.gnu.org/licenses/ .
+
+test_description='projfs placeholder entry creation tests
+
+Check that a provider can create many placeholder entries in a directory
+at once, with a result for each entry, and that entries which fail are
+not created and do not prevent the creation of later entries.
+'
+
+. ./test-lib.sh
+
+projfs_start test_proj_entries source target --initial || exit 1
+
+test_expect_success 'project entries into mount point' '
+	ls target >actual &&
+	cat >expect <<-EOF &&
+	d1
+	f1.txt
+	f2.txt
+	f3.txt
+	l1
+	ro.txt
+	EOF
+	test_cmp expect actual
+'
+
+test_expect_success 'check created entries' '
+	test_path_is_dir target/d1 &&
+	test_path_is_file target/f1.txt &&
+	test "$(stat -c %s target/f1.txt)" = 10 &&
+	test_path_is_file target/f2.txt &&
+	test "$(stat -c %s target/f2.txt)" = 20 &&
+	test "$(stat -c %s target/f3.txt)" = 3 &&
+	test "$(readlink target/l1)" = f1.txt &&
+	test "$(stat -c %a:%s target/ro.txt)" = 444:5
+'
+
+test_expect_success 'check failed entries not created' '
+	test_path_is_missing source/a &&
+	test_path_is_missing source/l2 &&
+	test_path_is_missing source/p1
+'
+
+projfs_stop || exit 1
+
+test_expect_success 'check per-entry results' '
+	cat >expect <<-EOF &&
+	  test entry d1: ok
+	  test entry f1.txt: ok
+	  test entry l1: ok
+	  test entry ro.txt: ok
+	  test entry ro.txt: EEXIST
+	  test entry a/b: EINVAL
+	  test entry ..: EINVAL
+	  test entry : EINVAL
+	  test entry l2: EINVAL
+	  test entry p1: EINVAL
+	  test entry f2.txt: ok
+	  test entry f3.txt: ok
+	  test entry f3.txt: EEXIST
+	  test entries: EEXIST
+	EOF
+	test_cmp expect test_proj_entries.out
+'
+
+test_expect_success 'check no unexpected error output' '
+	test_must_be_empty test_proj_entries.err
+'
+
+test_done
@@ -0,0 +1,98 @@
+#!/bin/sh
+#
+# Copyright (C) 2019 GitHub, Inc.
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see http://www.gnu.org/licenses/ .
+
+test_description='projfs placeholder entry creation tests with io_uring
+
+Check that placeholder entries are created with the same per-entry
+results when the io-uring option is set, whether they are created with
+io_uring or, when it or liburing is unavailable, with system calls, and
+that file operations on the entries then work as usual.
+'
+
+. ./test-lib.sh
+
+projfs_start test_proj_entries source target --initial --io-uring || exit 1
+
+test_expect_success 'project entries into mount point' '
+	ls target >actual &&
+	cat >expect <<-EOF &&
+	d1
+	f1.txt
+	f2.txt
+	f3.txt
+	l1
+	ro.txt
+	EOF
+	test_cmp expect actual
+'
+
+test_expect_success 'check created entries' '
+	test_path_is_dir target/d1 &&
+	test "$(stat -c %s target/f1.txt)" = 10 &&
+	test "$(stat -c %s target/f2.txt)" = 20 &&
+	test "$(stat -c %s target/f3.txt)" = 3 &&
+	test "$(readlink target/l1)" = f1.txt &&
+	test "$(stat -c %a:%s target/ro.txt)" = 444:5
+'
+
+test_expect_success 'read projected files' '
+	test "$(wc -c <target/f1.txt)" = 10 &&
+	test "$(wc -c <target/l1)" = 10 &&
+	test "$(wc -c <target/ro.txt)" = 5
+'
+
+test_expect_success 'write projected and new files' '
+	echo hello >target/f2.txt &&
+	echo hello >expect &&
+	test_cmp expect target/f2.txt &&
+	echo world >target/d1/f3.txt &&
+	echo world >expect &&
+	test_cmp expect target/d1/f3.txt &&
+	test_cmp expect source/d1/f3.txt
+'
+
+projfs_stop || exit 1
+
+test_expect_success 'check per-entry results' '
+	cat >expect <<-EOF &&
+	  test entry d1: ok
+	  test entry f1.txt: ok
+	  test entry l1: ok
+	  test entry ro.txt: ok
+	  test entry ro.txt: EEXIST
+	  test entry a/b: EINVAL
+	  test entry ..: EINVAL
+	  test entry : EINVAL
+	  test entry l2: EINVAL
+	  test entry p1: EINVAL
+	  test entry f2.txt: ok
+	  test entry f3.txt: ok
+	  test entry f3.txt: EEXIST
+	  test entries: EEXIST
+	EOF
+	test_cmp expect test_proj_entries.out
+'
+
+# without liburing, or a kernel which supports the io_uring operations
+# we need, the only error output is the notice that we fall back to
+# system calls
+test_expect_success 'check no unexpected error output' '
+	! grep -v "io_uring unavailable, using system calls" \
+		test_proj_entries.err
+'
+
+test_done
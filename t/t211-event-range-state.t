@@ -0,0 +1,54 @@
+#!/bin/sh
+#
+# Copyright (C) 2019 GitHub, Inc.
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see http://www.gnu.org/licenses/ .
+
+test_description='projfs range hydration state index tests
+
+Check that a file which is projected one chunk at a time is recorded
+in the state index as populated once all its chunks have been read,
+and not before.
+'
+
+. ./test-lib.sh
+
+projfs_start test_proj_range source target --initial --chunk-size=1048576 \
+	--state-index=state.index || exit 1
+
+test_expect_success 'read file by range to completion' '
+	head -c 3145728 /dev/zero | tr "\\0" x >expect &&
+	test_cmp expect target/full.bin
+'
+
+test_expect_success 'read first chunk of file' '
+	head -c 100 expect >expect.part &&
+	head -c 100 target/part.bin >actual.part &&
+	test_cmp expect.part actual.part
+'
+
+projfs_stop || exit 1
+
+test_expect_success 'check only fully read file is populated' '
+	cat >expect <<-EOF &&
+	  test populated path: full.bin
+	EOF
+	test_cmp expect test_proj_range.out
+'
+
+test_expect_success 'check no unexpected error output' '
+	test_must_be_empty test_proj_range.err
+'
+
+test_done
@@ -0,0 +1,72 @@
+#!/bin/sh
+#
+# Copyright (C) 2019 GitHub, Inc.
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see http://www.gnu.org/licenses/ .
+
+test_description='projfs open file rename event tests
+
+Check that the notification sent when a file open for writing is closed
+reports the path of the file at that time, after the file or one of its
+parent directories has been renamed.
+'
+
+. ./test-lib.sh
+. "$TEST_DIRECTORY"/test-lib-event.sh
+
+# use a long batch window so all events are delivered in one batch,
+# which is flushed when the filesystem is unmounted
+projfs_start test_notify_batch source target --notify-batch-size=1000 \
+	--notify-batch-msec=60000 || exit 1
+
+test_expect_success 'rename parent directory of file open for writing' '
+	mkdir target/d1 &&
+	(
+		exec 3>target/d1/f1.txt &&
+		mv target/d1 target/d2 &&
+		echo a >&3
+	) &&
+	test_path_is_file target/d2/f1.txt
+'
+
+test_expect_success 'rename file open for writing' '
+	(
+		exec 3>>target/d2/f1.txt &&
+		mv target/d2/f1.txt target/d2/f2.txt &&
+		echo b >&3
+	) &&
+	test_path_is_file target/d2/f2.txt
+'
+
+projfs_stop || exit 1
+
+test_expect_success 'check close events report current paths' '
+	sed -e "s/, [0-9]*\$//" test_notify_batch.out >actual &&
+	cat >expect <<-EOF &&
+	  test event notification batch of 6
+	  $event_msg_notify d1: $event_notify_create_dir
+	  $event_msg_notify d1/f1.txt: $event_notify_create_file
+	  $event_msg_notify d1, d2: $event_notify_rename_dir
+	  $event_msg_notify d2/f1.txt: $event_notify_close_file
+	  $event_msg_notify d2/f1.txt, d2/f2.txt: $event_notify_rename_file
+	  $event_msg_notify d2/f2.txt: $event_notify_close_file
+	EOF
+	test_cmp expect actual
+'
+
+test_expect_success 'check no unexpected error output' '
+	test_must_be_empty test_notify_batch.err
+'
+
+test_done
@@ -0,0 +1,78 @@
+#!/bin/sh
+#
+# Copyright (C) 2019 GitHub, Inc.
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see http://www.gnu.org/licenses/ .
+
+test_description='projfs file dehydration tests
+
+Check that a populated file is dehydrated by punching a hole over its
+contents and returning it to the empty state, that it is hydrated again
+when next opened, and that modified files and files open for reading
+are not dehydrated.
+
+Each file is dehydrated by the test mount helper when a file with the
+same name prefixed by "dehydrate-" is created.
+'
+
+. ./test-lib.sh
+
+projfs_start test_dehydrate source target --initial || exit 1
+
+test_expect_success 'dehydrate populated file' '
+	head -c 65536 /dev/zero | tr "\\0" x >expect &&
+	test_cmp expect target/f.txt &&
+	>target/dehydrate-f.txt
+'
+
+test_expect_success 'rehydrate file on next open' '
+	test_cmp expect target/f.txt
+'
+
+test_expect_success 'do not dehydrate file open for reading' '
+	exec 3<target/g.txt &&
+	>target/dehydrate-g.txt &&
+	exec 3<&- &&
+	test_cmp expect target/g.txt &&
+	>target/dehydrate-g.txt
+'
+
+test_expect_success 'do not dehydrate modified file' '
+	echo x >>target/h.txt &&
+	>target/dehydrate-h.txt
+'
+
+projfs_stop || exit 1
+
+test_expect_success 'check dehydration results' '
+	cat >expect.out <<-EOF &&
+	  test hydrate: f.txt
+	  test dehydrate f.txt: ok
+	  test lower file f.txt: state y, blocks 0, size 65536
+	  test hydrate: f.txt
+	  test hydrate: g.txt
+	  test dehydrate g.txt: EBUSY
+	  test dehydrate g.txt: ok
+	  test lower file g.txt: state y, blocks 0, size 65536
+	  test hydrate: h.txt
+	  test dehydrate h.txt: EPERM
+	EOF
+	test_cmp expect.out test_dehydrate.out
+'
+
+test_expect_success 'check no unexpected error output' '
+	test_must_be_empty test_dehydrate.err
+'
+
+test_done
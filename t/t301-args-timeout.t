@@ -0,0 +1,52 @@
+#!/bin/sh
+#
+# Copyright (C) 2019 GitHub, Inc.
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see http://www.gnu.org/licenses/ .
+
+test_description='projfs cache timeout argument test
+
+Check that projection and file attributes remain correct when the kernel
+is permitted to cache entries and attributes.
+'
+
+. ./test-lib.sh
+
+HELPER_LOG='test_simple.log'
+
+projfs_start test_simple source target --log="$HELPER_LOG" --initial \
+	--entry-timeout=60 --attr-timeout=60 --negative-timeout=60 || exit 1
+
+test_expect_success 'mount with timeouts projected on read' '
+	ls target &&
+	grep "directory projected .*: \.$" "$HELPER_LOG"
+'
+
+test_expect_success 'mount with timeouts reports new entries' '
+	test_path_is_missing target/f1.txt &&
+	echo text >target/f1.txt &&
+	test_path_is_file target/f1.txt &&
+	test_path_is_file source/f1.txt
+'
+
+test_expect_success 'mount with timeouts reports changed attributes' '
+	echo text >>target/f1.txt &&
+	test $(wc -c <target/f1.txt) -eq 10 &&
+	chmod 0600 target/f1.txt &&
+	test $(stat -c %a target/f1.txt) = 600
+'
+
+projfs_stop || exit 1
+
+test_done
@@ -0,0 +1,129 @@
+/* Linux Projected Filesystem
+   Copyright (C) 2019 GitHub, Inc.
+
+   See the NOTICE file distributed with this library for additional
+   information regarding copyright ownership.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library, in the file COPYING; if not,
+   see <http://www.gnu.org/licenses/>.
+*/
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../lib/chunkmap.h"
+#include "test_common.h"
+
+#define TEST_SHIFT 16
+#define TEST_CHUNK ((off_t)1 << TEST_SHIFT)
+
+// ten chunks, the last of which is partial
+#define TEST_FILE_SIZE (9 * TEST_CHUNK + 100)
+
+static void test_missing(const char *argv0, const struct chunkmap *map,
+			 off_t offset, size_t length,
+			 uint64_t expect_first, uint64_t expect_count)
+{
+	uint64_t first = 0, count;
+
+	count = chunkmap_find_missing(map, offset, length, &first);
+	if (count != expect_count || (count > 0 && first != expect_first)) {
+		test_exit_error(argv0, "unexpected missing chunks for range "
+				       "%lld+%zu: found %llu+%llu, "
+				       "expected %llu+%llu",
+				(long long)offset, length,
+				(unsigned long long)first,
+				(unsigned long long)count,
+				(unsigned long long)expect_first,
+				(unsigned long long)expect_count);
+	}
+}
+
+static void test_ranges(const char *argv0)
+{
+	struct chunkmap map, copy;
+	int res;
+
+	res = chunkmap_init(&map, TEST_FILE_SIZE, TEST_SHIFT);
+	if (res != 0 || map.nchunks != 10 || map.shift != TEST_SHIFT)
+		test_exit_error(argv0, "unable to initialize chunk map");
+
+	test_missing(argv0, &map, 0, 1, 0, 1);
+	test_missing(argv0, &map, TEST_CHUNK - 1, 2, 0, 2);
+	test_missing(argv0, &map, 3 * TEST_CHUNK, 4096, 3, 1);
+	test_missing(argv0, &map, 0, TEST_FILE_SIZE * 2, 0, 10);
+	test_missing(argv0, &map, 10 * TEST_CHUNK, 4096, 0, 0);
+	test_missing(argv0, &map, 0, 0, 0, 0);
+
+	chunkmap_set(&map, 2, 3);
+	test_missing(argv0, &map, 2 * TEST_CHUNK, 3 * TEST_CHUNK, 0, 0);
+	test_missing(argv0, &map, 0, 4 * TEST_CHUNK, 0, 2);
+	test_missing(argv0, &map, 3 * TEST_CHUNK, 4 * TEST_CHUNK, 5, 2);
+	if (chunkmap_is_full(&map))
+		test_exit_error(argv0, "partial chunk map reported full");
+
+	// round-trip through the encoded form, as stored in an xattr
+	res = chunkmap_load(&copy, TEST_FILE_SIZE, map.value, map.size);
+	if (res != 0)
+		test_exit_error(argv0, "unable to load encoded chunk map");
+	test_missing(argv0, &copy, 0, TEST_FILE_SIZE, 0, 2);
+	test_missing(argv0, &copy, 2 * TEST_CHUNK, TEST_FILE_SIZE, 5, 5);
+
+	chunkmap_set(&copy, 0, 2);
+	chunkmap_set(&copy, 5, 5);
+	test_missing(argv0, &copy, 0, TEST_FILE_SIZE, 0, 0);
+	if (!chunkmap_is_full(&copy))
+		test_exit_error(argv0, "full chunk map not reported full");
+
+	// an encoded map must match the size of the file
+	res = chunkmap_load(&copy, 20 * TEST_CHUNK, map.value, map.size);
+	if (res != EINVAL)
+		test_exit_error(argv0, "mismatched chunk map loaded");
+
+	chunkmap_free(&copy);
+	chunkmap_free(&map);
+}
+
+static void test_limits(const char *argv0)
+{
+	struct chunkmap map;
+	int res;
+
+	// chunks are enlarged so that large files' maps remain small
+	res = chunkmap_init(&map, (off_t)1 << 40, CHUNKMAP_MIN_SHIFT);
+	if (res != 0 || map.size > CHUNKMAP_MAX_SIZE ||
+	    map.shift <= CHUNKMAP_MIN_SHIFT)
+		test_exit_error(argv0, "unable to map large file");
+	test_missing(argv0, &map, ((off_t)1 << 40) - 1, 1,
+		     map.nchunks - 1, 1);
+	chunkmap_free(&map);
+
+	res = chunkmap_init(&map, 0, TEST_SHIFT);
+	if (res != 0 || map.nchunks != 0 || !chunkmap_is_full(&map))
+		test_exit_error(argv0, "unable to map empty file");
+	test_missing(argv0, &map, 0, 4096, 0, 0);
+	chunkmap_free(&map);
+}
+
+int main(int argc, char *const argv[])
+{
+	test_parse_opts(argc, argv, TEST_OPT_NONE, 0, 0, NULL, NULL, "");
+
+	test_ranges(argv[0]);
+	test_limits(argv[0]);
+
+	exit(EXIT_SUCCESS);
+}
@@ -52,6 +52,7 @@ static const struct retval errno_retvals[] = {
 	{ "null",	0		},
 	{ "allow", 	PROJFS_ALLOW	},
 	{ "deny",	PROJFS_DENY	},
+	{ "pending",	PROJFS_PENDING	},
 	{ retval_entry(EBADF)		},
 	{ retval_entry(EINPROGRESS)	},
 	{ retval_entry(EINVAL)		},
@@ -77,6 +78,24 @@ static const char *const all_mount_opts[] = {
 	"--debug",
 	"--initial",
 	"--log=",
+	"--log-level=",
+	"--entry-timeout=",
+	"--attr-timeout=",
+	"--negative-timeout=",
+	"--notify-async",
+	"--notify-queue-size=",
+	"--notify-overflow=",
+	"--notify-batch-size=",
+	"--notify-batch-msec=",
+	"--chunk-size=",
+	"--max-hydrations=",
+	"--prefetch-threshold=",
+	"--prefetch-threads=",
+	"--prefetch-window-msec=",
+	"--hydration-trace=",
+	"--state-index=",
+	"--io-uring",
+	"--evict-budget-mb=",
 	NULL
 };
 
@@ -87,7 +106,7 @@ struct opt_usage {
 
 static const struct opt_usage all_opts_usage[] = {
 	{ NULL, 1 },
-	{ "allow|deny|null|<error>", 1 },
+	{ "allow|deny|null|pending|<error>", 1 },
 	{ "<retval-file>", 1 },
 	{ "<max-seconds>", 1 },
 	{ "<lock-file>", 1 },
@@ -0,0 +1,173 @@
+/* Linux Projected Filesystem
+   Copyright (C) 2018-2019 GitHub, Inc.
+
+   See the NOTICE file distributed with this library for additional
+   information regarding copyright ownership.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library, in the file COPYING; if not,
+   see <http://www.gnu.org/licenses/>.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+
+#include "test_common.h"
+
+#define TEST_FILE_SIZE 65536
+#define TEST_FILE_CHAR 'x'
+
+// creating a file with this prefix dehydrates the file named by the rest
+#define TEST_DEHYDRATE_PREFIX "dehydrate-"
+#define TEST_DEHYDRATE_PREFIX_LEN (sizeof(TEST_DEHYDRATE_PREFIX) - 1)
+
+#define TEST_STATE_XATTR_NAME "user.projection.empty"
+
+static const char *const test_files[] = { "f.txt", "g.txt", "h.txt" };
+
+#define NUM_FILES (sizeof(test_files) / sizeof(test_files[0]))
+
+static int lower_fd;
+
+static int write_file(int fd)
+{
+	char buf[TEST_FILE_SIZE];
+	size_t offset = 0;
+
+	memset(buf, TEST_FILE_CHAR, sizeof(buf));
+	while (offset < sizeof(buf)) {
+		ssize_t res;
+
+		res = write(fd, buf + offset, sizeof(buf) - offset);
+		if (res == -1)
+			return -errno;
+		offset += res;
+	}
+
+	return 0;
+}
+
+static int test_proj_event(struct projfs_event *event)
+{
+	unsigned int i;
+	int res;
+
+	if (!(event->mask & PROJFS_ONDIR)) {
+		printf("  test hydrate: %s\n", event->path);
+		return write_file(event->fd);
+	}
+
+	if (strcmp(event->path, ".") != 0)
+		return 0;
+
+	for (i = 0; i < NUM_FILES; ++i) {
+		res = projfs_create_proj_file(event->fs, test_files[i],
+					      TEST_FILE_SIZE, 0644, NULL, 0);
+		if (res != 0)
+			return -res;
+	}
+
+	return 0;
+}
+
+static const char *get_errname(int err)
+{
+	switch (err) {
+	case 0:
+		return "ok";
+	case EBUSY:
+		return "EBUSY";
+	case EPERM:
+		return "EPERM";
+	default:
+		return strerror(err);
+	}
+}
+
+static void print_lower_state(const char *path)
+{
+	struct stat st;
+	char value = '-';
+	int fd;
+
+	fd = openat(lower_fd, path, O_RDONLY | O_NOFOLLOW);
+	if (fd == -1 || fstat(fd, &st) == -1) {
+		printf("  test lower file %s: %s\n", path, strerror(errno));
+		goto out;
+	}
+
+	if (fgetxattr(fd, TEST_STATE_XATTR_NAME, &value, sizeof(value)) == -1)
+		value = '-';
+
+	printf("  test lower file %s: state %c, blocks %lld, size %lld\n",
+	       path, value, (long long)st.st_blocks, (long long)st.st_size);
+
+out:
+	if (fd != -1)
+		close(fd);
+}
+
+static int test_notify_event(struct projfs_event *event)
+{
+	const char *path = event->path;
+	int res;
+
+	if ((event->mask & PROJFS_ONDIR) ||
+	    strncmp(path, TEST_DEHYDRATE_PREFIX,
+		    TEST_DEHYDRATE_PREFIX_LEN) != 0)
+		return 0;
+	path += TEST_DEHYDRATE_PREFIX_LEN;
+
+	res = projfs_dehydrate(event->fs, path);
+	printf("  test dehydrate %s: %s\n", path, get_errname(res));
+	if (res == 0)
+		print_lower_state(path);
+
+	return 0;
+}
+
+int main(int argc, char *const argv[])
+{
+	const char *lower_path, *mount_path;
+	struct test_mount_args mount_args;
+	struct projfs *fs;
+	struct projfs_handlers handlers = { 0 };
+
+	test_parse_mount_opts(argc, argv, TEST_OPT_NONE,
+			      &lower_path, &mount_path, &mount_args);
+
+	lower_fd = open(lower_path, O_DIRECTORY | O_RDONLY);
+	if (lower_fd == -1)
+		test_exit_error(argv[0], "unable to open %s: %s",
+				lower_path, strerror(errno));
+
+	handlers.handle_proj_event = &test_proj_event;
+	handlers.handle_notify_event = &test_notify_event;
+
+	fs = test_start_mount(lower_path, mount_path,
+			      &handlers, sizeof(handlers), NULL,
+			      &mount_args);
+	test_wait_signal();
+	test_stop_mount(fs);
+
+	close(lower_fd);
+	test_free_opts(&mount_args);
+
+	exit(EXIT_SUCCESS);
+}
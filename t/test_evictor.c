@@ -0,0 +1,223 @@
+/* Linux Projected Filesystem
+   Copyright (C) 2019 GitHub, Inc.
+
+   See the NOTICE file distributed with this library for additional
+   information regarding copyright ownership.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library, in the file COPYING; if not,
+   see <http://www.gnu.org/licenses/>.
+*/
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../lib/evictor.h"
+#include "test_common.h"
+
+#define TEST_BUDGET 1000
+#define TEST_WAIT_SEC 5
+
+#define MAX_EVICTED 8
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static char *evicted[MAX_EVICTED];
+static unsigned int num_evicted;
+static const char *busy_path;
+static unsigned int num_busy;
+
+static int test_evict(void *data, const char *path)
+{
+	int res = 0;
+
+	pthread_mutex_lock(&mutex);
+	if (busy_path != NULL && strcmp(path, busy_path) == 0) {
+		++num_busy;
+		res = EBUSY;
+	} else if (num_evicted < MAX_EVICTED) {
+		evicted[num_evicted++] = strdup(path);
+	}
+	pthread_cond_broadcast(&cond);
+	pthread_mutex_unlock(&mutex);
+
+	return res;
+}
+
+static void wait_evicted(const char *argv0, unsigned int expect)
+{
+	struct timespec deadline;
+	int res = 0;
+
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += TEST_WAIT_SEC;
+
+	pthread_mutex_lock(&mutex);
+	while (num_evicted < expect && res == 0)
+		res = pthread_cond_timedwait(&cond, &mutex, &deadline);
+	pthread_mutex_unlock(&mutex);
+
+	if (res != 0)
+		test_exit_error(argv0, "timed out waiting for eviction");
+}
+
+static void check_evicted(const char *argv0, unsigned int i,
+			  const char *path)
+{
+	pthread_mutex_lock(&mutex);
+	if (i >= num_evicted || strcmp(evicted[i], path) != 0)
+		test_exit_error(argv0, "unexpected eviction %u: %s",
+				i, (i < num_evicted) ? evicted[i] : "");
+	pthread_mutex_unlock(&mutex);
+}
+
+static void check_tracked(const char *argv0, struct evictor *ev,
+			  unsigned int files, uint64_t bytes)
+{
+	struct evictor_stats stats;
+
+	evictor_get_stats(ev, &stats);
+	if (stats.tracked_files != files || stats.tracked_bytes != bytes)
+		test_exit_error(argv0, "unexpected tracked files %u, bytes %lu",
+				stats.tracked_files,
+				(unsigned long)stats.tracked_bytes);
+}
+
+static void record(const char *argv0, struct evictor *ev, const char *path,
+		   uint64_t size)
+{
+	if (evictor_record(ev, path, size) != 0)
+		test_exit_error(argv0, "unable to record %s", path);
+}
+
+static void check_renamed(const char *argv0, struct evictor *ev,
+			  const char *old_path, const char *new_path)
+{
+	struct evictor_stats before, after;
+
+	evictor_get_stats(ev, &before);
+	evictor_remove(ev, old_path);
+	evictor_get_stats(ev, &after);
+	if (after.tracked_files != before.tracked_files)
+		test_exit_error(argv0, "old path still recorded: %s",
+				old_path);
+
+	evictor_remove(ev, new_path);
+	evictor_get_stats(ev, &after);
+	if (after.tracked_files != before.tracked_files - 1)
+		test_exit_error(argv0, "new path not recorded: %s", new_path);
+}
+
+static void test_rename(const char *argv0)
+{
+	struct evictor *ev;
+
+	// no thread is started, so nothing is evicted
+	ev = evictor_create(TEST_BUDGET, test_evict, NULL);
+	if (ev == NULL)
+		test_exit_error(argv0, "unable to create evictor");
+
+	// files beneath a renamed directory move with it
+	record(argv0, ev, "d1/a", 100);
+	record(argv0, ev, "d1/s/b", 100);
+	record(argv0, ev, "d1c", 100);
+	evictor_rename(ev, "d1", "d2", 0);
+	check_tracked(argv0, ev, 3, 300);
+	check_renamed(argv0, ev, "d1/a", "d2/a");
+	check_renamed(argv0, ev, "d1/s/b", "d2/s/b");
+
+	// but not files merely sharing its name as a prefix
+	check_renamed(argv0, ev, "d2c", "d1c");
+
+	// a replaced file is no longer recorded
+	record(argv0, ev, "e", 100);
+	record(argv0, ev, "f", 100);
+	evictor_rename(ev, "e", "f", 0);
+	check_tracked(argv0, ev, 1, 100);
+	check_renamed(argv0, ev, "e", "f");
+
+	// exchanged paths swap their records
+	record(argv0, ev, "g/h", 100);
+	record(argv0, ev, "i", 100);
+	evictor_rename(ev, "g", "i", 1);
+	check_tracked(argv0, ev, 2, 200);
+	check_renamed(argv0, ev, "g/h", "i/h");
+	check_renamed(argv0, ev, "i", "g");
+
+	evictor_destroy(ev);
+}
+
+int main(int argc, char *const argv[])
+{
+	const char *argv0 = argv[0];
+	struct evictor *ev;
+	unsigned int i;
+
+	test_parse_opts(argc, argv, TEST_OPT_NONE, 0, 0, NULL, NULL, "");
+
+	ev = evictor_create(TEST_BUDGET, test_evict, NULL);
+	if (ev == NULL || evictor_start(ev) != 0)
+		test_exit_error(argv0, "unable to start evictor");
+
+	// within the budget, nothing is evicted
+	record(argv0, ev, "a", 400);
+	record(argv0, ev, "b", 400);
+	evictor_touch(ev, "a");
+	usleep(100 * 1000);
+	check_tracked(argv0, ev, 2, 800);
+
+	// the least recently used file is evicted first
+	record(argv0, ev, "c", 400);
+	wait_evicted(argv0, 1);
+	check_evicted(argv0, 0, "b");
+	check_tracked(argv0, ev, 2, 800);
+
+	// a busy file is kept, and the next least recently used is evicted
+	pthread_mutex_lock(&mutex);
+	busy_path = "a";
+	pthread_mutex_unlock(&mutex);
+	record(argv0, ev, "d", 300);
+	wait_evicted(argv0, 2);
+	check_evicted(argv0, 1, "c");
+	check_tracked(argv0, ev, 2, 700);
+	if (num_busy != 1)
+		test_exit_error(argv0, "busy file not tried once");
+
+	// removed files are no longer counted
+	evictor_remove(ev, "d");
+	check_tracked(argv0, ev, 1, 400);
+
+	// busy files are retried after an interval
+	record(argv0, ev, "a", 1200);
+	usleep(EVICTOR_RETRY_MSEC * 1000 / 2);
+	pthread_mutex_lock(&mutex);
+	busy_path = NULL;
+	pthread_mutex_unlock(&mutex);
+	wait_evicted(argv0, 3);
+	check_evicted(argv0, 2, "a");
+	check_tracked(argv0, ev, 0, 0);
+
+	evictor_destroy(ev);
+
+	test_rename(argv0);
+
+	for (i = 0; i < num_evicted; ++i)
+		free(evicted[i]);
+
+	exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,126 @@
+/* Linux Projected Filesystem
+   Copyright (C) 2019 GitHub, Inc.
+
+   See the NOTICE file distributed with this library for additional
+   information regarding copyright ownership.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library, in the file COPYING; if not,
+   see <http://www.gnu.org/licenses/>.
+*/
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../lib/fdcopy.h"
+#include "test_common.h"
+
+// spans several copy chunks and is not a multiple of any block size
+#define TEST_DATA_SIZE (4 * FDCOPY_CHUNK_SIZE + 1234)
+
+#define TEST_SRC_FILE "fdcopy.src"
+#define TEST_DST_FILE "fdcopy.dst"
+
+static char data[TEST_DATA_SIZE];
+static char buf[TEST_DATA_SIZE];
+
+static int open_file(const char *argv0, const char *name)
+{
+	int fd;
+
+	fd = open(name, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (fd == -1)
+		test_exit_error(argv0, "unable to open file: %s", name);
+
+	return fd;
+}
+
+static void test_check(const char *argv0, int fd, off_t offset,
+		       const char *expect, size_t length, const char *desc)
+{
+	if (pread(fd, buf, length, offset) != (ssize_t)length)
+		test_exit_error(argv0, "unable to read copied data: %s", desc);
+	if (memcmp(buf, expect, length) != 0)
+		test_exit_error(argv0, "copied data mismatch: %s", desc);
+}
+
+static void test_copy(const char *argv0, int fd, off_t offset,
+		      int src_fd, off_t src_offset, size_t length,
+		      const char *desc)
+{
+	int res;
+
+	res = fdcopy_range(fd, offset, src_fd, src_offset, length);
+	if (res != 0) {
+		test_exit_error(argv0, "unable to copy data: %s: %s",
+				desc, strerror(res));
+	}
+}
+
+int main(int argc, char *const argv[])
+{
+	int src_fd, fd, pipefd[2];
+	size_t i;
+	int res;
+
+	test_parse_opts(argc, argv, TEST_OPT_NONE, 0, 0, NULL, NULL, "");
+
+	for (i = 0; i < TEST_DATA_SIZE; ++i)
+		data[i] = random();
+
+	src_fd = open_file(argv[0], TEST_SRC_FILE);
+	if (write(src_fd, data, TEST_DATA_SIZE) != TEST_DATA_SIZE)
+		test_exit_error(argv[0], "unable to write source file");
+
+	// whole file, which may be cloned if the filesystem supports it
+	fd = open_file(argv[0], TEST_DST_FILE);
+	test_copy(argv[0], fd, 0, src_fd, 0, TEST_DATA_SIZE, "whole file");
+	test_check(argv[0], fd, 0, data, TEST_DATA_SIZE, "whole file");
+
+	// unaligned ranges, which can never be cloned
+	test_copy(argv[0], fd, 100, src_fd, 4321, FDCOPY_CHUNK_SIZE + 1,
+		  "unaligned range");
+	test_check(argv[0], fd, 0, data, 100, "unaligned range prefix");
+	test_check(argv[0], fd, 100, data + 4321, FDCOPY_CHUNK_SIZE + 1,
+		   "unaligned range");
+
+	// short source
+	res = fdcopy_range(fd, 0, src_fd, TEST_DATA_SIZE - 10, 20);
+	if (res != EIO) {
+		test_exit_error(argv[0], "unexpected result for short source: "
+					 "%d", res);
+	}
+
+	// pipe, read from its current position
+	if (pipe(pipefd) == -1)
+		test_exit_error(argv[0], "unable to create pipe");
+	if (write(pipefd[1], data, 1000) != 1000)
+		test_exit_error(argv[0], "unable to write pipe");
+	close(pipefd[1]);
+	test_copy(argv[0], fd, 10, pipefd[0], -1, 1000, "pipe");
+	test_check(argv[0], fd, 10, data, 1000, "pipe");
+	close(pipefd[0]);
+
+	close(fd);
+	close(src_fd);
+	unlink(TEST_DST_FILE);
+	unlink(TEST_SRC_FILE);
+
+	exit(EXIT_SUCCESS);
+}
@@ -19,14 +19,24 @@
    see <http://www.gnu.org/licenses/>.
 */
 
+#define _GNU_SOURCE		// for clock_gettime() in <time.h>
+
+#include <errno.h>
 #include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <sys/time.h>
+#include <time.h>
 
 #include "../lib/fdtable.h"
 #include "test_common.h"
 
-static pid_t pids[MAX_TABLE_SIZE];
+// well beyond the maximum size of prior fixed-limit tables
+#define TEST_TABLE_SIZE (1 << 18)
+
+static pid_t pids[TEST_TABLE_SIZE];
 
 static pid_t get_random_pid(void)
 {
@@ -77,63 +87,213 @@ static int test_remove(const char *argv0, struct fdtable *table, int fd)
 	return ret;
 }
 
-int main(int argc, char *const argv[])
+static void test_usage(const char *argv0, struct fdtable *table,
+		       unsigned int load)
+{
+	unsigned int used, size;
+
+	fdtable_get_usage(table, &used, &size);
+	if (used != load || size < used) {
+		test_exit_error(argv0, "unexpected table usage: %u entries "
+				       "of %u, expected %u entries",
+				used, size, load);
+	}
+}
+
+static void test_fill(const char *argv0)
 {
 	struct fdtable *table;
-	struct timeval tv;
-	unsigned int max_load = 2 * MAX_TABLE_SIZE / 3;
-	unsigned int min_load = MAX_TABLE_SIZE / 2;
+	unsigned int max_load = 2 * TEST_TABLE_SIZE / 3;
+	unsigned int min_load = TEST_TABLE_SIZE / 2;
 	unsigned int load_range = max_load - min_load;
 	unsigned int load = 0;
 	unsigned int target = 0;
 	int fd, i;
 
-	gettimeofday(&tv, NULL);
-	srandom(tv.tv_sec + tv.tv_usec);
-
 	table = fdtable_create();
 	if (table == NULL)
-		test_exit_error(argv[0], "unable to create fdtable");
+		test_exit_error(argv0, "unable to create fdtable");
 
-	for (i = 0; i < MAX_TABLE_SIZE * 10; ++i) {
+	for (i = 0; i < TEST_TABLE_SIZE * 10; ++i) {
 		while (target == load)
 			target = random() % load_range + min_load;
 
-		fd = random() & (MAX_TABLE_SIZE - 1);
+		fd = random() & (TEST_TABLE_SIZE - 1);
 		if (target > load) {
 			if (pids[fd] == 0) {
-				test_insert(argv[0], table, fd);
+				test_insert(argv0, table, fd);
 				++load;
 			} else {
-				test_replace(argv[0], table, fd);
+				test_replace(argv0, table, fd);
 			}
 		} else {
-			if (test_remove(argv[0], table, fd) == 0)
+			if (test_remove(argv0, table, fd) == 0)
 				--load;
 		}
 	}
 
 	while (load < max_load) {
-		fd = random() & (MAX_TABLE_SIZE - 1);
+		fd = random() & (TEST_TABLE_SIZE - 1);
 		if (pids[fd] == 0) {
-			test_insert(argv[0], table, fd);
+			test_insert(argv0, table, fd);
 			++load;
 		}
 	}
+	test_usage(argv0, table, load);
 
-	fd = 0;
-	while (pids[fd] > 0)
-		++fd;
-	if (fdtable_insert(table, fd, 1) != -1) {
-		test_exit_error(argv[0], "insert above maximum table size "
-					 "and load factor succeeded");
+	for (i = 0; i < TEST_TABLE_SIZE; ++i)
+		test_remove(argv0, table, i);
+
+	// oscillate around a small load, then refill after shrinking
+	for (i = 0; i < TEST_TABLE_SIZE; ++i) {
+		test_insert(argv0, table, i & 0xFF);
+		test_remove(argv0, table, i & 0xFF);
 	}
+	for (i = 0; i < TEST_TABLE_SIZE; ++i)
+		test_insert(argv0, table, i);
+	for (i = 0; i < TEST_TABLE_SIZE; ++i)
+		test_remove(argv0, table, i);
+	test_usage(argv0, table, 0);
+
+	fdtable_destroy(table);
+}
 
-	for (i = 0; i < MAX_TABLE_SIZE; ++i)
-		test_remove(argv[0], table, i);
+
+#define MAX_THREADS 64
+#define THREAD_OPS (TEST_TABLE_SIZE * 4)
+
+struct test_thread {
+	pthread_t thread_id;
+	const char *argv0;
+	struct fdtable *table;
+	unsigned int id;
+	unsigned int num_threads;
+	uint32_t seed;
+};
+
+// per-thread xorshift generator, since random() takes a global lock
+static uint32_t next_random(uint32_t *seed)
+{
+	uint32_t x = *seed;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return (*seed = x);
+}
+
+/* Each thread operates only on the fds congruent to its ID, so that it
+ * may track its expected table contents in its own part of pids[], while
+ * still sharing every part of the fdtable with all other threads.
+ */
+static void *test_thread_ops(void *data)
+{
+	struct test_thread *thread = (struct test_thread *)data;
+	unsigned int num_fds = TEST_TABLE_SIZE / thread->num_threads;
+	unsigned int max_load = 2 * TEST_TABLE_SIZE / 3 / thread->num_threads;
+	unsigned int load = 0;
+	unsigned int i;
+	int fd;
+
+	for (i = 0; i < THREAD_OPS; ++i) {
+		uint32_t r = next_random(&thread->seed);
+
+		fd = (r % num_fds) * thread->num_threads + thread->id;
+		if (pids[fd] == 0) {
+			if (load < max_load) {
+				test_insert(thread->argv0, thread->table, fd);
+				++load;
+			}
+		} else if (r & 0x80000000U) {
+			test_replace(thread->argv0, thread->table, fd);
+		} else if (test_remove(thread->argv0, thread->table,
+				       fd) == 0) {
+			--load;
+		}
+	}
+
+	for (fd = thread->id; fd < TEST_TABLE_SIZE; fd += thread->num_threads) {
+		if (pids[fd] > 0 &&
+		    test_remove(thread->argv0, thread->table, fd) == -1)
+			test_exit_error(thread->argv0,
+					"unable to remove entry with key %d",
+					fd);
+	}
+
+	return NULL;
+}
+
+static void test_threads(const char *argv0, unsigned int num_threads)
+{
+	struct test_thread threads[MAX_THREADS];
+	struct fdtable *table;
+	struct timespec start, end;
+	double secs;
+	unsigned int i;
+	int res;
+
+	table = fdtable_create();
+	if (table == NULL)
+		test_exit_error(argv0, "unable to create fdtable");
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < num_threads; ++i) {
+		threads[i].argv0 = argv0;
+		threads[i].table = table;
+		threads[i].id = i;
+		threads[i].num_threads = num_threads;
+		threads[i].seed = random() | 1;
+
+		res = pthread_create(&threads[i].thread_id, NULL,
+				     test_thread_ops, &threads[i]);
+		if (res != 0)
+			test_exit_error(argv0, "unable to create thread: %d",
+					res);
+	}
+
+	for (i = 0; i < num_threads; ++i)
+		pthread_join(threads[i].thread_id, NULL);
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	// every entry was removed, so the table must accept a full load
+	for (i = 0; i < 2 * TEST_TABLE_SIZE / 3; ++i)
+		test_insert(argv0, table, i);
+	for (i = 0; i < 2 * TEST_TABLE_SIZE / 3; ++i)
+		test_remove(argv0, table, i);
 
 	fdtable_destroy(table);
 
-	exit(EXIT_SUCCESS);
+	secs = (end.tv_sec - start.tv_sec) +
+	       (end.tv_nsec - start.tv_nsec) / 1e9;
+	printf("%u threads: %u operations in %.3f seconds "
+	       "(%.0f operations/second)\n",
+	       num_threads, num_threads * THREAD_OPS, secs,
+	       num_threads * THREAD_OPS / secs);
 }
 
+int main(int argc, char *const argv[])
+{
+	struct timeval tv;
+	char *args[1];
+	long int num_threads;
+
+	test_parse_opts(argc, argv, TEST_OPT_NONE, 0, 1, args, NULL,
+			"[<threads>]");
+
+	gettimeofday(&tv, NULL);
+	srandom(tv.tv_sec + tv.tv_usec);
+
+	if (args[0] == NULL) {
+		test_fill(argv[0]);
+	} else {
+		num_threads = test_parse_long(args[0], 10);
+		if (errno > 0 || num_threads < 1 || num_threads > MAX_THREADS)
+			test_exit_error(argv[0], "invalid thread count: %s",
+					args[0]);
+		test_threads(argv[0], num_threads);
+	}
+
+	exit(EXIT_SUCCESS);
+}
@@ -22,12 +22,57 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <inttypes.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 
 #include "test_common.h"
 
+// delay before completing a pending projection, in microseconds
+#define TEST_PENDING_DELAY 100000
+
+struct test_pending {
+	struct projfs *fs;
+	uint64_t cookie;
+};
+
+static void *test_complete_pending(void *data)
+{
+	struct test_pending *pending = (struct test_pending *)data;
+	int res;
+
+	usleep(TEST_PENDING_DELAY);
+
+	res = projfs_complete_event(pending->fs, pending->cookie, 0);
+	if (res != 0)
+		fprintf(stderr, "unable to complete pending event: %d\n", res);
+
+	free(pending);
+	return NULL;
+}
+
+static int test_defer_event(struct projfs_event *event)
+{
+	struct test_pending *pending;
+	pthread_t thread_id;
+
+	pending = malloc(sizeof(*pending));
+	if (pending == NULL)
+		return -ENOMEM;
+	pending->fs = event->fs;
+	pending->cookie = event->cookie;
+
+	if (pthread_create(&thread_id, NULL, test_complete_pending,
+			   pending) != 0) {
+		free(pending);
+		return -EAGAIN;
+	}
+	pthread_detach(thread_id);
+
+	return PROJFS_PENDING;
+}
+
 static int test_handle_event(struct projfs_event *event, const char *desc,
 			     int proj, int perm)
 {
@@ -53,7 +98,9 @@ static int test_handle_event(struct projfs_event *event, const char *desc,
 	}
 
 	if (proj) {
-		if ((event->mask & ~PROJFS_ONDIR) != PROJFS_CREATE) {
+		uint64_t flags = PROJFS_ONDIR | PROJFS_ONRANGE;
+
+		if ((event->mask & ~flags) != PROJFS_CREATE) {
 			fprintf(stderr, "unknown projection flags\n");
 			ret = -EINVAL;
 		}
@@ -79,6 +126,13 @@ static int test_handle_event(struct projfs_event *event, const char *desc,
 			return -EINVAL;
 	}
 
+	if ((ret_flags & TEST_VAL_SET) != TEST_VAL_UNSET &&
+	    ret == PROJFS_PENDING) {
+		if (proj)
+			return test_defer_event(event);
+		ret_flags &= ~TEST_VAL_SET;
+	}
+
 	if ((ret_flags & TEST_VAL_SET) == TEST_VAL_UNSET)
 		ret = perm ? PROJFS_ALLOW : 0;
 	else if (!perm && ret > 0)
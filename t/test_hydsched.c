@@ -0,0 +1,177 @@
+/* Linux Projected Filesystem
+   Copyright (C) 2019 GitHub, Inc.
+
+   See the NOTICE file distributed with this library for additional
+   information regarding copyright ownership.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library, in the file COPYING; if not,
+   see <http://www.gnu.org/licenses/>.
+*/
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../lib/hydsched.h"
+#include "test_common.h"
+
+#define TEST_POLL_USEC 1000
+
+struct test_request {
+	char name;
+	pid_t pid;
+	enum hydsched_class class;
+};
+
+// requests in order of arrival, while the only slot is held
+static const struct test_request test_requests[] = {
+	{ 'A', 10, HYDSCHED_BACKGROUND },
+	{ 'B', 20, HYDSCHED_NORMAL },
+	{ 'C', 30, HYDSCHED_INTERACTIVE },
+	{ 'D', 30, HYDSCHED_INTERACTIVE },
+	{ 'E', 40, HYDSCHED_INTERACTIVE }
+};
+
+#define NUM_REQUESTS (sizeof(test_requests) / sizeof(test_requests[0]))
+
+// interactive first, alternating between processes, then by class
+#define EXPECT_ORDER "CEDBA"
+
+static struct hydsched *sched;
+static char order[NUM_REQUESTS + 1];
+static unsigned int order_len;
+
+static void *run_request(void *data)
+{
+	const struct test_request *req = data;
+
+	hydsched_enter(sched, req->pid, req->class);
+	order[order_len++] = req->name;		// serialized by the scheduler
+	hydsched_exit(sched);
+
+	return NULL;
+}
+
+static void wait_for_waiting(unsigned int expect)
+{
+	unsigned int running, waiting;
+
+	do {
+		usleep(TEST_POLL_USEC);
+		hydsched_get_counts(sched, &running, &waiting);
+	} while (waiting < expect);
+}
+
+static void test_order(const char *argv0)
+{
+	pthread_t threads[NUM_REQUESTS];
+	unsigned int i;
+
+	sched = hydsched_create(1);
+	if (sched == NULL)
+		test_exit_error(argv0, "unable to create scheduler");
+
+	hydsched_enter(sched, 1, HYDSCHED_INTERACTIVE);
+	for (i = 0; i < NUM_REQUESTS; ++i) {
+		if (pthread_create(&threads[i], NULL, run_request,
+				   (void *)&test_requests[i]) != 0)
+			test_exit_error(argv0, "unable to create thread");
+		wait_for_waiting(i + 1);
+	}
+	hydsched_exit(sched);
+
+	for (i = 0; i < NUM_REQUESTS; ++i)
+		pthread_join(threads[i], NULL);
+
+	if (strcmp(order, EXPECT_ORDER) != 0)
+		test_exit_error(argv0, "requests served in order %s, "
+				       "expected %s", order, EXPECT_ORDER);
+
+	hydsched_destroy(sched);
+}
+
+#define LIMIT_SLOTS 2
+#define LIMIT_THREADS 8
+#define LIMIT_LOOPS 50
+
+static pthread_mutex_t limit_mutex = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int limit_running;
+static unsigned int limit_max_running;
+
+static void *run_limited(void *data)
+{
+	pid_t pid = (pid_t)(long)data;
+	int i;
+
+	for (i = 0; i < LIMIT_LOOPS; ++i) {
+		hydsched_enter(sched, pid, pid % HYDSCHED_NUM_CLASSES);
+
+		pthread_mutex_lock(&limit_mutex);
+		if (++limit_running > limit_max_running)
+			limit_max_running = limit_running;
+		pthread_mutex_unlock(&limit_mutex);
+
+		usleep(TEST_POLL_USEC / 10);
+
+		pthread_mutex_lock(&limit_mutex);
+		--limit_running;
+		pthread_mutex_unlock(&limit_mutex);
+
+		hydsched_exit(sched);
+	}
+
+	return NULL;
+}
+
+static void test_limit(const char *argv0)
+{
+	pthread_t threads[LIMIT_THREADS];
+	unsigned int running, waiting;
+	long i;
+
+	sched = hydsched_create(LIMIT_SLOTS);
+	if (sched == NULL)
+		test_exit_error(argv0, "unable to create scheduler");
+
+	for (i = 0; i < LIMIT_THREADS; ++i) {
+		if (pthread_create(&threads[i], NULL, run_limited,
+				   (void *)(i + 1)) != 0)
+			test_exit_error(argv0, "unable to create thread");
+	}
+	for (i = 0; i < LIMIT_THREADS; ++i)
+		pthread_join(threads[i], NULL);
+
+	if (limit_max_running > LIMIT_SLOTS)
+		test_exit_error(argv0, "%u requests ran concurrently, "
+				       "limit was %u",
+				limit_max_running, LIMIT_SLOTS);
+
+	hydsched_get_counts(sched, &running, &waiting);
+	if (running != 0 || waiting != 0)
+		test_exit_error(argv0, "scheduler not idle after requests");
+
+	hydsched_destroy(sched);
+}
+
+int main(int argc, char *const argv[])
+{
+	test_parse_opts(argc, argv, TEST_OPT_NONE, 0, 0, NULL, NULL, "");
+
+	test_order(argv[0]);
+	test_limit(argv[0]);
+
+	exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,226 @@
+/* Linux Projected Filesystem
+   Copyright (C) 2019 GitHub, Inc.
+
+   See the NOTICE file distributed with this library for additional
+   information regarding copyright ownership.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library, in the file COPYING; if not,
+   see <http://www.gnu.org/licenses/>.
+*/
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../lib/hydtrace.h"
+#include "test_common.h"
+
+#define TEST_TRACE_PATH "test.trace"
+#define TEST_NUM_FILES 20
+#define TEST_POLL_USEC 1000
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static char *replayed[TEST_NUM_FILES + 1];
+static int replayed_isdir[TEST_NUM_FILES + 1];
+static unsigned int num_replayed;
+static int block_replay;
+
+static void test_replay(void *data, int isdir, const char *path)
+{
+	pthread_mutex_lock(&mutex);
+	if (num_replayed <= TEST_NUM_FILES) {
+		replayed[num_replayed] = strdup(path);
+		replayed_isdir[num_replayed] = isdir;
+		++num_replayed;
+	}
+	while (block_replay)
+		pthread_cond_wait(&cond, &mutex);
+	pthread_mutex_unlock(&mutex);
+}
+
+static unsigned int get_num_replayed(void)
+{
+	unsigned int n;
+
+	pthread_mutex_lock(&mutex);
+	n = num_replayed;
+	pthread_mutex_unlock(&mutex);
+
+	return n;
+}
+
+static void reset_replayed(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < num_replayed; ++i)
+		free(replayed[i]);
+	num_replayed = 0;
+}
+
+static void make_file_path(char *buf, unsigned int i)
+{
+	sprintf(buf, "d/f%u", i);
+}
+
+static struct hydtrace *create_trace(const char *argv0)
+{
+	struct hydtrace *trace;
+
+	trace = hydtrace_create(TEST_TRACE_PATH);
+	if (trace == NULL)
+		test_exit_error(argv0, "unable to create trace");
+
+	return trace;
+}
+
+static void test_record(const char *argv0)
+{
+	struct hydtrace *trace;
+	char path[32];
+	unsigned int i;
+	FILE *file;
+
+	unlink(TEST_TRACE_PATH);
+	trace = create_trace(argv0);
+
+	// with no previous trace, there is nothing to replay
+	if (hydtrace_start_replay(trace, test_replay, NULL) != 0)
+		test_exit_error(argv0, "unable to start empty replay");
+
+	if (hydtrace_record(trace, 1, "d") != 0)
+		test_exit_error(argv0, "unable to record directory");
+	for (i = 0; i < TEST_NUM_FILES; ++i) {
+		make_file_path(path, i);
+		if (hydtrace_record(trace, 0, path) != 0)
+			test_exit_error(argv0, "unable to record file");
+	}
+	hydtrace_destroy(trace);
+
+	// a truncated final record is ignored
+	file = fopen(TEST_TRACE_PATH, "a");
+	if (file == NULL || fputs("fd/partial", file) == EOF ||
+	    fclose(file) != 0)
+		test_exit_error(argv0, "unable to append to trace");
+}
+
+static void test_replay_all(const char *argv0)
+{
+	struct hydtrace *trace;
+	char path[32];
+	unsigned int i;
+
+	trace = create_trace(argv0);
+	if (hydtrace_start_replay(trace, test_replay, NULL) != 0)
+		test_exit_error(argv0, "unable to start replay");
+
+	while (get_num_replayed() < TEST_NUM_FILES + 1)
+		usleep(TEST_POLL_USEC);
+	hydtrace_destroy(trace);
+
+	if (num_replayed != TEST_NUM_FILES + 1 || !replayed_isdir[0] ||
+	    strcmp(replayed[0], "d") != 0)
+		test_exit_error(argv0, "unexpected replay of directory");
+	for (i = 0; i < TEST_NUM_FILES; ++i) {
+		make_file_path(path, i);
+		if (replayed_isdir[i + 1] || strcmp(replayed[i + 1], path) != 0)
+			test_exit_error(argv0, "unexpected replay of %s: %s",
+					path, replayed[i + 1]);
+	}
+	reset_replayed();
+}
+
+static void test_overtake(const char *argv0)
+{
+	struct hydtrace *trace;
+	char path[32];
+	unsigned int i;
+
+	block_replay = 1;
+	trace = create_trace(argv0);
+	if (hydtrace_start_replay(trace, test_replay, NULL) != 0)
+		test_exit_error(argv0, "unable to start replay");
+
+	while (get_num_replayed() < 1)
+		usleep(TEST_POLL_USEC);
+
+	// paths absent from the trace, or already passed, are ignored
+	for (i = 0; i < HYDTRACE_MAX_OVERTAKEN; ++i) {
+		hydtrace_note_foreground(trace, "d");
+		hydtrace_note_foreground(trace, "unknown");
+	}
+	if (hydtrace_is_replay_stopping(trace))
+		test_exit_error(argv0, "replay stopped prematurely");
+
+	for (i = 0; i < HYDTRACE_MAX_OVERTAKEN; ++i) {
+		make_file_path(path, TEST_NUM_FILES - 1 - i);
+		hydtrace_note_foreground(trace, path);
+	}
+	if (!hydtrace_is_replay_stopping(trace))
+		test_exit_error(argv0, "overtaken replay not stopped");
+
+	pthread_mutex_lock(&mutex);
+	block_replay = 0;
+	pthread_cond_broadcast(&cond);
+	pthread_mutex_unlock(&mutex);
+
+	hydtrace_destroy(trace);
+	if (num_replayed != 1)
+		test_exit_error(argv0, "replay continued after being stopped");
+	reset_replayed();
+}
+
+static void test_invalid(const char *argv0)
+{
+	struct hydtrace *trace;
+	FILE *file;
+
+	// e.g., a trace whose header was lost in a crash
+	file = fopen(TEST_TRACE_PATH, "w");
+	if (file == NULL || fputs("fd/f0", file) == EOF || fclose(file) != 0)
+		test_exit_error(argv0, "unable to write invalid trace");
+
+	trace = create_trace(argv0);
+	if (!hydtrace_was_invalid(trace))
+		test_exit_error(argv0, "invalid trace not reported");
+	if (hydtrace_start_replay(trace, test_replay, NULL) != 0)
+		test_exit_error(argv0, "unable to start replay");
+	hydtrace_destroy(trace);
+
+	if (num_replayed != 0)
+		test_exit_error(argv0, "invalid trace replayed");
+}
+
+int main(int argc, char *const argv[])
+{
+	const char *argv0 = argv[0];
+
+	test_parse_opts(argc, argv, TEST_OPT_NONE, 0, 0, NULL, NULL, "");
+
+	test_record(argv0);
+	test_replay_all(argv0);
+
+	// a mount which records nothing retains the previous trace
+	test_overtake(argv0);
+	test_replay_all(argv0);
+
+	test_invalid(argv0);
+
+	unlink(TEST_TRACE_PATH);
+
+	exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,283 @@
+/* Linux Projected Filesystem
+   Copyright (C) 2019 GitHub, Inc.
+
+   See the NOTICE file distributed with this library for additional
+   information regarding copyright ownership.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library, in the file COPYING; if not,
+   see <http://www.gnu.org/licenses/>.
+*/
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../lib/locktable.h"
+#include "test_common.h"
+
+#define TEST_DEV 0x801
+#define TEST_INO 1234
+
+// a short wait for the timeout test, and a long one for all others
+#define TEST_SHORT_MSEC 200
+#define TEST_LONG_MSEC 10000
+
+// time allowed for waiters to start waiting
+#define TEST_START_MSEC 100
+
+/* A waiter must be woken promptly once the lock is released; this is
+ * well under the 100ms interval at which locks were formerly polled.
+ */
+#define TEST_WAKE_MSEC 50
+
+// states are opaque to the table, so any ordered values will do
+#define TEST_STATE_A 1
+#define TEST_STATE_B 2
+#define TEST_STATE_C 3
+
+#define TEST_ERR EIO
+
+#define MAX_WAITERS 4
+
+struct test_waiter {
+	struct locktable *table;
+	int want;
+	int res;
+	struct lock_result shared;
+	struct timespec done;
+};
+
+static long elapsed_msec(const struct timespec *start,
+			 const struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) * 1000 +
+	       (end->tv_nsec - start->tv_nsec) / (1000 * 1000);
+}
+
+static void *run_waiter(void *data)
+{
+	struct test_waiter *waiter = data;
+
+	waiter->res = locktable_lock(waiter->table, TEST_DEV, TEST_INO,
+				     waiter->want, TEST_LONG_MSEC,
+				     &waiter->shared);
+	clock_gettime(CLOCK_MONOTONIC, &waiter->done);
+
+	// release a lock we acquired, but publish nothing
+	if (waiter->res == 0)
+		locktable_unlock(waiter->table, TEST_DEV, TEST_INO, NULL);
+
+	return NULL;
+}
+
+static void start_waiter(const char *argv0, pthread_t *thread,
+			 struct test_waiter *waiter,
+			 struct locktable *table, int want)
+{
+	waiter->table = table;
+	waiter->want = want;
+	waiter->res = -1;
+
+	if (pthread_create(thread, NULL, run_waiter, waiter) != 0)
+		test_exit_error(argv0, "unable to create thread");
+}
+
+static void lock(const char *argv0, struct locktable *table)
+{
+	struct lock_result shared;
+	int res;
+
+	res = locktable_lock(table, TEST_DEV, TEST_INO, LOCKTABLE_NO_SHARE,
+			     TEST_LONG_MSEC, &shared);
+	if (res != 0)
+		test_exit_error(argv0, "unable to acquire lock: %d", res);
+}
+
+static void test_timeout(const char *argv0)
+{
+	struct locktable *table;
+	struct lock_result shared;
+	struct timespec start, end;
+	long msec;
+	int res;
+
+	table = locktable_create();
+	if (table == NULL)
+		test_exit_error(argv0, "unable to create lock table");
+
+	lock(argv0, table);
+
+	// locks are not recursive, so we wait on our own lock
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	res = locktable_lock(table, TEST_DEV, TEST_INO, LOCKTABLE_NO_SHARE,
+			     TEST_SHORT_MSEC, &shared);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	if (res != EWOULDBLOCK)
+		test_exit_error(argv0, "unexpected result %d on timeout", res);
+	msec = elapsed_msec(&start, &end);
+	if (msec < TEST_SHORT_MSEC - 1 || msec >= TEST_LONG_MSEC)
+		test_exit_error(argv0, "timed out after %ldms, expected %dms",
+				msec, TEST_SHORT_MSEC);
+
+	// another inode's lock is independent
+	res = locktable_lock(table, TEST_DEV, TEST_INO + 1,
+			     LOCKTABLE_NO_SHARE, TEST_SHORT_MSEC, &shared);
+	if (res != 0)
+		test_exit_error(argv0, "unable to acquire other lock: %d",
+				res);
+	locktable_unlock(table, TEST_DEV, TEST_INO + 1, NULL);
+
+	locktable_unlock(table, TEST_DEV, TEST_INO, NULL);
+	locktable_destroy(table);
+}
+
+static void test_wake(const char *argv0)
+{
+	struct locktable *table;
+	struct test_waiter waiter;
+	struct timespec unlocked;
+	pthread_t thread;
+	long msec;
+
+	table = locktable_create();
+	if (table == NULL)
+		test_exit_error(argv0, "unable to create lock table");
+
+	lock(argv0, table);
+	start_waiter(argv0, &thread, &waiter, table, LOCKTABLE_NO_SHARE);
+	usleep(TEST_START_MSEC * 1000);
+
+	clock_gettime(CLOCK_MONOTONIC, &unlocked);
+	locktable_unlock(table, TEST_DEV, TEST_INO, NULL);
+	pthread_join(thread, NULL);
+
+	if (waiter.res != 0)
+		test_exit_error(argv0, "waiter failed to acquire lock: %d",
+				waiter.res);
+	msec = elapsed_msec(&unlocked, &waiter.done);
+	if (msec > TEST_WAKE_MSEC)
+		test_exit_error(argv0, "waiter woken %ldms after unlock",
+				msec);
+
+	locktable_destroy(table);
+}
+
+/**
+ * Starts waiters for a held lock, then releases it with the given result,
+ * and checks which waiters shared that result and which acquired the lock.
+ *
+ * @param result result to publish, or NULL to publish none
+ * @param wants minimum state wanted by each waiter, or LOCKTABLE_NO_SHARE
+ * @param shares 1 for each waiter expected to share the result; 0 for
+ *               each expected to acquire the lock
+ */
+static void test_share(const char *argv0, const char *desc,
+		       const struct lock_result *result, unsigned int n,
+		       const int *wants, const int *shares)
+{
+	struct test_waiter waiters[MAX_WAITERS];
+	pthread_t threads[MAX_WAITERS];
+	struct locktable *table;
+	struct lock_result shared;
+	unsigned int i;
+	int res;
+
+	table = locktable_create();
+	if (table == NULL)
+		test_exit_error(argv0, "unable to create lock table");
+
+	lock(argv0, table);
+	for (i = 0; i < n; ++i)
+		start_waiter(argv0, &threads[i], &waiters[i], table, wants[i]);
+	usleep(TEST_START_MSEC * 1000);
+
+	locktable_unlock(table, TEST_DEV, TEST_INO, result);
+	for (i = 0; i < n; ++i)
+		pthread_join(threads[i], NULL);
+
+	for (i = 0; i < n; ++i) {
+		const struct test_waiter *waiter = &waiters[i];
+
+		if (!shares[i]) {
+			if (waiter->res != 0)
+				test_exit_error(argv0, "%s: waiter %u did not "
+						       "acquire lock: %d",
+						desc, i, waiter->res);
+			continue;
+		}
+
+		if (waiter->res != LOCKTABLE_SHARED)
+			test_exit_error(argv0, "%s: waiter %u did not share "
+					       "result: %d",
+					desc, i, waiter->res);
+		if (waiter->shared.state != result->state ||
+		    waiter->shared.err != result->err)
+			test_exit_error(argv0, "%s: waiter %u shared "
+					       "state %d, error %d",
+					desc, i, waiter->shared.state,
+					waiter->shared.err);
+	}
+
+	// a result is never shared with a later locker
+	res = locktable_lock(table, TEST_DEV, TEST_INO, TEST_STATE_A,
+			     TEST_SHORT_MSEC, &shared);
+	if (res != 0)
+		test_exit_error(argv0, "%s: unable to acquire lock after "
+				       "waiters: %d", desc, res);
+	locktable_unlock(table, TEST_DEV, TEST_INO, NULL);
+
+	locktable_destroy(table);
+}
+
+static void test_single_flight(const char *argv0)
+{
+	static const struct lock_result state = { TEST_STATE_B, 0 };
+	static const int state_wants[] = {
+		TEST_STATE_A, TEST_STATE_B, TEST_STATE_C, LOCKTABLE_NO_SHARE
+	};
+	static const int state_shares[] = { 1, 1, 0, 0 };
+	static const struct lock_result error = { TEST_STATE_A, TEST_ERR };
+	static const int error_wants[] = {
+		TEST_STATE_A, TEST_STATE_C, LOCKTABLE_NO_SHARE
+	};
+	static const int error_shares[] = { 1, 1, 0 };
+	static const int none_wants[] = { TEST_STATE_A, TEST_STATE_A };
+	static const int none_shares[] = { 0, 0 };
+
+	// a state is shared with waiters wanting no more than that state
+	test_share(argv0, "state", &state, 4, state_wants, state_shares);
+
+	// an error is shared with all waiters which accept a shared result
+	test_share(argv0, "error", &error, 3, error_wants, error_shares);
+
+	/* Nothing is shared if no result is published, as when permission
+	 * to open a file is denied, since that is particular to a process.
+	 */
+	test_share(argv0, "no result", NULL, 2, none_wants, none_shares);
+}
+
+int main(int argc, char *const argv[])
+{
+	test_parse_opts(argc, argv, TEST_OPT_NONE, 0, 0, NULL, NULL, "");
+
+	test_timeout(argv[0]);
+	test_wake(argv[0]);
+	test_single_flight(argv[0]);
+
+	exit(EXIT_SUCCESS);
+}
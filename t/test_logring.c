@@ -0,0 +1,286 @@
+/* Linux Projected Filesystem
+   Copyright (C) 2019 GitHub, Inc.
+
+   See the NOTICE file distributed with this library for additional
+   information regarding copyright ownership.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library, in the file COPYING; if not,
+   see <http://www.gnu.org/licenses/>.
+*/
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../lib/logring.h"
+#include "test_common.h"
+
+#define TEST_LOG_PATH "test.log"
+#define TEST_NUM_THREADS 8
+#define TEST_NUM_MESSAGES 100
+#define TEST_RING_SIZE 4
+#define TEST_LONG_LEN (2 * LOGRING_TEXT_SIZE)
+
+struct expected {
+	char *text;
+	size_t len;
+};
+
+static int log_message(struct logring *ring, const char *fmt, ...)
+{
+	va_list ap;
+	int res;
+
+	va_start(ap, fmt);
+	res = logring_vwrite(ring, fmt, ap);
+	va_end(ap);
+
+	return res;
+}
+
+#define test_write(argv0, ring, ...)					\
+	do {								\
+		int res = log_message(ring, __VA_ARGS__);		\
+									\
+		if (res != 0)						\
+			test_exit_error(argv0, "unable to log "		\
+					       "message: %d", res);	\
+	} while (0)
+
+static void expect(const char *argv0, struct expected *exp,
+		   const char *fmt, ...)
+{
+	va_list ap;
+	int len;
+
+	va_start(ap, fmt);
+	len = vsnprintf(NULL, 0, fmt, ap);
+	va_end(ap);
+
+	exp->text = realloc(exp->text, exp->len + len + 2);
+	if (exp->text == NULL)
+		test_exit_error(argv0, "unable to allocate expected text");
+
+	va_start(ap, fmt);
+	vsnprintf(exp->text + exp->len, len + 1, fmt, ap);
+	va_end(ap);
+	exp->len += len;
+	exp->text[exp->len++] = '\n';
+	exp->text[exp->len] = '\0';
+}
+
+// logs a message, and records how it should be formatted
+#define TEST_MESSAGE(fmt, ...)						\
+	do {								\
+		test_write(argv0, ring, fmt, __VA_ARGS__);		\
+		expect(argv0, &exp, fmt, __VA_ARGS__);			\
+	} while (0)
+
+static FILE *open_log(const char *argv0)
+{
+	FILE *file;
+
+	file = fopen(TEST_LOG_PATH, "w+");
+	if (file == NULL)
+		test_exit_error(argv0, "unable to open log file");
+
+	return file;
+}
+
+static char *read_log(const char *argv0, FILE *file)
+{
+	char *text;
+	long len = 0;
+
+	if (fseek(file, 0, SEEK_END) != 0 || (len = ftell(file)) < 0 ||
+	    fseek(file, 0, SEEK_SET) != 0)
+		test_exit_error(argv0, "unable to seek log file");
+
+	text = calloc(1, len + 1);
+	if (text == NULL)
+		test_exit_error(argv0, "unable to allocate log text");
+	if (fread(text, 1, len, file) != (size_t)len)
+		test_exit_error(argv0, "unable to read log file");
+	fclose(file);
+
+	return text;
+}
+
+static void test_format(const char *argv0)
+{
+	struct expected exp = { .text = NULL, .len = 0 };
+	char long_str[TEST_LONG_LEN + 1];
+	struct logring *ring;
+	FILE *file;
+	char *text;
+
+	file = open_log(argv0);
+	ring = logring_create(file, LOGRING_DEFAULT_RECORDS);
+	if (ring == NULL)
+		test_exit_error(argv0, "unable to create log ring");
+
+	TEST_MESSAGE("%s", "plain message");
+	TEST_MESSAGE("ints %d %i %hhd %hd %ld %lld %zd %jd %td",
+		     -1, 2, (signed char)-3, (short)4, -5L, 6LL,
+		     (ssize_t)-7, (intmax_t)8, (ptrdiff_t)-9);
+	TEST_MESSAGE("unsigned %u %o %x %X %lu %llx %zu %ju",
+		     1U, 8U, 0xabU, 0xcdU, 2UL, 0xefULL, (size_t)3,
+		     (uintmax_t)4);
+	TEST_MESSAGE("padded [%-5d] [%05u] [%+d] [%#x] [%.3s] [%8s]",
+		     12, 34U, 56, 0x78U, "abcdef", "right");
+	TEST_MESSAGE("double %f %.2e %g %c %p %s 100%%",
+		     1.5, 2.25, 0.125, 'c', (void *)ring, (char *)NULL);
+
+	// these are formatted immediately, as they cannot be stored
+	TEST_MESSAGE("star [%*d] [%.*s]", 6, 7, 2, "xyz");
+	TEST_MESSAGE("too many %d %d %d %d %d %d %d %d %d %d %d %d %d",
+		     1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13);
+
+	// long strings are truncated, and later strings left empty
+	memset(long_str, 'a', TEST_LONG_LEN);
+	long_str[TEST_LONG_LEN] = '\0';
+	test_write(argv0, ring, "long %s [%s] %d", long_str, "lost", 1);
+	expect(argv0, &exp, "long %.*s [] 1", LOGRING_TEXT_SIZE - 1,
+	       long_str);
+
+	logring_destroy(ring);
+
+	text = read_log(argv0, file);
+	if (strcmp(text, exp.text) != 0)
+		test_exit_error(argv0, "unexpected log text: '%s', "
+				       "expected '%s'", text, exp.text);
+	free(text);
+	free(exp.text);
+}
+
+struct thread_data {
+	const char *argv0;
+	struct logring *ring;
+	unsigned int id;
+};
+
+static void *write_loop(void *data)
+{
+	struct thread_data *td = (struct thread_data *)data;
+	unsigned int i;
+
+	for (i = 0; i < TEST_NUM_MESSAGES; ++i) {
+		test_write(td->argv0, td->ring, "thread %u message %u",
+			   td->id, i);
+	}
+
+	return NULL;
+}
+
+static void test_threads(const char *argv0)
+{
+	struct thread_data td[TEST_NUM_THREADS];
+	pthread_t thread_ids[TEST_NUM_THREADS];
+	unsigned int next[TEST_NUM_THREADS] = { 0 };
+	unsigned int i, id, n;
+	struct logring *ring;
+	char *text, *line;
+	FILE *file;
+
+	file = open_log(argv0);
+	// exited threads' rings may be reused before they are written out
+	ring = logring_create(file, TEST_NUM_THREADS * TEST_NUM_MESSAGES);
+	if (ring == NULL)
+		test_exit_error(argv0, "unable to create log ring");
+	if (logring_start(ring) != 0)
+		test_exit_error(argv0, "unable to start log writer");
+
+	for (i = 0; i < TEST_NUM_THREADS; ++i) {
+		td[i].argv0 = argv0;
+		td[i].ring = ring;
+		td[i].id = i;
+		if (pthread_create(&thread_ids[i], NULL, write_loop,
+				   &td[i]) != 0)
+			test_exit_error(argv0, "unable to create thread");
+	}
+
+	for (i = 0; i < TEST_NUM_THREADS; ++i)
+		pthread_join(thread_ids[i], NULL);
+
+	// pending messages are written when the writer stops
+	logring_stop(ring);
+	logring_destroy(ring);
+	text = read_log(argv0, file);
+
+	// each thread's messages are written in order
+	for (line = strtok(text, "\n"); line != NULL;
+	     line = strtok(NULL, "\n")) {
+		if (sscanf(line, "thread %u message %u", &id, &n) != 2 ||
+		    id >= TEST_NUM_THREADS || n != next[id])
+			test_exit_error(argv0, "unexpected log line: %s",
+					line);
+		++next[id];
+	}
+	for (i = 0; i < TEST_NUM_THREADS; ++i) {
+		if (next[i] != TEST_NUM_MESSAGES)
+			test_exit_error(argv0, "missing messages from "
+					       "thread %u", i);
+	}
+	free(text);
+}
+
+static void test_overflow(const char *argv0)
+{
+	struct logring *ring;
+	unsigned int i;
+	FILE *file;
+	char *text;
+
+	file = open_log(argv0);
+	ring = logring_create(file, TEST_RING_SIZE);
+	if (ring == NULL)
+		test_exit_error(argv0, "unable to create log ring");
+
+	// without a writer, messages beyond the size of the ring are dropped
+	for (i = 0; i < 2 * TEST_RING_SIZE; ++i) {
+		if (log_message(ring, "message %u", i) !=
+		    ((i < TEST_RING_SIZE) ? 0 : ENOBUFS))
+			test_exit_error(argv0, "unexpected result for "
+					       "message %u", i);
+	}
+
+	logring_destroy(ring);
+
+	text = read_log(argv0, file);
+	if (strcmp(text, "message 0\nmessage 1\nmessage 2\nmessage 3\n"
+			 "4 log messages dropped\n") != 0)
+		test_exit_error(argv0, "unexpected log text: '%s'", text);
+	free(text);
+}
+
+int main(int argc, char *const argv[])
+{
+	const char *argv0 = argv[0];
+
+	test_parse_opts(argc, argv, TEST_OPT_NONE, 0, 0, NULL, NULL, "");
+
+	test_format(argv0);
+	test_threads(argv0);
+	test_overflow(argv0);
+
+	unlink(TEST_LOG_PATH);
+
+	exit(EXIT_SUCCESS);
+}
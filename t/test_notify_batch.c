@@ -0,0 +1,71 @@
+/* Linux Projected Filesystem
+   Copyright (C) 2019 GitHub, Inc.
+
+   See the NOTICE file distributed with this library for additional
+   information regarding copyright ownership.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library, in the file COPYING; if not,
+   see <http://www.gnu.org/licenses/>.
+*/
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "test_common.h"
+
+static int test_notify_batch(struct projfs_event *events, size_t n)
+{
+	size_t i;
+
+	printf("  test event notification batch of %zu\n", n);
+
+	for (i = 0; i < n; ++i) {
+		struct projfs_event *event = &events[i];
+
+		printf("  test event notification for %s%s%s: "
+		       "0x%04" PRIx64 "-%08" PRIx64 ", %d\n",
+		       event->path,
+		       ((event->target_path == NULL) ? "" : ", "),
+		       ((event->target_path == NULL) ? ""
+						     : event->target_path),
+		       event->mask >> 32, event->mask & 0xFFFFFFFF,
+		       event->pid);
+	}
+
+	return 0;
+}
+
+int main(int argc, char *const argv[])
+{
+	const char *lower_path, *mount_path;
+	struct test_mount_args mount_args;
+	struct projfs *fs;
+	struct projfs_handlers handlers = { 0 };
+
+	test_parse_mount_opts(argc, argv, TEST_OPT_NONE,
+			      &lower_path, &mount_path, &mount_args);
+
+	handlers.handle_notify_batch = &test_notify_batch;
+
+	fs = test_start_mount(lower_path, mount_path,
+			      &handlers, sizeof(handlers), NULL,
+			      &mount_args);
+	test_wait_signal();
+	test_stop_mount(fs);
+
+	test_free_opts(&mount_args);
+
+	exit(EXIT_SUCCESS);
+}
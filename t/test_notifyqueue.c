@@ -0,0 +1,158 @@
+/* Linux Projected Filesystem
+   Copyright (C) 2019 GitHub, Inc.
+
+   See the NOTICE file distributed with this library for additional
+   information regarding copyright ownership.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library, in the file COPYING; if not,
+   see <http://www.gnu.org/licenses/>.
+*/
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../lib/notifyqueue.h"
+#include "test_common.h"
+
+#define TEST_PID 100
+
+struct test_event {
+	uint64_t mask;
+	const char *path;
+};
+
+// events which fill the queue before its dispatcher is started
+static const struct test_event test_queued[] = {
+	{ PROJFS_CLOSE_WRITE, "a" },
+	{ PROJFS_DELETE, "a" },
+	{ PROJFS_CREATE, "a" }
+};
+
+#define NUM_QUEUED (sizeof(test_queued) / sizeof(test_queued[0]))
+
+// duplicates the newest queued event for its path, so is merged into it
+static const struct test_event test_merged = { PROJFS_CREATE, "a" };
+
+/* duplicates an older queued event for its path, so must wait for space
+ * rather than be merged, or the final write to the file would be lost
+ */
+static const struct test_event test_blocked = { PROJFS_CLOSE_WRITE, "a" };
+
+static const struct test_event test_expected[] = {
+	{ PROJFS_CLOSE_WRITE, "a" },
+	{ PROJFS_DELETE, "a" },
+	{ PROJFS_CREATE, "a" },
+	{ PROJFS_CLOSE_WRITE, "a" }
+};
+
+#define NUM_EXPECTED (sizeof(test_expected) / sizeof(test_expected[0]))
+
+static struct test_event delivered[NUM_EXPECTED + 1];
+static unsigned int num_delivered;
+
+static void deliver(void *data, const struct notify_entry *entries,
+		    unsigned int n)
+{
+	const char *argv0 = data;
+	unsigned int i;
+
+	for (i = 0; i < n; ++i) {
+		if (num_delivered == NUM_EXPECTED + 1)
+			test_exit_error(argv0, "too many events delivered");
+
+		delivered[num_delivered].mask = entries[i].mask;
+		delivered[num_delivered].path = strdup(entries[i].path);
+		if (delivered[num_delivered].path == NULL)
+			test_exit_error(argv0, "unable to copy event path");
+		++num_delivered;
+	}
+}
+
+static struct notifyqueue *queue;
+
+static void push_event(const char *argv0, const struct test_event *event)
+{
+	int res;
+
+	res = notifyqueue_push(queue, event->mask, TEST_PID, event->path,
+			       NULL);
+	if (res != 0)
+		test_exit_error(argv0, "unable to queue event: %s",
+				strerror(res));
+}
+
+static void *run_blocked(void *data)
+{
+	push_event(data, &test_blocked);
+
+	return NULL;
+}
+
+static void test_coalesce(const char *argv0)
+{
+	struct notifyqueue_stats stats;
+	pthread_t thread;
+	unsigned int i;
+
+	queue = notifyqueue_create(NUM_QUEUED, NOTIFYQUEUE_COALESCE,
+				   deliver, (void *)argv0);
+	if (queue == NULL)
+		test_exit_error(argv0, "unable to create queue");
+
+	for (i = 0; i < NUM_QUEUED; ++i)
+		push_event(argv0, &test_queued[i]);
+
+	// returns at once, as the queue is full and the event is merged
+	push_event(argv0, &test_merged);
+
+	if (pthread_create(&thread, NULL, run_blocked, (void *)argv0) != 0)
+		test_exit_error(argv0, "unable to create thread");
+
+	if (notifyqueue_start(queue) != 0)
+		test_exit_error(argv0, "unable to start queue");
+	pthread_join(thread, NULL);
+	notifyqueue_stop(queue);
+
+	if (num_delivered != NUM_EXPECTED)
+		test_exit_error(argv0, "%u events delivered, expected %u",
+				num_delivered, (unsigned int)NUM_EXPECTED);
+	for (i = 0; i < NUM_EXPECTED; ++i) {
+		if (delivered[i].mask != test_expected[i].mask ||
+		    strcmp(delivered[i].path, test_expected[i].path) != 0)
+			test_exit_error(argv0, "unexpected event %u delivered: "
+					       "0x%08llx %s", i,
+					(unsigned long long)delivered[i].mask,
+					delivered[i].path);
+		free((char *)delivered[i].path);
+	}
+
+	notifyqueue_get_stats(queue, &stats);
+	if (stats.coalesced != 1)
+		test_exit_error(argv0, "%llu events coalesced, expected 1",
+				(unsigned long long)stats.coalesced);
+
+	notifyqueue_destroy(queue);
+}
+
+int main(int argc, char *const argv[])
+{
+	test_parse_opts(argc, argv, TEST_OPT_NONE, 0, 0, NULL, NULL, "");
+
+	test_coalesce(argv[0]);
+
+	exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,122 @@
+/* Linux Projected Filesystem
+   Copyright (C) 2019 GitHub, Inc.
+
+   See the NOTICE file distributed with this library for additional
+   information regarding copyright ownership.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library, in the file COPYING; if not,
+   see <http://www.gnu.org/licenses/>.
+*/
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../lib/opstats.h"
+#include "test_common.h"
+
+#define TEST_NUM_IDS 3
+#define TEST_NUM_THREADS 8
+#define TEST_NUM_RECORDS 1000
+
+// a latency which falls in bucket 3, of 4-8 usec
+#define TEST_DELAY_NSEC (5 * 1000)
+
+struct thread_data {
+	struct opstats *stats;
+	unsigned int id;
+};
+
+static void *record_loop(void *data)
+{
+	struct thread_data *td = (struct thread_data *)data;
+	unsigned int i;
+
+	for (i = 0; i < TEST_NUM_RECORDS; ++i) {
+		opstats_record(td->stats, td->id, TEST_DELAY_NSEC,
+			       (i % 10 == 0));
+	}
+
+	return NULL;
+}
+
+static void run_threads(const char *argv0, struct opstats *stats)
+{
+	struct thread_data td[TEST_NUM_THREADS];
+	pthread_t thread_ids[TEST_NUM_THREADS];
+	unsigned int i;
+
+	for (i = 0; i < TEST_NUM_THREADS; ++i) {
+		td[i].stats = stats;
+		td[i].id = i % 2;
+		if (pthread_create(&thread_ids[i], NULL, record_loop,
+				   &td[i]) != 0)
+			test_exit_error(argv0, "unable to create thread");
+	}
+
+	for (i = 0; i < TEST_NUM_THREADS; ++i)
+		pthread_join(thread_ids[i], NULL);
+}
+
+static void check_counter(const char *argv0, const struct opstats_counter *c,
+			  unsigned int id, uint64_t count)
+{
+	uint64_t sum = 0;
+	unsigned int i;
+
+	for (i = 0; i < OPSTATS_BUCKETS; ++i)
+		sum += c->buckets[i];
+
+	if (c->count != count || c->errors != count / 10 || sum != count)
+		test_exit_error(argv0, "unexpected counts for id %u: "
+				       "%lu, %lu errors, %lu in buckets",
+				id, (unsigned long)c->count,
+				(unsigned long)c->errors, (unsigned long)sum);
+
+	if (count > 0 && (c->buckets[0] != 0 || c->buckets[1] != 0 ||
+			  c->buckets[2] != 0 ||
+			  c->max_nsec != TEST_DELAY_NSEC ||
+			  c->total_nsec != count * TEST_DELAY_NSEC))
+		test_exit_error(argv0, "unexpected latencies for id %u", id);
+}
+
+int main(int argc, char *const argv[])
+{
+	const char *argv0 = argv[0];
+	struct opstats_counter counters[TEST_NUM_IDS];
+	uint64_t per_id = TEST_NUM_THREADS / 2 * TEST_NUM_RECORDS;
+	struct opstats *stats;
+
+	test_parse_opts(argc, argv, TEST_OPT_NONE, 0, 0, NULL, NULL, "");
+
+	stats = opstats_create(TEST_NUM_IDS);
+	if (stats == NULL)
+		test_exit_error(argv0, "unable to create statistics");
+
+	run_threads(argv0, stats);
+	opstats_merge(stats, counters);
+	check_counter(argv0, &counters[0], 0, per_id);
+	check_counter(argv0, &counters[1], 1, per_id);
+	check_counter(argv0, &counters[2], 2, 0);
+
+	// samples from exited threads are kept as their slots are reused
+	run_threads(argv0, stats);
+	opstats_merge(stats, counters);
+	check_counter(argv0, &counters[0], 0, 2 * per_id);
+	check_counter(argv0, &counters[1], 1, 2 * per_id);
+
+	opstats_destroy(stats);
+
+	exit(EXIT_SUCCESS);
+}
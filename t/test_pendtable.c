@@ -0,0 +1,156 @@
+/* Linux Projected Filesystem
+   Copyright (C) 2019 GitHub, Inc.
+
+   See the NOTICE file distributed with this library for additional
+   information regarding copyright ownership.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library, in the file COPYING; if not,
+   see <http://www.gnu.org/licenses/>.
+*/
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "../lib/pendtable.h"
+#include "test_common.h"
+
+#define TEST_SHORT_MSEC 100
+#define TEST_LONG_MSEC 10000
+
+#define TEST_RESULT -EIO
+#define TEST_CANCEL_RESULT -ECANCELED
+
+struct test_completer {
+	struct pendtable *table;
+	uint64_t cookie;
+};
+
+static void *run_completer(void *data)
+{
+	struct test_completer *completer = data;
+
+	usleep(TEST_SHORT_MSEC * 1000);
+	pendtable_complete(completer->table, completer->cookie, TEST_RESULT);
+
+	return NULL;
+}
+
+static void *run_canceller(void *data)
+{
+	usleep(TEST_SHORT_MSEC * 1000);
+	pendtable_cancel(data, TEST_CANCEL_RESULT);
+
+	return NULL;
+}
+
+static uint64_t add(const char *argv0, struct pendtable *table,
+		    struct pending_wait *wait)
+{
+	uint64_t cookie;
+
+	cookie = pendtable_add(table, wait);
+	if (cookie == 0)
+		test_exit_error(argv0, "unable to add waiter");
+
+	return cookie;
+}
+
+static void test_complete(const char *argv0, struct pendtable *table)
+{
+	struct test_completer completer;
+	struct pending_wait wait;
+	pthread_t thread;
+	int res;
+
+	// a result not pending is returned at once
+	add(argv0, table, &wait);
+	res = pendtable_finish(table, &wait, 0, 0, TEST_LONG_MSEC);
+	if (res != 0)
+		test_exit_error(argv0, "unexpected result %d", res);
+
+	// a pending result is returned on completion
+	completer.table = table;
+	completer.cookie = add(argv0, table, &wait);
+	if (pthread_create(&thread, NULL, run_completer, &completer) != 0)
+		test_exit_error(argv0, "unable to create thread");
+	res = pendtable_finish(table, &wait, 1, 0, TEST_LONG_MSEC);
+	pthread_join(thread, NULL);
+	if (res != TEST_RESULT)
+		test_exit_error(argv0, "unexpected completed result %d", res);
+
+	// a completed cookie is no longer outstanding
+	res = pendtable_complete(table, completer.cookie, 0);
+	if (res != ENOENT)
+		test_exit_error(argv0, "unexpected repeat completion %d", res);
+}
+
+static void test_timeout(const char *argv0, struct pendtable *table)
+{
+	struct pending_wait wait;
+	uint64_t cookie;
+	int res;
+
+	cookie = add(argv0, table, &wait);
+	res = pendtable_finish(table, &wait, 1, 0, TEST_SHORT_MSEC);
+	if (res != -ETIMEDOUT)
+		test_exit_error(argv0, "unexpected timeout result %d", res);
+
+	// a late completion finds nothing to complete
+	res = pendtable_complete(table, cookie, 0);
+	if (res != ENOENT)
+		test_exit_error(argv0, "unexpected late completion %d", res);
+}
+
+static void test_cancel(const char *argv0, struct pendtable *table)
+{
+	struct pending_wait wait;
+	pthread_t thread;
+	int res;
+
+	add(argv0, table, &wait);
+	if (pthread_create(&thread, NULL, run_canceller, table) != 0)
+		test_exit_error(argv0, "unable to create thread");
+	res = pendtable_finish(table, &wait, 1, 0, TEST_LONG_MSEC);
+	pthread_join(thread, NULL);
+	if (res != TEST_CANCEL_RESULT)
+		test_exit_error(argv0, "unexpected cancelled result %d", res);
+
+	// later waiters do not wait once the table is cancelled
+	add(argv0, table, &wait);
+	res = pendtable_finish(table, &wait, 1, 0, TEST_LONG_MSEC);
+	if (res != TEST_CANCEL_RESULT)
+		test_exit_error(argv0, "unexpected later result %d", res);
+}
+
+int main(int argc, char *const argv[])
+{
+	struct pendtable *table;
+
+	test_parse_opts(argc, argv, TEST_OPT_NONE, 0, 0, NULL, NULL, "");
+
+	table = pendtable_create();
+	if (table == NULL)
+		test_exit_error(argv[0], "unable to create pending table");
+
+	test_complete(argv[0], table);
+	test_timeout(argv[0], table);
+	test_cancel(argv[0], table);
+
+	pendtable_destroy(table);
+
+	exit(EXIT_SUCCESS);
+}
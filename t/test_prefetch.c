@@ -0,0 +1,154 @@
+/* Linux Projected Filesystem
+   Copyright (C) 2019 GitHub, Inc.
+
+   See the NOTICE file distributed with this library for additional
+   information regarding copyright ownership.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library, in the file COPYING; if not,
+   see <http://www.gnu.org/licenses/>.
+*/
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../lib/prefetch.h"
+#include "test_common.h"
+
+#define TEST_THRESHOLD 3
+#define TEST_WINDOW_MSEC 200
+#define TEST_WAIT_SEC 5
+
+#define MAX_PREFETCHED 8
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static char *prefetched[MAX_PREFETCHED];
+static pid_t prefetched_pid[MAX_PREFETCHED];
+static unsigned int num_prefetched;
+
+static void test_prefetch_dir(void *data, const char *dir, pid_t pid)
+{
+	pthread_mutex_lock(&mutex);
+	if (num_prefetched < MAX_PREFETCHED) {
+		prefetched[num_prefetched] = strdup(dir);
+		prefetched_pid[num_prefetched] = pid;
+		++num_prefetched;
+	}
+	pthread_cond_broadcast(&cond);
+	pthread_mutex_unlock(&mutex);
+}
+
+static unsigned int get_num_prefetched(void)
+{
+	unsigned int n;
+
+	pthread_mutex_lock(&mutex);
+	n = num_prefetched;
+	pthread_mutex_unlock(&mutex);
+
+	return n;
+}
+
+static void wait_prefetched(const char *argv0, unsigned int expect)
+{
+	struct timespec deadline;
+	int res = 0;
+
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += TEST_WAIT_SEC;
+
+	pthread_mutex_lock(&mutex);
+	while (num_prefetched < expect && res == 0)
+		res = pthread_cond_timedwait(&cond, &mutex, &deadline);
+	pthread_mutex_unlock(&mutex);
+
+	if (res != 0)
+		test_exit_error(argv0, "timed out waiting for prefetch");
+}
+
+static void check_prefetched(const char *argv0, unsigned int i,
+			     const char *dir, pid_t pid)
+{
+	if (prefetched[i] == NULL || strcmp(prefetched[i], dir) != 0 ||
+	    prefetched_pid[i] != pid)
+		test_exit_error(argv0, "unexpected prefetch %u: %s, %d",
+				i, prefetched[i], prefetched_pid[i]);
+}
+
+static void record(struct prefetch *pf, const char *dir, pid_t pid,
+		   unsigned int n)
+{
+	while (n-- > 0)
+		prefetch_record(pf, dir, pid);
+}
+
+int main(int argc, char *const argv[])
+{
+	const char *argv0 = argv[0];
+	struct prefetch *pf;
+	unsigned int i;
+
+	test_parse_opts(argc, argv, TEST_OPT_NONE, 0, 0, NULL, NULL, "");
+
+	pf = prefetch_create(TEST_THRESHOLD, TEST_WINDOW_MSEC, 2,
+			     test_prefetch_dir, NULL);
+	if (pf == NULL || prefetch_start(pf) != 0)
+		test_exit_error(argv0, "unable to start prefetch workers");
+
+	// below the threshold, nothing is prefetched
+	record(pf, "a", 1, TEST_THRESHOLD - 1);
+	record(pf, "b", 2, TEST_THRESHOLD - 1);
+	usleep(TEST_WINDOW_MSEC * 1000 / 2);
+	if (get_num_prefetched() != 0)
+		test_exit_error(argv0, "prefetched below threshold");
+
+	// reaching the threshold prefetches once per window
+	record(pf, "a", 3, TEST_THRESHOLD);
+	wait_prefetched(argv0, 1);
+	check_prefetched(argv0, 0, "a", 3);
+
+	// hydrations spread over more than one window are not counted
+	usleep(TEST_WINDOW_MSEC * 1000 * 2);
+	record(pf, "b", 2, 1);
+	usleep(TEST_WINDOW_MSEC * 1000 * 2);
+	record(pf, "b", 2, TEST_THRESHOLD - 1);
+	usleep(TEST_WINDOW_MSEC * 1000 / 2);
+	if (get_num_prefetched() != 1)
+		test_exit_error(argv0, "prefetched across windows");
+
+	// a new window permits another prefetch
+	record(pf, "b", 4, 1);
+	record(pf, "a", 5, TEST_THRESHOLD);
+	wait_prefetched(argv0, 3);
+	pthread_mutex_lock(&mutex);
+	if (strcmp(prefetched[1], "b") == 0) {
+		check_prefetched(argv0, 1, "b", 4);
+		check_prefetched(argv0, 2, "a", 5);
+	} else {
+		check_prefetched(argv0, 1, "a", 5);
+		check_prefetched(argv0, 2, "b", 4);
+	}
+	pthread_mutex_unlock(&mutex);
+
+	prefetch_destroy(pf);
+
+	for (i = 0; i < num_prefetched; ++i)
+		free(prefetched[i]);
+
+	exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,109 @@
+/* Linux Projected Filesystem
+   Copyright (C) 2018-2019 GitHub, Inc.
+
+   See the NOTICE file distributed with this library for additional
+   information regarding copyright ownership.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library, in the file COPYING; if not,
+   see <http://www.gnu.org/licenses/>.
+*/
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "test_common.h"
+
+/* entries which fail lie between ones which succeed, and no two entries
+ * which may be created together with io_uring share a name, so as entries
+ * are created in order, the results are the same with the io-uring option
+ */
+static struct projfs_entry test_entries[] = {
+	{ .name = "d1", .mode = S_IFDIR | 0755 },
+	{ .name = "f1.txt", .mode = S_IFREG | 0644, .size = 10 },
+	{ .name = "l1", .mode = S_IFLNK | 0777, .target = "f1.txt" },
+	{ .name = "ro.txt", .mode = S_IFREG | 0444, .size = 5 },
+	{ .name = "ro.txt", .mode = S_IFREG | 0644, .size = 5 },
+	{ .name = "a/b", .mode = S_IFREG | 0644 },
+	{ .name = "..", .mode = S_IFDIR | 0755 },
+	{ .name = "", .mode = S_IFREG | 0644 },
+	{ .name = "l2", .mode = S_IFLNK | 0777 },
+	{ .name = "p1", .mode = S_IFIFO | 0644 },
+	{ .name = "f2.txt", .mode = S_IFREG | 0644, .size = 20 },
+	{ .name = "f3.txt", .mode = S_IFREG | 0644, .size = 3 },
+	{ .name = "f3.txt", .mode = S_IFLNK | 0777, .target = "f1.txt" }
+};
+
+#define NUM_ENTRIES (sizeof(test_entries) / sizeof(test_entries[0]))
+
+static const char *result_name(int res)
+{
+	switch (res) {
+	case 0:
+		return "ok";
+	case EEXIST:
+		return "EEXIST";
+	case EINVAL:
+		return "EINVAL";
+	default:
+		return strerror(res);
+	}
+}
+
+static int test_proj_event(struct projfs_event *event)
+{
+	unsigned int i;
+	int res;
+
+	// only the mount point's initial projection creates entries
+	if (!(event->mask & PROJFS_ONDIR) || strcmp(event->path, ".") != 0)
+		return 0;
+
+	res = projfs_create_proj_entries(event->fs, event->path,
+					 test_entries, NUM_ENTRIES);
+
+	for (i = 0; i < NUM_ENTRIES; ++i) {
+		printf("  test entry %s: %s\n", test_entries[i].name,
+		       result_name(test_entries[i].result));
+	}
+	printf("  test entries: %s\n", result_name(res));
+	fflush(stdout);
+
+	return 0;
+}
+
+int main(int argc, char *const argv[])
+{
+	const char *lower_path, *mount_path;
+	struct test_mount_args mount_args;
+	struct projfs *fs;
+	struct projfs_handlers handlers = { 0 };
+
+	test_parse_mount_opts(argc, argv, TEST_OPT_NONE,
+			      &lower_path, &mount_path, &mount_args);
+
+	handlers.handle_proj_event = &test_proj_event;
+
+	fs = test_start_mount(lower_path, mount_path,
+			      &handlers, sizeof(handlers), NULL,
+			      &mount_args);
+	test_wait_signal();
+	test_stop_mount(fs);
+
+	test_free_opts(&mount_args);
+
+	exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,120 @@
+/* Linux Projected Filesystem
+   Copyright (C) 2018-2019 GitHub, Inc.
+
+   See the NOTICE file distributed with this library for additional
+   information regarding copyright ownership.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library, in the file COPYING; if not,
+   see <http://www.gnu.org/licenses/>.
+*/
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "test_common.h"
+
+// three chunks of the 1 MiB chunk size used by the test
+#define TEST_FILE_SIZE (3 << 20)
+#define TEST_FILE_CHAR 'x'
+
+static const char *const test_files[] = { "full.bin", "part.bin" };
+
+#define NUM_FILES (sizeof(test_files) / sizeof(test_files[0]))
+
+static int write_range(int fd, off_t offset, size_t length)
+{
+	char buf[65536];
+
+	memset(buf, TEST_FILE_CHAR, sizeof(buf));
+	while (length > 0) {
+		size_t n = (length < sizeof(buf)) ? length : sizeof(buf);
+		ssize_t res;
+
+		res = pwrite(fd, buf, n, offset);
+		if (res == -1)
+			return -errno;
+		offset += res;
+		length -= res;
+	}
+
+	return 0;
+}
+
+static int test_proj_event(struct projfs_event *event)
+{
+	unsigned int i;
+	int res;
+
+	if (event->mask & PROJFS_ONRANGE)
+		return write_range(event->fd, event->offset, event->length);
+
+	if (!(event->mask & PROJFS_ONDIR))
+		return write_range(event->fd, 0, TEST_FILE_SIZE);
+
+	if (strcmp(event->path, ".") != 0)
+		return 0;
+
+	for (i = 0; i < NUM_FILES; ++i) {
+		res = projfs_create_proj_file(event->fs, test_files[i],
+					      TEST_FILE_SIZE, 0644, NULL, 0);
+		if (res != 0)
+			return -res;
+	}
+
+	return 0;
+}
+
+static int print_path(void *data, const char *path, int isdir)
+{
+	(void)data;
+
+	printf("  test populated path: %s%s\n", path, isdir ? "/" : "");
+
+	return 0;
+}
+
+int main(int argc, char *const argv[])
+{
+	const char *lower_path, *mount_path;
+	struct test_mount_args mount_args;
+	struct projfs *fs;
+	struct projfs_handlers handlers = { 0 };
+	int res;
+
+	test_parse_mount_opts(argc, argv, TEST_OPT_NONE,
+			      &lower_path, &mount_path, &mount_args);
+
+	handlers.handle_proj_event = &test_proj_event;
+
+	fs = test_start_mount(lower_path, mount_path,
+			      &handlers, sizeof(handlers), NULL,
+			      &mount_args);
+	test_wait_signal();
+
+	res = projfs_iterate_state(fs, PROJFS_STATE_POPULATED, print_path,
+				   NULL);
+	if (res != 0)
+		test_exit_error(argv[0], "unable to iterate state index: %s",
+				strerror(res));
+
+	test_stop_mount(fs);
+
+	test_free_opts(&mount_args);
+
+	exit(EXIT_SUCCESS);
+}
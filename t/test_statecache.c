@@ -0,0 +1,173 @@
+/* Linux Projected Filesystem
+   Copyright (C) 2019 GitHub, Inc.
+
+   See the NOTICE file distributed with this library for additional
+   information regarding copyright ownership.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library, in the file COPYING; if not,
+   see <http://www.gnu.org/licenses/>.
+*/
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../lib/statecache.h"
+#include "test_common.h"
+
+#define TEST_DEV 0x801
+#define TEST_INO 1234
+
+// states are opaque to the cache, so any non-negative values will do
+#define TEST_STATE_A 1
+#define TEST_STATE_B 2
+
+static void test_lookup(const char *argv0, struct statecache *cache,
+			dev_t dev, ino_t ino, int expect)
+{
+	int state;
+
+	state = statecache_lookup(cache, dev, ino);
+	if (state != expect) {
+		test_exit_error(argv0, "unexpected state for %llu:%llu: "
+				       "found %d, expected %d",
+				(unsigned long long)dev,
+				(unsigned long long)ino, state, expect);
+	}
+}
+
+static void test_entries(const char *argv0)
+{
+	struct statecache *cache;
+
+	cache = statecache_create();
+	if (cache == NULL)
+		test_exit_error(argv0, "unable to create state cache");
+
+	test_lookup(argv0, cache, TEST_DEV, TEST_INO, STATECACHE_MISS);
+
+	statecache_update(cache, TEST_DEV, TEST_INO, TEST_STATE_A);
+	test_lookup(argv0, cache, TEST_DEV, TEST_INO, TEST_STATE_A);
+
+	// same inode number on another device is a distinct key
+	test_lookup(argv0, cache, TEST_DEV + 1, TEST_INO, STATECACHE_MISS);
+
+	statecache_update(cache, TEST_DEV, TEST_INO, TEST_STATE_B);
+	test_lookup(argv0, cache, TEST_DEV, TEST_INO, TEST_STATE_B);
+
+	// invalidating another key leaves the entry in place
+	statecache_invalidate(cache, TEST_DEV + 1, TEST_INO);
+	test_lookup(argv0, cache, TEST_DEV, TEST_INO, TEST_STATE_B);
+
+	statecache_invalidate(cache, TEST_DEV, TEST_INO);
+	test_lookup(argv0, cache, TEST_DEV, TEST_INO, STATECACHE_MISS);
+
+	statecache_destroy(cache);
+}
+
+// number of distinct keys to insert, well beyond the cache capacity
+#define TEST_FILL (4 * STATECACHE_SIZE)
+
+static void test_capacity(const char *argv0)
+{
+	struct statecache *cache;
+	unsigned int hits = 0;
+	int evicted = 0;
+	ino_t ino;
+
+	cache = statecache_create();
+	if (cache == NULL)
+		test_exit_error(argv0, "unable to create state cache");
+
+	statecache_update(cache, TEST_DEV, 1, TEST_STATE_A);
+	for (ino = 2; ino <= TEST_FILL; ++ino) {
+		statecache_update(cache, TEST_DEV, ino, TEST_STATE_B);
+
+		// the newest entry always displaces its slot's old entry
+		test_lookup(argv0, cache, TEST_DEV, ino, TEST_STATE_B);
+
+		if (!evicted && statecache_lookup(cache, TEST_DEV, 1) ==
+				STATECACHE_MISS)
+			evicted = 1;
+	}
+
+	if (!evicted)
+		test_exit_error(argv0, "first entry not evicted after %u "
+				       "insertions", TEST_FILL);
+
+	for (ino = 1; ino <= TEST_FILL; ++ino) {
+		if (statecache_lookup(cache, TEST_DEV, ino) != STATECACHE_MISS)
+			++hits;
+	}
+	if (hits > STATECACHE_SIZE)
+		test_exit_error(argv0, "%u entries cached, capacity is %u",
+				hits, STATECACHE_SIZE);
+
+	statecache_destroy(cache);
+}
+
+#define TEST_WRITES 100000
+
+static void *run_writer(void *data)
+{
+	struct statecache *cache = data;
+	unsigned int i;
+
+	for (i = 0; i < TEST_WRITES; ++i) {
+		statecache_update(cache, TEST_DEV, TEST_INO,
+				  (i % 2 == 0) ? TEST_STATE_A : TEST_STATE_B);
+	}
+
+	return NULL;
+}
+
+static void test_concurrent(const char *argv0)
+{
+	struct statecache *cache;
+	pthread_t thread;
+	unsigned int i;
+	int state;
+
+	cache = statecache_create();
+	if (cache == NULL)
+		test_exit_error(argv0, "unable to create state cache");
+
+	if (pthread_create(&thread, NULL, run_writer, cache) != 0)
+		test_exit_error(argv0, "unable to create thread");
+
+	// a lookup racing with writes may miss, but sees only states written
+	for (i = 0; i < TEST_WRITES; ++i) {
+		state = statecache_lookup(cache, TEST_DEV, TEST_INO);
+		if (state != STATECACHE_MISS && state != TEST_STATE_A &&
+		    state != TEST_STATE_B)
+			test_exit_error(argv0, "unexpected state %d during "
+					       "concurrent updates", state);
+	}
+
+	pthread_join(thread, NULL);
+	test_lookup(argv0, cache, TEST_DEV, TEST_INO, TEST_STATE_B);
+
+	statecache_destroy(cache);
+}
+
+int main(int argc, char *const argv[])
+{
+	test_parse_opts(argc, argv, TEST_OPT_NONE, 0, 0, NULL, NULL, "");
+
+	test_entries(argv[0]);
+	test_capacity(argv[0]);
+	test_concurrent(argv[0]);
+
+	exit(EXIT_SUCCESS);
+}
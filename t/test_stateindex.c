@@ -0,0 +1,298 @@
+/* Linux Projected Filesystem
+   Copyright (C) 2019 GitHub, Inc.
+
+   See the NOTICE file distributed with this library for additional
+   information regarding copyright ownership.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library, in the file COPYING; if not,
+   see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../lib/stateindex.h"
+#include "test_common.h"
+
+#define TEST_INDEX_PATH "test.index"
+#define TEST_MAX_PATHS 16
+#define TEST_NUM_TOGGLES (2 * STATEINDEX_COMPACT_MIN + 1)
+
+// record of a file path "z", following a header left open by another boot
+static const char crashed_index[] =
+	"projfs-index-1\0o00000000-0000-0000-0000-000000000000\0Mfz";
+
+// header truncated within its boot ID, and an unrecognized header
+static const char truncated_index[] = "projfs-index-1\0o0000";
+static const char invalid_index[] = "projfs-index-0\0c\0Mfz";
+
+struct collected {
+	char *paths[TEST_MAX_PATHS];
+	unsigned int n;
+};
+
+static int collect_path(void *data, const char *path, int isdir)
+{
+	struct collected *c = (struct collected *)data;
+
+	if (c->n == TEST_MAX_PATHS)
+		return 1;
+	c->paths[c->n] = malloc(strlen(path) + 2);
+	if (c->paths[c->n] == NULL)
+		return 1;
+	sprintf(c->paths[c->n], "%s%s", path, isdir ? "/" : "");
+	++c->n;
+
+	return 0;
+}
+
+/* Checks the paths in a state, given as a space-separated list in
+ * directory order, with directories suffixed by a slash.
+ */
+static void check_state(const char *argv0, struct stateindex *index,
+			enum stateindex_state state, const char *expect)
+{
+	struct collected c = { .n = 0 };
+	char *found;
+	size_t len = 1;
+	unsigned int i;
+
+	if (stateindex_iterate(index, state, collect_path, &c) != 0)
+		test_exit_error(argv0, "unable to iterate index");
+
+	for (i = 0; i < c.n; ++i)
+		len += strlen(c.paths[i]) + 1;
+	found = calloc(1, len);
+	if (found == NULL)
+		test_exit_error(argv0, "unable to allocate path list");
+	for (i = 0; i < c.n; ++i) {
+		if (i > 0)
+			strcat(found, " ");
+		strcat(found, c.paths[i]);
+		free(c.paths[i]);
+	}
+
+	if (strcmp(found, expect) != 0) {
+		test_exit_error(argv0, "unexpected paths in state %d: "
+				       "found '%s', expected '%s'",
+				state, found, expect);
+	}
+	free(found);
+}
+
+static struct stateindex *create_index(const char *argv0, int rebuild)
+{
+	struct stateindex *index;
+
+	index = stateindex_create(TEST_INDEX_PATH);
+	if (index == NULL)
+		test_exit_error(argv0, "unable to create index");
+	if (stateindex_needs_rebuild(index) != rebuild)
+		test_exit_error(argv0, "unexpected rebuild flag");
+
+	return index;
+}
+
+static void set_state(const char *argv0, struct stateindex *index,
+		      const char *path, int isdir,
+		      enum stateindex_state state)
+{
+	if (stateindex_set(index, path, isdir, state) != 0)
+		test_exit_error(argv0, "unable to set state of %s", path);
+}
+
+static void test_record(const char *argv0)
+{
+	struct stateindex *index;
+	FILE *file;
+
+	unlink(TEST_INDEX_PATH);
+	index = create_index(argv0, 1);
+	if (stateindex_finish_rebuild(index) != 0)
+		test_exit_error(argv0, "unable to finish rebuild");
+
+	set_state(argv0, index, "a", 0, STATEINDEX_MODIFIED);
+	set_state(argv0, index, "d", 1, STATEINDEX_MODIFIED);
+	set_state(argv0, index, "d/x", 0, STATEINDEX_MODIFIED);
+	set_state(argv0, index, "d/y", 0, STATEINDEX_MODIFIED);
+	set_state(argv0, index, "d/y", 0, STATEINDEX_DELETED);
+	set_state(argv0, index, "dx", 0, STATEINDEX_MODIFIED);
+
+	if (stateindex_rename(index, "d", 1, "e", 0, 0) != 0)
+		test_exit_error(argv0, "unable to rename directory");
+
+	check_state(argv0, index, STATEINDEX_MODIFIED, "a dx e/ e/x");
+	check_state(argv0, index, STATEINDEX_DELETED, "d/ d/x d/y");
+	stateindex_destroy(index);
+
+	// a truncated final record is ignored
+	file = fopen(TEST_INDEX_PATH, "a");
+	if (file == NULL || fputs("Mfpartial", file) == EOF ||
+	    fclose(file) != 0)
+		test_exit_error(argv0, "unable to append to index");
+
+	index = create_index(argv0, 0);
+	check_state(argv0, index, STATEINDEX_MODIFIED, "a dx e/ e/x");
+	check_state(argv0, index, STATEINDEX_DELETED, "d/ d/x d/y");
+	stateindex_destroy(index);
+}
+
+static void test_exchange(const char *argv0)
+{
+	struct stateindex *index;
+
+	unlink(TEST_INDEX_PATH);
+	index = create_index(argv0, 1);
+
+	set_state(argv0, index, "p/1", 0, STATEINDEX_MODIFIED);
+	set_state(argv0, index, "q/2", 0, STATEINDEX_MODIFIED);
+	set_state(argv0, index, "q/3", 0, STATEINDEX_DELETED);
+
+	if (stateindex_rename(index, "p", 1, "q", 1, 1) != 0)
+		test_exit_error(argv0, "unable to exchange directories");
+
+	check_state(argv0, index, STATEINDEX_MODIFIED, "p/ p/2 q/ q/1");
+	check_state(argv0, index, STATEINDEX_DELETED, "p/1 q/2 q/3");
+	stateindex_destroy(index);
+
+	// an unfinished rebuild is repeated
+	index = create_index(argv0, 1);
+	stateindex_destroy(index);
+}
+
+static void test_populated(const char *argv0)
+{
+	struct stateindex *index;
+
+	unlink(TEST_INDEX_PATH);
+	index = create_index(argv0, 1);
+	if (stateindex_finish_rebuild(index) != 0)
+		test_exit_error(argv0, "unable to finish rebuild");
+
+	set_state(argv0, index, "src.c", 0, STATEINDEX_POPULATED);
+	set_state(argv0, index, "src-old", 0, STATEINDEX_POPULATED);
+	set_state(argv0, index, "src/y/z", 0, STATEINDEX_POPULATED);
+	set_state(argv0, index, "src/y", 1, STATEINDEX_MODIFIED);
+	set_state(argv0, index, "src/x", 0, STATEINDEX_POPULATED);
+	set_state(argv0, index, "src/w", 0, STATEINDEX_POPULATED);
+	set_state(argv0, index, "src/w", 0, STATEINDEX_MODIFIED);
+	set_state(argv0, index, "src", 1, STATEINDEX_MODIFIED);
+
+	// paths beneath a directory precede its siblings
+	check_state(argv0, index, STATEINDEX_MODIFIED, "src/ src/w src/y/");
+	check_state(argv0, index, STATEINDEX_POPULATED,
+		    "src/x src/y/z src-old src.c");
+	stateindex_destroy(index);
+
+	index = create_index(argv0, 0);
+	check_state(argv0, index, STATEINDEX_POPULATED,
+		    "src/x src/y/z src-old src.c");
+	stateindex_destroy(index);
+}
+
+static void test_compact(const char *argv0)
+{
+	struct stateindex *index;
+	struct stat st;
+	unsigned int i;
+
+	unlink(TEST_INDEX_PATH);
+	index = create_index(argv0, 1);
+	if (stateindex_finish_rebuild(index) != 0)
+		test_exit_error(argv0, "unable to finish rebuild");
+
+	for (i = 0; i < TEST_NUM_TOGGLES; ++i) {
+		set_state(argv0, index, "t", 0, (i % 2 == 0)
+						? STATEINDEX_MODIFIED
+						: STATEINDEX_DELETED);
+	}
+
+	// each record of "t" requires four bytes
+	if (stat(TEST_INDEX_PATH, &st) == -1 ||
+	    st.st_size >= 4 * (STATEINDEX_COMPACT_MIN + 2) + 64)
+		test_exit_error(argv0, "index not compacted");
+	check_state(argv0, index, STATEINDEX_MODIFIED, "t");
+	stateindex_destroy(index);
+}
+
+static void test_crash(const char *argv0)
+{
+	struct stateindex *index;
+	FILE *file;
+
+	file = fopen(TEST_INDEX_PATH, "w");
+	if (file == NULL ||
+	    fwrite(crashed_index, sizeof(crashed_index), 1, file) != 1 ||
+	    fclose(file) != 0)
+		test_exit_error(argv0, "unable to write index");
+
+	// records from an index left open by another boot are kept
+	index = create_index(argv0, 1);
+	check_state(argv0, index, STATEINDEX_MODIFIED, "z");
+	stateindex_destroy(index);
+}
+
+static void write_index(const char *argv0, const char *data, size_t len)
+{
+	FILE *file;
+
+	file = fopen(TEST_INDEX_PATH, "w");
+	if (file == NULL || fwrite(data, len, 1, file) != 1 ||
+	    fclose(file) != 0)
+		test_exit_error(argv0, "unable to write index");
+}
+
+static void test_corrupt(const char *argv0)
+{
+	struct stateindex *index;
+
+	// a corrupt header is ignored and the index rebuilt
+	write_index(argv0, truncated_index, sizeof(truncated_index) - 1);
+	index = create_index(argv0, 1);
+	check_state(argv0, index, STATEINDEX_MODIFIED, "");
+	stateindex_destroy(index);
+
+	write_index(argv0, invalid_index, sizeof(invalid_index));
+	index = create_index(argv0, 1);
+	check_state(argv0, index, STATEINDEX_MODIFIED, "");
+	if (stateindex_finish_rebuild(index) != 0)
+		test_exit_error(argv0, "unable to finish rebuild");
+	set_state(argv0, index, "a", 0, STATEINDEX_MODIFIED);
+	stateindex_destroy(index);
+
+	index = create_index(argv0, 0);
+	check_state(argv0, index, STATEINDEX_MODIFIED, "a");
+	stateindex_destroy(index);
+}
+
+int main(int argc, char *const argv[])
+{
+	const char *argv0 = argv[0];
+
+	test_parse_opts(argc, argv, TEST_OPT_NONE, 0, 0, NULL, NULL, "");
+
+	test_record(argv0);
+	test_exchange(argv0);
+	test_populated(argv0);
+	test_compact(argv0);
+	test_crash(argv0);
+	test_corrupt(argv0);
+
+	unlink(TEST_INDEX_PATH);
+
+	exit(EXIT_SUCCESS);
+}